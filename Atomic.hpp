@@ -0,0 +1,64 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/**
+ * Atomic operations on an int shared between threads. All of them are
+ * full barriers, so they also order the plain memory accesses around them.
+ **/
+inline int atomicLoad(volatile int * value)
+{
+#ifdef WIN32
+    return InterlockedCompareExchange((volatile LONG *)value, 0, 0);
+#else
+    return __sync_val_compare_and_swap(value, 0, 0);
+#endif
+}
+
+inline int atomicExchange(volatile int * value, int newValue)
+{
+#ifdef WIN32
+    return InterlockedExchange((volatile LONG *)value, newValue);
+#else
+    int old;
+    do
+    {
+        old = *value;
+    }
+    while(!__sync_bool_compare_and_swap(value, old, newValue));
+    return old;
+#endif
+}
+
+inline void atomicStore(volatile int * value, int newValue)
+{
+    atomicExchange(value, newValue);
+}
+
+// Returns the new value.
+inline int atomicAdd(volatile int * value, int amount)
+{
+#ifdef WIN32
+    return InterlockedExchangeAdd((volatile LONG *)value, amount) + amount;
+#else
+    return __sync_add_and_fetch(value, amount);
+#endif
+}
+
+// Sets value to newValue if it equals expected. Returns the previous value.
+inline int atomicCompareExchange(volatile int * value, int expected,
+                                 int newValue)
+{
+#ifdef WIN32
+    return InterlockedCompareExchange((volatile LONG *)value, newValue,
+                                      expected);
+#else
+    return __sync_val_compare_and_swap(value, expected, newValue);
+#endif
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#include <errno.h>
+#endif
+
+/**
+ * Auto-reset event. signal() wakes one waiter, or the next call to wait()
+ * if nobody is waiting yet.
+ **/
+class Event
+{
+    public:
+        Event()
+        {
+#ifdef WIN32
+            _event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+            _signalled = false;
+            pthread_mutex_init(&_mutex, NULL);
+            pthread_cond_init(&_cond, NULL);
+#endif
+        }
+
+        ~Event()
+        {
+#ifdef WIN32
+            CloseHandle(_event);
+#else
+            pthread_cond_destroy(&_cond);
+            pthread_mutex_destroy(&_mutex);
+#endif
+        }
+
+        void signal()
+        {
+#ifdef WIN32
+            SetEvent(_event);
+#else
+            pthread_mutex_lock(&_mutex);
+            _signalled = true;
+            pthread_cond_signal(&_cond);
+            pthread_mutex_unlock(&_mutex);
+#endif
+        }
+
+        // Returns true if signalled, false on timeout. Negative timeout waits forever.
+        bool wait(int timeoutMs)
+        {
+#ifdef WIN32
+            return WaitForSingleObject(_event,
+                    timeoutMs < 0 ? INFINITE : timeoutMs) == WAIT_OBJECT_0;
+#else
+            pthread_mutex_lock(&_mutex);
+            if(timeoutMs < 0)
+            {
+                while(!_signalled)
+                {
+                    pthread_cond_wait(&_cond, &_mutex);
+                }
+            }
+            else
+            {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                struct timespec until;
+                long long nsec = now.tv_usec * 1000LL
+                        + (timeoutMs % 1000) * 1000000LL;
+                until.tv_sec = now.tv_sec + timeoutMs / 1000
+                        + nsec / 1000000000LL;
+                until.tv_nsec = nsec % 1000000000LL;
+                while(!_signalled)
+                {
+                    if(pthread_cond_timedwait(&_cond, &_mutex, &until)
+                            == ETIMEDOUT)
+                    {
+                        break;
+                    }
+                }
+            }
+            bool signalled = _signalled;
+            _signalled = false;
+            pthread_mutex_unlock(&_mutex);
+            return signalled;
+#endif
+        }
+
+    protected:
+#ifdef WIN32
+        HANDLE _event;
+#else
+        bool _signalled;
+        pthread_mutex_t _mutex;
+        pthread_cond_t _cond;
+#endif
+};
+
+#endif
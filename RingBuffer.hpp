@@ -0,0 +1,67 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include "Atomic.hpp"
+
+/**
+ * Lock-free queue for exactly one producer and one consumer thread.
+ * Holds capacity - 1 items, capacity must be a power of two. push() fails
+ * rather than waits when the consumer falls behind.
+ **/
+template<typename T>
+class RingBuffer
+{
+    public:
+        RingBuffer(int capacity)
+        {
+            _mask = capacity - 1;
+            _items = new T[capacity];
+            _head = 0;
+            _tail = 0;
+        }
+
+        ~RingBuffer()
+        {
+            delete[] _items;
+        }
+
+        // Producer side.
+        bool push(const T & item)
+        {
+            int head = _head;
+            int next = (head + 1) & _mask;
+            if(next == atomicLoad(&_tail))
+            {
+                return false;
+            }
+            _items[head] = item;
+            // Publishes the item, the store is a full barrier.
+            atomicStore(&_head, next);
+            return true;
+        }
+
+        // Consumer side.
+        bool pop(T & item)
+        {
+            int tail = _tail;
+            if(tail == atomicLoad(&_head))
+            {
+                return false;
+            }
+            item = _items[tail];
+            atomicStore(&_tail, (tail + 1) & _mask);
+            return true;
+        }
+
+    protected:
+        T * _items;
+        int _mask;
+        volatile int _head; // Next slot to write, only moved by the producer.
+        volatile int _tail; // Next slot to read, only moved by the consumer.
+
+    private:
+        RingBuffer(const RingBuffer &);
+        RingBuffer & operator=(const RingBuffer &);
+};
+
+#endif
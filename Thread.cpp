@@ -1,5 +1,38 @@
 #include "Thread.hpp"
 
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static THREAD_LOCAL const char * threadName = NULL;
+
+// Every name ever given, log and trace records point at them after their
+// thread is gone.
+static Mutex namesMutex;
+static std::vector<const char *> names;
+
+static const char * keepName(const char * name)
+{
+    const char * kept = NULL;
+    namesMutex.lock();
+    for(size_t i = 0; i < names.size() && !kept; i++)
+    {
+        if(strcmp(names[i], name) == 0)
+        {
+            kept = names[i];
+        }
+    }
+    if(!kept)
+    {
+        char * copy = new char[strlen(name) + 1];
+        strcpy(copy, name);
+        names.push_back(copy);
+        kept = copy;
+    }
+    namesMutex.unlock();
+    return kept;
+}
+
 THREAD_RET thread_start(void * obj)
 {
     Thread * thread = (Thread*) obj;
@@ -7,3 +40,18 @@ THREAD_RET thread_start(void * obj)
     return 0;
 }
 
+void Thread::nameCurrentThread(const char * name)
+{
+    threadName = keepName(name);
+#ifdef __linux__
+    // Linux limits names to 15 characters.
+    char shortName[16];
+    snprintf(shortName, sizeof(shortName), "%s", name);
+    pthread_setname_np(pthread_self(), shortName);
+#endif
+}
+
+const char * Thread::currentName()
+{
+    return threadName;
+}
@@ -8,10 +8,22 @@
 #else
 #include <pthread.h>
 #define THREAD_RET void *
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #endif
 
 #include "Mutex.hpp"
 
+// Declares a variable with one instance per thread.
+#ifdef WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 THREAD_RET thread_start(void * obj);
 
 class Thread
@@ -53,6 +65,12 @@ class Thread
             _quitMutex->unlock();
         }
 
+        // Names the calling thread for logs, traces and debuggers. Call at
+        // the top of run(), the name is copied.
+        static void nameCurrentThread(const char * name);
+        // NULL if the thread wasn't named.
+        static const char * currentName();
+
         void join()
         {
             quit();
@@ -66,6 +84,18 @@ class Thread
         }
 
     protected:
+        // For background work: lowers the priority of the calling thread so it
+        // only gets CPU time the tracking and polling threads don't use.
+        static void lowerCurrentPriority()
+        {
+#ifdef WIN32
+            SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+            // Linux applies nice values per thread.
+            setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+        }
+
         bool _quit;
         Mutex * _quitMutex;
 
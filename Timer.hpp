@@ -0,0 +1,44 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * Monotonic clock in microseconds. Only useful for measuring intervals.
+ **/
+inline unsigned long long getTimeMicros()
+{
+#ifdef WIN32
+    static LARGE_INTEGER frequency;
+    static bool init = false;
+    if(!init)
+    {
+        QueryPerformanceFrequency(&frequency);
+        init = true;
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)((counter.QuadPart * 1000000.0)
+            / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long long)ts.tv_sec) * 1000000ULL
+            + ts.tv_nsec / 1000;
+#endif
+}
+
+/**
+ * Monotonic clock in seconds.
+ **/
+inline double getTime()
+{
+    return getTimeMicros() / 1000000.0;
+}
+
+#endif
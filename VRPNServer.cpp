@@ -1,4 +1,14 @@
 #include "VRPNServer.h"
+#include "Timer.hpp"
+#include "latency_stats.h"
+#include "trace.h"
+
+#include <cmath>
+#include <cstdio>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
 VRPNServer::VRPNServer(std::vector<MoveState*> & stateList,
                        vrpn_Connection * con) :
@@ -19,18 +29,48 @@ VRPNServer::VRPNServer(std::vector<MoveState*> & stateList,
     _buttonMasks.push_back(Btn_T);
 
     num_buttons = _buttonMasks.size() * _stateList.size();
-    num_channel = _stateList.size();
 
     for(int i = 0; i < num_buttons; ++i)
     {
         buttons[i] = 0;
     }
-    for(int i = 0; i < num_channel; ++i)
+    for(int i = 0; i < vrpn_CHANNEL_MAX; ++i)
     {
         channel[i] = 0.0;
     }
 
     num_sensors = _stateList.size();
+
+    _reportedSequence.resize(_stateList.size(), 0);
+    _reportAll = true;
+    setRates(10.0f, 250.0f);
+    setAnalogChannels(false, false, false);
+}
+
+void VRPNServer::setAnalogChannels(bool accel, bool gyro, bool mag)
+{
+    _accelChannels = accel;
+    _gyroChannels = gyro;
+    _magChannels = mag;
+    // Per controller: trigger, then the enabled groups of three.
+    _channelsPerController = 1 + (accel ? 3 : 0) + (gyro ? 3 : 0)
+            + (mag ? 3 : 0);
+
+    num_channel = _channelsPerController * _stateList.size();
+    if(num_channel > vrpn_CHANNEL_MAX)
+    {
+        // Controllers past the limit lose their analogs rather than the
+        // channels being shuffled around.
+        printf("WARNING: %d VRPN analog channels requested, only %d are sent.\n",
+               (int)num_channel, vrpn_CHANNEL_MAX);
+        num_channel = vrpn_CHANNEL_MAX;
+    }
+}
+
+void VRPNServer::setRates(float minRate, float maxRate)
+{
+    _minInterval = maxRate > 0.0f ? 1.0 / maxRate : 0.0;
+    _maxInterval = minRate > 0.0f ? 1.0 / minRate : 1.0;
 }
 
 VRPNServer::~VRPNServer()
@@ -39,6 +79,10 @@ VRPNServer::~VRPNServer()
 
 void VRPNServer::run()
 {
+    double lastReport = 0.0;
+    double lastFullReport = 0.0;
+    nameCurrentThread("vrpn");
+
     while(1)
     {
         _quitMutex->lock();
@@ -49,29 +93,64 @@ void VRPNServer::run()
         }
         _quitMutex->unlock();
 
-        mainloop();
-
-        _con->mainloop();
+        // Sleep until new data arrives, waking at least every 100 ms so the
+        // connection is serviced and keepalive reports go out.
+        double now = getTime();
+        double untilFull = lastFullReport + _maxInterval - now;
+        int timeoutMs = (int)(untilFull * 1000.0);
+        if(timeoutMs > 100)
+        {
+            timeoutMs = 100;
+        }
+        else if(timeoutMs < 0)
+        {
+            timeoutMs = 0;
+        }
+        bool signalled = moveStateEvent->wait(timeoutMs);
 
-        // rate limit
+        now = getTime();
+        if(signalled && now - lastReport < _minInterval)
+        {
+            // Rate limit, the next pass picks up everything that changed meanwhile.
+            double wait = lastReport + _minInterval - now;
 #ifdef WIN32
-		Sleep(10);
+            Sleep((DWORD)(wait * 1000.0));
 #else
-        struct timespec ts;
-        ts.tv_sec = 0;
-        ts.tv_nsec = 14000000;
-        nanosleep(&ts, NULL);
+            usleep((useconds_t)(wait * 1000000.0));
 #endif
+            now = getTime();
+        }
+
+        _reportAll = now - lastFullReport >= _maxInterval;
+        if(signalled || _reportAll)
+        {
+            mainloop();
+            lastReport = now;
+            if(_reportAll)
+            {
+                lastFullReport = now;
+            }
+        }
+
+        _con->mainloop();
     }
 }
 
 void VRPNServer::mainloop()
 {
+    TraceScope scope("report");
 
     server_mainloop();
 
     vrpn_float64 position[3];
     vrpn_float64 quat[4];
+    vrpn_float64 velocity[3];
+    vrpn_float64 acceleration[3];
+    vrpn_float64 gyro[3];
+    vrpn_float64 analog[10];
+    // Angular velocity is sent as the rotation over this interval.
+    const vrpn_float64 velQuatDt = 0.01;
+    const vrpn_float64 noRotation[4] = { 0.0, 0.0, 0.0, 1.0 };
     struct timeval tv;
     gettimeofday(&tv, NULL);
     int bindexOffset = 0;
@@ -81,7 +160,18 @@ void VRPNServer::mainloop()
 
     for(int j = 0; j < _stateList.size(); ++j)
     {
-        _stateList[j]->lock->lock();
+        traceLock(_stateList[j]->lock, "wait MoveState");
+        // Nothing new for this sensor, buttons and analogs only report changes anyway.
+        if(!_reportAll && _stateList[j]->sequence == _reportedSequence[j])
+        {
+            _stateList[j]->lock->unlock();
+            bindexOffset += _buttonMasks.size();
+            continue;
+        }
+        // Keepalive reports of unchanged sensors aren't counted as latency.
+        bool changed = _stateList[j]->sequence != _reportedSequence[j];
+        double updateTime = _stateList[j]->updateTime;
+        _reportedSequence[j] = _stateList[j]->sequence;
         unsigned int buttonState = _stateList[j]->buttons;
 
         for(int i = 0; i < _buttonMasks.size(); ++i)
@@ -97,20 +187,89 @@ void VRPNServer::mainloop()
         }
         bindexOffset += _buttonMasks.size();
 
-        channel[j] = _stateList[j]->trigger;
+        MoveState * state = _stateList[j];
+        int n = 0;
+        analog[n++] = state->trigger;
+        if(_accelChannels)
+        {
+            analog[n++] = state->ax;
+            analog[n++] = state->ay;
+            analog[n++] = state->az;
+        }
+        if(_gyroChannels)
+        {
+            analog[n++] = state->gx;
+            analog[n++] = state->gy;
+            analog[n++] = state->gz;
+        }
+        if(_magChannels)
+        {
+            analog[n++] = state->mx;
+            analog[n++] = state->my;
+            analog[n++] = state->mz;
+        }
+        for(int i = 0; i < n; i++)
+        {
+            int index = j * _channelsPerController + i;
+            if(index < num_channel)
+            {
+                channel[index] = analog[i];
+            }
+        }
+
+        // Tracker units are cm, VRPN's are m.
+        position[0] = state->x * 0.01;
+        position[1] = state->y * 0.01;
+        position[2] = state->z * 0.01;
+        velocity[0] = state->vx * 0.01;
+        velocity[1] = state->vy * 0.01;
+        velocity[2] = state->vz * 0.01;
+        acceleration[0] = state->lax * 0.01;
+        acceleration[1] = state->lay * 0.01;
+        acceleration[2] = state->laz * 0.01;
+        gyro[0] = state->gx;
+        gyro[1] = state->gy;
+        gyro[2] = state->gz;
 
-        position[0] = _stateList[j]->x * 0.01;
-        position[1] = _stateList[j]->y * 0.01;
-        position[2] = _stateList[j]->z * 0.01;
+        quat[0] = state->qx;
+        quat[1] = state->qy;
+        quat[2] = state->qz;
+        quat[3] = state->qw;
 
-        quat[0] = _stateList[j]->qx;
-        quat[1] = _stateList[j]->qy;
-        quat[2] = _stateList[j]->qz;
-        quat[3] = _stateList[j]->qw;
+        state->lock->unlock();
 
-        _stateList[j]->lock->unlock();
+        // The gyro measures in the controller frame, rotate it into the
+        // world frame: w = q * gyro * q^-1.
+        vrpn_float64 tx = 2.0 * (quat[1] * gyro[2] - quat[2] * gyro[1]);
+        vrpn_float64 ty = 2.0 * (quat[2] * gyro[0] - quat[0] * gyro[2]);
+        vrpn_float64 tz = 2.0 * (quat[0] * gyro[1] - quat[1] * gyro[0]);
+        vrpn_float64 w[3];
+        w[0] = gyro[0] + quat[3] * tx + (quat[1] * tz - quat[2] * ty);
+        w[1] = gyro[1] + quat[3] * ty + (quat[2] * tx - quat[0] * tz);
+        w[2] = gyro[2] + quat[3] * tz + (quat[0] * ty - quat[1] * tx);
+
+        // Rotation by |w| * dt around w.
+        vrpn_float64 velQuat[4] = { 0.0, 0.0, 0.0, 1.0 };
+        vrpn_float64 rate = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+        if(rate > 1e-6)
+        {
+            vrpn_float64 half = 0.5 * rate * velQuatDt;
+            vrpn_float64 s = sin(half) / rate;
+            velQuat[0] = w[0] * s;
+            velQuat[1] = w[1] * s;
+            velQuat[2] = w[2] * s;
+            velQuat[3] = cos(half);
+        }
 
         report_pose(j, tv, position, quat);
+        statsCount(COUNT_VRPN_REPORTS);
+        if(changed && updateTime != 0.0)
+        {
+            statsRecordSince(HIST_VRPN, updateTime);
+        }
+        report_pose_velocity(j, tv, velocity, velQuat, velQuatDt);
+        // No angular acceleration estimate, reported as no rotation.
+        report_pose_acceleration(j, tv, acceleration, noRotation, velQuatDt);
     }
 
     vrpn_Button::report_changes();
@@ -21,6 +21,12 @@ class VRPNServer : public Thread,
         VRPNServer(std::vector<MoveState*> & stateList, vrpn_Connection * con);
         virtual ~VRPNServer();
 
+        // Reports go out when MoveStates change, at most maxRate times a
+        // second. Every sensor is reported at least minRate times a second.
+        void setRates(float minRate, float maxRate);
+        // Adds raw IMU analog channels after each controller's trigger.
+        void setAnalogChannels(bool accel, bool gyro, bool mag);
+
         virtual void run();
         void mainloop();
 
@@ -29,6 +35,15 @@ class VRPNServer : public Thread,
 
         vrpn_Connection * _con;
         std::vector<unsigned int> _buttonMasks;
+
+        double _minInterval;
+        double _maxInterval;
+        bool _reportAll; // Report unchanged sensors too on this pass.
+        bool _accelChannels;
+        bool _gyroChannels;
+        bool _magChannels;
+        int _channelsPerController;
+        std::vector<unsigned int> _reportedSequence;
 };
 
 #endif
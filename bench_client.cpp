@@ -0,0 +1,122 @@
+#include "bench_client.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+std::string controlCommand(const std::string & socketPath,
+                           const char * command)
+{
+    std::string reply;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(s < 0)
+    {
+        return reply;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(),
+            sizeof(address.sun_path) - 1);
+    if(connect(s, (struct sockaddr *)&address, sizeof(address)) == 0)
+    {
+        std::string line = std::string(command) + "\n";
+        if(write(s, line.c_str(), line.size()) == (ssize_t)line.size())
+        {
+            // The reply comes in one go, stop once the socket goes quiet.
+            struct timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 300000;
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            char buffer[4096];
+            ssize_t n;
+            while((n = read(s, buffer, sizeof(buffer))) > 0)
+            {
+                reply.append(buffer, n);
+            }
+        }
+    }
+    close(s);
+    return reply;
+}
+
+LatencyProbes::LatencyProbes()
+{
+    _times.assign(PROBE_SLOTS, 0.0);
+    _probe = 0;
+    _lastSeen = -1;
+    _sent = 0;
+}
+
+int LatencyProbes::send(char * command, double now)
+{
+    // Probe numbers start at 1, 0 is left for colours set by others.
+    _probe = _probe % (PROBE_SLOTS - 1) + 1;
+    _times[_probe] = now;
+    _sent++;
+    return sprintf(command, "d 0 0 0 0 0 1 %d %d %d", _probe & 0xff,
+                   _probe >> 8, PROBE_MARK);
+}
+
+void LatencyProbes::received(const char * packet, double now)
+{
+    int sequence, controller;
+    if(sscanf(packet, "a %d %d", &sequence, &controller) != 2
+            || controller != 0)
+    {
+        return;
+    }
+
+    // r g b are fields 19 to 21.
+    const char * p = packet;
+    for(int field = 0; field < 19 && p; field++)
+    {
+        p = strchr(p + 1, ' ');
+    }
+    int r, g, b;
+    if(!p || sscanf(p, "%d %d %d", &r, &g, &b) != 3 || b != PROBE_MARK)
+    {
+        return;
+    }
+    int probe = r | (g << 8);
+    if(probe != _lastSeen && _times[probe] > 0.0)
+    {
+        _latencies.push_back(now - _times[probe]);
+        _times[probe] = 0.0;
+    }
+    _lastSeen = probe;
+}
+
+void LatencyProbes::reset()
+{
+    _latencies.clear();
+    _sent = 0;
+}
+
+unsigned int LatencyProbes::lost() const
+{
+    return _sent > _latencies.size() ? _sent - (unsigned int)_latencies.size()
+            : 0;
+}
+
+std::vector<double> LatencyProbes::latencies() const
+{
+    std::vector<double> sorted(_latencies);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+double percentile(const std::vector<double> & sorted, double p)
+{
+    if(sorted.empty())
+    {
+        return 0.0;
+    }
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
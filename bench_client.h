@@ -0,0 +1,60 @@
+#ifndef BENCH_CLIENT_H
+#define BENCH_CLIENT_H
+
+#include <string>
+#include <vector>
+
+// Blue channel of a probe colour, red and green hold the probe number.
+#define PROBE_MARK 0xa5
+#define PROBE_SLOTS 65536
+// Seconds between the "p" keep-alives of a client, well within the
+// server's subscriber_timeout.
+#define KEEP_ALIVE_INTERVAL 1.0
+
+// Sends one command over a server's control socket and returns the reply,
+// empty if the server can't be reached. POSIX only.
+std::string controlCommand(const std::string & socketPath,
+                           const char * command);
+
+/**
+ * Command to stream latency as a client sees it. A probe is a "d" command
+ * that sets controller 0's LED to a colour encoding the probe number, timed
+ * until an "a" packet of controller 0 carries that colour. It covers the
+ * command's way in, the wait for the controller's next poll and the
+ * packet's way out.
+ *
+ * Used by move_server_bench and move_loadgen, not thread safe.
+ **/
+class LatencyProbes
+{
+    public:
+        LatencyProbes();
+
+        // Writes the next probe command to 'command' and returns its length.
+        int send(char * command, double now);
+        // Looks for a probe colour in a received "a" packet.
+        void received(const char * packet, double now);
+        // Forgets the latencies, probes in flight still count.
+        void reset();
+
+        unsigned int sent() const
+        {
+            return _sent;
+        }
+        // Probes sent since reset() without an answer yet.
+        unsigned int lost() const;
+        // Latencies since reset() in seconds, sorted.
+        std::vector<double> latencies() const;
+
+    protected:
+        std::vector<double> _times; // Send time per probe number.
+        std::vector<double> _latencies;
+        int _probe;
+        int _lastSeen;
+        unsigned int _sent;
+};
+
+// p in 0..1 of sorted values, 0 if there are none.
+double percentile(const std::vector<double> & sorted, double p);
+
+#endif
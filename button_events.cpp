@@ -0,0 +1,151 @@
+#include "button_events.h"
+#include "latency_stats.h"
+
+#include <cstdio>
+
+ButtonEvents::ButtonEvents(int controllers, const std::vector<int> & thresholds,
+                           float retransmit)
+{
+    _thresholds = thresholds;
+    if(_thresholds.size() > MAX_TRIGGER_THRESHOLDS)
+    {
+        _thresholds.resize(MAX_TRIGGER_THRESHOLDS);
+    }
+    _retransmit = retransmit;
+    _events.resize(EVENT_HISTORY);
+    _next = 0;
+    _buttons.resize(controllers, -1);
+    _triggerDown.resize(controllers, 0);
+    _generation.resize(MAX_SUBSCRIBERS, -1);
+    _base.resize(MAX_SUBSCRIBERS, -1);
+    _sent.resize(MAX_SUBSCRIBERS, -1);
+    _sendTime.resize(MAX_SUBSCRIBERS * EVENT_HISTORY, 0.0);
+}
+
+void ButtonEvents::push(int controller, double time, char type, int value,
+                        int down)
+{
+    ButtonEvent & event = _events[_next % EVENT_HISTORY];
+    event.sequence = _next++;
+    event.controller = controller;
+    event.time = time;
+    event.type = type;
+    event.value = value;
+    event.down = down;
+    statsCount(COUNT_EVENTS);
+}
+
+void ButtonEvents::report(int controller, double time, int buttons,
+                          int trigger)
+{
+    int triggerDown = _triggerDown[controller];
+    for(size_t i = 0; i < _thresholds.size(); i++)
+    {
+        if(trigger >= _thresholds[i])
+        {
+            triggerDown |= 1 << i;
+        }
+        else if(trigger < _thresholds[i] - EVENT_TRIGGER_HYSTERESIS)
+        {
+            triggerDown &= ~(1 << i);
+        }
+    }
+
+    if(_buttons[controller] < 0)
+    {
+        _buttons[controller] = buttons;
+        _triggerDown[controller] = triggerDown;
+        return;
+    }
+
+    int changed = buttons ^ _buttons[controller];
+    for(int bit = 7; bit >= 0; bit--)
+    {
+        if(changed & (1 << bit))
+        {
+            push(controller, time, 'b', 1 << bit, (buttons >> bit) & 1);
+        }
+    }
+    changed = triggerDown ^ _triggerDown[controller];
+    for(size_t i = 0; i < _thresholds.size(); i++)
+    {
+        if(changed & (1 << i))
+        {
+            push(controller, time, 't', _thresholds[i], (triggerDown >> i) & 1);
+        }
+    }
+    _buttons[controller] = buttons;
+    _triggerDown[controller] = triggerDown;
+}
+
+void ButtonEvents::reset(int controller)
+{
+    _buttons[controller] = -1;
+    _triggerDown[controller] = 0;
+}
+
+void ButtonEvents::send(SOCKET socket,
+                        const std::vector<Subscriber> & subscribers,
+                        SubscriberTable & table, double now)
+{
+    char message[128];
+    for(size_t i = 0; i < subscribers.size(); i++)
+    {
+        const Subscriber & subscriber = subscribers[i];
+        if(_generation[i] != subscriber.generation)
+        {
+            _generation[i] = subscriber.generation;
+            _base[i] = _next - 1;
+            _sent[i] = _next - 1;
+        }
+        if(!subscriber.active || !subscriber.events)
+        {
+            continue;
+        }
+
+        int acked = table.acked(i);
+        if(acked - _base[i] < 0)
+        {
+            acked = _base[i];
+        }
+        if(_next - acked > EVENT_HISTORY)
+        {
+            acked = _next - EVENT_HISTORY - 1;
+        }
+
+        // New events go out straight away, the rest once the interval is up
+        // for the oldest one. New events don't hold back the retransmit.
+        double * sendTime = &_sendTime[i * EVENT_HISTORY];
+        int from = _sent[i] + 1;
+        int oldest = acked + 1;
+        if(oldest - _sent[i] <= 0
+                && now - sendTime[oldest % EVENT_HISTORY] >= _retransmit)
+        {
+            from = oldest;
+        }
+        if(from - _next >= 0)
+        {
+            continue;
+        }
+
+        for(int sequence = from; sequence - _next < 0; sequence++)
+        {
+            const ButtonEvent & event = _events[sequence % EVENT_HISTORY];
+            int length = sprintf(message, "e %d %d %.4f %c %d %d",
+                                 event.sequence, event.controller, event.time,
+                                 event.type, event.value, event.down);
+            if(sendto(socket, message, length, 0,
+                      (const SOCKADDR*)&subscriber.address,
+                      sizeof(subscriber.address)) < 0)
+            {
+                statsCount(COUNT_SEND_ERRORS);
+            }
+            if(sequence - _sent[i] <= 0)
+            {
+                statsCount(COUNT_EVENT_RETRANSMITS);
+            }
+            sendTime[sequence % EVENT_HISTORY] = now;
+        }
+        _sent[i] = _next - 1;
+    }
+}
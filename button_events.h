@@ -0,0 +1,67 @@
+#ifndef BUTTON_EVENTS_H
+#define BUTTON_EVENTS_H
+
+#include "subscribers.h"
+
+#include <vector>
+
+// Events kept for retransmission. Older unacknowledged ones are given up on.
+#define EVENT_HISTORY 256
+#define MAX_TRIGGER_THRESHOLDS 4
+// The trigger has to drop this far below a threshold to count as released.
+#define EVENT_TRIGGER_HYSTERESIS 8
+
+struct ButtonEvent
+{
+        int sequence;
+        int controller;
+        double time; // Poll time of the report with the edge.
+        char type; // 'b' button, 't' trigger threshold
+        int value; // Button bit as in "a" packets, or the threshold.
+        int down;
+};
+
+/**
+ * Press and release edges of every button and trigger threshold, found in
+ * every report the physical thread polls, so short presses and presses in a
+ * lost "a" packet aren't missed. Events go to the subscribers with events=1:
+ *   e <sequence> <controller> <time> <b|t> <button bit|threshold> <1|0>
+ * The client acknowledges with "k <sequence> [port]", everything up to the
+ * sequence counts as received. Once the oldest unacknowledged event was
+ * sent a retransmit interval ago, it and every event after it are sent
+ * again.
+ **/
+class ButtonEvents
+{
+    public:
+        ButtonEvents(int controllers, const std::vector<int> & thresholds,
+                     float retransmit);
+
+        // Compares a report with the controller's previous one.
+        void report(int controller, double time, int buttons, int trigger);
+        // A new controller in the slot, its first report sets the state.
+        void reset(int controller);
+
+        void send(SOCKET socket, const std::vector<Subscriber> & subscribers,
+                  SubscriberTable & table, double now);
+
+    protected:
+        void push(int controller, double time, char type, int value, int down);
+
+        std::vector<int> _thresholds;
+        double _retransmit;
+
+        std::vector<ButtonEvent> _events; // Ring indexed by sequence.
+        int _next; // Sequence of the next event.
+
+        std::vector<int> _buttons; // Last buttons per controller, -1 before the first report.
+        std::vector<int> _triggerDown; // Bit per threshold the trigger is past.
+
+        // Per subscriber.
+        std::vector<int> _generation;
+        std::vector<int> _base; // Events before subscribing aren't sent.
+        std::vector<int> _sent;
+        std::vector<double> _sendTime; // Per subscriber and event slot, last sent.
+};
+
+#endif
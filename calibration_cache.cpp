@@ -0,0 +1,104 @@
+#include "calibration_cache.h"
+
+#include <cstdio>
+
+CalibrationCache::CalibrationCache(const std::string & file, int maxAge)
+{
+    _file = file;
+    _maxAge = maxAge;
+}
+
+bool CalibrationCache::load()
+{
+    FILE * fp = fopen(_file.c_str(), "r");
+    if(!fp)
+    {
+        return false;
+    }
+
+    _entries.clear();
+    char serial[64];
+    int camera, r, g, b;
+    long timestamp;
+    while(fscanf(fp, "%63s %d %d %d %d %ld", serial, &camera, &r, &g, &b,
+                 &timestamp) == 6)
+    {
+        CalibrationEntry entry;
+        entry.serial = serial;
+        entry.camera = camera;
+        entry.r = r;
+        entry.g = g;
+        entry.b = b;
+        entry.timestamp = timestamp;
+        _entries.push_back(entry);
+    }
+    fclose(fp);
+    return true;
+}
+
+bool CalibrationCache::save()
+{
+    // Write a temporary file and rename it, a crash mid-write keeps the old cache.
+    std::string tmp = _file + ".tmp";
+    FILE * fp = fopen(tmp.c_str(), "w");
+    if(!fp)
+    {
+        return false;
+    }
+    for(size_t i = 0; i < _entries.size(); i++)
+    {
+        const CalibrationEntry & e = _entries[i];
+        fprintf(fp, "%s %d %d %d %d %ld\n", e.serial.c_str(), e.camera, e.r,
+                e.g, e.b, (long)e.timestamp);
+    }
+    fclose(fp);
+#ifdef WIN32
+    remove(_file.c_str());
+#endif
+    return rename(tmp.c_str(), _file.c_str()) == 0;
+}
+
+const CalibrationEntry * CalibrationCache::find(const std::string & serial,
+                                                int camera, time_t now) const
+{
+    for(size_t i = 0; i < _entries.size(); i++)
+    {
+        const CalibrationEntry & e = _entries[i];
+        if(e.serial == serial && e.camera == camera)
+        {
+            if(now - e.timestamp > _maxAge || now < e.timestamp)
+            {
+                return NULL;
+            }
+            return &e;
+        }
+    }
+    return NULL;
+}
+
+void CalibrationCache::store(const std::string & serial, int camera,
+                             unsigned char r, unsigned char g, unsigned char b,
+                             time_t now)
+{
+    for(size_t i = 0; i < _entries.size(); i++)
+    {
+        CalibrationEntry & e = _entries[i];
+        if(e.serial == serial && e.camera == camera)
+        {
+            e.r = r;
+            e.g = g;
+            e.b = b;
+            e.timestamp = now;
+            return;
+        }
+    }
+
+    CalibrationEntry entry;
+    entry.serial = serial;
+    entry.camera = camera;
+    entry.r = r;
+    entry.g = g;
+    entry.b = b;
+    entry.timestamp = now;
+    _entries.push_back(entry);
+}
@@ -0,0 +1,47 @@
+#ifndef CALIBRATION_CACHE_H
+#define CALIBRATION_CACHE_H
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+/**
+ * Tracking colour a controller was calibrated with on one camera.
+ **/
+struct CalibrationEntry
+{
+        std::string serial;
+        int camera;
+        unsigned char r, g, b;
+        time_t timestamp;
+};
+
+/**
+ * Persistent cache of tracker calibrations, keyed by controller serial and
+ * camera. On restart a controller is given its cached colour again, so
+ * psmoveapi can use its saved colour mapping instead of blinking through a
+ * full calibration.
+ *
+ * File format, one entry per line: serial camera r g b timestamp
+ **/
+class CalibrationCache
+{
+    public:
+        CalibrationCache(const std::string & file, int maxAge);
+
+        bool load();
+        bool save();
+
+        // Entry for this controller and camera if it is younger than maxAge, else NULL.
+        const CalibrationEntry * find(const std::string & serial, int camera,
+                                      time_t now) const;
+        void store(const std::string & serial, int camera, unsigned char r,
+                   unsigned char g, unsigned char b, time_t now);
+
+    protected:
+        std::string _file;
+        int _maxAge;
+        std::vector<CalibrationEntry> _entries;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "camera_fusion.h"
+
+#include <cmath>
+#include <cstring>
+
+void identityExtrinsics(CameraExtrinsics & extrinsics)
+{
+    memset(&extrinsics, 0, sizeof(CameraExtrinsics));
+    extrinsics.rotation[0] = 1.0f;
+    extrinsics.rotation[4] = 1.0f;
+    extrinsics.rotation[8] = 1.0f;
+}
+
+// Inverse of a 3x3 matrix, false if singular.
+static bool invert3(const double m[9], double out[9])
+{
+    double c0 = m[4] * m[8] - m[5] * m[7];
+    double c1 = m[5] * m[6] - m[3] * m[8];
+    double c2 = m[3] * m[7] - m[4] * m[6];
+    double det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+    if(fabs(det) < 1e-12)
+    {
+        return false;
+    }
+    double inv = 1.0 / det;
+    out[0] = c0 * inv;
+    out[1] = (m[2] * m[7] - m[1] * m[8]) * inv;
+    out[2] = (m[1] * m[5] - m[2] * m[4]) * inv;
+    out[3] = c1 * inv;
+    out[4] = (m[0] * m[8] - m[2] * m[6]) * inv;
+    out[5] = (m[2] * m[3] - m[0] * m[5]) * inv;
+    out[6] = c2 * inv;
+    out[7] = (m[1] * m[6] - m[0] * m[7]) * inv;
+    out[8] = (m[0] * m[4] - m[1] * m[3]) * inv;
+    return true;
+}
+
+CameraFusion::CameraFusion(int cameras, int controllers)
+{
+    _cameras = cameras;
+    _controllers = controllers;
+    _maxAge = 0.1;
+    _lateralNoise = 0.005f;
+    _depthNoise = 0.002f;
+
+    _extrinsics.resize(cameras);
+    for(int i = 0; i < cameras; i++)
+    {
+        identityExtrinsics(_extrinsics[i]);
+    }
+
+    Observation none;
+    memset(&none, 0, sizeof(Observation));
+    _observations.resize(cameras * controllers, none);
+}
+
+void CameraFusion::setExtrinsics(int camera,
+                                 const CameraExtrinsics & extrinsics)
+{
+    if(camera >= 0 && camera < _cameras)
+    {
+        _extrinsics[camera] = extrinsics;
+    }
+}
+
+void CameraFusion::setMaxAge(double maxAge)
+{
+    _maxAge = maxAge;
+}
+
+void CameraFusion::setNoise(float lateral, float depth)
+{
+    _lateralNoise = lateral;
+    _depthNoise = depth;
+}
+
+void CameraFusion::setObservation(int camera, int controller, double time,
+                                  int tracking, float x, float y, float z)
+{
+    Observation & o = _observations[controller * _cameras + camera];
+    o.time = time;
+    o.tracking = tracking;
+    if(!tracking)
+    {
+        return;
+    }
+
+    const CameraExtrinsics & e = _extrinsics[camera];
+    const float * r = e.rotation;
+    double p[3] = { x, y, z };
+    for(int i = 0; i < 3; i++)
+    {
+        o.position[i] = r[i * 3] * p[0] + r[i * 3 + 1] * p[1]
+                + r[i * 3 + 2] * p[2] + e.translation[i];
+    }
+
+    // Information in the camera frame is diagonal, rotate it: R * D * R^T
+    double depth = fabs(p[2]) > 1.0 ? fabs(p[2]) : 1.0;
+    double sl = _lateralNoise * depth;
+    double sd = _depthNoise * depth * depth;
+    double d[3] = { 1.0 / (sl * sl), 1.0 / (sl * sl), 1.0 / (sd * sd) };
+    for(int i = 0; i < 3; i++)
+    {
+        for(int j = 0; j < 3; j++)
+        {
+            double sum = 0.0;
+            for(int k = 0; k < 3; k++)
+            {
+                sum += r[i * 3 + k] * d[k] * r[j * 3 + k];
+            }
+            o.information[i * 3 + j] = sum;
+        }
+    }
+}
+
+int CameraFusion::fuse(int controller, double time, float & x, float & y,
+                       float & z)
+{
+    double information[9];
+    double weighted[3];
+    memset(information, 0, sizeof(information));
+    memset(weighted, 0, sizeof(weighted));
+
+    int used = 0;
+    for(int cam = 0; cam < _cameras; cam++)
+    {
+        const Observation & o = _observations[controller * _cameras + cam];
+        if(!o.tracking || time - o.time > _maxAge)
+        {
+            continue;
+        }
+        for(int i = 0; i < 3; i++)
+        {
+            for(int j = 0; j < 3; j++)
+            {
+                information[i * 3 + j] += o.information[i * 3 + j];
+                weighted[i] += o.information[i * 3 + j] * o.position[j];
+            }
+        }
+        used++;
+    }
+
+    double covariance[9];
+    if(used == 0 || !invert3(information, covariance))
+    {
+        return 0;
+    }
+
+    x = (float)(covariance[0] * weighted[0] + covariance[1] * weighted[1]
+            + covariance[2] * weighted[2]);
+    y = (float)(covariance[3] * weighted[0] + covariance[4] * weighted[1]
+            + covariance[5] * weighted[2]);
+    z = (float)(covariance[6] * weighted[0] + covariance[7] * weighted[1]
+            + covariance[8] * weighted[2]);
+    return used;
+}
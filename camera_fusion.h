@@ -0,0 +1,63 @@
+#ifndef CAMERA_FUSION_H
+#define CAMERA_FUSION_H
+
+#include <vector>
+
+/**
+ * Pose of a camera in the shared world frame: world = R * camera + t.
+ * Config line: camera_extrinsics <camera> r00 r01 r02 r10 r11 r12 r20 r21 r22 tx ty tz
+ **/
+struct CameraExtrinsics
+{
+        int camera; // Device index, as on the "camera" line.
+        float rotation[9]; // Row major
+        float translation[3]; // cm, same units as psmove_tracker_get_location
+};
+
+void identityExtrinsics(CameraExtrinsics & extrinsics);
+
+/**
+ * Fuses per-camera tracker locations into one world position per controller.
+ *
+ * Each observation is moved into the world frame with its camera's
+ * extrinsics and weighted by a covariance that models the tracker's error:
+ * lateral error grows with distance, depth error with distance squared.
+ * The fused position is the information weighted mean of all observations
+ * younger than maxAge. Only touched by the tracker send stage.
+ **/
+class CameraFusion
+{
+    public:
+        CameraFusion(int cameras, int controllers);
+
+        // Cameras are numbered by tracker here, in the order they were opened.
+        void setExtrinsics(int camera, const CameraExtrinsics & extrinsics);
+        void setMaxAge(double maxAge);
+        // Error model: sigma_lateral = lateral * z, sigma_depth = depth * z^2 (cm)
+        void setNoise(float lateral, float depth);
+
+        void setObservation(int camera, int controller, double time,
+                            int tracking, float x, float y, float z);
+
+        // Returns the number of cameras that contributed, 0 if none see the controller.
+        int fuse(int controller, double time, float & x, float & y, float & z);
+
+    protected:
+        struct Observation
+        {
+                double time;
+                int tracking;
+                double position[3]; // World frame
+                double information[9]; // Inverse covariance, world frame
+        };
+
+        int _cameras;
+        int _controllers;
+        double _maxAge;
+        float _lateralNoise;
+        float _depthNoise;
+        std::vector<CameraExtrinsics> _extrinsics;
+        std::vector<Observation> _observations; // [controller * cameras + camera]
+};
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * Check of CameraFusion with synthetic observations.
+ *
+ * Three cameras look at a volume from different sides. Points in the world
+ * frame are moved into each camera's frame with its extrinsics and given
+ * noise that follows the fusion's own error model. The check fails if
+ *   - noise free observations don't come back as the true point,
+ *   - the fused position is further off than the best single camera,
+ *   - an observation older than the max age is still used.
+ *
+ * camera_fusion_check [--points n] [--seed n]
+ *
+ * Exits with 1 if a check fails.
+ **/
+
+#include "camera_fusion.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define CHECK_CAMERAS 3
+// Same error model as CameraFusion's defaults.
+#define LATERAL_NOISE 0.005f
+#define DEPTH_NOISE 0.002f
+
+static void usage()
+{
+    printf("camera_fusion_check [--points n] [--seed n]\n");
+}
+
+// Camera turned by 'yaw' about y and placed at x, y, z (cm).
+static void makeCamera(CameraExtrinsics & camera, int index, double yaw,
+                       double x, double y, double z)
+{
+    identityExtrinsics(camera);
+    camera.camera = index;
+    float * r = camera.rotation;
+    r[0] = (float)cos(yaw);
+    r[2] = (float)sin(yaw);
+    r[6] = (float)-sin(yaw);
+    r[8] = (float)cos(yaw);
+    camera.translation[0] = (float)x;
+    camera.translation[1] = (float)y;
+    camera.translation[2] = (float)z;
+}
+
+// camera = R^T * (world - t)
+static void toCamera(const CameraExtrinsics & camera, const double world[3],
+                     double out[3])
+{
+    const float * r = camera.rotation;
+    double d[3];
+    for(int i = 0; i < 3; i++)
+    {
+        d[i] = world[i] - camera.translation[i];
+    }
+    for(int i = 0; i < 3; i++)
+    {
+        out[i] = r[i] * d[0] + r[3 + i] * d[1] + r[6 + i] * d[2];
+    }
+}
+
+static void toWorld(const CameraExtrinsics & camera, const double local[3],
+                    double out[3])
+{
+    const float * r = camera.rotation;
+    for(int i = 0; i < 3; i++)
+    {
+        out[i] = r[i * 3] * local[0] + r[i * 3 + 1] * local[1]
+                + r[i * 3 + 2] * local[2] + camera.translation[i];
+    }
+}
+
+static double gaussian()
+{
+    // Box-Muller
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static double distance(const double a[3], float x, float y, float z)
+{
+    double dx = a[0] - x, dy = a[1] - y, dz = a[2] - z;
+    return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+int main(int argc, char * argv[])
+{
+    int points = 2000;
+    unsigned int seed = 1;
+    for(int arg = 1; arg < argc; arg++)
+    {
+        bool more = arg + 1 < argc;
+        if(strcmp(argv[arg], "--points") == 0 && more)
+        {
+            points = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--seed") == 0 && more)
+        {
+            seed = atoi(argv[++arg]);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if(points < 1)
+    {
+        usage();
+        return 2;
+    }
+    srand(seed);
+
+    // One camera in front, two to the sides, all facing the volume at the
+    // world origin (cameras look along their +z).
+    CameraExtrinsics cameras[CHECK_CAMERAS];
+    makeCamera(cameras[0], 0, 0.0, 0.0, 0.0, -150.0);
+    makeCamera(cameras[1], 1, M_PI / 2.0, -150.0, 0.0, 0.0);
+    makeCamera(cameras[2], 2, -M_PI / 3.0, 130.0, 20.0, -75.0);
+
+    CameraFusion exact(CHECK_CAMERAS, 1);
+    CameraFusion noisy(CHECK_CAMERAS, 1);
+    noisy.setNoise(LATERAL_NOISE, DEPTH_NOISE);
+    for(int cam = 0; cam < CHECK_CAMERAS; cam++)
+    {
+        exact.setExtrinsics(cam, cameras[cam]);
+        noisy.setExtrinsics(cam, cameras[cam]);
+    }
+
+    bool failed = false;
+    double worstExact = 0.0;
+    double fusedSum = 0.0, bestSum = 0.0;
+    double singleSum[CHECK_CAMERAS] = { 0.0, 0.0, 0.0 };
+    double time = 0.0;
+    for(int p = 0; p < points; p++)
+    {
+        time += 0.01;
+        double world[3];
+        for(int i = 0; i < 3; i++)
+        {
+            world[i] = 40.0 * (2.0 * rand() / RAND_MAX - 1.0);
+        }
+
+        double bestError = 1e9;
+        for(int cam = 0; cam < CHECK_CAMERAS; cam++)
+        {
+            double local[3];
+            toCamera(cameras[cam], world, local);
+            exact.setObservation(cam, 0, time, 1, (float)local[0],
+                                 (float)local[1], (float)local[2]);
+
+            double depth = fabs(local[2]);
+            double lateral = LATERAL_NOISE * depth;
+            double axial = DEPTH_NOISE * depth * depth;
+            local[0] += lateral * gaussian();
+            local[1] += lateral * gaussian();
+            local[2] += axial * gaussian();
+            noisy.setObservation(cam, 0, time, 1, (float)local[0],
+                                 (float)local[1], (float)local[2]);
+
+            double seen[3];
+            toWorld(cameras[cam], local, seen);
+            double error = distance(world, (float)seen[0], (float)seen[1],
+                                    (float)seen[2]);
+            singleSum[cam] += error;
+            if(error < bestError)
+            {
+                bestError = error;
+            }
+        }
+        bestSum += bestError;
+
+        float x, y, z;
+        if(exact.fuse(0, time, x, y, z) != CHECK_CAMERAS)
+        {
+            printf("Exact observations: not every camera was used.\n");
+            failed = true;
+        }
+        double error = distance(world, x, y, z);
+        if(error > worstExact)
+        {
+            worstExact = error;
+        }
+        if(noisy.fuse(0, time, x, y, z) != CHECK_CAMERAS)
+        {
+            printf("Noisy observations: not every camera was used.\n");
+            failed = true;
+        }
+        fusedSum += distance(world, x, y, z);
+    }
+
+    printf("%d points, %d cameras, mean error (cm):\n", points, CHECK_CAMERAS);
+    for(int cam = 0; cam < CHECK_CAMERAS; cam++)
+    {
+        char name[32];
+        sprintf(name, "camera %d alone", cam);
+        printf("  %-22s %8.3f\n", name, singleSum[cam] / points);
+    }
+    printf("  %-22s %8.3f\n", "best camera per point", bestSum / points);
+    printf("  %-22s %8.3f\n", "fused", fusedSum / points);
+    printf("Worst error without noise: %.4f cm\n", worstExact);
+
+    if(worstExact > 0.01)
+    {
+        printf("FAILED: exact observations aren't recovered.\n");
+        failed = true;
+    }
+    if(fusedSum > bestSum)
+    {
+        printf("FAILED: fusion is worse than the best single camera.\n");
+        failed = true;
+    }
+
+    // Camera 1 stops seeing the controller: after the max age only the
+    // other two are used.
+    exact.setMaxAge(0.1);
+    double world[3] = { 5.0, -3.0, 12.0 };
+    for(int cam = 0; cam < CHECK_CAMERAS; cam++)
+    {
+        double local[3];
+        toCamera(cameras[cam], world, local);
+        exact.setObservation(cam, 0, cam == 1 ? time : time + 0.2, 1,
+                             (float)local[0], (float)local[1],
+                             (float)local[2]);
+    }
+    float x, y, z;
+    int used = exact.fuse(0, time + 0.2, x, y, z);
+    if(used != CHECK_CAMERAS - 1 || distance(world, x, y, z) > 0.01)
+    {
+        printf("FAILED: a stale observation was used (%d cameras).\n", used);
+        failed = true;
+    }
+    exact.setObservation(0, 0, time + 0.2, 0, 0.0f, 0.0f, 0.0f);
+    exact.setObservation(2, 0, time + 0.2, 0, 0.0f, 0.0f, 0.0f);
+    if(exact.fuse(0, time + 0.2, x, y, z) != 0)
+    {
+        printf("FAILED: a position without any tracking camera.\n");
+        failed = true;
+    }
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,402 @@
+#include "control_channel.h"
+
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <conio.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#endif
+
+// Longest a control client may keep reply() waiting for buffer space.
+#define REPLY_TIMEOUT_MS 200
+
+static volatile sig_atomic_t shutdownSignal = 0;
+static volatile sig_atomic_t reloadSignal = 0;
+
+#ifndef WIN32
+// Self-pipe, written by signal handlers and wake().
+static int wakePipe[2] = { -1, -1 };
+
+static void onSignal(int sig)
+{
+    if(sig == SIGHUP)
+    {
+        reloadSignal = 1;
+    }
+    else
+    {
+        shutdownSignal = 1;
+    }
+    ControlChannel::wake();
+}
+#else
+static void onSignal(int sig)
+{
+    shutdownSignal = 1;
+}
+#endif
+
+ControlChannel::ControlChannel()
+{
+    _useConsole = true;
+    _listenSocket = -1;
+}
+
+ControlChannel::~ControlChannel()
+{
+    close();
+}
+
+bool ControlChannel::open(bool useConsole, const std::string & socketPath)
+{
+    _useConsole = useConsole;
+
+#ifdef WIN32
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    if(!socketPath.empty())
+    {
+        printf("WARNING: control_socket is not supported on Windows.\n");
+    }
+    return true;
+#else
+    if(wakePipe[0] < 0)
+    {
+        if(pipe(wakePipe) != 0)
+        {
+            perror("pipe");
+            return false;
+        }
+        for(int i = 0; i < 2; i++)
+        {
+            fcntl(wakePipe[i], F_SETFL, fcntl(wakePipe[i], F_GETFL) | O_NONBLOCK);
+            fcntl(wakePipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+    // A control client hanging up mid reply mustn't kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    if(socketPath.empty())
+    {
+        return true;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(address.sun_path))
+    {
+        printf("Error: control socket path too long: %s\n", socketPath.c_str());
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    _listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(_listenSocket < 0)
+    {
+        perror("control socket");
+        return false;
+    }
+    // A stale socket from a previous run would stop bind.
+    unlink(socketPath.c_str());
+    if(bind(_listenSocket, (struct sockaddr *)&address, sizeof(address)) < 0
+            || listen(_listenSocket, 4) < 0)
+    {
+        perror("control socket");
+        ::close(_listenSocket);
+        _listenSocket = -1;
+        return false;
+    }
+    fcntl(_listenSocket, F_SETFD, FD_CLOEXEC);
+    _socketPath = socketPath;
+    printf("Control socket: %s\n", socketPath.c_str());
+    return true;
+#endif
+}
+
+void ControlChannel::close()
+{
+#ifndef WIN32
+    for(size_t i = 0; i < _clients.size(); i++)
+    {
+        ::close(_clients[i]);
+    }
+    _clients.clear();
+    _pending.clear();
+    if(_listenSocket >= 0)
+    {
+        ::close(_listenSocket);
+        _listenSocket = -1;
+        unlink(_socketPath.c_str());
+    }
+#endif
+}
+
+void ControlChannel::wake()
+{
+#ifndef WIN32
+    if(wakePipe[1] >= 0)
+    {
+        char c = 0;
+        // Full pipe means a wake up is already pending.
+        ssize_t written = write(wakePipe[1], &c, 1);
+        (void)written;
+    }
+#endif
+}
+
+bool ControlChannel::shutdownRequested()
+{
+    return shutdownSignal != 0;
+}
+
+bool ControlChannel::takeReloadRequest()
+{
+    if(reloadSignal)
+    {
+        reloadSignal = 0;
+        return true;
+    }
+    return false;
+}
+
+static void stripLine(std::string & line)
+{
+    while(!line.empty() && (line[line.size() - 1] == '\n'
+            || line[line.size() - 1] == '\r'))
+    {
+        line.erase(line.size() - 1);
+    }
+}
+
+void ControlChannel::wait(int timeoutMs, std::vector<ControlCommand> & commands)
+{
+    commands.clear();
+
+#ifdef WIN32
+    // No select() on console handles, poll the keyboard instead.
+    if(!_useConsole || !_kbhit())
+    {
+        Sleep(timeoutMs < 0 ? 50 : timeoutMs);
+    }
+    if(_useConsole && _kbhit())
+    {
+        char s[2048];
+        if(fgets(s, sizeof(s), stdin) != NULL)
+        {
+            ControlCommand command;
+            command.client = -1;
+            command.line = s;
+            stripLine(command.line);
+            commands.push_back(command);
+        }
+    }
+#else
+    fd_set rdset;
+    FD_ZERO(&rdset);
+    int maxFd = wakePipe[0];
+    FD_SET(wakePipe[0], &rdset);
+    if(_useConsole)
+    {
+        FD_SET(0, &rdset);
+    }
+    if(_listenSocket >= 0)
+    {
+        FD_SET(_listenSocket, &rdset);
+        if(_listenSocket > maxFd)
+        {
+            maxFd = _listenSocket;
+        }
+    }
+    for(size_t i = 0; i < _clients.size(); i++)
+    {
+        FD_SET(_clients[i], &rdset);
+        if(_clients[i] > maxFd)
+        {
+            maxFd = _clients[i];
+        }
+    }
+
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    if(select(maxFd + 1, &rdset, NULL, NULL, timeoutMs < 0 ? NULL : &timeout) <= 0)
+    {
+        return;
+    }
+
+    if(FD_ISSET(wakePipe[0], &rdset))
+    {
+        char buffer[64];
+        while(read(wakePipe[0], buffer, sizeof(buffer)) > 0)
+        {
+        }
+    }
+
+    if(_useConsole && FD_ISSET(0, &rdset))
+    {
+        readConsole(commands);
+    }
+
+    // Clients are read before accepting, so new ones aren't read unready.
+    for(size_t i = _clients.size(); i-- > 0;)
+    {
+        if(FD_ISSET(_clients[i], &rdset))
+        {
+            readClient(i, commands);
+        }
+    }
+
+    if(_listenSocket >= 0 && FD_ISSET(_listenSocket, &rdset))
+    {
+        int client = accept(_listenSocket, NULL, NULL);
+        if(client >= 0)
+        {
+            fcntl(client, F_SETFD, FD_CLOEXEC);
+            _clients.push_back(client);
+            _pending.push_back(std::string());
+        }
+    }
+#endif
+}
+
+// Reads fd 0 directly: select() only knows about the descriptor, lines
+// stdio had already buffered would wait for the next key press.
+void ControlChannel::readConsole(std::vector<ControlCommand> & commands)
+{
+#ifndef WIN32
+    char buffer[512];
+    ssize_t n = read(0, buffer, sizeof(buffer));
+    if(n < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return;
+    }
+    if(n <= 0)
+    {
+        // stdin closed (e.g. started from a service), stop reading it.
+        _useConsole = false;
+        _consoleLine.append("\n");
+    }
+    else
+    {
+        _consoleLine.append(buffer, n);
+    }
+
+    size_t end;
+    while((end = _consoleLine.find('\n')) != std::string::npos)
+    {
+        ControlCommand command;
+        command.client = -1;
+        command.line = _consoleLine.substr(0, end);
+        stripLine(command.line);
+        _consoleLine.erase(0, end + 1);
+        if(n > 0 || !command.line.empty())
+        {
+            commands.push_back(command);
+        }
+    }
+    if(_consoleLine.size() > 2048)
+    {
+        _consoleLine.clear();
+    }
+#endif
+}
+
+void ControlChannel::readClient(size_t i, std::vector<ControlCommand> & commands)
+{
+#ifndef WIN32
+    char buffer[512];
+    ssize_t n = recv(_clients[i], buffer, sizeof(buffer), 0);
+    if(n <= 0)
+    {
+        ::close(_clients[i]);
+        _clients.erase(_clients.begin() + i);
+        _pending.erase(_pending.begin() + i);
+        return;
+    }
+
+    std::string & pending = _pending[i];
+    pending.append(buffer, n);
+    size_t end;
+    while((end = pending.find('\n')) != std::string::npos)
+    {
+        ControlCommand command;
+        command.client = _clients[i];
+        command.line = pending.substr(0, end);
+        stripLine(command.line);
+        commands.push_back(command);
+        pending.erase(0, end + 1);
+    }
+    // Nobody sends commands this long, drop the client.
+    if(pending.size() > 2048)
+    {
+        ::close(_clients[i]);
+        _clients.erase(_clients.begin() + i);
+        _pending.erase(_pending.begin() + i);
+    }
+#endif
+}
+
+void ControlChannel::reply(int client, const std::string & text)
+{
+    if(client < 0)
+    {
+        printf("%s", text.c_str());
+        fflush(stdout);
+        return;
+    }
+#ifndef WIN32
+    size_t sent = 0;
+    while(sent < text.size())
+    {
+        ssize_t n = send(client, text.data() + sent, text.size() - sent,
+                         MSG_DONTWAIT);
+        if(n > 0)
+        {
+            sent += n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            fd_set wrset;
+            FD_ZERO(&wrset);
+            FD_SET(client, &wrset);
+            timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = REPLY_TIMEOUT_MS * 1000;
+            if(select(client + 1, NULL, &wrset, NULL, &timeout) > 0)
+            {
+                continue;
+            }
+        }
+        // Stuck or gone. The descriptor stays open until wait() reads the
+        // hang up, later replies in this batch still go to the right place.
+        shutdown(client, SHUT_RDWR);
+        break;
+    }
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef CONTROL_CHANNEL_H
+#define CONTROL_CHANNEL_H
+
+#include <string>
+#include <vector>
+
+/**
+ * A command line from the console or a control socket client.
+ **/
+struct ControlCommand
+{
+        int client; // -1 for the console.
+        std::string line;
+};
+
+/**
+ * Everything the main thread waits on: console input, a local control
+ * socket accepting the same commands, and signals (SIGTERM/SIGINT ask for
+ * shutdown, SIGHUP for a config reload). Signals and wake() go through a
+ * self-pipe, so wait() can block without a timeout and the main thread
+ * uses no CPU while idle.
+ *
+ * The control socket and signals are POSIX only. On Windows only the
+ * console is read, polled with a short timeout.
+ **/
+class ControlChannel
+{
+    public:
+        ControlChannel();
+        ~ControlChannel();
+
+        // useConsole is false in daemon mode. socketPath may be empty.
+        bool open(bool useConsole, const std::string & socketPath);
+        void close();
+
+        // Waits up to timeoutMs (negative waits forever) for commands or signals.
+        void wait(int timeoutMs, std::vector<ControlCommand> & commands);
+        // Never blocks on a client for long, one that doesn't take its
+        // reply is hung up on.
+        void reply(int client, const std::string & text);
+
+        // Wakes wait() from another thread or a signal handler.
+        static void wake();
+
+        bool shutdownRequested();
+        // Returns true once per SIGHUP.
+        bool takeReloadRequest();
+
+    protected:
+        void readClient(size_t i, std::vector<ControlCommand> & commands);
+        void readConsole(std::vector<ControlCommand> & commands);
+
+        bool _useConsole;
+        std::string _consoleLine; // Partial console line.
+        std::string _socketPath;
+        int _listenSocket;
+        std::vector<int> _clients;
+        std::vector<std::string> _pending; // Partial line per client.
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "controller_monitor.h"
+#include "move_backend.h"
+#include "trace.h"
+#include "log.h"
+#include "Timer.hpp"
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// How often slots are checked and new controllers are looked for.
+#define MONITOR_INTERVAL_MS 500
+
+static std::string controllerSerial(PSMove * move)
+{
+    std::string serial;
+    char * s = moveBackend->getSerial(move);
+    if(s)
+    {
+        serial = s;
+        free(s);
+    }
+    return serial;
+}
+
+ControllerMonitor::ControllerMonitor(PMONITORDATA data) :
+        Thread()
+{
+    _monitorData = data;
+    _serials.resize(data->totalSlots);
+    _disconnect.resize(data->totalSlots, 0);
+    // Controllers connected at startup, so they aren't connected twice.
+    for(int c = 0; c < data->totalSlots; c++)
+    {
+        if(data->controllers[c])
+        {
+            _serials[c] = controllerSerial(data->controllers[c]);
+        }
+    }
+    // Startup has just looked at everything that is connected.
+    _enumerated = moveBackend->countConnected();
+}
+
+ControllerMonitor::~ControllerMonitor()
+{
+}
+
+void ControllerMonitor::run()
+{
+    nameCurrentThread("monitor");
+
+    while(1)
+    {
+        step(getTime());
+
+        for(int wait = 0; wait < MONITOR_INTERVAL_MS; wait += 100)
+        {
+#ifdef WIN32
+            Sleep(100);
+#else
+            usleep(100000);
+#endif
+        }
+
+        _quitMutex->lock();
+        if(_quit)
+        {
+            _quitMutex->unlock();
+            break;
+        }
+        _quitMutex->unlock();
+    }
+}
+
+void ControllerMonitor::step(double now)
+{
+    int totalSlots = _monitorData->totalSlots;
+    PSMove** controllers = _monitorData->controllers;
+    ControllerData* controllerData = _monitorData->controllerData;
+    unsigned int allCameras = (1u << _monitorData->totalCameras) - 1;
+    int c;
+
+    traceLock(controllerMutex, "wait controllerMutex");
+    for(c = 0; c < totalSlots; c++)
+    {
+        ControllerData & slot = controllerData[c];
+        _disconnect[c] = 0;
+        if(slot.slotState == SLOT_ACTIVE
+                && now - slot.lastPoll > _monitorData->timeout)
+        {
+            slot.slotState = SLOT_RETIRING;
+            slot.released = 0;
+            LOG(LOG_WARNING, "Controller %d stopped responding, retiring it.", c);
+        }
+        else if(slot.slotState == SLOT_RETIRING
+                && slot.released >= _monitorData->releaseCount)
+        {
+            _disconnect[c] = 1;
+        }
+        else if(slot.slotState == SLOT_CONNECTING
+                && (slot.trackerDone & allCameras) == allCameras)
+        {
+            slot.slotState = SLOT_ACTIVE;
+            slot.lastPoll = now;
+            if(moveBackend->connectionType(controllers[c]) == Conn_Bluetooth)
+            {
+                slot.orientationState = ORIENTATION_WAITING;
+                LOG(LOG_INFO, "Controller %d connected. Press its MOVE button to calibrate orientation.", c);
+            }
+            else
+            {
+                slot.orientationState = ORIENTATION_UNAVAILABLE;
+                LOG(LOG_WARNING, "Controller %d connected by USB, physical data will be unavailable.", c);
+            }
+        }
+    }
+    controllerMutex->unlock();
+
+    // Nobody uses these anymore, disconnecting can take a while so it's done unlocked.
+    for(c = 0; c < totalSlots; c++)
+    {
+        if(_disconnect[c])
+        {
+            moveBackend->disconnect(controllers[c]);
+            _serials[c].clear();
+
+            traceLock(controllerMutex, "wait controllerMutex");
+            controllers[c] = NULL;
+            controllerData[c].slotState = SLOT_EMPTY;
+            controllerMutex->unlock();
+            LOG(LOG_INFO, "Controller %d disconnected, slot is free.", c);
+
+            // A controller turned away for lack of a slot can have it now.
+            _enumerated = -1;
+        }
+    }
+
+    discover(now);
+}
+
+void ControllerMonitor::discover(double now)
+{
+    int totalSlots = _monitorData->totalSlots;
+    PSMove** controllers = _monitorData->controllers;
+    // Only the monitor changes which slots hold a controller after startup.
+    int used = 0;
+    for(int c = 0; c < totalSlots; c++)
+    {
+        if(controllers[c])
+        {
+            used++;
+        }
+    }
+
+    // Only enumerate when the count changed or a slot was freed since the
+    // last time. Connecting by id opens the device, so doing it every pass
+    // would churn through controllers that are already in a slot.
+    int connected = moveBackend->countConnected();
+    if(connected == _enumerated || used == totalSlots)
+    {
+        return;
+    }
+    _enumerated = connected;
+    if(connected <= used)
+    {
+        return;
+    }
+
+    for(int id = 0; id < connected && used < totalSlots; id++)
+    {
+        PSMove * move = moveBackend->connect(id);
+        if(!move)
+        {
+            // Try again on the next pass.
+            _enumerated = -1;
+            continue;
+        }
+
+        std::string serial = controllerSerial(move);
+        bool known = serial.empty();
+        for(int c = 0; c < totalSlots && !known; c++)
+        {
+            known = _serials[c] == serial;
+        }
+        if(known)
+        {
+            moveBackend->disconnect(move);
+            continue;
+        }
+
+        int slot = 0;
+        while(controllers[slot])
+        {
+            slot++;
+        }
+        _serials[slot] = serial;
+        used++;
+
+        moveBackend->enableOrientation(move);
+
+        traceLock(controllerMutex, "wait controllerMutex");
+        ControllerData & data = _monitorData->controllerData[slot];
+        controllers[slot] = move;
+        data.r = data.g = data.b = 0;
+        data.tr = data.tg = data.tb = 0;
+        data.rumble = 0;
+        data.rumbleUntil = 0.0;
+        data.hapticPattern = -1;
+        data.hapticStart = 0.0;
+        data.resetOrientation = 0;
+        data.changeLight = 1;
+        data.trackerLight = 0;
+        data.orientationState = ORIENTATION_UNCALIBRATED;
+        data.generation++;
+        data.released = 0;
+        data.trackerDone = 0;
+        data.lastPoll = now;
+        data.slotState = SLOT_CONNECTING;
+        controllerMutex->unlock();
+
+        LOG(LOG_INFO, "New controller %s in slot %d.%s", serial.c_str(), slot,
+            _monitorData->totalCameras > 0
+                    ? " Hold it about 10cm from the camera for calibration."
+                    : "");
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef CONTROLLER_MONITOR_H
+#define CONTROLLER_MONITOR_H
+
+#include "Thread.hpp"
+#include "move_udp_server.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Discovers and retires controllers while the server runs.
+ *
+ * A controller that hasn't returned a poll for the timeout is marked
+ * SLOT_RETIRING. The physical thread, each capture stage and the send stage
+ * acknowledge by incrementing 'released' once they no longer use it, only
+ * then is it disconnected and the slot freed. New controllers are connected
+ * into free slots as SLOT_CONNECTING and become SLOT_ACTIVE once every
+ * camera has tried to calibrate them. The polling and tracking threads
+ * never wait on the monitor.
+ **/
+class ControllerMonitor : public Thread
+{
+    public:
+        ControllerMonitor(PMONITORDATA data);
+        virtual ~ControllerMonitor();
+
+        virtual void run();
+
+    protected:
+        // One pass over the slots followed by discover(), run() calls it
+        // every MONITOR_INTERVAL_MS.
+        void step(double now);
+        void discover(double now);
+
+        PMONITORDATA _monitorData;
+        std::vector<std::string> _serials; // Serial of the controller in each slot.
+        std::vector<int> _disconnect; // Slots step() disconnects this pass.
+        // countConnected() when the controllers were last enumerated, -1 to
+        // enumerate on the next pass. A controller paired over USB and
+        // Bluetooth is counted twice, so the count alone can't tell whether
+        // there is a new one.
+        int _enumerated;
+};
+
+#endif
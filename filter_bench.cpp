@@ -0,0 +1,210 @@
+/**
+ * Benchmark and frequency response of the smoothing filters.
+ *
+ * The benchmark times SmoothingBank::update for 16 controllers, the way the
+ * physical thread filters orientation and the tracker filters position.
+ *
+ * The frequency response feeds sine waves to one controller at the poll
+ * rate and measures the amplitude that comes out once the filter has
+ * settled. The exponential filter must match the gain of its first order
+ * low pass within 2%. The One-Euro filter must let more of a fast movement
+ * through than the exponential filter with the same minimum cutoff, which
+ * is what its speed term is for.
+ *
+ * filter_bench [--controllers n] [--ticks n] [--rate hz]
+ *
+ * Exits with 1 if the frequency response is off.
+ **/
+
+#include "smoothing_filter.h"
+#include "Timer.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Cutoff of the filters under test, Hz.
+#define BENCH_CUTOFF 5.0f
+// Seconds of sine fed before measuring, and measured. The measurement
+// covers whole periods of every test frequency.
+#define SETTLE_TIME 2.0
+#define MEASURE_TIME 4.0
+
+static void usage()
+{
+    printf("filter_bench [--controllers n] [--ticks n] [--rate hz]\n");
+}
+
+static FilterSettings makeSettings(int type, float minCutoff, float beta)
+{
+    FilterSettings settings;
+    settings.type = type;
+    settings.minCutoff = minCutoff;
+    settings.beta = beta;
+    settings.dCutoff = 1.0f;
+    return settings;
+}
+
+// Nanoseconds per controller and tick.
+static double timeBank(int controllers, int dimension, bool quaternion,
+                       const FilterSettings & settings, int ticks, float rate)
+{
+    SmoothingBank bank(controllers, dimension, quaternion);
+    for(int c = 0; c < controllers; c++)
+    {
+        bank.setFilter(c, settings);
+    }
+    std::vector<float> raw(controllers * dimension), out(controllers * dimension);
+    std::vector<int> valid(controllers, 1);
+
+    double start = getTime();
+    for(int t = 0; t < ticks; t++)
+    {
+        // Something that moves, so the One-Euro speed term is exercised.
+        double time = t / rate;
+        for(int c = 0; c < controllers; c++)
+        {
+            float * x = &raw[c * dimension];
+            float angle = (float)(time + c);
+            x[0] = cosf(angle);
+            x[1] = sinf(angle);
+            for(int i = 2; i < dimension; i++)
+            {
+                x[i] = 0.1f * i;
+            }
+        }
+        bank.update(time, &raw[0], &valid[0], &out[0]);
+    }
+    double elapsed = getTime() - start;
+    return elapsed * 1e9 / ((double)ticks * controllers);
+}
+
+// Amplitude out over amplitude in of a sine at 'frequency', from the
+// output's component at that frequency.
+static double measureGain(const FilterSettings & settings, float rate,
+                          double frequency, double amplitude)
+{
+    SmoothingBank bank(1, 1, false);
+    bank.setFilter(0, settings);
+    int valid = 1;
+    double re = 0.0, im = 0.0;
+    int settle = (int)(SETTLE_TIME * rate);
+    int measured = (int)(MEASURE_TIME * rate);
+    for(int t = 0; t < settle + measured; t++)
+    {
+        double time = t / rate;
+        double phase = 2.0 * M_PI * frequency * time;
+        float in = (float)(amplitude * sin(phase));
+        float out;
+        bank.update(time, &in, &valid, &out);
+        if(t >= settle)
+        {
+            re += out * cos(phase);
+            im += out * sin(phase);
+        }
+    }
+    return 2.0 * sqrt(re * re + im * im) / measured / amplitude;
+}
+
+// Gain of y += a * (x - y) at 'frequency', a as in smoothing_filter.cpp.
+static double expectedGain(float cutoff, float rate, double frequency)
+{
+    double dt = 1.0 / rate;
+    double tau = 1.0 / (2.0 * M_PI * cutoff);
+    double a = 1.0 / (1.0 + tau / dt);
+    double w = 2.0 * M_PI * frequency * dt;
+    return a / sqrt(1.0 - 2.0 * (1.0 - a) * cos(w) + (1.0 - a) * (1.0 - a));
+}
+
+int main(int argc, char * argv[])
+{
+    int controllers = 16;
+    int ticks = 200000;
+    float rate = 100.0f;
+    for(int arg = 1; arg < argc; arg++)
+    {
+        bool more = arg + 1 < argc;
+        if(strcmp(argv[arg], "--controllers") == 0 && more)
+        {
+            controllers = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--ticks") == 0 && more)
+        {
+            ticks = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--rate") == 0 && more)
+        {
+            rate = atof(argv[++arg]);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if(controllers < 1 || ticks < 1 || rate <= 0.0f)
+    {
+        usage();
+        return 2;
+    }
+
+    FilterSettings none = makeSettings(FILTER_NONE, BENCH_CUTOFF, 0.0f);
+    FilterSettings exponential = makeSettings(FILTER_EXPONENTIAL, BENCH_CUTOFF,
+                                              0.0f);
+    FilterSettings oneEuro = makeSettings(FILTER_ONE_EURO, BENCH_CUTOFF, 0.5f);
+
+    printf("update() for %d controllers, %d ticks, ns per controller:\n",
+           controllers, ticks);
+    printf("  %-12s %12s %12s\n", "", "orientation", "position");
+    const char * names[3] = { "none", "exponential", "oneeuro" };
+    const FilterSettings * settings[3] = { &none, &exponential, &oneEuro };
+    for(int i = 0; i < 3; i++)
+    {
+        double quaternion = timeBank(controllers, 4, true, *settings[i],
+                                     ticks, rate);
+        double position = timeBank(controllers, 3, false, *settings[i],
+                                   ticks, rate);
+        printf("  %-12s %12.1f %12.1f\n", names[i], quaternion, position);
+    }
+
+    printf("\nFrequency response at %.0f Hz, cutoff %.1f Hz:\n", rate,
+           BENCH_CUTOFF);
+    printf("  %8s %10s %10s %10s %12s\n", "Hz", "expected", "exponential",
+           "oneeuro", "oneeuro x10");
+    const double frequencies[] = { 0.5, 1.0, 2.0, 5.0, 10.0, 20.0 };
+    const int count = sizeof(frequencies) / sizeof(frequencies[0]);
+    bool failed = false;
+    for(int i = 0; i < count; i++)
+    {
+        double f = frequencies[i];
+        if(f >= rate / 2.0)
+        {
+            break;
+        }
+        double expected = expectedGain(BENCH_CUTOFF, rate, f);
+        double gain = measureGain(exponential, rate, f, 1.0);
+        double slow = measureGain(oneEuro, rate, f, 1.0);
+        double fast = measureGain(oneEuro, rate, f, 10.0);
+        const char * mark = "";
+        if(fabs(gain - expected) > 0.02 * expected)
+        {
+            mark = "  <- exponential off";
+            failed = true;
+        }
+        else if(fast < gain)
+        {
+            mark = "  <- oneeuro slower than exponential";
+            failed = true;
+        }
+        printf("  %8.1f %10.3f %10.3f %10.3f %12.3f%s\n", f, expected, gain,
+               slow, fast, mark);
+    }
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#include "frame_triple_buffer.h"
+#include "Atomic.hpp"
+
+#include <cstdio>
+
+// Set in _middle when the writer has swapped in a frame the reader hasn't taken.
+#define FRAME_FRESH 4
+#define FRAME_INDEX 3
+
+FrameTripleBuffer::FrameTripleBuffer()
+{
+    for(int i = 0; i < 3; i++)
+    {
+        _frames[i].image = NULL;
+        _frames[i].camera = 0;
+        _frames[i].number = 0;
+    }
+    _back = 0;
+    _middle = 1;
+    _front = 2;
+}
+
+FrameTripleBuffer::~FrameTripleBuffer()
+{
+    for(int i = 0; i < 3; i++)
+    {
+        if(_frames[i].image)
+        {
+            cvReleaseImage(&_frames[i].image);
+        }
+    }
+}
+
+void FrameTripleBuffer::publish(const IplImage * image, int camera,
+                                unsigned int number,
+                                const std::vector<TrackedController> & controllers)
+{
+    ViewerFrame & frame = _frames[_back];
+    if(frame.image && (frame.image->width != image->width
+            || frame.image->height != image->height
+            || frame.image->nChannels != image->nChannels
+            || frame.image->depth != image->depth))
+    {
+        cvReleaseImage(&frame.image);
+    }
+    if(!frame.image)
+    {
+        frame.image = cvCreateImage(cvGetSize(image), image->depth,
+                                    image->nChannels);
+    }
+    cvCopy(image, frame.image);
+    frame.camera = camera;
+    frame.number = number;
+    frame.controllers = controllers;
+
+    // The exchange is a full barrier, the copy is complete before the reader can see it.
+    _back = atomicExchange(&_middle, _back | FRAME_FRESH) & FRAME_INDEX;
+}
+
+ViewerFrame * FrameTripleBuffer::acquire()
+{
+    if(!(atomicLoad(&_middle) & FRAME_FRESH))
+    {
+        return NULL;
+    }
+    // Only the reader clears FRESH, so it is still set here.
+    _front = atomicExchange(&_middle, _front) & FRAME_INDEX;
+    return &_frames[_front];
+}
+
+void annotateViewerFrame(ViewerFrame & frame)
+{
+    CvFont font;
+    cvInitFont(&font, CV_FONT_HERSHEY_SIMPLEX, 0.5, 0.5, 0, 1, CV_AA);
+
+    for(size_t c = 0; c < frame.controllers.size(); c++)
+    {
+        const TrackedController & t = frame.controllers[c];
+        if(!t.tracking)
+        {
+            continue;
+        }
+        CvPoint centre = cvPoint((int)(t.ux * frame.image->width),
+                                 (int)(t.uy * frame.image->height));
+        CvScalar colour = CV_RGB(t.r, t.g, t.b);
+        cvCircle(frame.image, centre, (int)t.radius, colour, 2, CV_AA);
+
+        char label[64];
+        sprintf(label, "%d: %.1f %.1f %.1f", (int)c, t.x, t.y, t.z);
+        cvPutText(frame.image, label,
+                  cvPoint(centre.x + (int)t.radius + 4, centre.y), &font,
+                  colour);
+    }
+
+    char info[32];
+    sprintf(info, "Camera %d #%u", frame.camera, frame.number);
+    cvPutText(frame.image, info, cvPoint(10, 20), &font,
+              CV_RGB(255, 255, 255));
+}
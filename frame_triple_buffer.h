@@ -0,0 +1,57 @@
+#ifndef FRAME_TRIPLE_BUFFER_H
+#define FRAME_TRIPLE_BUFFER_H
+
+#include "udp_tracker.h"
+
+#include <opencv2/core/core_c.h>
+
+#include <vector>
+
+/**
+ * A camera image copied out of the tracker, with what was tracked in it.
+ **/
+struct ViewerFrame
+{
+        IplImage * image;
+        int camera;
+        unsigned int number;
+        std::vector<TrackedController> controllers;
+};
+
+/**
+ * Lock-free hand-off of tracker frames to the viewer. The capture stage
+ * copies into the back buffer and swaps it with the middle one, the viewer
+ * swaps the middle buffer with its front one when a new frame is there.
+ * Neither side ever waits, the viewer always gets a complete frame, and the
+ * tracker never has to keep its image alive for the viewer.
+ *
+ * Exactly one thread may ever call publish() and one acquire(). _back
+ * isn't shared, so two writers would copy into the same buffer. Every
+ * capture stage therefore has a buffer of its own; switching the shown
+ * camera switches which buffer the viewer reads, never who writes.
+ **/
+class FrameTripleBuffer
+{
+    public:
+        FrameTripleBuffer();
+        ~FrameTripleBuffer();
+
+        // Writer. Copies image, tracked positions are in image pixels.
+        void publish(const IplImage * image, int camera, unsigned int number,
+                     const std::vector<TrackedController> & controllers);
+
+        // Reader. Returns the newest frame, or NULL if nothing new has been
+        // published since the last call. Valid until the next call.
+        ViewerFrame * acquire();
+
+    protected:
+        ViewerFrame _frames[3];
+        int _back; // Owned by the writer.
+        int _front; // Owned by the reader.
+        volatile int _middle; // Index of the shared buffer, FRESH if unread.
+};
+
+// Draws the tracked controllers into the frame's image.
+void annotateViewerFrame(ViewerFrame & frame);
+
+#endif
@@ -0,0 +1,360 @@
+/**
+ * Offline check of the IMU/camera position fusion against a recorded
+ * session (see "record" in move.cfg).
+ *
+ * Every poll of the log goes through PositionFusion as on the physical
+ * thread, and the tracker positions of one camera correct it. Every n-th
+ * tracker position is held back instead, and compared with where the
+ * fusion thinks the controller is at that moment. The same frames are
+ * compared with the last tracker position ("b" packets without fusion) and
+ * with the fusion without the accelerometer, so the report shows what the
+ * accelerometer adds. Errors include the camera's own noise.
+ *
+ * The server gets a camera position only after the polls that followed the
+ * frame. A second run applies every tracker position --late seconds after
+ * its frame, between later polls, and compares with the last tracker
+ * position that had arrived by then.
+ *
+ * fusion_check <session.log> [--camera n] [--holdout n] [--coast s]
+ *              [--accel-noise cm/s^2] [--position-noise x y z]
+ *              [--gravity-time s] [--align w x y z] [--late s]
+ *
+ * Exits with 1 if the fusion, on time or late, is further off than the
+ * last tracker position.
+ **/
+
+#include "position_fusion.h"
+#include "session_log.h"
+
+#include <psmoveapi/psmove_tracker.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+// One poll or tracker position of a controller, in log order.
+struct CheckEvent
+{
+        double time;
+        int controller;
+        bool track; // Tracker position, else a poll.
+        SessionPoll poll;
+        float position[3];
+};
+
+// Squared errors of one way of estimating the position.
+struct CheckError
+{
+        double sum[3];
+        int count;
+};
+
+static void usage()
+{
+    printf("fusion_check <session.log> [--camera n] [--holdout n] [--coast s]\n"
+           "             [--accel-noise cm/s^2] [--position-noise x y z]\n"
+           "             [--gravity-time s] [--align w x y z] [--late s]\n");
+}
+
+static bool earlier(const CheckEvent & a, const CheckEvent & b)
+{
+    return a.time < b.time;
+}
+
+static void addError(CheckError & error, const float * estimate,
+                     const float * measured)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        double d = estimate[i] - measured[i];
+        error.sum[i] += d * d;
+    }
+    error.count++;
+}
+
+// RMS over all three axes.
+static double printError(const char * name, const CheckError & error)
+{
+    double rms[3], total = 0.0;
+    for(int i = 0; i < 3; i++)
+    {
+        rms[i] = error.count ? sqrt(error.sum[i] / error.count) : 0.0;
+        total += error.count ? error.sum[i] / error.count : 0.0;
+    }
+    total = sqrt(total);
+    printf("  %-18s %8.3f %8.3f %8.3f %8.3f\n", name, rms[0], rms[1], rms[2],
+           total);
+    return total;
+}
+
+// Reads the polls of every controller and the positions of one camera.
+static bool readLog(const char * file, int camera,
+                    std::vector<CheckEvent> & events, int & controllers)
+{
+    FILE * in = fopen(file, "rb");
+    if(!in)
+    {
+        printf("Couldn't open %s\n", file);
+        return false;
+    }
+    SessionFileHeader header;
+    if(fread(&header, sizeof(header), 1, in) != 1
+            || header.magic != SESSION_MAGIC
+            || header.version != SESSION_VERSION)
+    {
+        printf("%s isn't a session log this build can read.\n", file);
+        fclose(in);
+        return false;
+    }
+
+    controllers = 0;
+    SessionRecordHeader record;
+    std::vector<char> payload;
+    while(fread(&record, sizeof(record), 1, in) == 1)
+    {
+        payload.resize(record.size + 1);
+        if(record.size && fread(&payload[0], record.size, 1, in) != 1)
+        {
+            // The server was stopped while writing.
+            break;
+        }
+        CheckEvent event;
+        event.time = record.time;
+        event.controller = record.id;
+        if(record.type == RECORD_POLL && record.size == sizeof(SessionPoll))
+        {
+            event.track = false;
+            memcpy(&event.poll, &payload[0], sizeof(SessionPoll));
+        }
+        else if(record.type == RECORD_TRACK
+                && record.size == sizeof(SessionTrack))
+        {
+            SessionTrack track;
+            memcpy(&track, &payload[0], sizeof(track));
+            if(track.camera != camera || track.status != Tracker_TRACKING)
+            {
+                continue;
+            }
+            event.track = true;
+            event.position[0] = track.x;
+            event.position[1] = track.y;
+            event.position[2] = track.z;
+        }
+        else
+        {
+            continue;
+        }
+        if(event.controller + 1 > controllers)
+        {
+            controllers = event.controller + 1;
+        }
+        events.push_back(event);
+    }
+    fclose(in);
+
+    // Polls and frames come from different threads, the log is only in
+    // order per thread.
+    std::stable_sort(events.begin(), events.end(), earlier);
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    const char * file = NULL;
+    int camera = 0;
+    int holdout = 4;
+    double late = 0.05;
+    FusionSettings settings;
+    defaultFusionSettings(settings);
+    settings.enabled = 1;
+
+    for(int arg = 1; arg < argc; arg++)
+    {
+        bool more = arg + 1 < argc;
+        if(strcmp(argv[arg], "--camera") == 0 && more)
+        {
+            camera = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--holdout") == 0 && more)
+        {
+            holdout = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--coast") == 0 && more)
+        {
+            settings.coastTime = atof(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--accel-noise") == 0 && more)
+        {
+            settings.accelNoise = atof(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--late") == 0 && more)
+        {
+            late = atof(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--gravity-time") == 0 && more)
+        {
+            settings.gravityTime = atof(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--position-noise") == 0 && arg + 3 < argc)
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                settings.positionNoise[i] = atof(argv[++arg]);
+            }
+        }
+        else if(strcmp(argv[arg], "--align") == 0 && arg + 4 < argc)
+        {
+            for(int i = 0; i < 4; i++)
+            {
+                settings.alignment[i] = atof(argv[++arg]);
+            }
+        }
+        else if(argv[arg][0] != '-' && !file)
+        {
+            file = argv[arg];
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if(!file || holdout < 2 || late < 0.0)
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<CheckEvent> events;
+    int controllers = 0;
+    if(!readLog(file, camera, events, controllers))
+    {
+        return 2;
+    }
+
+    FusionSettings noAccel = settings;
+    noAccel.useAccel = 0;
+
+    bool worse = false;
+    int checked = 0;
+    for(int c = 0; c < controllers; c++)
+    {
+        PositionFusion fusion(settings);
+        PositionFusion velocityOnly(noAccel);
+        PositionFusion lateFusion(settings);
+        CheckError last, plain, fused, lastLate, fusedLate;
+        memset(&last, 0, sizeof(last));
+        memset(&plain, 0, sizeof(plain));
+        memset(&fused, 0, sizeof(fused));
+        memset(&lastLate, 0, sizeof(lastLate));
+        memset(&fusedLate, 0, sizeof(fusedLate));
+        float lastTrack[3], lateTrack[3];
+        bool haveTrack = false, haveLateTrack = false;
+        int tracks = 0;
+        // Tracker positions on their way to the late fusion.
+        std::deque<CheckEvent> pending;
+
+        for(size_t i = 0; i < events.size(); i++)
+        {
+            const CheckEvent & event = events[i];
+            if(event.controller != c)
+            {
+                continue;
+            }
+            if(!event.track)
+            {
+                const SessionPoll & poll = event.poll;
+                const float * q = poll.orientation;
+                if(!poll.hasOrientation)
+                {
+                    static const float identity[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+                    q = identity;
+                }
+                fusion.predict(event.time, poll.accel[0], poll.accel[1],
+                               poll.accel[2], q[0], q[1], q[2], q[3]);
+                velocityOnly.predict(event.time, poll.accel[0], poll.accel[1],
+                                     poll.accel[2], q[0], q[1], q[2], q[3]);
+                lateFusion.predict(event.time, poll.accel[0], poll.accel[1],
+                                   poll.accel[2], q[0], q[1], q[2], q[3]);
+                while(!pending.empty() && pending.front().time + late <= event.time)
+                {
+                    const float * p = pending.front().position;
+                    lateFusion.correct(pending.front().time, p[0], p[1], p[2]);
+                    memcpy(lateTrack, p, sizeof(lateTrack));
+                    haveLateTrack = true;
+                    pending.pop_front();
+                }
+                continue;
+            }
+
+            const float * measured = event.position;
+            if(tracks++ % holdout == 0 && haveTrack
+                    && fusion.tracking(event.time))
+            {
+                float estimate[3];
+                addError(last, lastTrack, measured);
+                velocityOnly.getPosition(estimate[0], estimate[1],
+                                         estimate[2]);
+                addError(plain, estimate, measured);
+                fusion.getPosition(estimate[0], estimate[1], estimate[2]);
+                addError(fused, estimate, measured);
+                if(haveLateTrack && lateFusion.tracking(event.time))
+                {
+                    addError(lastLate, lateTrack, measured);
+                    lateFusion.getPosition(estimate[0], estimate[1],
+                                           estimate[2]);
+                    addError(fusedLate, estimate, measured);
+                }
+                continue;
+            }
+            pending.push_back(event);
+            fusion.correct(event.time, measured[0], measured[1], measured[2]);
+            velocityOnly.correct(event.time, measured[0], measured[1],
+                                 measured[2]);
+            memcpy(lastTrack, measured, sizeof(lastTrack));
+            haveTrack = true;
+        }
+
+        if(!fused.count)
+        {
+            printf("Controller %d: no tracked frames from camera %d.\n", c,
+                   camera);
+            continue;
+        }
+        checked++;
+        printf("Controller %d: %d of %d tracked frames held back\n", c,
+               fused.count, tracks);
+        printf("  %-18s %8s %8s %8s %8s  (RMS cm)\n", "", "x", "y", "z", "3D");
+        double lastError = printError("last tracker", last);
+        printError("fusion, no accel", plain);
+        double fusedError = printError("fusion", fused);
+        if(fusedError > lastError)
+        {
+            printf("  The fusion is worse than the last tracker position, check fusion_align.\n");
+            worse = true;
+        }
+        if(fusedLate.count)
+        {
+            char name[32];
+            sprintf(name, "last tracker +%.0fms", late * 1000.0);
+            double lastLateError = printError(name, lastLate);
+            sprintf(name, "fusion +%.0fms", late * 1000.0);
+            if(printError(name, fusedLate) > lastLateError)
+            {
+                printf("  The fusion is worse than the last tracker position with late corrections.\n");
+                worse = true;
+            }
+        }
+    }
+    if(!checked)
+    {
+        printf("Nothing to check in %s.\n", file);
+        return 2;
+    }
+    return worse ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#include "haptics.h"
+
+#include <cstdlib>
+
+bool parseHapticPattern(const char * text, int & id, HapticPattern & pattern)
+{
+    char * end;
+    id = strtol(text, &end, 10);
+    if(end == text || id < 0 || id >= HAPTIC_MAX_PATTERNS)
+    {
+        return false;
+    }
+    text = end;
+    pattern.repeat = strtol(text, &end, 10);
+    if(end == text || pattern.repeat < -1)
+    {
+        return false;
+    }
+    text = end;
+
+    pattern.points = 0;
+    while(pattern.points < HAPTIC_MAX_POINTS)
+    {
+        HapticPoint & p = pattern.point[pattern.points];
+        p.time = strtol(text, &end, 10);
+        if(end == text)
+        {
+            break;
+        }
+        text = end;
+        p.level = strtol(text, &end, 10);
+        if(end == text)
+        {
+            return false;
+        }
+        text = end;
+
+        if(p.time < 0 || p.level < 0 || p.level > 255
+                || (pattern.points > 0 && p.time < pattern.point[pattern.points - 1].time))
+        {
+            return false;
+        }
+        pattern.points++;
+    }
+    // The last point ends the pattern, a pattern that ends at 0 ms would
+    // never be played.
+    return pattern.points > 0 && pattern.point[pattern.points - 1].time > 0;
+}
+
+int hapticLevel(const HapticPattern & pattern, double elapsed)
+{
+    if(pattern.points == 0 || elapsed < 0.0)
+    {
+        return -1;
+    }
+
+    int ms = (int)(elapsed * 1000.0);
+    int length = pattern.point[pattern.points - 1].time;
+    if(ms >= length)
+    {
+        // parseHapticPattern doesn't accept these, they'd never finish a pass.
+        if(length <= 0)
+        {
+            return -1;
+        }
+        int pass = ms / length;
+        if(pattern.repeat >= 0 && pass > pattern.repeat)
+        {
+            return -1;
+        }
+        ms -= pass * length;
+    }
+
+    if(ms < pattern.point[0].time)
+    {
+        return 0;
+    }
+    for(int i = 1; i < pattern.points; i++)
+    {
+        const HapticPoint & a = pattern.point[i - 1];
+        const HapticPoint & b = pattern.point[i];
+        if(ms < b.time)
+        {
+            return a.level + (b.level - a.level) * (ms - a.time) / (b.time - a.time);
+        }
+    }
+    return pattern.point[pattern.points - 1].level;
+}
@@ -0,0 +1,41 @@
+#ifndef HAPTICS_H
+#define HAPTICS_H
+
+#define HAPTIC_MAX_PATTERNS 32
+#define HAPTIC_MAX_POINTS 16
+
+// Rumble level changes inside an envelope are written at most this often,
+// starting and stopping are always written straight away.
+#define HAPTIC_WRITE_INTERVAL 0.02
+
+struct HapticPoint
+{
+        int time; // ms from the start of the pattern
+        int level; // 0 - 255
+};
+
+/**
+ * Rumble envelope, the level is interpolated linearly between the points.
+ **/
+struct HapticPattern
+{
+        int points; // 0 for an empty slot
+        int repeat; // Times the pattern is played again, -1 until stopped.
+        HapticPoint point[HAPTIC_MAX_POINTS];
+};
+
+/**
+ * Parses "<id> <repeat> <ms> <level> [<ms> <level> ...]", the format of the
+ * "h p" client message and of the "haptic" config line. Times must not
+ * decrease and the last one must be after 0 ms. Returns false if the
+ * pattern is malformed.
+ **/
+bool parseHapticPattern(const char * text, int & id, HapticPattern & pattern);
+
+/**
+ * Rumble level of the pattern 'elapsed' seconds after it was triggered,
+ * -1 once it has finished.
+ **/
+int hapticLevel(const HapticPattern & pattern, double elapsed);
+
+#endif
@@ -0,0 +1,186 @@
+#include "latency_stats.h"
+#include "Atomic.hpp"
+#include "Timer.hpp"
+
+#include <cstdio>
+
+static const char * histogramNames[HIST_COUNT] = { "physical", "tracker",
+        "command", "vrpn" };
+
+static const char * counterNames[COUNT_COUNT] = { "physical packets",
+        "tracker packets", "send errors", "polls", "failed polls",
+        "tracking lost", "commands", "vrpn reports", "output reports",
+        "button events", "event retransmits",
+        "unchanged packets", "lost reports", "history refused" };
+
+static LatencyHistogram histograms[HIST_COUNT];
+static volatile int counters[COUNT_COUNT];
+static double statsStart = 0.0;
+
+static inline int highestBit(unsigned int value)
+{
+#ifdef __GNUC__
+    return 31 - __builtin_clz(value);
+#else
+    int bit = 0;
+    while(value >>= 1)
+    {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+int LatencyHistogram::bucketOf(unsigned int micros)
+{
+    if(micros < LATENCY_SUB_BUCKETS)
+    {
+        return micros;
+    }
+    int shift = highestBit(micros) - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS
+            + ((micros >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+unsigned int LatencyHistogram::bucketTop(int bucket)
+{
+    if(bucket < LATENCY_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    unsigned int sub = bucket % LATENCY_SUB_BUCKETS;
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(unsigned long long micros)
+{
+    if(micros > 0x7fffffffULL)
+    {
+        micros = 0x7fffffffULL;
+    }
+    int value = (int)micros;
+    atomicAdd(&_buckets[bucketOf(value)], 1);
+
+    int max = _max;
+    while(value > max)
+    {
+        int previous = atomicCompareExchange(&_max, max, value);
+        if(previous == max)
+        {
+            break;
+        }
+        max = previous;
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for(int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        atomicStore(&_buckets[i], 0);
+    }
+    atomicStore(&_max, 0);
+}
+
+std::string LatencyHistogram::report(const char * name)
+{
+    static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    const int totalPercentiles = sizeof(percentiles) / sizeof(percentiles[0]);
+
+    // Snapshot first so the percentiles agree with the count.
+    unsigned int buckets[LATENCY_BUCKETS];
+    unsigned long long count = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        buckets[i] = (unsigned int)atomicLoad(&_buckets[i]);
+        count += buckets[i];
+    }
+    unsigned int max = (unsigned int)atomicLoad(&_max);
+
+    char line[256];
+    if(count == 0)
+    {
+        snprintf(line, sizeof(line), "  %-9s no samples\n", name);
+        return line;
+    }
+
+    double values[totalPercentiles];
+    int p = 0;
+    unsigned long long seen = 0;
+    for(int i = 0; i < LATENCY_BUCKETS && p < totalPercentiles; i++)
+    {
+        seen += buckets[i];
+        while(p < totalPercentiles && seen >= percentiles[p] * count)
+        {
+            // Upper edge of the bucket, never more than the real max.
+            unsigned int top = bucketTop(i);
+            values[p++] = (top < max ? top : max) / 1000.0;
+        }
+    }
+
+    snprintf(line, sizeof(line),
+             "  %-9s %9llu  p50 %7.3f  p90 %7.3f  p99 %7.3f  p99.9 %7.3f  max %7.3f ms\n",
+             name, count, values[0], values[1], values[2], values[3],
+             max / 1000.0);
+    return line;
+}
+
+void statsRecord(int histogram, unsigned long long micros)
+{
+    histograms[histogram].record(micros);
+}
+
+void statsRecordSince(int histogram, double start)
+{
+    double seconds = getTime() - start;
+    histograms[histogram].record(seconds > 0.0 ?
+            (unsigned long long)(seconds * 1000000.0) : 0);
+}
+
+void statsCount(int counter, int amount)
+{
+    atomicAdd(&counters[counter], amount);
+}
+
+void statsReset()
+{
+    for(int i = 0; i < HIST_COUNT; i++)
+    {
+        histograms[i].reset();
+    }
+    for(int i = 0; i < COUNT_COUNT; i++)
+    {
+        atomicStore(&counters[i], 0);
+    }
+    statsStart = getTime();
+}
+
+std::string statsReport()
+{
+    char line[256];
+    std::string out;
+
+    double elapsed = getTime() - statsStart;
+    snprintf(line, sizeof(line), "Latency over %.2f s:\n", elapsed);
+    out += line;
+    for(int i = 0; i < HIST_COUNT; i++)
+    {
+        out += histograms[i].report(histogramNames[i]);
+    }
+
+    out += "Counters:\n";
+    for(int i = 0; i < COUNT_COUNT; i++)
+    {
+        unsigned int value = (unsigned int)atomicLoad(&counters[i]);
+        snprintf(line, sizeof(line), "  %-16s %10u  (%.1f/s)\n",
+                 counterNames[i], value, elapsed > 0.0 ? value / elapsed : 0.0);
+        out += line;
+    }
+    return out;
+}
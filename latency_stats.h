@@ -0,0 +1,78 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <string>
+
+/**
+ * Latencies measured through the server, in microseconds.
+ **/
+enum StatHistogram
+{
+    HIST_PHYSICAL = 0, // psmove_poll to sendto of the "a" packet
+    HIST_TRACKER, // Camera image grabbed to sendto of the "b" packet
+    HIST_COMMAND, // "d" message received to applied by the physical thread
+    HIST_VRPN, // MoveState updated to report_pose
+    HIST_COUNT
+};
+
+enum StatCounter
+{
+    COUNT_PHYSICAL_PACKETS = 0, // "a" and "f" packets sent
+    COUNT_TRACKER_PACKETS, // "b" packets sent
+    COUNT_SEND_ERRORS, // sendto failures of either
+    COUNT_POLLS,
+    COUNT_FAILED_POLLS, // psmove_poll returned no new data
+    COUNT_TRACKING_LOST, // A tracked controller dropped out of every camera
+    COUNT_COMMANDS, // "d" messages received
+    COUNT_VRPN_REPORTS,
+    COUNT_OUTPUT_REPORTS, // LED and rumble writes to the controllers
+    COUNT_EVENTS, // Button and trigger edges
+    COUNT_EVENT_RETRANSMITS, // "e" packets sent again for lack of an ack
+    COUNT_SUPPRESSED, // Stream packets not sent to a subscriber, unchanged
+    COUNT_LOST_REPORTS, // Controller reports replaced before a poll read them, simulated backend only
+    COUNT_HISTORY_REFUSED, // "g" requests from non-subscribers or over history_rate
+    COUNT_COUNT
+};
+
+// Sub-buckets per power of two, the resolution is 1/16 of the value.
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+// Values are clamped to 2^31 us, about 36 minutes.
+#define LATENCY_BUCKETS ((32 - LATENCY_SUB_BITS) * LATENCY_SUB_BUCKETS)
+
+/**
+ * Log-linear latency histogram (as HdrHistogram): exact below 16 us, then
+ * 16 buckets per power of two. Any thread can record without a lock; a
+ * report taken meanwhile may be off by the samples in flight.
+ **/
+class LatencyHistogram
+{
+    public:
+        LatencyHistogram();
+
+        void record(unsigned long long micros);
+        void reset();
+
+        // Count, percentiles and max in ms on one line.
+        std::string report(const char * name);
+
+    protected:
+        static int bucketOf(unsigned int micros);
+        // Highest value that falls in the bucket.
+        static unsigned int bucketTop(int bucket);
+
+        volatile int _buckets[LATENCY_BUCKETS];
+        volatile int _max;
+};
+
+/**
+ * Server wide statistics, shared by every thread.
+ **/
+void statsRecord(int histogram, unsigned long long micros);
+// Same, for a start time taken with getTime().
+void statsRecordSince(int histogram, double start);
+void statsCount(int counter, int amount = 1);
+void statsReset();
+std::string statsReport();
+
+#endif
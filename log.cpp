@@ -0,0 +1,254 @@
+#include "log.h"
+#include "Atomic.hpp"
+#include "RingBuffer.hpp"
+#include "Thread.hpp"
+#include "Timer.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define LOG_MESSAGE_SIZE 200
+// Messages per thread waiting for the sink.
+#define LOG_QUEUE_SIZE 256
+#define LOG_SINK_INTERVAL_MS 20
+
+struct LogEntry
+{
+        double time;
+        int level;
+        int suppressed; // Messages of the same site dropped before this one.
+        const char * thread;
+        char text[LOG_MESSAGE_SIZE];
+};
+
+/**
+ * One thread's messages, only that thread pushes.
+ **/
+struct LogQueue
+{
+        LogQueue() :
+                entries(LOG_QUEUE_SIZE)
+        {
+            dropped = 0;
+        }
+
+        RingBuffer<LogEntry> entries;
+        volatile int dropped;
+};
+
+/**
+ * Writes the queued messages of every thread.
+ **/
+class LogSink : public Thread
+{
+    public:
+        virtual void run();
+};
+
+static volatile int logLevel = LOG_INFO;
+static double logStartTime = getTime();
+
+static Mutex queuesMutex;
+static std::vector<LogQueue *> queues;
+static LogSink * sink = NULL;
+static volatile int sinkRunning = 0;
+static FILE * logOut = NULL;
+
+static THREAD_LOCAL LogQueue * threadQueue = NULL;
+
+static const char levelLetters[] = { 'D', 'I', 'W', 'E' };
+
+static void writeEntry(const LogEntry & entry)
+{
+    FILE * out = logOut ? logOut : stderr;
+    int level = entry.level < LOG_DEBUG || entry.level > LOG_ERROR
+            ? LOG_ERROR : entry.level;
+    fprintf(out, "%9.3f %c %-12s %s", entry.time - logStartTime,
+            levelLetters[level], entry.thread ? entry.thread : "main",
+            entry.text);
+    if(entry.suppressed)
+    {
+        fprintf(out, " (%d similar messages suppressed)", entry.suppressed);
+    }
+    fputc('\n', out);
+}
+
+// Writes everything queued, returns false if there was nothing.
+static bool drainQueues()
+{
+    bool wrote = false;
+    LogEntry entry;
+
+    // Queues are never removed. Writing happens unlocked so a thread
+    // adding its queue never waits on the console.
+    queuesMutex.lock();
+    std::vector<LogQueue *> current = queues;
+    queuesMutex.unlock();
+
+    for(size_t i = 0; i < current.size(); i++)
+    {
+        while(current[i]->entries.pop(entry))
+        {
+            writeEntry(entry);
+            wrote = true;
+        }
+        int dropped = atomicExchange(&current[i]->dropped, 0);
+        if(dropped)
+        {
+            entry.time = getTime();
+            entry.level = LOG_WARNING;
+            entry.suppressed = 0;
+            entry.thread = "log";
+            snprintf(entry.text, sizeof(entry.text),
+                     "%d messages dropped, the log couldn't keep up.",
+                     dropped);
+            writeEntry(entry);
+            wrote = true;
+        }
+    }
+    if(wrote)
+    {
+        fflush(logOut ? logOut : stderr);
+    }
+    return wrote;
+}
+
+void LogSink::run()
+{
+    nameCurrentThread("log");
+    lowerCurrentPriority();
+    while(1)
+    {
+        if(!drainQueues())
+        {
+#ifdef WIN32
+            Sleep(LOG_SINK_INTERVAL_MS);
+#else
+            usleep(LOG_SINK_INTERVAL_MS * 1000);
+#endif
+        }
+
+        _quitMutex->lock();
+        if(_quit)
+        {
+            _quitMutex->unlock();
+            break;
+        }
+        _quitMutex->unlock();
+    }
+    drainQueues();
+}
+
+void logWrite(LogSite & site, int level, const char * format, ...)
+{
+    if(level < logLevel)
+    {
+        return;
+    }
+
+    LogEntry entry;
+    entry.time = getTime();
+    entry.suppressed = 0;
+
+    // The first message of a new second resets the count and reports what
+    // the last second suppressed.
+    int window = (int)entry.time;
+    int old = atomicLoad(&site.window);
+    if(old != window
+            && atomicCompareExchange(&site.window, old, window) == old)
+    {
+        atomicStore(&site.count, 0);
+        entry.suppressed = atomicExchange(&site.suppressed, 0);
+    }
+    if(atomicAdd(&site.count, 1) > LOG_RATE_LIMIT)
+    {
+        atomicAdd(&site.suppressed, 1);
+        return;
+    }
+
+    entry.level = level;
+    entry.thread = Thread::currentName();
+    va_list args;
+    va_start(args, format);
+    vsnprintf(entry.text, sizeof(entry.text), format, args);
+    va_end(args);
+
+    if(!atomicLoad(&sinkRunning))
+    {
+        queuesMutex.lock();
+        writeEntry(entry);
+        fflush(logOut ? logOut : stderr);
+        queuesMutex.unlock();
+        return;
+    }
+
+    LogQueue * queue = threadQueue;
+    if(!queue)
+    {
+        queue = threadQueue = new LogQueue();
+        queuesMutex.lock();
+        queues.push_back(queue);
+        queuesMutex.unlock();
+    }
+    if(!queue->entries.push(entry))
+    {
+        atomicAdd(&queue->dropped, 1);
+    }
+}
+
+void logSetLevel(int level)
+{
+    atomicStore(&logLevel, level);
+}
+
+int logParseLevel(const char * name)
+{
+    const char * names[] = { "debug", "info", "warning", "error" };
+    for(int i = LOG_DEBUG; i <= LOG_ERROR; i++)
+    {
+        if(strcmp(name, names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool logStart(const std::string & file)
+{
+    if(sink)
+    {
+        return true;
+    }
+    bool opened = true;
+    if(!file.empty())
+    {
+        logOut = fopen(file.c_str(), "a");
+        opened = logOut != NULL;
+    }
+    sink = new LogSink();
+    atomicStore(&sinkRunning, 1);
+    sink->startThread();
+    return opened;
+}
+
+void logStop()
+{
+    if(!sink)
+    {
+        return;
+    }
+    // Later messages are written directly again.
+    atomicStore(&sinkRunning, 0);
+    sink->join();
+    delete sink;
+    sink = NULL;
+    drainQueues();
+    if(logOut)
+    {
+        fclose(logOut);
+        logOut = NULL;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <string>
+
+enum LogLevel
+{
+    LOG_DEBUG = 0,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR
+};
+
+// Messages from one call site beyond this many a second are suppressed,
+// the next one that gets through says how many were.
+#define LOG_RATE_LIMIT 10
+
+/**
+ * Rate limit state of one LOG() call site.
+ **/
+struct LogSite
+{
+        volatile int window; // Second the count belongs to.
+        volatile int count;
+        volatile int suppressed;
+};
+
+/**
+ * Server threads never write to the console themselves: LOG() formats the
+ * message into the calling thread's own lock-free queue and a sink thread
+ * writes the queues out to stderr or the log file. A full queue drops
+ * messages (counted) instead of waiting. Before logStart() and after
+ * logStop() messages are written straight away.
+ **/
+#define LOG(level, ...) \
+    do \
+    { \
+        static LogSite logSite; \
+        logWrite(logSite, level, __VA_ARGS__); \
+    } while(0)
+
+void logWrite(LogSite & site, int level, const char * format, ...);
+
+// Messages below the level are discarded.
+void logSetLevel(int level);
+// Parses "debug", "info", "warning" or "error", -1 if unknown.
+int logParseLevel(const char * name);
+
+// Starts the sink thread, writing to 'file' or stderr if empty.
+bool logStart(const std::string & file);
+// Writes out what is queued and stops the sink.
+void logStop();
+
+#endif
@@ -0,0 +1,342 @@
+#include "mjpeg_stream.h"
+#include "Atomic.hpp"
+#include "Timer.hpp"
+
+#include <opencv2/imgproc/imgproc_c.h>
+#include <opencv2/highgui/highgui_c.h>
+
+#include <cstring>
+
+#ifdef WIN32
+#define closesocket_compat closesocket
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#define closesocket_compat close
+#define INVALID_SOCKET -1
+#endif
+
+#define STREAM_BOUNDARY "moveserverframe"
+
+// True if a failed send only means the socket buffer is full.
+static bool sendWouldBlock()
+{
+#ifdef WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+void defaultDebugStreamSettings(DebugStreamSettings & settings)
+{
+    settings.port = 0;
+    settings.address = "127.0.0.1";
+    settings.camera = 0;
+    settings.fps = 10.0f;
+    settings.scale = 0.5f;
+    settings.quality = 70;
+    settings.budget = 0.05f;
+}
+
+MjpegStream::MjpegStream(const DebugStreamSettings & settings) :
+        Thread()
+{
+    _settings = settings;
+    if(_settings.fps <= 0.0f)
+    {
+        _settings.fps = 1.0f;
+    }
+    if(_settings.budget <= 0.0f)
+    {
+        _settings.budget = 0.01f;
+    }
+    _scaled = NULL;
+    _listenSocket = INVALID_SOCKET;
+    _viewers = 0;
+    _lastPublish = 0.0;
+    _intervalMicros = (int)(1000000.0f / _settings.fps);
+}
+
+MjpegStream::~MjpegStream()
+{
+    for(size_t i = 0; i < _clients.size(); i++)
+    {
+        closesocket_compat(_clients[i]);
+    }
+    if(_listenSocket != INVALID_SOCKET)
+    {
+        closesocket_compat(_listenSocket);
+    }
+    if(_scaled)
+    {
+        cvReleaseImage(&_scaled);
+    }
+}
+
+bool MjpegStream::open()
+{
+    SOCKADDR_IN address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(_settings.port);
+    if(inet_pton(AF_INET, _settings.address.c_str(), &address.sin_addr) != 1)
+    {
+        printf("Debug stream: invalid address %s\n", _settings.address.c_str());
+        return false;
+    }
+
+    _listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(_listenSocket == INVALID_SOCKET)
+    {
+        printf("Debug stream: error creating socket\n");
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
+               sizeof(reuse));
+    if(bind(_listenSocket, (SOCKADDR *)&address, sizeof(address)) < 0
+            || listen(_listenSocket, 4) < 0)
+    {
+        printf("Debug stream: can't listen on %s:%d\n",
+               _settings.address.c_str(), _settings.port);
+        closesocket_compat(_listenSocket);
+        _listenSocket = INVALID_SOCKET;
+        return false;
+    }
+    printf("Debug stream of camera %d: http://%s:%d/\n", _settings.camera,
+           _settings.address.c_str(), _settings.port);
+    return true;
+}
+
+bool MjpegStream::wantsFrame(int camera, double now)
+{
+    if(camera != _settings.camera || atomicLoad(&_viewers) == 0)
+    {
+        return false;
+    }
+    if(now - _lastPublish < atomicLoad(&_intervalMicros) * 0.000001)
+    {
+        return false;
+    }
+    _lastPublish = now;
+    return true;
+}
+
+void MjpegStream::publish(const IplImage * image, int camera,
+                          unsigned int number,
+                          const std::vector<TrackedController> & controllers)
+{
+    _buffer.publish(image, camera, number, controllers);
+}
+
+void MjpegStream::acceptClient()
+{
+    SOCKET client = accept(_listenSocket, NULL, NULL);
+    if(client == INVALID_SOCKET)
+    {
+        return;
+    }
+    // Never let a slow viewer block the stream thread, it skips frames instead.
+#ifdef WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(client, FIONBIO, &nonBlocking);
+#else
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+#endif
+    _clients.push_back(client);
+    _streaming.push_back(0);
+    _pending.push_back(std::string());
+}
+
+void MjpegStream::dropClient(size_t i)
+{
+    closesocket_compat(_clients[i]);
+    _clients.erase(_clients.begin() + i);
+    if(_streaming[i])
+    {
+        atomicAdd(&_viewers, -1);
+    }
+    _streaming.erase(_streaming.begin() + i);
+    _pending.erase(_pending.begin() + i);
+}
+
+// Sends what the client's socket will take of its pending data. Returns
+// false if the client was dropped.
+bool MjpegStream::flushClient(size_t i)
+{
+    std::string & pending = _pending[i];
+    while(!pending.empty())
+    {
+        int n = send(_clients[i], pending.data(), (int)pending.size(), 0);
+        if(n > 0)
+        {
+            pending.erase(0, n);
+        }
+        else if(n < 0 && sendWouldBlock())
+        {
+            break;
+        }
+        else
+        {
+            dropClient(i);
+            return false;
+        }
+    }
+    return true;
+}
+
+void MjpegStream::readClient(size_t i)
+{
+    // Whatever was asked for, the answer is the stream.
+    char request[1024];
+    int n = recv(_clients[i], request, sizeof(request), 0);
+    if(n <= 0)
+    {
+        dropClient(i);
+        return;
+    }
+    if(_streaming[i])
+    {
+        return;
+    }
+
+    const char * header = "HTTP/1.0 200 OK\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: close\r\n"
+            "Content-Type: multipart/x-mixed-replace; boundary=" STREAM_BOUNDARY "\r\n"
+            "\r\n";
+    _pending[i] = header;
+    _streaming[i] = 1;
+    atomicAdd(&_viewers, 1);
+    flushClient(i);
+}
+
+void MjpegStream::sendFrame(const unsigned char * data, int size)
+{
+    char header[128];
+    int headerLength = sprintf(header, "--" STREAM_BOUNDARY "\r\n"
+                               "Content-Type: image/jpeg\r\n"
+                               "Content-Length: %d\r\n\r\n", size);
+
+    for(size_t i = _clients.size(); i-- > 0;)
+    {
+        // A viewer still busy with the last frame skips this one, parts are
+        // only ever sent whole.
+        if(!_streaming[i] || !_pending[i].empty())
+        {
+            continue;
+        }
+        std::string & part = _pending[i];
+        part.reserve(headerLength + size + 2);
+        part.append(header, headerLength);
+        part.append((const char *)data, size);
+        part.append("\r\n", 2);
+        flushClient(i);
+    }
+}
+
+void MjpegStream::run()
+{
+    nameCurrentThread("debug stream");
+    lowerCurrentPriority();
+
+    int params[3] = { CV_IMWRITE_JPEG_QUALITY, _settings.quality, 0 };
+    double minInterval = 1.0 / _settings.fps;
+
+    while(1)
+    {
+        fd_set rdset, wrset;
+        FD_ZERO(&rdset);
+        FD_ZERO(&wrset);
+        FD_SET(_listenSocket, &rdset);
+        SOCKET maxSocket = _listenSocket;
+        for(size_t i = 0; i < _clients.size(); i++)
+        {
+            FD_SET(_clients[i], &rdset);
+            if(!_pending[i].empty())
+            {
+                FD_SET(_clients[i], &wrset);
+            }
+            if(_clients[i] > maxSocket)
+            {
+                maxSocket = _clients[i];
+            }
+        }
+
+        // Wake at the frame rate while streaming, otherwise only for quit.
+        timeval timeout;
+        double wait = atomicLoad(&_viewers) ? minInterval * 0.5 : 0.1;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = (long)(wait * 1000000.0);
+        if(select((int)maxSocket + 1, &rdset, &wrset, NULL, &timeout) > 0)
+        {
+            for(size_t i = _clients.size(); i-- > 0;)
+            {
+                // Flushed first, readClient can drop the client.
+                if(FD_ISSET(_clients[i], &wrset) && !flushClient(i))
+                {
+                    continue;
+                }
+                if(FD_ISSET(_clients[i], &rdset))
+                {
+                    readClient(i);
+                }
+            }
+            if(FD_ISSET(_listenSocket, &rdset))
+            {
+                acceptClient();
+            }
+        }
+
+        ViewerFrame * frame = atomicLoad(&_viewers) ? _buffer.acquire() : NULL;
+        if(frame)
+        {
+            double start = getTime();
+
+            annotateViewerFrame(*frame);
+            CvSize size = cvSize((int)(frame->image->width * _settings.scale),
+                                 (int)(frame->image->height * _settings.scale));
+            if(size.width < 1 || size.height < 1)
+            {
+                size = cvGetSize(frame->image);
+            }
+            if(_scaled && (_scaled->width != size.width
+                    || _scaled->height != size.height
+                    || _scaled->nChannels != frame->image->nChannels))
+            {
+                cvReleaseImage(&_scaled);
+            }
+            if(!_scaled)
+            {
+                _scaled = cvCreateImage(size, frame->image->depth,
+                                        frame->image->nChannels);
+            }
+            cvResize(frame->image, _scaled, CV_INTER_AREA);
+
+            CvMat * jpeg = cvEncodeImage(".jpg", _scaled, params);
+            if(jpeg)
+            {
+                sendFrame(jpeg->data.ptr, jpeg->cols * jpeg->rows);
+                cvReleaseMat(&jpeg);
+            }
+
+            // Keep encoding within its share of a core by lowering the rate.
+            double spent = getTime() - start;
+            double interval = spent / _settings.budget;
+            atomicStore(&_intervalMicros, (int)(1000000.0
+                    * (interval > minInterval ? interval : minInterval)));
+        }
+
+        _quitMutex->lock();
+        if(_quit)
+        {
+            _quitMutex->unlock();
+            break;
+        }
+        _quitMutex->unlock();
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef MJPEG_STREAM_H
+#define MJPEG_STREAM_H
+
+#include "Thread.hpp"
+#include "move_udp_server.h"
+#include "frame_triple_buffer.h"
+
+#include <opencv2/core/core_c.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * Config for the debug stream, all 'debug_stream_*' keys.
+ **/
+struct DebugStreamSettings
+{
+        int port; // 0 disables the stream.
+        std::string address; // Interface to listen on.
+        int camera;
+        float fps;
+        float scale; // Image size relative to the camera.
+        int quality; // JPEG quality, 0-100.
+        float budget; // Share of one core encoding may use.
+};
+
+void defaultDebugStreamSettings(DebugStreamSettings & settings);
+
+/**
+ * Serves the annotated view of one camera as an MJPEG stream over HTTP
+ * (multipart/x-mixed-replace, viewable in a browser), for hosts without a
+ * display.
+ *
+ * The capture stage hands over frames through a FrameTripleBuffer and only
+ * while a viewer is connected, at most at the stream rate. Downscaling and
+ * encoding happen on this thread at low priority, and the rate is lowered
+ * further if encoding would use more than the budget.
+ **/
+class MjpegStream : public Thread
+{
+    public:
+        MjpegStream(const DebugStreamSettings & settings);
+        virtual ~MjpegStream();
+
+        bool open();
+        virtual void run();
+
+        // Capture stage side. True if this camera's frame is wanted now.
+        bool wantsFrame(int camera, double now);
+        void publish(const IplImage * image, int camera, unsigned int number,
+                     const std::vector<TrackedController> & controllers);
+
+    protected:
+        void acceptClient();
+        void readClient(size_t i);
+        void sendFrame(const unsigned char * data, int size);
+        bool flushClient(size_t i);
+        void dropClient(size_t i);
+
+        DebugStreamSettings _settings;
+        FrameTripleBuffer _buffer;
+        IplImage * _scaled;
+
+        SOCKET _listenSocket;
+        std::vector<SOCKET> _clients;
+        std::vector<int> _streaming; // Client has sent its request and gets frames.
+        // What the socket hasn't taken yet of the client's last part. A
+        // client with something pending skips frames until it catches up.
+        std::vector<std::string> _pending;
+
+        volatile int _viewers; // Read by the capture stage.
+        volatile int _intervalMicros; // Between frames, raised when over budget.
+        double _lastPublish; // Owned by the capture stage.
+};
+
+#endif
@@ -0,0 +1,286 @@
+/**
+ * Lifecycle check of the ControllerMonitor on the simulated backend.
+ *
+ * Controllers are plugged in and out of a simulated bus, one of them paired
+ * over USB and Bluetooth at once so it is counted twice. This program
+ * plays the physical and tracking threads: it keeps the controllers on the
+ * bus polling, acknowledges retiring ones and calibrates connecting ones.
+ * The monitor is stepped with made up times, so the check runs in no time.
+ * It fails if
+ *   - a controller doesn't get a slot, or the wrong one, or gets two,
+ *   - a controller that was unplugged isn't retired and disconnected,
+ *   - the monitor opens controllers while nothing on the bus changes,
+ *   - a controller handle is leaked.
+ *
+ * monitor_check
+ *
+ * Exits with 1 if a check fails.
+ **/
+
+#include "controller_monitor.h"
+#include "simulated_backend.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// Normally defined by move_udp_server.cpp.
+MoveBackend * moveBackend = NULL;
+Mutex * controllerMutex = NULL;
+
+#define CHECK_SLOTS 2
+#define CHECK_TIMEOUT 1.0
+#define CHECK_INTERVAL 0.5
+
+/**
+ * Simulated controllers that come and go. Each entry of the bus is one
+ * enumeration id and holds the simulated controller it opens, the same
+ * controller can be on the bus twice.
+ **/
+class LifecycleBackend : public SimulatedBackend
+{
+    public:
+        LifecycleBackend(const SimulationSettings & settings) :
+                SimulatedBackend(settings), connects(0)
+        {
+        }
+
+        virtual int countConnected()
+        {
+            return (int)bus.size();
+        }
+
+        virtual PSMove * connect(int id)
+        {
+            if(id < 0 || id >= (int)bus.size())
+            {
+                return NULL;
+            }
+            connects++;
+            PSMove * move = SimulatedBackend::connect(bus[id]);
+            if(move)
+            {
+                open[move] = bus[id];
+            }
+            return move;
+        }
+
+        virtual void disconnect(PSMove * move)
+        {
+            open.erase(move);
+            SimulatedBackend::disconnect(move);
+        }
+
+        void plug(int controller)
+        {
+            bus.push_back(controller);
+        }
+
+        void unplug(int controller)
+        {
+            for(size_t i = 0; i < bus.size(); )
+            {
+                if(bus[i] == controller)
+                {
+                    bus.erase(bus.begin() + i);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+
+        bool onBus(PSMove * move)
+        {
+            std::map<PSMove *, int>::iterator it = open.find(move);
+            if(it == open.end())
+            {
+                return false;
+            }
+            for(size_t i = 0; i < bus.size(); i++)
+            {
+                if(bus[i] == it->second)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::vector<int> bus;
+        std::map<PSMove *, int> open; // Handles not disconnected yet.
+        int connects;
+};
+
+// Gives the check access to step().
+class CheckedMonitor : public ControllerMonitor
+{
+    public:
+        CheckedMonitor(PMONITORDATA data) :
+                ControllerMonitor(data)
+        {
+        }
+
+        void check(double now)
+        {
+            step(now);
+        }
+};
+
+static bool failed = false;
+
+static void expect(bool ok, const char * what)
+{
+    if(!ok)
+    {
+        printf("FAILED: %s\n", what);
+        failed = true;
+    }
+}
+
+// What the other threads do between two monitor passes.
+static void serve(LifecycleBackend & backend, MONITORDATA & data, double now)
+{
+    unsigned int allCameras = (1u << data.totalCameras) - 1;
+    for(int c = 0; c < data.totalSlots; c++)
+    {
+        ControllerData & slot = data.controllerData[c];
+        if(slot.slotState == SLOT_ACTIVE && backend.onBus(data.controllers[c]))
+        {
+            slot.lastPoll = now;
+        }
+        else if(slot.slotState == SLOT_RETIRING)
+        {
+            slot.released = data.releaseCount;
+        }
+        else if(slot.slotState == SLOT_CONNECTING)
+        {
+            slot.trackerDone = allCameras;
+        }
+    }
+}
+
+// Runs the monitor for 'seconds' and returns how many controllers it opened.
+static int run(CheckedMonitor & monitor, LifecycleBackend & backend,
+               MONITORDATA & data, double & now, double seconds)
+{
+    int connects = backend.connects;
+    for(double end = now + seconds; now < end; now += CHECK_INTERVAL)
+    {
+        serve(backend, data, now);
+        monitor.check(now);
+    }
+    return backend.connects - connects;
+}
+
+// The simulated controller in 'slot', -1 if it's empty.
+static int slotController(LifecycleBackend & backend, MONITORDATA & data,
+                          int slot)
+{
+    PSMove * move = data.controllers[slot];
+    if(!move || data.controllerData[slot].slotState != SLOT_ACTIVE)
+    {
+        return -1;
+    }
+    return backend.open[move];
+}
+
+static bool leaked(LifecycleBackend & backend, MONITORDATA & data)
+{
+    size_t used = 0;
+    for(int c = 0; c < data.totalSlots; c++)
+    {
+        if(data.controllers[c])
+        {
+            used++;
+        }
+    }
+    return backend.open.size() != used;
+}
+
+int main(int argc, char * argv[])
+{
+    if(argc > 1)
+    {
+        printf("monitor_check\n");
+        return 2;
+    }
+
+    SimulationSettings settings;
+    defaultSimulationSettings(settings);
+    settings.controllers = 4;
+    LifecycleBackend backend(settings);
+    moveBackend = &backend;
+    controllerMutex = new Mutex();
+
+    PSMove * controllers[CHECK_SLOTS];
+    ControllerData controllerData[CHECK_SLOTS];
+    memset(controllers, 0, sizeof(controllers));
+    memset(controllerData, 0, sizeof(controllerData));
+    MONITORDATA data;
+    data.totalSlots = CHECK_SLOTS;
+    data.controllers = controllers;
+    data.controllerData = controllerData;
+    data.totalCameras = 1;
+    data.releaseCount = 3;
+    data.timeout = CHECK_TIMEOUT;
+
+    // Controller 0 on Bluetooth and USB, connected at startup like the
+    // server does.
+    backend.plug(0);
+    backend.plug(0);
+    controllers[0] = backend.connect(0);
+    controllerData[0].slotState = SLOT_ACTIVE;
+    double now = 100.0;
+    controllerData[0].lastPoll = now;
+
+    CheckedMonitor monitor(&data);
+
+    printf("Controller 0 counted twice.\n");
+    expect(run(monitor, backend, data, now, 10.0) == 0,
+           "controllers were opened while nothing changed");
+    expect(slotController(backend, data, 0) == 0, "controller 0 lost its slot");
+    expect(!controllers[1], "controller 0 took a second slot");
+
+    printf("Controller 1 plugged in.\n");
+    backend.plug(1);
+    run(monitor, backend, data, now, 2.0);
+    expect(slotController(backend, data, 1) == 1, "controller 1 has no slot");
+    expect(run(monitor, backend, data, now, 10.0) == 0,
+           "controllers were opened after controller 1 was connected");
+
+    printf("Controller 2 plugged in, no free slot.\n");
+    backend.plug(2);
+    run(monitor, backend, data, now, 2.0);
+    expect(run(monitor, backend, data, now, 10.0) == 0,
+           "controllers were opened while every slot was used");
+
+    printf("Controller 0 unplugged.\n");
+    backend.unplug(0);
+    run(monitor, backend, data, now, CHECK_TIMEOUT + 3.0);
+    expect(slotController(backend, data, 0) == 2,
+           "controller 2 didn't get the slot controller 0 left");
+    expect(slotController(backend, data, 1) == 1, "controller 1 lost its slot");
+    expect(run(monitor, backend, data, now, 10.0) == 0,
+           "controllers were opened after controller 2 was connected");
+
+    printf("Controller 1 unplugged.\n");
+    backend.unplug(1);
+    run(monitor, backend, data, now, CHECK_TIMEOUT + 3.0);
+    expect(!controllers[1], "controller 1 wasn't disconnected");
+
+    printf("Controller 0 plugged in again.\n");
+    backend.plug(0);
+    run(monitor, backend, data, now, 2.0);
+    expect(slotController(backend, data, 1) == 0,
+           "controller 0 didn't get the free slot");
+    expect(run(monitor, backend, data, now, 10.0) == 0,
+           "controllers were opened after controller 0 came back");
+
+    expect(!leaked(backend, data), "a controller handle was leaked");
+    printf("%d controllers opened in all.\n", backend.connects);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
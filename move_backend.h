@@ -0,0 +1,131 @@
+#ifndef MOVE_BACKEND_H
+#define MOVE_BACKEND_H
+
+#include <psmoveapi/psmove.h>
+#include <psmoveapi/psmove_tracker.h>
+
+/**
+ * Everything the server asks of the controllers and cameras. The methods
+ * mirror the psmoveapi calls they replace; PSMove and PSMoveTracker are
+ * opaque handles owned by the backend that created them.
+ *
+ * PSMoveApiBackend talks to real hardware, SimulatedBackend makes up
+ * controllers and cameras so the server can run (and be benchmarked)
+ * without any.
+ **/
+class MoveBackend
+{
+    public:
+        virtual ~MoveBackend()
+        {
+        }
+
+        virtual bool init() = 0;
+        virtual void shutdown() = 0;
+        virtual const char * name() = 0;
+
+        // False if the backend paces itself (a replay), the physical thread
+        // then polls without sleeping.
+        virtual bool realtime()
+        {
+            return true;
+        }
+
+        // True once there is nothing more to come, the server then exits.
+        virtual bool finished()
+        {
+            return false;
+        }
+
+        // Hands out client commands the backend wants handled as if they had
+        // arrived over UDP. Returns false if none is due.
+        virtual bool takeCommand(char * message, int size)
+        {
+            return false;
+        }
+
+        // ----- Controllers -----
+        virtual int countConnected() = 0;
+        virtual PSMove * connect(int id) = 0;
+        virtual void disconnect(PSMove * move) = 0;
+        virtual enum PSMove_Connection_Type connectionType(PSMove * move) = 0;
+        // Caller frees the result, may be NULL.
+        virtual char * getSerial(PSMove * move) = 0;
+        virtual void enableOrientation(PSMove * move) = 0;
+        virtual bool hasOrientation(PSMove * move) = 0;
+        virtual void resetOrientation(PSMove * move) = 0;
+
+        // Returns 0 if there is no new data.
+        virtual int poll(PSMove * move) = 0;
+        virtual unsigned int getButtons(PSMove * move) = 0;
+        virtual int getTrigger(PSMove * move) = 0;
+        virtual void getAccelerometer(PSMove * move, float * x, float * y,
+                                      float * z) = 0;
+        virtual void getGyroscope(PSMove * move, float * x, float * y,
+                                  float * z) = 0;
+        virtual void getMagnetometer(PSMove * move, float * x, float * y,
+                                     float * z) = 0;
+        virtual void getOrientation(PSMove * move, float * w, float * x,
+                                    float * y, float * z) = 0;
+
+        virtual void setLeds(PSMove * move, unsigned char r, unsigned char g,
+                             unsigned char b) = 0;
+        virtual void setRumble(PSMove * move, unsigned char rumble) = 0;
+        virtual void updateLeds(PSMove * move) = 0;
+
+        // ----- Cameras -----
+        // camera -1 opens the default camera.
+        virtual PSMoveTracker * newTracker(int camera) = 0;
+        virtual void freeTracker(PSMoveTracker * tracker) = 0;
+        virtual void getTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings) = 0;
+        virtual void setTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings) = 0;
+        virtual void getTrackerSize(PSMoveTracker * tracker, int * width,
+                                    int * height) = 0;
+
+        virtual enum PSMoveTracker_Status enable(PSMoveTracker * tracker,
+                                                 PSMove * move) = 0;
+        virtual enum PSMoveTracker_Status enableWithColor(
+                PSMoveTracker * tracker, PSMove * move, unsigned char r,
+                unsigned char g, unsigned char b) = 0;
+        virtual void disable(PSMoveTracker * tracker, PSMove * move) = 0;
+        virtual void getColor(PSMoveTracker * tracker, PSMove * move,
+                              unsigned char * r, unsigned char * g,
+                              unsigned char * b) = 0;
+        virtual void setAutoUpdateLeds(PSMoveTracker * tracker, PSMove * move,
+                                       bool enabled) = 0;
+
+        // Grabs the next image, blocks until the camera has one. If the
+        // backend grabs ahead, only makes the image grabImage() kept the
+        // current one; update() and getFrame() only ever see that one.
+        virtual void updateImage(PSMoveTracker * tracker) = 0;
+        // True if the tracker can keep a grabbed image apart from the one
+        // being tracked. grabImage() then blocks until the camera has the
+        // next image and keeps it for updateImage(). It runs on a grab
+        // thread while the capture thread tracks, the two hand off so they
+        // never use the same kept image at once.
+        virtual bool canGrabAhead()
+        {
+            return false;
+        }
+        virtual void grabImage(PSMoveTracker * tracker)
+        {
+        }
+        virtual void update(PSMoveTracker * tracker, PSMove * move) = 0;
+        virtual enum PSMoveTracker_Status getStatus(PSMoveTracker * tracker,
+                                                    PSMove * move) = 0;
+        // Blob centre and radius in pixels.
+        virtual void getPosition(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * radius) = 0;
+        // Position in cm relative to the camera.
+        virtual void getLocation(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * z) = 0;
+        // The last image as an IplImage, owned by the tracker.
+        virtual void * getFrame(PSMoveTracker * tracker) = 0;
+};
+
+// Selected by the "backend" config line, set up before anything is connected.
+extern MoveBackend * moveBackend;
+
+#endif
@@ -0,0 +1,666 @@
+/**
+ * Load generator for the UDP side of a running move_server. Several
+ * clients flood 'd' commands at RECV_PORT in steps of increasing rate while
+ * one of them receives the "a"/"b" streams on SEND_PORT. Per step it
+ * reports the command rate achieved and handled, stream loss, reordering
+ * and inter-arrival jitter, and the command to stream latency.
+ *
+ * The latency is measured with probes: commands to controller 0 that set
+ * its LED to a colour encoding the probe number, timed until an "a" packet
+ * carries that colour. Flood commands only touch the rumble, so they don't
+ * disturb the probes.
+ *
+ * With --loss the command flood is replaced by a redundancy test: the
+ * stream client subscribes with each --redundancy depth in turn and drops
+ * received packets at each loss rate (percent). Per step it reports the
+ * stream bandwidth and how many dropped samples were rebuilt from the
+ * redundancy records of later packets.
+ *
+ * move_loadgen [--host addr] [--clients n] [--controllers n]
+ *              [--rates r1,r2,...] [--step s] [--probe hz] [--socket path]
+ *              [--loss p1,p2,...] [--redundancy k1,k2,...]
+ *
+ * The streams are received on SEND_PORT, so run it with no other client on
+ * this machine. --socket reads the server's own command counter from its
+ * control socket. POSIX only.
+ **/
+
+#include "move_udp_server.h"
+#include "bench_client.h"
+#include "Thread.hpp"
+#include "Timer.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct LoadOptions
+{
+        std::string host;
+        int clients;
+        int controllers;
+        std::vector<float> rates; // Commands per second, all clients together.
+        float step; // Seconds per rate.
+        float probe; // Probes per second.
+        std::string socket;
+        std::vector<float> loss; // Percent of packets dropped, redundancy test.
+        std::vector<float> redundancy;
+};
+
+/**
+ * One stream ("a" or "b") as seen over a step.
+ **/
+struct StreamStats
+{
+        unsigned int packets;
+        unsigned int lost; // Sequence numbers skipped, per controller.
+        unsigned int reordered; // Arrived after a later sequence number.
+        std::vector<int> last; // Highest sequence number per controller.
+        std::vector<double> lastArrival;
+        // Inter-arrival times per controller, summed over all controllers.
+        double intervalSum, intervalSquares;
+        unsigned int intervals;
+
+        void reset(int controllers)
+        {
+            packets = lost = reordered = 0;
+            last.assign(controllers, -1);
+            lastArrival.assign(controllers, 0.0);
+            intervalSum = intervalSquares = 0.0;
+            intervals = 0;
+        }
+
+        void add(int sequence, int controller, double now)
+        {
+            packets++;
+            if(controller < 0 || controller >= (int)last.size())
+            {
+                return;
+            }
+            if(last[controller] >= 0)
+            {
+                if(sequence <= last[controller])
+                {
+                    reordered++;
+                    // Was counted as lost when the gap opened.
+                    if(lost > 0 && sequence < last[controller])
+                    {
+                        lost--;
+                    }
+                    return;
+                }
+                lost += sequence - last[controller] - 1;
+                double interval = now - lastArrival[controller];
+                intervalSum += interval;
+                intervalSquares += interval * interval;
+                intervals++;
+            }
+            last[controller] = sequence;
+            lastArrival[controller] = now;
+        }
+
+        double interval() const
+        {
+            return intervals ? intervalSum / intervals : 0.0;
+        }
+
+        double jitter() const
+        {
+            if(intervals < 2)
+            {
+                return 0.0;
+            }
+            double mean = interval();
+            double variance = intervalSquares / intervals - mean * mean;
+            return variance > 0.0 ? sqrt(variance) : 0.0;
+        }
+};
+
+/**
+ * Samples of one stream dropped on purpose, and how many of them came back
+ * in the redundancy records of later packets.
+ **/
+struct RecoveryStats
+{
+        unsigned int bytes; // Received, dropped or not.
+        unsigned int dropped;
+        unsigned int recovered;
+        std::set<std::pair<int, int> > missing; // Controller, sequence.
+
+        void reset()
+        {
+            bytes = dropped = recovered = 0;
+            missing.clear();
+        }
+
+        void drop(int controller, int sequence)
+        {
+            dropped++;
+            missing.insert(std::make_pair(controller, sequence));
+        }
+
+        // Reads the records after " R <n>", each 'fields' long and starting
+        // with the sequence number.
+        void recover(const char * packet, int controller, int fields)
+        {
+            const char * p = strstr(packet, " R ");
+            int records;
+            if(!p || sscanf(p, " R %d", &records) != 1)
+            {
+                return;
+            }
+            p = strchr(p + 3, ' ');
+            for(int r = 0; r < records && p; r++)
+            {
+                int sequence;
+                if(sscanf(p, "%d", &sequence) == 1
+                        && missing.erase(std::make_pair(controller, sequence)))
+                {
+                    recovered++;
+                }
+                for(int field = 0; field < fields && p; field++)
+                {
+                    p = strchr(p + 1, ' ');
+                }
+            }
+        }
+};
+
+/**
+ * Receives and parses the streams of the client that connected.
+ **/
+class StreamReceiver : public Thread
+{
+    public:
+        StreamReceiver(int socket, int controllers)
+        {
+            _socket = socket;
+            _controllers = controllers;
+            _loss = 0.0f;
+            _seed = 1;
+            reset();
+        }
+
+        virtual void run()
+        {
+            char packet[512];
+            while(1)
+            {
+                ssize_t n = recv(_socket, packet, sizeof(packet) - 1, 0);
+                double now = getTime();
+                if(n > 0)
+                {
+                    packet[n] = 0;
+                    if(!lost(packet, n))
+                    {
+                        parse(packet, now);
+                    }
+                }
+
+                _quitMutex->lock();
+                if(_quit)
+                {
+                    _quitMutex->unlock();
+                    break;
+                }
+                _quitMutex->unlock();
+            }
+        }
+
+        void reset()
+        {
+            _mutex.lock();
+            _physical.reset(_controllers);
+            _tracker.reset(_controllers);
+            _probes.reset();
+            _physicalRecovery.reset();
+            _trackerRecovery.reset();
+            _mutex.unlock();
+        }
+
+        // Fraction of the packets to drop as if lost on the way.
+        void setLoss(float loss)
+        {
+            _mutex.lock();
+            _loss = loss;
+            _mutex.unlock();
+        }
+
+        void recovery(RecoveryStats & physical, RecoveryStats & tracker)
+        {
+            _mutex.lock();
+            physical = _physicalRecovery;
+            tracker = _trackerRecovery;
+            _mutex.unlock();
+        }
+
+        // Writes the next probe command, called right before it is sent.
+        int probeCommand(char * command, double now)
+        {
+            _mutex.lock();
+            int length = _probes.send(command, now);
+            _mutex.unlock();
+            return length;
+        }
+
+        void results(StreamStats & physical, StreamStats & tracker,
+                     std::vector<double> & latencies, unsigned int & lostProbes)
+        {
+            _mutex.lock();
+            physical = _physical;
+            tracker = _tracker;
+            latencies = _probes.latencies();
+            lostProbes = _probes.lost();
+            _mutex.unlock();
+        }
+
+    protected:
+        // Counts the bandwidth and decides whether the packet is dropped.
+        bool lost(const char * packet, int length)
+        {
+            int sequence = 0, controller = -1;
+            char type = 0;
+            if(sscanf(packet, "%c %d %d", &type, &sequence, &controller) != 3
+                    || (type != 'a' && type != 'b'))
+            {
+                return false;
+            }
+
+            _mutex.lock();
+            RecoveryStats & recovery = type == 'a' ? _physicalRecovery
+                    : _trackerRecovery;
+            recovery.bytes += length;
+            bool drop = _loss > 0.0f && rand_r(&_seed) < _loss * RAND_MAX;
+            if(drop)
+            {
+                recovery.drop(controller, sequence);
+            }
+            else
+            {
+                // "a" records: sequence buttons trigger qw qx qy qz,
+                // "b" records: sequence x y z tracking.
+                recovery.recover(packet, controller, type == 'a' ? 7 : 5);
+            }
+            _mutex.unlock();
+            return drop;
+        }
+
+        void parse(const char * packet, double now)
+        {
+            int sequence = 0, controller = -1;
+            char type = 0;
+            if(sscanf(packet, "%c %d %d", &type, &sequence, &controller) != 3)
+            {
+                return;
+            }
+
+            _mutex.lock();
+            if(type == 'a')
+            {
+                _physical.add(sequence, controller, now);
+                _probes.received(packet, now);
+            }
+            else if(type == 'b')
+            {
+                _tracker.add(sequence, controller, now);
+            }
+            _mutex.unlock();
+        }
+
+        int _socket;
+        int _controllers;
+
+        Mutex _mutex;
+        StreamStats _physical;
+        StreamStats _tracker;
+        LatencyProbes _probes;
+
+        float _loss;
+        unsigned int _seed;
+        RecoveryStats _physicalRecovery;
+        RecoveryStats _trackerRecovery;
+};
+
+static void usage()
+{
+    printf("move_loadgen [--host addr] [--clients n] [--controllers n]\n"
+           "             [--rates r1,r2,...] [--step s] [--probe hz]\n"
+           "             [--socket path] [--loss p1,p2,...]\n"
+           "             [--redundancy k1,k2,...]\n");
+}
+
+static std::vector<float> parseRates(const char * list)
+{
+    std::vector<float> rates;
+    const char * p = list;
+    while(*p)
+    {
+        rates.push_back((float)atof(p));
+        p = strchr(p, ',');
+        if(!p)
+        {
+            break;
+        }
+        p++;
+    }
+    return rates;
+}
+
+// The "commands" counter of a stats reply, -1 if it isn't there.
+static int handledCommands(const std::string & stats)
+{
+    size_t at = stats.find("  commands ");
+    unsigned int count;
+    if(at == std::string::npos
+            || sscanf(stats.c_str() + at, " commands %u", &count) != 1)
+    {
+        return -1;
+    }
+    return count;
+}
+
+static double percentage(unsigned int part, unsigned int whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+// Waits 'seconds', keeping the client subscribed.
+static void keepAlive(int client, const struct sockaddr_in & server,
+                      double seconds)
+{
+    double end = getTime() + seconds;
+    double now;
+    while((now = getTime()) < end)
+    {
+        sendto(client, "p", 1, 0, (struct sockaddr *)&server, sizeof(server));
+        double wait = end - now < KEEP_ALIVE_INTERVAL ? end - now
+                : KEEP_ALIVE_INTERVAL;
+        usleep((useconds_t)(wait * 1000000.0));
+    }
+}
+
+// Redundancy depth against simulated loss, no commands are sent.
+static void redundancyTest(const LoadOptions & options, int client,
+                           const struct sockaddr_in & server,
+                           StreamReceiver & receiver)
+{
+    printf("Redundancy test, %.1f s per step\n\n", options.step);
+    printf("  depth  loss %% |   a kB/s   b kB/s |  a dropped  rebuilt %% |  b dropped  rebuilt %%\n");
+
+    char command[64];
+    for(size_t k = 0; k < options.redundancy.size(); k++)
+    {
+        int depth = (int)options.redundancy[k];
+        int length = sprintf(command, "c redundancy=%d", depth);
+        sendto(client, command, length, 0, (struct sockaddr *)&server,
+               sizeof(server));
+        usleep(200000);
+
+        for(size_t l = 0; l < options.loss.size(); l++)
+        {
+            receiver.setLoss(options.loss[l] / 100.0f);
+            receiver.reset();
+            double start = getTime();
+            keepAlive(client, server, options.step);
+            double elapsed = getTime() - start;
+
+            RecoveryStats physical, tracker;
+            receiver.recovery(physical, tracker);
+            printf("%7d %7.1f | %8.1f %8.1f | %10u %9.1f | %10u %9.1f\n",
+                   depth, options.loss[l], physical.bytes / elapsed / 1000.0,
+                   tracker.bytes / elapsed / 1000.0, physical.dropped,
+                   percentage(physical.recovered, physical.dropped),
+                   tracker.dropped,
+                   percentage(tracker.recovered, tracker.dropped));
+            fflush(stdout);
+        }
+    }
+    receiver.setLoss(0.0f);
+}
+
+int main(int argc, char * argv[])
+{
+    LoadOptions options;
+    options.host = "127.0.0.1";
+    options.clients = 8;
+    options.controllers = 1;
+    options.rates = parseRates("0,1000,5000,10000,20000,50000,100000");
+    options.step = 3.0f;
+    options.probe = 20.0f;
+    options.redundancy = parseRates("0,1,2,4");
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--host" && hasValue)
+        {
+            options.host = argv[++i];
+        }
+        else if(arg == "--clients" && hasValue)
+        {
+            options.clients = atoi(argv[++i]);
+        }
+        else if(arg == "--controllers" && hasValue)
+        {
+            options.controllers = atoi(argv[++i]);
+        }
+        else if(arg == "--rates" && hasValue)
+        {
+            options.rates = parseRates(argv[++i]);
+        }
+        else if(arg == "--step" && hasValue)
+        {
+            options.step = (float)atof(argv[++i]);
+        }
+        else if(arg == "--probe" && hasValue)
+        {
+            options.probe = (float)atof(argv[++i]);
+        }
+        else if(arg == "--socket" && hasValue)
+        {
+            options.socket = argv[++i];
+        }
+        else if(arg == "--loss" && hasValue)
+        {
+            options.loss = parseRates(argv[++i]);
+        }
+        else if(arg == "--redundancy" && hasValue)
+        {
+            options.redundancy = parseRates(argv[++i]);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if(options.clients < 1 || options.controllers < 1 || options.rates.empty()
+            || options.step <= 0.0f)
+    {
+        usage();
+        return 1;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(RECV_PORT);
+    if(inet_pton(AF_INET, options.host.c_str(), &server.sin_addr) != 1)
+    {
+        printf("Bad server address '%s'\n", options.host.c_str());
+        return 1;
+    }
+
+    // Client 0 connects first and gets the streams on SEND_PORT, the others
+    // only add load.
+    std::vector<int> clients;
+    for(int i = 0; i < options.clients; i++)
+    {
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        if(i == 0)
+        {
+            struct sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_ANY);
+            local.sin_port = htons(SEND_PORT);
+            if(bind(s, (struct sockaddr *)&local, sizeof(local)) != 0)
+            {
+                printf("Couldn't bind port %d, is a client already running?\n",
+                       SEND_PORT);
+                return 1;
+            }
+            struct timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 100000;
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+        clients.push_back(s);
+    }
+
+    char packet[512];
+    bool streaming = false;
+    double deadline = getTime() + 10.0;
+    while(!streaming && getTime() < deadline)
+    {
+        sendto(clients[0], "c", 1, 0, (struct sockaddr *)&server,
+               sizeof(server));
+        if(recv(clients[0], packet, sizeof(packet), 0) > 0)
+        {
+            streaming = true;
+        }
+    }
+    if(!streaming)
+    {
+        printf("No stream from %s, is the server running?\n",
+               options.host.c_str());
+        return 1;
+    }
+    for(size_t i = 1; i < clients.size(); i++)
+    {
+        sendto(clients[i], "c", 1, 0, (struct sockaddr *)&server,
+               sizeof(server));
+    }
+
+    StreamReceiver receiver(clients[0], options.controllers);
+    receiver.startThread();
+
+    if(!options.loss.empty())
+    {
+        redundancyTest(options, clients[0], server, receiver);
+        sendto(clients[0], "u", 1, 0, (struct sockaddr *)&server,
+               sizeof(server));
+        receiver.join();
+        for(size_t i = 0; i < clients.size(); i++)
+        {
+            close(clients[i]);
+        }
+        return 0;
+    }
+
+    printf("%d clients, commands to %d controllers, %.1f s per step, %.0f probes/s\n\n",
+           options.clients, options.controllers, options.step, options.probe);
+    printf("  offered     sent/s  handled/s |    a/s  a lost a reord  a jitter |    b/s  b lost | probe p50    p99    max  lost\n");
+    printf("                                |                          ms      |                |        ms     ms     ms\n");
+
+    char command[64];
+    unsigned int target = 0;
+    for(size_t step = 0; step < options.rates.size(); step++)
+    {
+        float rate = options.rates[step];
+        if(!options.socket.empty())
+        {
+            controlCommand(options.socket, "stats reset");
+        }
+        receiver.reset();
+
+        unsigned int sent = 0, errors = 0;
+        double start = getTime();
+        double end = start + options.step;
+        double nextProbe = start;
+        double nextKeepAlive = start;
+        double now;
+        while((now = getTime()) < end)
+        {
+            if(now >= nextKeepAlive)
+            {
+                sendto(clients[0], "p", 1, 0, (struct sockaddr *)&server,
+                       sizeof(server));
+                nextKeepAlive += KEEP_ALIVE_INTERVAL;
+            }
+            unsigned int due = (unsigned int)((now - start) * rate);
+            while(sent < due)
+            {
+                // Rumble off: keeps the server busy without changing the LEDs.
+                int c = target++ % options.controllers;
+                int length = sprintf(command, "d %d 1 0 0 0 0 0 0 0", c);
+                int s = clients[sent % clients.size()];
+                if(sendto(s, command, length, 0, (struct sockaddr *)&server,
+                          sizeof(server)) < 0)
+                {
+                    errors++;
+                }
+                sent++;
+            }
+            if(options.probe > 0.0f && now >= nextProbe)
+            {
+                int length = receiver.probeCommand(command, now);
+                sendto(clients[0], command, length, 0,
+                       (struct sockaddr *)&server, sizeof(server));
+                nextProbe += 1.0 / options.probe;
+            }
+            usleep(1000);
+        }
+        double elapsed = getTime() - start;
+
+        // Latecomers of this step still count towards it.
+        usleep(200000);
+        StreamStats physical, tracker;
+        std::vector<double> latencies;
+        unsigned int lostProbes;
+        receiver.results(physical, tracker, latencies, lostProbes);
+
+        int handled = -1;
+        if(!options.socket.empty())
+        {
+            handled = handledCommands(controlCommand(options.socket, "stats"));
+        }
+        char handledText[16] = "-";
+        if(handled >= 0)
+        {
+            sprintf(handledText, "%.0f", handled / elapsed);
+        }
+
+        printf("%9.0f %10.0f %10s | %6.0f %7u %7u %9.2f | %6.0f %7u | %9.1f %6.1f %6.1f %5u\n",
+               rate, sent / elapsed, handledText, physical.packets / elapsed,
+               physical.lost, physical.reordered, physical.jitter() * 1000.0,
+               tracker.packets / elapsed, tracker.lost,
+               percentile(latencies, 0.5) * 1000.0,
+               percentile(latencies, 0.99) * 1000.0,
+               latencies.empty() ? 0.0 : latencies.back() * 1000.0,
+               lostProbes);
+        if(errors)
+        {
+            printf("          %u sends failed\n", errors);
+        }
+        fflush(stdout);
+    }
+
+    sendto(clients[0], "u", 1, 0, (struct sockaddr *)&server, sizeof(server));
+    receiver.join();
+    for(size_t i = 0; i < clients.size(); i++)
+    {
+        close(clients[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,413 @@
+/**
+ * End to end benchmark: starts move_server on the simulated backend, acts
+ * as its UDP client over loopback and reports packet rates and losses,
+ * server CPU per controller, the command to stream latency measured here
+ * with LED probes (see bench_client.h), and the server's own latency
+ * percentiles ("stats").
+ *
+ * move_server_bench [--server path] [--controllers n] [--rate hz]
+ *                   [--latency ms] [--cameras n] [--fps fps]
+ *                   [--grab ms] [--track ms] [--no-grab-ahead]
+ *                   [--duration s] [--fusion]
+ *
+ * POSIX only.
+ **/
+
+#include "move_udp_server.h"
+#include "bench_client.h"
+#include "Timer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// LED probes per second, see bench_client.h.
+#define BENCH_PROBE_RATE 20.0
+
+struct BenchOptions
+{
+        std::string server;
+        int controllers;
+        float rate;
+        float latency;
+        int cameras;
+        float fps;
+        float grab; // ms of CPU per simulated image.
+        float track; // ms of CPU per controller and image.
+        int grabAhead;
+        float duration;
+        int fusion;
+};
+
+struct StreamCount
+{
+        unsigned int packets;
+        unsigned int lost; // Sequence numbers that never arrived, per controller.
+        std::vector<int> last; // Last sequence number per controller.
+};
+
+static void usage()
+{
+    printf("move_server_bench [--server path] [--controllers n] [--rate hz]\n"
+           "                  [--latency ms] [--cameras n] [--fps fps]\n"
+           "                  [--grab ms] [--track ms] [--no-grab-ahead]\n"
+           "                  [--duration s] [--fusion]\n");
+}
+
+// move_server next to this executable unless given.
+static std::string defaultServer(const char * argv0)
+{
+    std::string path(argv0);
+    size_t slash = path.rfind('/');
+    if(slash == std::string::npos)
+    {
+        return "./move_server";
+    }
+    return path.substr(0, slash + 1) + "move_server";
+}
+
+// utime + stime of a process in seconds.
+static double processCpu(pid_t pid)
+{
+    char path[64];
+    sprintf(path, "/proc/%d/stat", (int)pid);
+    FILE * file = fopen(path, "r");
+    if(!file)
+    {
+        return 0.0;
+    }
+    char buffer[1024];
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[n] = 0;
+
+    // Fields after the command name, which may contain spaces.
+    char * p = strrchr(buffer, ')');
+    unsigned long utime = 0, stime = 0;
+    if(!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &utime, &stime) != 2)
+    {
+        return 0.0;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void countPacket(StreamCount & count, int sequence, int controller)
+{
+    count.packets++;
+    if(controller < 0 || controller >= (int)count.last.size())
+    {
+        return;
+    }
+    if(count.last[controller] >= 0 && sequence > count.last[controller] + 1)
+    {
+        count.lost += sequence - count.last[controller] - 1;
+    }
+    count.last[controller] = sequence;
+}
+
+int main(int argc, char * argv[])
+{
+    BenchOptions options;
+    options.server = defaultServer(argv[0]);
+    options.controllers = 4;
+    options.rate = 100.0f;
+    options.latency = 0.0f;
+    options.cameras = 1;
+    options.fps = 60.0f;
+    options.grab = 0.0f;
+    options.track = 0.0f;
+    options.grabAhead = 1;
+    options.duration = 10.0f;
+    options.fusion = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "--server" && hasValue)
+        {
+            options.server = argv[++i];
+        }
+        else if(arg == "--controllers" && hasValue)
+        {
+            options.controllers = atoi(argv[++i]);
+        }
+        else if(arg == "--rate" && hasValue)
+        {
+            options.rate = (float)atof(argv[++i]);
+        }
+        else if(arg == "--latency" && hasValue)
+        {
+            options.latency = (float)atof(argv[++i]);
+        }
+        else if(arg == "--cameras" && hasValue)
+        {
+            options.cameras = atoi(argv[++i]);
+        }
+        else if(arg == "--fps" && hasValue)
+        {
+            options.fps = (float)atof(argv[++i]);
+        }
+        else if(arg == "--grab" && hasValue)
+        {
+            options.grab = (float)atof(argv[++i]);
+        }
+        else if(arg == "--track" && hasValue)
+        {
+            options.track = (float)atof(argv[++i]);
+        }
+        else if(arg == "--no-grab-ahead")
+        {
+            options.grabAhead = 0;
+        }
+        else if(arg == "--duration" && hasValue)
+        {
+            options.duration = (float)atof(argv[++i]);
+        }
+        else if(arg == "--fusion")
+        {
+            options.fusion = 1;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if(options.controllers < 1 || options.cameras < 1)
+    {
+        usage();
+        return 1;
+    }
+
+    char name[64];
+    sprintf(name, "/tmp/move_server_bench_%d", (int)getpid());
+    std::string configPath = std::string(name) + ".cfg";
+    std::string socketPath = std::string(name) + ".sock";
+    std::string logPath = std::string(name) + ".log";
+
+    FILE * config = fopen(configPath.c_str(), "w");
+    if(!config)
+    {
+        printf("Couldn't write %s\n", configPath.c_str());
+        return 1;
+    }
+    fprintf(config, "backend simulated\n");
+    fprintf(config, "sim_controllers %d\n", options.controllers);
+    fprintf(config, "sim_rate %f\n", options.rate);
+    fprintf(config, "sim_latency %f\n", options.latency);
+    fprintf(config, "sim_fps %f\n", options.fps);
+    fprintf(config, "sim_grab %f\n", options.grab);
+    fprintf(config, "sim_track %f\n", options.track);
+    fprintf(config, "grab_ahead %d\n", options.grabAhead);
+    fprintf(config, "max_controllers %d\n", options.controllers);
+    fprintf(config, "fusion %d\n", options.fusion);
+    fprintf(config, "control_socket %s\n", socketPath.c_str());
+    for(int i = 0; options.cameras > 1 && i < options.cameras; i++)
+    {
+        fprintf(config, "camera %d\n", i);
+    }
+    fclose(config);
+
+    // The server streams to SEND_PORT of whoever sent the connect message.
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons(SEND_PORT);
+    if(bind(udp, (struct sockaddr *)&local, sizeof(local)) != 0)
+    {
+        printf("Couldn't bind port %d, is a client already running?\n",
+               SEND_PORT);
+        unlink(configPath.c_str());
+        return 1;
+    }
+    // Short, so probes go out on time even if the stream stalls.
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 10000;
+    setsockopt(udp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(RECV_PORT);
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(log >= 0)
+        {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        close(udp);
+        execl(options.server.c_str(), options.server.c_str(),
+              configPath.c_str(), "--daemon", (char *)NULL);
+        _exit(127);
+    }
+    if(pid < 0)
+    {
+        printf("Couldn't start %s\n", options.server.c_str());
+        unlink(configPath.c_str());
+        return 1;
+    }
+
+    printf("%s: %d controllers at %.0f Hz (%.1f ms latency), %d camera(s) at %.0f fps (%.1f ms grab, %.1f ms tracking%s)%s\n",
+           options.server.c_str(), options.controllers, options.rate,
+           options.latency, options.cameras, options.fps, options.grab,
+           options.track, options.grabAhead ? ", grab ahead" : "",
+           options.fusion ? ", fusion" : "");
+
+    // Connect, retrying until the server is up and streaming.
+    char packet[512];
+    bool streaming = false;
+    double deadline = getTime() + 30.0;
+    while(!streaming && getTime() < deadline)
+    {
+        sendto(udp, "c", 1, 0, (struct sockaddr *)&server, sizeof(server));
+        if(recv(udp, packet, sizeof(packet), 0) > 0)
+        {
+            streaming = true;
+        }
+        if(waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            break;
+        }
+    }
+    if(!streaming)
+    {
+        printf("Server didn't start streaming, see %s\n", logPath.c_str());
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        unlink(configPath.c_str());
+        return 1;
+    }
+
+    // Let the threads settle before measuring.
+    double warmup = getTime() + 1.0;
+    while(getTime() < warmup)
+    {
+        recv(udp, packet, sizeof(packet), 0);
+    }
+    controlCommand(socketPath, "stats reset");
+
+    StreamCount physical, tracker, fused;
+    physical.packets = tracker.packets = fused.packets = 0;
+    physical.lost = tracker.lost = fused.lost = 0;
+    physical.last.assign(options.controllers, -1);
+    tracker.last.assign(options.controllers, -1);
+    fused.last.assign(options.controllers, -1);
+    unsigned int other = 0;
+    LatencyProbes probes;
+    char command[64];
+
+    double cpuStart = processCpu(pid);
+    double start = getTime();
+    double end = start + options.duration;
+    double nextProbe = start;
+    double nextKeepAlive = start + KEEP_ALIVE_INTERVAL;
+    double now;
+    while((now = getTime()) < end)
+    {
+        if(now >= nextKeepAlive)
+        {
+            sendto(udp, "p", 1, 0, (struct sockaddr *)&server, sizeof(server));
+            nextKeepAlive += KEEP_ALIVE_INTERVAL;
+        }
+        if(now >= nextProbe)
+        {
+            int length = probes.send(command, now);
+            sendto(udp, command, length, 0, (struct sockaddr *)&server,
+                   sizeof(server));
+            nextProbe += 1.0 / BENCH_PROBE_RATE;
+        }
+        ssize_t n = recv(udp, packet, sizeof(packet) - 1, 0);
+        if(n <= 0)
+        {
+            continue;
+        }
+        packet[n] = 0;
+        int sequence = 0, controller = -1;
+        char type = 0;
+        if(sscanf(packet, "%c %d %d", &type, &sequence, &controller) != 3)
+        {
+            other++;
+            continue;
+        }
+        switch(type)
+        {
+            case 'a':
+                countPacket(physical, sequence, controller);
+                probes.received(packet, getTime());
+                break;
+            case 'b':
+                countPacket(tracker, sequence, controller);
+                break;
+            case 'f':
+                countPacket(fused, sequence, controller);
+                break;
+            default:
+                other++;
+                break;
+        }
+    }
+    double elapsed = getTime() - start;
+    double cpu = processCpu(pid) - cpuStart;
+    std::string stats = controlCommand(socketPath, "stats");
+
+    controlCommand(socketPath, "exit");
+    double stopDeadline = getTime() + 5.0;
+    int status = 0;
+    while(waitpid(pid, &status, WNOHANG) != pid)
+    {
+        if(getTime() > stopDeadline)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            break;
+        }
+        usleep(10000);
+    }
+    close(udp);
+    unlink(configPath.c_str());
+
+    printf("\nReceived over %.2f s:\n", elapsed);
+    printf("  a  %8u packets  %8.1f/s  %u lost\n", physical.packets,
+           physical.packets / elapsed, physical.lost);
+    printf("  b  %8u packets  %8.1f/s  %u lost\n", tracker.packets,
+           tracker.packets / elapsed, tracker.lost);
+    if(options.fusion)
+    {
+        printf("  f  %8u packets  %8.1f/s  %u lost\n", fused.packets,
+               fused.packets / elapsed, fused.lost);
+    }
+    if(other)
+    {
+        printf("  %u other packets\n", other);
+    }
+    printf("Server CPU: %.1f%% of a core, %.2f%% per controller\n",
+           100.0 * cpu / elapsed, 100.0 * cpu / elapsed / options.controllers);
+    std::vector<double> latencies = probes.latencies();
+    printf("Command to stream, seen by the client: %u probes, p50 %.2f ms, p99 %.2f ms, max %.2f ms, %u lost\n",
+           probes.sent(), percentile(latencies, 0.5) * 1000.0,
+           percentile(latencies, 0.99) * 1000.0,
+           latencies.empty() ? 0.0 : latencies.back() * 1000.0,
+           probes.lost());
+    printf("\nServer stats:\n%s", stats.c_str());
+    unlink(logPath.c_str());
+    return 0;
+}
@@ -28,6 +28,23 @@
 
 #include "move_udp_server.h"
 #include "udp_tracker.h"
+#include "udp_tracker_send.h"
+#include "calibration_cache.h"
+#include "controller_monitor.h"
+#include "control_channel.h"
+#include "frame_triple_buffer.h"
+#include "mjpeg_stream.h"
+#include "latency_stats.h"
+#include "psmoveapi_backend.h"
+#include "simulated_backend.h"
+#include "replay_backend.h"
+#include "session_recorder.h"
+#include "trace.h"
+#include "log.h"
+#include "subscribers.h"
+#include "button_events.h"
+#include "sample_history.h"
+#include "Timer.hpp"
 #include "udp_recv.h"
 #include "udp_physical.h"
 
@@ -39,49 +56,165 @@
 #endif
 
 #include <cstring>
+#include <cctype>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <string>
 
-#ifdef WIN32
-#include <conio.h>
+#include <cstdarg>
 
+#ifdef WIN32
 #pragma comment (lib, "Ws2_32.lib")
-
 #endif
 
-#ifdef __APPLE__
-#include <sys/select.h>
+#ifndef PSMOVE_TRACKER_FILENAME_ENV
+#define PSMOVE_TRACKER_FILENAME_ENV "PSMOVE_TRACKER_FILENAME"
 #endif
 
 #ifndef WIN32
 #define INVALID_SOCKET -1
+#endif
 
-// simplified version of kbhit since full functionality is not required
-// http://www.flipcode.com/archives/_kbhit_for_Linux.shtml
-bool kbhit()
+static const char * orientationStateName(int state)
 {
-    timeval timeout;
-    fd_set rdset;
-
-    FD_ZERO(&rdset);
-    FD_SET(0, &rdset);
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
-
-    return select(1, &rdset, NULL, NULL, &timeout);
+    switch(state)
+    {
+        case ORIENTATION_UNAVAILABLE:
+            return "unavailable (USB)";
+        case ORIENTATION_UNCALIBRATED:
+            return "uncalibrated";
+        case ORIENTATION_WAITING:
+            return "waiting for MOVE";
+        case ORIENTATION_CALIBRATED:
+            return "calibrated";
+    }
+    return "unknown";
 }
 
-#endif
+static const char * slotStateName(int state)
+{
+    switch(state)
+    {
+        case SLOT_EMPTY:
+            return "not connected";
+        case SLOT_CONNECTING:
+            return "connecting";
+        case SLOT_ACTIVE:
+            return "active";
+        case SLOT_RETIRING:
+            return "disconnecting";
+    }
+    return "unknown";
+}
 
+MoveBackend * moveBackend = NULL;
 Mutex * trackerMutex = NULL;
 Mutex * controllerMutex = NULL;
+Event * moveStateEvent = NULL;
+
+std::vector<int> camera_indices;
+std::vector<CameraExtrinsics> camera_extrinsics;
+float camera_max_age = 0.1f;
+int grab_ahead = 1;
+
+// Offline input: psmoveapi reads this video file or image sequence instead of a camera.
+std::string video_file;
+float video_fps = 0.0f;
+int video_frames = 0;
+
+// Controllers and cameras, real or simulated.
+std::string backend_name = "psmoveapi";
+SimulationSettings simulationSettings;
+
+// Session logs: everything the backend returns is recorded to record_file,
+// "replay <file>" plays one back instead of the hardware.
+std::string record_file;
+std::string replay_file;
+float replay_speed = 1.0f;
+
+// Timeline trace, saved on "trace save" and on exit while tracing.
+std::string trace_file = "move_server_trace.json";
+
+// Messages of the server threads go through the log, stderr if no file.
+std::string log_file;
+
+// Daemon mode: no console or tracker window, controlled by signals and the control socket.
+int daemon_mode = 0;
+std::string control_socket;
+std::string config_file;
+
+DebugStreamSettings debugStreamSettings;
+
+// VRPN reports follow MoveState changes within these rates (Hz).
+float vrpn_min_rate = 10.0f;
+float vrpn_max_rate = 250.0f;
+// Raw IMU analog channels, added after each controller's trigger channel.
+bool vrpn_analog_accel = false;
+bool vrpn_analog_gyro = false;
+bool vrpn_analog_mag = false;
+
+// Incremented when filterRules change.
+int filterVersion = 0;
+
+// Controller slots, new controllers can be connected while there are free ones.
+int max_controllers = 4;
+float controller_timeout = 3.0f;
+// Unchanged LEDs are rewritten this often so they don't time out.
+float led_refresh = 1.0f;
+// Trigger levels that produce button events, and their retransmit interval.
+int event_triggers[MAX_TRIGGER_THRESHOLDS] = { 128 };
+int event_trigger_count = 1;
+float event_retransmit = 0.05f;
+// Subscriber defaults for suppressing unchanged stream packets.
+int send_on_change = 0;
+float keyframe_interval = 1.0f;
+// Changes within these don't count for send_on_change, 0 counts any.
+float deadband_imu = 0.0f;
+float deadband_quaternion = 0.0f;
+float deadband_position = 0.0f;
+int redundancy = 0;
+// Subscribers silent for longer than this are dropped, 0 keeps them.
+float subscriber_timeout = 0.0f;
+// Samples kept per controller for "g" requests, 0 keeps none, and the
+// "G" packets a subscriber gets per second.
+int history_size = 512;
+int history_rate = 64;
+
+// Calibration cache, disabled unless a file is given.
+std::string calibration_cache_file;
+int calibration_cache_age = 3600;
+FusionSettings fusionSettings;
+std::vector<FilterRule> filterRules;
+HapticPattern hapticPatterns[HAPTIC_MAX_PATTERNS];
+
+// What loadConfig reads for the running threads. The caller swaps it in,
+// under controllerMutex once they run, so the file is never read with the
+// lock held.
+struct RuntimeConfig
+{
+        std::vector<FilterRule> filterRules;
+        HapticPattern hapticPatterns[HAPTIC_MAX_PATTERNS];
+        int hapticSet[HAPTIC_MAX_PATTERNS]; // Pattern is in the file.
+};
 
-int camera_index = -1;
+void loadConfig(std::string & file, RuntimeConfig & runtime);
 
-void loadConfig(std::string & file);
+// Caller holds controllerMutex if the threads run. Patterns the file
+// doesn't set keep what the client uploaded.
+static void applyRuntimeConfig(const RuntimeConfig & runtime)
+{
+    filterRules = runtime.filterRules;
+    filterVersion++;
+    for(int i = 0; i < HAPTIC_MAX_PATTERNS; i++)
+    {
+        if(runtime.hapticSet[i])
+        {
+            hapticPatterns[i] = runtime.hapticPatterns[i];
+        }
+    }
+}
 
 MoveState * createMoveState()
 {
@@ -90,7 +223,22 @@ MoveState * createMoveState()
     ms->x = ms->y = ms->z = 0.0;
     ms->qx = ms->qy = ms->qw = 0.0;
     ms->qz = 1.0;
+    ms->rx = ms->ry = ms->rz = 0.0;
+    ms->rqx = ms->rqy = ms->rqw = 0.0;
+    ms->rqz = 1.0;
+    ms->vx = ms->vy = ms->vz = 0.0;
+    ms->lax = ms->lay = ms->laz = 0.0;
+    ms->ax = ms->ay = ms->az = 0.0;
+    ms->gx = ms->gy = ms->gz = 0.0;
+    ms->mx = ms->my = ms->mz = 0.0;
     ms->trigger = 0.0;
+    ms->sequence = 0;
+    ms->updateTime = 0.0;
+    ms->fusion = NULL;
+    if(fusionSettings.enabled)
+    {
+        ms->fusion = new PositionFusion(fusionSettings);
+    }
     ms->lock = new Mutex();
     return ms;
 }
@@ -102,54 +250,370 @@ int main(int argc, char* argv[])
     int c;
     std::vector<MoveState*> moveStateList;
 
-    std::string configFile;
+    defaultFusionSettings(fusionSettings);
+    defaultDebugStreamSettings(debugStreamSettings);
+    defaultSimulationSettings(simulationSettings);
 
-    if(argc > 1)
+    // move_server [config] [--daemon]
+    for(int arg = 1; arg < argc; arg++)
     {
-        configFile = argv[1];
-        loadConfig(configFile);
+        if(strcmp(argv[arg], "--daemon") == 0 || strcmp(argv[arg], "-d") == 0)
+        {
+            daemon_mode = 1;
+        }
+        else
+        {
+            config_file = argv[arg];
+        }
+    }
+    if(!config_file.empty())
+    {
+        RuntimeConfig runtime;
+        loadConfig(config_file, runtime);
+        applyRuntimeConfig(runtime);
+    }
+    if(!logStart(log_file))
+    {
+        printf("WARNING: Couldn't open log file %s, logging to stderr.\n",
+               log_file.c_str());
     }
 
-    if(!psmove_init(PSMOVE_CURRENT_VERSION))
+    if(backend_name == "simulated")
     {
-        fprintf(stderr, "PS Move API init failed (wrong version?)\n");
+        moveBackend = new SimulatedBackend(simulationSettings);
+    }
+    else if(backend_name == "replay")
+    {
+        moveBackend = new ReplayBackend(replay_file, replay_speed);
+    }
+    else
+    {
+        if(backend_name != "psmoveapi")
+        {
+            printf("Unknown backend '%s', using psmoveapi.\n",
+                   backend_name.c_str());
+        }
+        moveBackend = new PSMoveApiBackend();
+    }
+    if(!moveBackend->init())
+    {
+        fprintf(stderr, "Couldn't initialise the %s backend.\n",
+                moveBackend->name());
         exit(1);
     }
+    if(!record_file.empty())
+    {
+        sessionRecorder = new SessionRecorder(record_file);
+        if(sessionRecorder->open())
+        {
+            sessionRecorder->startThread();
+            moveBackend = new RecordingBackend(moveBackend, sessionRecorder);
+        }
+        else
+        {
+            delete sessionRecorder;
+            sessionRecorder = NULL;
+        }
+    }
 
-    totalConnectedMoves = psmove_count_connected();
+    totalConnectedMoves = moveBackend->countConnected();
     printf("Connected controllers: %d\n", totalConnectedMoves);
 
     if(totalConnectedMoves == 0)
     {
-        printf("No Moves found, shutting down.\n");
-        exit(1);
+        printf("No Moves found, waiting for controllers to connect.\n");
     }
 
-    controllers = (PSMove **)calloc(totalConnectedMoves, sizeof(PSMove *));
+    // Room for the controllers found now and any connected later.
+    int totalSlots = totalConnectedMoves > max_controllers
+            ? totalConnectedMoves : max_controllers;
+    controllers = (PSMove **)calloc(totalSlots, sizeof(PSMove *));
 
     printf("Run server\n");
     // Run the server. This will block until the server is exited.
-    udp_move_server(controllers, moveStateList);
+    udp_move_server(controllers, totalSlots, moveStateList);
 
     // Shut down the api.
-    for(c = 0; c < totalConnectedMoves; c++)
+    for(c = 0; c < totalSlots; c++)
     {
-        psmove_disconnect(controllers[c]);
+        if(controllers[c])
+        {
+            moveBackend->disconnect(controllers[c]);
+        }
     }
     printf("Controllers disconnected. Okay to exit. (Shutdown hangs sometimes.)\n");
-    psmove_shutdown();
+    moveBackend->shutdown();
+    delete moveBackend;
+    logStop();
     return 0;
 }
 
-int udp_move_server(PSMove **controllers,
+/**
+ * What the console and control socket commands act on.
+ **/
+struct CommandContext
+{
+        int *closeServer;
+        int trackingEnabled;
+        int totalCameras;
+        int totalSlots;
+        int *showTracker;
+        int *shownCamera;
+        ControllerData *controllerData;
+        std::vector<UDP_Tracker*> *trackerThreads;
+        UDP_TrackerSend *trackerSendThread;
+        PMONITORDATA monitorData;
+};
+
+// printf into a command reply.
+static void reply(std::string & out, const char * format, ...)
+{
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    out += buffer;
+}
+
+static void print_commands(CommandContext & ctx, std::string & out)
+{
+    reply(out, " showtracker [n] : Shows annotated footage of camera 'n' (default 0).\n");
+    reply(out, " hidetracker : Stops updating the tracker footage.\n");
+    reply(out, " calibrate c : Resets the quaternion for controller 'c' (0-%d).\n",
+          ctx.totalSlots - 1);
+    reply(out, " status      : Calibration state of each controller.\n");
+    reply(out, " trackerstats [reset] : Tracker frame rate and per stage timing.\n");
+    reply(out, " stats [reset] : Latency percentiles and packet/poll counters.\n");
+    reply(out, " trace on|off|save [file] : Thread timeline as Chrome trace JSON.\n");
+    reply(out, " reload      : Reloads the config file (also on SIGHUP).\n");
+    reply(out, " exit        : Shutdown the server\n");
+}
+
+// Filters, haptic patterns and the controller timeout apply immediately,
+// the rest of the config is only read at startup.
+static void reload_config(CommandContext & ctx, std::string & out)
+{
+    if(config_file.empty())
+    {
+        reply(out, "Error: Started without a config file.\n");
+        return;
+    }
+
+    // Only read at startup, or by this thread.
+    camera_indices.clear();
+    camera_extrinsics.clear();
+    RuntimeConfig runtime;
+    loadConfig(config_file, runtime);
+
+    controllerMutex->lock();
+    applyRuntimeConfig(runtime);
+    ctx.monitorData->timeout = controller_timeout;
+    controllerMutex->unlock();
+
+    reply(out, "Reloaded %s. Camera, video and fusion settings apply after a restart.\n",
+          config_file.c_str());
+}
+
+static void run_command(const char * s, CommandContext & ctx, std::string & out)
+{
+    int c;
+    ControllerData * controllerData = ctx.controllerData;
+
+    if(strlen(s) == 0)
+    {
+        // Do nothing
+    }
+    else if(strcmp(s, "exit") == 0)
+    {
+        *ctx.closeServer = 1;
+    }
+    else if(strcmp(s, "help") == 0)
+    {
+        print_commands(ctx, out);
+    }
+    else if(strcmp(s, "reload") == 0)
+    {
+        reload_config(ctx, out);
+    }
+    else if(strcmp(s, "showtracker") == 0
+            || strncmp(s, "showtracker ", 12) == 0)
+    {
+        int camera = 0;
+        sscanf(s, "showtracker %d", &camera);
+        if(daemon_mode)
+        {
+            reply(out, "Error: No tracker window in daemon mode.\n");
+        }
+        else if(ctx.trackingEnabled && (camera < 0 || camera >= ctx.totalCameras))
+        {
+            reply(out, "Error: Camera %d is not a valid option.\n", camera);
+        }
+        else if(ctx.trackingEnabled)
+        {
+            // Need to tell the tracking thread to annotate and show the tracking footage.
+            trackerMutex->lock();
+            *ctx.showTracker = 1;
+            *ctx.shownCamera = camera;
+            trackerMutex->unlock();
+            cvNamedWindow("Camera", CV_WINDOW_AUTOSIZE);
+        }
+        else
+        {
+            reply(out, "Error: Tracker not enabled.\n");
+        }
+    }
+    else if(strcmp(s, "hidetracker") == 0)
+    {
+        if(ctx.trackingEnabled && *ctx.showTracker)
+        {
+            trackerMutex->lock();
+            *ctx.showTracker = 0;
+            trackerMutex->unlock();
+            cvDestroyWindow("Camera");
+        }
+        else if(!ctx.trackingEnabled)
+        {
+            reply(out, "Error: Tracker not enabled.\n");
+        }
+    }
+    else if(strncmp(s, "trackerstats", 12) == 0)
+    {
+        if(ctx.trackingEnabled)
+        {
+            bool reset = strcmp(s, "trackerstats reset") == 0;
+            std::vector<UDP_Tracker*> & trackerThreads = *ctx.trackerThreads;
+            for(size_t i = 0; i < trackerThreads.size(); i++)
+            {
+                char name[32];
+                sprintf(name, "Camera %d", (int)i);
+                out += trackerThreads[i]->timing().report(name);
+                if(reset)
+                {
+                    trackerThreads[i]->timing().reset();
+                }
+            }
+            out += ctx.trackerSendThread->timing().report("Send");
+            if(reset)
+            {
+                ctx.trackerSendThread->timing().reset();
+            }
+        }
+        else
+        {
+            reply(out, "Error: Tracker not enabled.\n");
+        }
+    }
+    else if(strcmp(s, "stats") == 0 || strcmp(s, "stats reset") == 0)
+    {
+        out += statsReport();
+        if(strcmp(s, "stats reset") == 0)
+        {
+            statsReset();
+        }
+    }
+    else if(strcmp(s, "trace on") == 0)
+    {
+        traceEnabled = 1;
+        reply(out, "Tracing.\n");
+    }
+    else if(strcmp(s, "trace off") == 0)
+    {
+        traceEnabled = 0;
+        reply(out, "Tracing stopped.\n");
+    }
+    else if(strncmp(s, "trace save", 10) == 0)
+    {
+        std::string file = trace_file;
+        if(s[10] == ' ' && s[11])
+        {
+            file = s + 11;
+        }
+        int events = traceWrite(file);
+        if(events < 0)
+        {
+            reply(out, "Error: Couldn't write %s.\n", file.c_str());
+        }
+        else
+        {
+            reply(out, "%d events written to %s.\n", events, file.c_str());
+        }
+    }
+    else if(strcmp(s, "status") == 0)
+    {
+        controllerMutex->lock();
+        for(c = 0; c < ctx.totalSlots; c++)
+        {
+            if(controllerData[c].slotState != SLOT_ACTIVE)
+            {
+                reply(out, "Controller %d: %s\n", c,
+                      slotStateName(controllerData[c].slotState));
+                continue;
+            }
+            reply(out, "Controller %d: orientation %s", c,
+                  orientationStateName(controllerData[c].orientationState));
+            if(ctx.trackingEnabled)
+            {
+                reply(out, ", tracking colour %d %d %d", controllerData[c].tr,
+                      controllerData[c].tg, controllerData[c].tb);
+            }
+            reply(out, "\n");
+        }
+        controllerMutex->unlock();
+    }
+    else if(strncmp(s, "calibrate ", 10) == 0)
+    {
+        int controllerToCalibrate = -1;
+        sscanf(s, "calibrate %d", &controllerToCalibrate);
+        if(controllerToCalibrate >= 0 && controllerToCalibrate < ctx.totalSlots)
+        {
+            controllerMutex->lock();
+            if(controllerData[controllerToCalibrate].slotState != SLOT_ACTIVE)
+            {
+                reply(out, "Error: Controller %d is not connected.\n",
+                      controllerToCalibrate);
+            }
+            else if(controllerData[controllerToCalibrate].orientationState
+                    == ORIENTATION_UNAVAILABLE)
+            {
+                reply(out, "Error: Controller %d has no orientation (USB).\n",
+                      controllerToCalibrate);
+            }
+            else
+            {
+                // The physical thread finishes this when MOVE is pressed.
+                controllerData[controllerToCalibrate].orientationState =
+                        ORIENTATION_WAITING;
+                reply(out, "Hold PSMove flat facing your screen and press the MOVE button to calibrate orientation.\n");
+            }
+            controllerMutex->unlock();
+        }
+        else
+        {
+            reply(out, "Error: Controller %d is not a valid option.\n",
+                  controllerToCalibrate);
+        }
+    }
+    else
+    {
+        reply(out, "Invalid command: '%s'\n", s);
+    }
+}
+
+int udp_move_server(PSMove **controllers, int totalSlots,
                     std::vector<MoveState*> & moveStateList)
 {
-    int totalConnectedMoves = psmove_count_connected();
+    // Controllers connected now are calibrated below, later ones by the monitor.
+    int totalConnectedMoves = moveBackend->countConnected();
+    if(totalConnectedMoves > totalSlots)
+    {
+        totalConnectedMoves = totalSlots;
+    }
 
-    ControllerData* controllerData = new ControllerData[totalConnectedMoves];
+    ControllerData* controllerData = new ControllerData[totalSlots];
 
     // Initialise controller data
-    for(int c = 0; c < totalConnectedMoves; c++)
+    for(int c = 0; c < totalSlots; c++)
     {
         controllerData[c].r = 0;
         controllerData[c].g = 0;
@@ -160,13 +624,33 @@ int udp_move_server(PSMove **controllers,
         controllerData[c].resetOrientation = 0;
         controllerData[c].changeLight = 1;
         controllerData[c].rumble = 0;
-        controllerData[c].rumbleTimeout = 0;
+        controllerData[c].rumbleUntil = 0.0;
+        controllerData[c].hapticPattern = -1;
+        controllerData[c].hapticStart = 0.0;
         controllerData[c].trackerLight = 0;
+        controllerData[c].orientationState = ORIENTATION_UNCALIBRATED;
+        controllerData[c].slotState = SLOT_EMPTY;
+        controllerData[c].generation = 0;
+        controllerData[c].released = 0;
+        controllerData[c].trackerDone = 0;
+        controllerData[c].lastPoll = 0.0;
+        controllerData[c].commandTime = 0.0;
+        moveStateList.push_back(createMoveState());
     }
 
     int okayToSend = 0;
     SOCKET udpSendSocket, udpRecvSocket;
-    SOCKADDR_IN *localSendAddress = new SOCKADDR_IN;
+    Subscriber subscriberDefaults;
+    subscriberDefaults.stream = 1;
+    subscriberDefaults.events = 0;
+    subscriberDefaults.changes = send_on_change;
+    subscriberDefaults.keyframe = keyframe_interval;
+    subscriberDefaults.deadband[DEADBAND_IMU] = deadband_imu;
+    subscriberDefaults.deadband[DEADBAND_QUATERNION] = deadband_quaternion;
+    subscriberDefaults.deadband[DEADBAND_POSITION] = deadband_position;
+    subscriberDefaults.redundancy = redundancy;
+    SubscriberTable *subscribers = new SubscriberTable(subscriberDefaults,
+                                                       subscriber_timeout);
     SOCKADDR_IN *localRecvAddress = new SOCKADDR_IN;
 
 #ifdef WIN32
@@ -252,49 +736,117 @@ int udp_move_server(PSMove **controllers,
     // Create the receiving UDP socket.
     set_up_udp_socket(&udpRecvSocket, localRecvAddress, 1);
 
-    PSMoveTracker * tracker = NULL;
-    if(camera_index < 0)
+    // One tracker per configured camera, each runs on its own capture thread.
+    // Without a camera line the default camera is used.
+    std::vector<PSMoveTracker*> trackers;
+    std::vector<int> tracker_camera_ids; // Camera index per tracker, -1 for the default camera.
+    if(!video_file.empty())
+    {
+        // Same tracking and annotation path, fed from a file by psmoveapi.
+        printf("Using recorded video input: %s\n", video_file.c_str());
+#ifdef WIN32
+        _putenv_s(PSMOVE_TRACKER_FILENAME_ENV, video_file.c_str());
+#else
+        setenv(PSMOVE_TRACKER_FILENAME_ENV, video_file.c_str(), 1);
+#endif
+        PSMoveTracker * videoTracker = moveBackend->newTracker(-1);
+        if(videoTracker)
+        {
+            trackers.push_back(videoTracker);
+            tracker_camera_ids.push_back(-1);
+        }
+    }
+    else if(camera_indices.empty())
     {
-        tracker = psmove_tracker_new();
+        PSMoveTracker * defaultTracker = moveBackend->newTracker(-1);
+        if(defaultTracker)
+        {
+            trackers.push_back(defaultTracker);
+            tracker_camera_ids.push_back(-1);
+        }
     }
     else
     {
-        std::cerr << "Using camera index: " << camera_index << std::endl;
-        tracker = psmove_tracker_new_with_camera(camera_index);
+        for(size_t i = 0; i < camera_indices.size(); i++)
+        {
+            std::cerr << "Using camera index: " << camera_indices[i] << std::endl;
+            PSMoveTracker * cameraTracker = moveBackend->newTracker(
+                    camera_indices[i]);
+            if(cameraTracker)
+            {
+                trackers.push_back(cameraTracker);
+                tracker_camera_ids.push_back(camera_indices[i]);
+            }
+            else
+            {
+                printf("WARNING: Couldn't open camera %d.\n", camera_indices[i]);
+            }
+        }
     }
 
-    if(tracker)
+    for(size_t i = 0; i < trackers.size(); i++)
     {
         // Attempt to initialise the tracker, with custom settings.
         PSMoveTrackerSettings settings;
-        psmove_tracker_get_settings(tracker, &settings);
+        moveBackend->getTrackerSettings(trackers[i], &settings);
         settings.exposure_mode = Exposure_LOW;
         settings.color_mapping_max_age = 0;
         settings.camera_mirror = PSMove_True;
         settings.color_save_colormapping = PSMove_False; // Means we need to calibrate each time, saves us from saving bad calibrations.
         settings.color_list_start_ind = 0; // TODO: Allow user to select this. (Starting tracking color of the Move)
-        psmove_tracker_set_settings(tracker, &settings);
+        if(!calibration_cache_file.empty())
+        {
+            // Keep psmoveapi's colour mapping as long as our cache entries, so
+            // cached colours can be reused without blink calibration.
+            settings.color_save_colormapping = PSMove_True;
+            settings.color_mapping_max_age = calibration_cache_age;
+        }
+        moveBackend->setTrackerSettings(trackers[i], &settings);
+    }
+
+    CalibrationCache * calibrationCache = NULL;
+    if(!calibration_cache_file.empty())
+    {
+        calibrationCache = new CalibrationCache(calibration_cache_file,
+                                                calibration_cache_age);
+        calibrationCache->load();
     }
 
+    // The first camera picks the colours, the others are calibrated to match.
+    PSMoveTracker * tracker = trackers.empty() ? NULL : trackers[0];
+    int totalCameras = trackers.size();
+
     // Calibrate each controller with the tracker.
     int c;
     int tracking_enabled = 0;
     int show_tracker = 0;
-    PSMove* move;
-    int currPoll;
+    int shown_camera = 0;
+    int close_server = 0;
 
-    UDP_Tracker * tracker_thread = NULL;
+    std::vector<UDP_Tracker*> tracker_threads;
+    UDP_TrackerSend * tracker_send_thread = NULL;
     PTRACKERDATA trackerData = NULL;
 
+    controllerMutex = new Mutex();
+    if(controllerMutex->error())
+    {
+        printf("Error creating controllerMutex.\n");
+        return 1;
+    }
+    moveStateEvent = new Event();
+    statsReset();
+
     printf("Start tracker calib\n");
     // Check if the tracker was successfully initialised.
     if(tracker)
     {
         tracking_enabled = 1;
         printf("------------\nTracker calibration (Hold wand about 10cm from camera)\n------------\n");
+        // Connect everything first so cached controllers can be lit together.
+        std::vector<std::string> serials(totalConnectedMoves);
         for(c = 0; c < totalConnectedMoves; c++)
         {
-            controllers[c] = psmove_connect_by_id(c);
+            controllers[c] = moveBackend->connect(c);
 
             if(controllers[c] == NULL)
             {
@@ -303,53 +855,181 @@ int udp_move_server(PSMove **controllers,
             }
             printf("Controller opened\n");
 
-            if(psmove_connection_type(controllers[c]) == Conn_USB) printf(
+            if(moveBackend->connectionType(controllers[c]) == Conn_USB) printf(
                     "WARNING: Controller &d is connected by USB, physical data will be unavailable.");
-            psmove_set_orientation_fusion_type(
-                    controllers[c], (PSMoveOrientation_Fusion_Type)3);
-            psmove_enable_orientation(controllers[c], PSMove_True);
+            moveBackend->enableOrientation(controllers[c]);
+
+            char * serial = moveBackend->getSerial(controllers[c]);
+            if(serial)
+            {
+                serials[c] = serial;
+                free(serial);
+            }
+        }
 
-            moveStateList.push_back(createMoveState());
-            printf("Calibrating tracker for controller: %d", c);
-            while(psmove_tracker_enable(tracker, controllers[c])
-                    != Tracker_CALIBRATED)
+        // Controllers with a valid cached colour get it back all at once, the
+        // tracker then only has to confirm it sees them (no blink calibration).
+        // Copies, store() below may grow the cache.
+        std::vector<CalibrationEntry> cached(totalConnectedMoves);
+        std::vector<int> useCached(totalConnectedMoves, 0);
+        time_t now = time(NULL);
+        if(calibrationCache)
+        {
+            for(c = 0; c < totalConnectedMoves; c++)
+            {
+                if(serials[c].empty())
+                {
+                    continue;
+                }
+                const CalibrationEntry * entry = calibrationCache->find(
+                        serials[c], tracker_camera_ids[0], now);
+                // Two controllers must never share a colour.
+                for(int other = 0; entry && other < c; other++)
+                {
+                    if(useCached[other] && cached[other].r == entry->r
+                            && cached[other].g == entry->g
+                            && cached[other].b == entry->b)
+                    {
+                        entry = NULL;
+                    }
+                }
+                if(entry)
+                {
+                    cached[c] = *entry;
+                    useCached[c] = 1;
+                    moveBackend->setLeds(controllers[c], entry->r, entry->g,
+                                         entry->b);
+                    moveBackend->updateLeds(controllers[c]);
+                }
+            }
+        }
+
+        // Every cached colour is confirmed before any blink calibration, so
+        // the tracker knows they are taken and doesn't hand one out again.
+        std::vector<int> fromCache(totalConnectedMoves, 0);
+        for(c = 0; c < totalConnectedMoves; c++)
+        {
+            if(!useCached[c])
             {
-                printf(".");
+                continue;
             }
+            fromCache[c] = moveBackend->enableWithColor(tracker,
+                    controllers[c], cached[c].r, cached[c].g, cached[c].b)
+                    == Tracker_CALIBRATED;
+            if(!fromCache[c])
+            {
+                // Dark again, the blink calibration below gives it a colour.
+                moveBackend->setLeds(controllers[c], 0, 0, 0);
+                moveBackend->updateLeds(controllers[c]);
+            }
+        }
 
-            printf(" Tracker Calibrated!\n");
+        for(c = 0; c < totalConnectedMoves; c++)
+        {
+            LOG(LOG_INFO, "Calibrating tracker for controller: %d", c);
+            enum PSMoveTracker_Status status = fromCache[c]
+                    ? Tracker_CALIBRATED : Tracker_NOT_CALIBRATED;
+
+            int attempts = 0;
+            while(status != Tracker_CALIBRATED
+                    && (status = moveBackend->enable(tracker, controllers[c]))
+                            != Tracker_CALIBRATED)
+            {
+                ++attempts;
+                // A recording only calibrates if it contains the blink sequence, don't wait forever.
+                if(!video_file.empty() && attempts >= 5)
+                {
+                    break;
+                }
+            }
+
+            if(status != Tracker_CALIBRATED)
+            {
+                LOG(LOG_WARNING, "Controller %d not found in recording.", c);
+            }
+            else
+            {
+                LOG(LOG_INFO, "Controller %d: tracker calibrated%s after %d retries.",
+                    c, fromCache[c] ? " (cached)" : "", attempts);
+            }
 
             // Save the tracker color values. Used in the case of the client changing colors and wanting to revert.
-            psmove_tracker_get_color(tracker, controllers[c],
-                                     &controllerData[c].tr,
-                                     &controllerData[c].tg,
-                                     &controllerData[c].tb);
+            moveBackend->getColor(tracker, controllers[c],
+                                  &controllerData[c].tr,
+                                  &controllerData[c].tg,
+                                  &controllerData[c].tb);
             controllerData[c].r = controllerData[c].tr;
             controllerData[c].g = controllerData[c].tg;
             controllerData[c].b = controllerData[c].tb;
-            psmove_tracker_set_auto_update_leds(tracker, controllers[c],
-                                                PSMove_False);
+            moveBackend->setAutoUpdateLeds(tracker, controllers[c], false);
 
-            // Calibrating the controller's orientation quaternion. (Checking if its connected via bluetooth)
-            if(psmove_connection_type(controllers[c]) == Conn_Bluetooth)
+            if(calibrationCache && status == Tracker_CALIBRATED
+                    && !serials[c].empty())
             {
-                printf("Hold PSMove flat facing your screen and press the MOVE button to calibrate orientation.\n");
-                while(1)
+                calibrationCache->store(serials[c], tracker_camera_ids[0],
+                                        controllerData[c].tr,
+                                        controllerData[c].tg,
+                                        controllerData[c].tb, now);
+            }
+
+            for(int cam = 1; cam < totalCameras; cam++)
+            {
+                // A camera that can't see the controller now just won't track it.
+                int attempt;
+                for(attempt = 0; attempt < 5; attempt++)
                 {
-                    move = controllers[c];
-                    currPoll = psmove_poll(move);
-                    if(currPoll)
+                    if(moveBackend->enableWithColor(trackers[cam],
+                            controllers[c], controllerData[c].tr,
+                            controllerData[c].tg, controllerData[c].tb)
+                            == Tracker_CALIBRATED)
                     {
-                        if(psmove_get_buttons(move) & Btn_MOVE)
-                        {
-                            psmove_reset_orientation(move);
-                            printf("Controller %d has been calibrated.\n", c);
-                            break;
-                        }
+                        break;
                     }
                 }
+                if(attempt < 5)
+                {
+                    LOG(LOG_INFO, "Camera %d calibrated for controller %d.", cam, c);
+                }
+                else
+                {
+                    LOG(LOG_WARNING, "Camera %d couldn't calibrate controller %d.", cam, c);
+                }
+                moveBackend->setAutoUpdateLeds(trackers[cam], controllers[c],
+                                               false);
+                if(calibrationCache && attempt < 5 && !serials[c].empty())
+                {
+                    calibrationCache->store(serials[c], tracker_camera_ids[cam],
+                                            controllerData[c].tr,
+                                            controllerData[c].tg,
+                                            controllerData[c].tb, now);
+                }
+            }
+
+        }
+
+        if(calibrationCache && !calibrationCache->save())
+        {
+            printf("WARNING: Couldn't write calibration cache %s\n",
+                   calibration_cache_file.c_str());
+        }
+
+        // Orientation is calibrated in the background by the physical thread,
+        // streaming starts without waiting for every controller.
+        double startTime = getTime();
+        for(c = 0; c < totalConnectedMoves; c++)
+        {
+            controllerData[c].slotState = SLOT_ACTIVE;
+            controllerData[c].lastPoll = startTime;
+            if(moveBackend->connectionType(controllers[c]) == Conn_Bluetooth)
+            {
+                controllerData[c].orientationState = ORIENTATION_WAITING;
+            }
+            else
+            {
+                controllerData[c].orientationState = ORIENTATION_UNAVAILABLE;
             }
         }
+        printf("Hold each PSMove flat facing your screen and press its MOVE button to calibrate orientation.\n");
 
         trackerMutex = new Mutex();
         if(trackerMutex->error())
@@ -361,41 +1041,97 @@ int udp_move_server(PSMove **controllers,
         // Create the trackerData struct to send to the tracking thread.
         trackerData = new TRACKERDATA;
         trackerData->controllers = controllers;
-        trackerData->tracker = tracker;
-        trackerData->totalConnectedMoves = totalConnectedMoves;
+        trackerData->trackers = &trackers[0];
+        trackerData->totalCameras = totalCameras;
+        trackerData->totalConnectedMoves = totalSlots;
+        trackerData->controllerData = controllerData;
         trackerData->showTracker = &show_tracker;
-        trackerData->sendAddress = localSendAddress;
+        trackerData->shownCamera = &shown_camera;
+        trackerData->subscribers = subscribers;
         trackerData->udpSocket = &udpSendSocket;
         trackerData->okayToSend = &okayToSend;
-        trackerData->frame = NULL;
-        trackerData->frameMutex = new Mutex();
+        trackerData->frameBuffers = new FrameTripleBuffer[totalCameras];
+        trackerData->debugStream = NULL;
+        if(debugStreamSettings.port > 0)
+        {
+            MjpegStream * debugStream = new MjpegStream(debugStreamSettings);
+            if(debugStream->open())
+            {
+                debugStream->startThread();
+                trackerData->debugStream = debugStream;
+            }
+            else
+            {
+                delete debugStream;
+            }
+        }
+        trackerData->mailbox = new TrackerFrameMailbox(totalCameras);
+        trackerData->cameraFusion = new CameraFusion(totalCameras,
+                                                     totalSlots);
+        trackerData->cameraFusion->setMaxAge(camera_max_age);
+        trackerData->framePace = video_file.empty() ? 0.0f : video_fps;
+        trackerData->frameLimit = video_file.empty() ? 0 : video_frames;
+        trackerData->grabAhead = grab_ahead && moveBackend->canGrabAhead();
+        trackerData->closeServer = &close_server;
+        // Extrinsics name the camera by device index, the fusion by tracker.
+        // Cameras that failed to open have no tracker.
+        for(size_t i = 0; i < camera_extrinsics.size(); i++)
+        {
+            size_t t = 0;
+            while(t < tracker_camera_ids.size()
+                    && tracker_camera_ids[t] != camera_extrinsics[i].camera)
+            {
+                t++;
+            }
+            if(t < tracker_camera_ids.size())
+            {
+                trackerData->cameraFusion->setExtrinsics(t, camera_extrinsics[i]);
+            }
+            else
+            {
+                printf("WARNING: Extrinsics for camera %d, which isn't open.\n",
+                       camera_extrinsics[i].camera);
+            }
+        }
 
-        tracker_thread = new UDP_Tracker(trackerData, moveStateList);
-        tracker_thread->startThread();
+        // Capture/tracking and filtering/sending run as a pipeline: one
+        // capture thread per camera feeding a single send thread.
+        tracker_send_thread = new UDP_TrackerSend(trackerData, moveStateList);
+        tracker_send_thread->startThread();
+        for(int cam = 0; cam < totalCameras; cam++)
+        {
+            tracker_threads.push_back(new UDP_Tracker(trackerData, cam,
+                                                      moveStateList));
+            tracker_threads.back()->startThread();
+        }
     }
     else
     {
         printf("WARNING: Couldn't initialise tracker. Only physical move data will be sent. \n");
     }
+    // Only used for the controllers connected at startup.
+    delete calibrationCache;
+    calibrationCache = NULL;
 
     // ----- Initialising the 'Receive Thread' -----
-    controllerMutex = new Mutex();
-    if(controllerMutex->error())
-    {
-        printf("Error creating controllerMutex.\n");
-        return 1;
-    }
 
     // Create the recvData struct to send to the receive thread.
     PRECVTHREADDATA recvData = new RECVTHREADDATA;
 
     recvData->recvAddress = localRecvAddress;
     recvData->udpSocket = &udpRecvSocket;
-    recvData->totalConnectedMoves = totalConnectedMoves;
+    recvData->totalConnectedMoves = totalSlots;
     recvData->controllerData = controllerData;
     recvData->okayToSend = &okayToSend;
     recvData->udpSocketOut = &udpSendSocket;
-    recvData->sendAddress = localSendAddress;
+    recvData->subscribers = subscribers;
+    SampleHistory *history = NULL;
+    if(history_size > 0)
+    {
+        history = new SampleHistory(totalSlots, history_size);
+    }
+    recvData->history = history;
+    recvData->historyRate = history_rate;
 
     UDP_Recv * recv_thread = new UDP_Recv(recvData);
     recv_thread->startThread();
@@ -405,140 +1141,134 @@ int udp_move_server(PSMove **controllers,
     // Create the sendData struct to send to the 'physical send' thread.
     PSENDTHREADDATA sendData = new SENDTHREADDATA;
     sendData->controllerData = controllerData;
-    sendData->totalConnectedMoves = totalConnectedMoves;
+    sendData->totalConnectedMoves = totalSlots;
     sendData->controllers = controllers;
     sendData->udpSocket = &udpSendSocket;
-    sendData->sendAddress = localSendAddress;
+    sendData->subscribers = subscribers;
     sendData->okayToSend = &okayToSend;
     sendData->trackingEnabled = &tracking_enabled;
+    sendData->ledRefresh = led_refresh;
+    sendData->eventThresholds.assign(event_triggers,
+                                     event_triggers + event_trigger_count);
+    sendData->eventRetransmit = event_retransmit;
+    sendData->history = history;
 
     UDP_Physical * send_thread = new UDP_Physical(sendData, moveStateList);
+
+    // ----- Initialising the 'Controller Monitor' -----
+    PMONITORDATA monitorData = new MONITORDATA;
+    monitorData->totalSlots = totalSlots;
+    monitorData->controllers = controllers;
+    monitorData->controllerData = controllerData;
+    monitorData->totalCameras = tracking_enabled ? totalCameras : 0;
+    // The physical thread, plus each capture stage and the send stage.
+    monitorData->releaseCount = 1 + (tracking_enabled ? totalCameras + 1 : 0);
+    monitorData->timeout = controller_timeout;
+
+    ControllerMonitor * monitor_thread = new ControllerMonitor(monitorData);
+
     send_thread->startThread();
+    monitor_thread->startThread();
 
 #ifdef WITH_VRPN
     std::stringstream vrpnaddr;
     vrpnaddr << ":" << VRPN_PORT;
     std::cerr << "vrpn bind " << vrpnaddr.str() << std::endl;
     VRPNServer * vrpn = new VRPNServer(moveStateList, vrpn_create_server_connection(vrpnaddr.str().c_str(),NULL,NULL));
+    vrpn->setRates(vrpn_min_rate, vrpn_max_rate);
+    vrpn->setAnalogChannels(vrpn_analog_accel, vrpn_analog_gyro,
+                            vrpn_analog_mag);
     vrpn->startThread();
 #endif
 
     printf("------------\nServer Started. (Waiting on client connection.)\n");
 
-    int close_server = 0;
-    int controllerToCalibrate = 0;
+    CommandContext context;
+    context.closeServer = &close_server;
+    context.trackingEnabled = tracking_enabled;
+    context.totalCameras = totalCameras;
+    context.totalSlots = totalSlots;
+    context.showTracker = &show_tracker;
+    context.shownCamera = &shown_camera;
+    context.controllerData = controllerData;
+    context.trackerThreads = &tracker_threads;
+    context.trackerSendThread = tracker_send_thread;
+    context.monitorData = monitorData;
+
+    ControlChannel control;
+    if(!control.open(!daemon_mode, control_socket))
+    {
+        printf("WARNING: Control socket unavailable, only signals will be handled.\n");
+    }
 
-    printf("------------\nCommands:\n------------\n");
-    printf(" showtracker : Shows annotated tracker footage if available.\n");
-    printf(" hidetracker : Stops updating the tracker footage.\n");
-    printf(" calibrate c : Resets the quaternion for controller 'c' (0-3).\n");
-    printf(" exit        : Shutdown the server\n");
-    printf("------------\n");
+    if(daemon_mode)
+    {
+        printf("------------\nRunning as a daemon. SIGTERM/SIGINT to stop, SIGHUP to reload the config.\n");
+    }
+    else
+    {
+        std::string help;
+        print_commands(context, help);
+        printf("------------\nCommands:\n------------\n%s------------\n",
+               help.c_str());
+    }
+
+    std::vector<ControlCommand> commands;
+    bool replaying = backend_name == "replay";
     while(!close_server)
     {
-        // Run main menu. Adapted from TUIO.cpp
-        if(kbhit())
-        {
-            char s[2048];
-            memset(s, 0, sizeof(s));
-            if(fgets(s, sizeof(s), stdin) != NULL)
-            {
-                // strip trailing newline
-                if(s[strlen(s) - 1] == '\n')
-                {
-                    s[strlen(s) - 1] = '\0';
-                }
+        // Sleeps until a command or signal arrives, only tracker footage
+        // and the end of a replay need the loop to keep turning.
+        control.wait(show_tracker ? 1 : (replaying ? 100 : -1), commands);
 
-                if(strlen(s) == 0)
-                {
-                    // Do nothing
-                }
-                else if(strcmp(s, "exit") == 0)
-                {
-                    close_server = 1;
-                    break;
-                }
-                else if(strcmp(s, "showtracker") == 0)
-                {
-                    if(tracking_enabled)
-                    {
-                        // Need to tell the tracking thread to annotate and show the tracking footage.
-                        trackerMutex->lock();
-                        show_tracker = 1;
-                        trackerMutex->unlock();
-                        cvNamedWindow("Camera", CV_WINDOW_AUTOSIZE);
-                    }
-                    else
-                    {
-                        printf("Error: Tracker not enabled.\n");
-                    }
-                }
-                else if(strcmp(s, "hidetracker") == 0)
-                {
-                    if(tracking_enabled)
-                    {
-                        trackerMutex->lock();
-                        show_tracker = 0;
-                        trackerMutex->unlock();
-                        cvDestroyWindow("Camera");
-                    }
-                    else
-                    {
-                        printf("Error: Tracker not enabled.\n");
-                    }
-                }
-                else if(memcmp(s, "calibrate ", 10) == 0)
-                {
-                    sscanf(s, "calibrate %d\n", &controllerToCalibrate);
-                    if(controllerToCalibrate >= 0
-                            && controllerToCalibrate < totalConnectedMoves)
-                    {
-                        printf("Hold PSMove flat facing your screen and press the MOVE button to calibrate orientation.\n");
-                        while(1)
-                        {
-                            move = controllers[controllerToCalibrate];
-                            currPoll = psmove_poll(move);
-                            if(currPoll)
-                            {
-                                if(psmove_get_buttons(move) & Btn_MOVE)
-                                {
-                                    psmove_reset_orientation(move);
-                                    printf("Controller %d has been calibrated.\n",
-                                           controllerToCalibrate);
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    else
-                    {
-                        printf("Error: Controller %d is not a valid option.\n",
-                               controllerToCalibrate);
-                    }
+        if(moveBackend->finished())
+        {
+            printf("\nReplay finished, shutting down.\n");
+            close_server = 1;
+            break;
+        }
 
-                }
-                else
-                {
-                    printf("Invalid command: '%s'\n", s);
-                }
+        if(control.shutdownRequested())
+        {
+            printf("\nShutting down.\n");
+            close_server = 1;
+            break;
+        }
+        if(control.takeReloadRequest())
+        {
+            std::string out;
+            reload_config(context, out);
+            printf("\n%s", out.c_str());
+        }
 
-                printf("> ");
-                fflush(stdout);
+        for(size_t i = 0; i < commands.size(); i++)
+        {
+            std::string out;
+            run_command(commands[i].line.c_str(), context, out);
+            if(commands[i].client < 0)
+            {
+                out += "> ";
             }
+            control.reply(commands[i].client, out);
         }
 
         if(trackerData && show_tracker)
         {
-            trackerData->frameMutex->lock();
-            if(trackerData->frame)
+            // Only the main thread changes shown_camera.
+            ViewerFrame * view = trackerData->frameBuffers[shown_camera].acquire();
+            if(view)
             {
-                cvShowImage("Camera", trackerData->frame);
-                trackerData->frame = NULL;
+                annotateViewerFrame(*view);
+                cvShowImage("Camera", view->image);
             }
-            trackerData->frameMutex->unlock();
             cvWaitKey(1);
         }
     }
+    control.close();
+
+    // Stopped first so it doesn't wait on threads that have already exited.
+    monitor_thread->join();
+    delete monitor_thread;
     recv_thread->join();
     delete recv_thread;
     send_thread->join();
@@ -549,9 +1279,42 @@ int udp_move_server(PSMove **controllers,
 #endif
     if(tracking_enabled)
     {
-        tracker_thread->join();
-        delete tracker_thread;
-        psmove_tracker_free(tracker);
+        for(size_t i = 0; i < tracker_threads.size(); i++)
+        {
+            tracker_threads[i]->join();
+            delete tracker_threads[i];
+        }
+        tracker_send_thread->join();
+        delete tracker_send_thread;
+        delete trackerData->mailbox;
+        delete [] trackerData->frameBuffers;
+        if(trackerData->debugStream)
+        {
+            trackerData->debugStream->join();
+            delete trackerData->debugStream;
+        }
+        delete trackerData->cameraFusion;
+        for(size_t i = 0; i < trackers.size(); i++)
+        {
+            moveBackend->freeTracker(trackers[i]);
+        }
+    }
+    if(traceEnabled)
+    {
+        traceEnabled = 0;
+        int events = traceWrite(trace_file);
+        if(events >= 0)
+        {
+            printf("Trace of %d events written to %s\n", events,
+                   trace_file.c_str());
+        }
+    }
+    if(sessionRecorder)
+    {
+        // Writes out what is still queued.
+        sessionRecorder->join();
+        delete sessionRecorder;
+        sessionRecorder = NULL;
     }
     return 0;
 }
@@ -598,8 +1361,10 @@ void set_up_udp_socket(SOCKET *newSocket, SOCKADDR_IN *socketAddress, int recv)
     }
 }
 
-void loadConfig(std::string & file)
+void loadConfig(std::string & file, RuntimeConfig & runtime)
 {
+    runtime.filterRules.clear();
+    memset(runtime.hapticSet, 0, sizeof(runtime.hapticSet));
     std::ifstream infile(file.c_str());
     std::string line;
     if(infile.is_open())
@@ -609,9 +1374,338 @@ void loadConfig(std::string & file)
             std::getline(infile, line);
             int ivalue;
             float fvalue;
+            char svalue[64];
+            float fvalues[4];
+            FilterRule rule;
+            CameraExtrinsics extrinsics;
+            float * r = extrinsics.rotation;
+            float * t = extrinsics.translation;
             if(sscanf(line.c_str(), "camera %d", &ivalue) == 1)
             {
-                camera_index = ivalue;
+                camera_indices.push_back(ivalue);
+            }
+            else if(sscanf(line.c_str(),
+                           "camera_extrinsics %d %f %f %f %f %f %f %f %f %f %f %f %f",
+                           &extrinsics.camera, &r[0], &r[1], &r[2], &r[3],
+                           &r[4], &r[5], &r[6], &r[7], &r[8], &t[0], &t[1],
+                           &t[2]) == 13)
+            {
+                camera_extrinsics.push_back(extrinsics);
+            }
+            else if(sscanf(line.c_str(), "grab_ahead %d", &ivalue) == 1)
+            {
+                grab_ahead = ivalue;
+            }
+            else if(sscanf(line.c_str(), "camera_max_age %f", &fvalue) == 1)
+            {
+                camera_max_age = fvalue;
+            }
+            else if(sscanf(line.c_str(), "video_fps %f", &fvalue) == 1)
+            {
+                video_fps = fvalue;
+            }
+            else if(sscanf(line.c_str(), "video_frames %d", &ivalue) == 1)
+            {
+                video_frames = ivalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_port %d", &ivalue) == 1)
+            {
+                debugStreamSettings.port = ivalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_camera %d", &ivalue) == 1)
+            {
+                debugStreamSettings.camera = ivalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_fps %f", &fvalue) == 1)
+            {
+                debugStreamSettings.fps = fvalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_scale %f", &fvalue) == 1)
+            {
+                debugStreamSettings.scale = fvalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_quality %d", &ivalue) == 1)
+            {
+                debugStreamSettings.quality = ivalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_budget %f", &fvalue) == 1)
+            {
+                debugStreamSettings.budget = fvalue;
+            }
+            else if(sscanf(line.c_str(), "debug_stream_address %63s", svalue) == 1)
+            {
+                debugStreamSettings.address = svalue;
+            }
+            else if(sscanf(line.c_str(), "vrpn_min_rate %f", &fvalue) == 1)
+            {
+                vrpn_min_rate = fvalue;
+            }
+            else if(sscanf(line.c_str(), "vrpn_max_rate %f", &fvalue) == 1)
+            {
+                vrpn_max_rate = fvalue;
+            }
+            else if(line.compare(0, 12, "vrpn_analog ") == 0)
+            {
+                // vrpn_analog [accel] [gyro] [mag]
+                std::istringstream groups(line.substr(12));
+                std::string group;
+                vrpn_analog_accel = vrpn_analog_gyro = vrpn_analog_mag = false;
+                while(groups >> group)
+                {
+                    if(group == "accel")
+                    {
+                        vrpn_analog_accel = true;
+                    }
+                    else if(group == "gyro")
+                    {
+                        vrpn_analog_gyro = true;
+                    }
+                    else if(group == "mag")
+                    {
+                        vrpn_analog_mag = true;
+                    }
+                    else
+                    {
+                        printf("Unknown vrpn_analog group: '%s'\n", group.c_str());
+                    }
+                }
+            }
+            else if(sscanf(line.c_str(), "backend %63s", svalue) == 1)
+            {
+                backend_name = svalue;
+            }
+            else if(sscanf(line.c_str(), "sim_controllers %d", &ivalue) == 1)
+            {
+                simulationSettings.controllers = ivalue;
+            }
+            else if(sscanf(line.c_str(), "sim_rate %f", &fvalue) == 1)
+            {
+                simulationSettings.rate = fvalue;
+            }
+            else if(sscanf(line.c_str(), "sim_latency %f", &fvalue) == 1)
+            {
+                simulationSettings.latency = fvalue;
+            }
+            else if(sscanf(line.c_str(), "sim_fps %f", &fvalue) == 1)
+            {
+                simulationSettings.fps = fvalue;
+            }
+            else if(sscanf(line.c_str(), "sim_grab %f", &fvalue) == 1)
+            {
+                simulationSettings.grab = fvalue;
+            }
+            else if(sscanf(line.c_str(), "sim_track %f", &fvalue) == 1)
+            {
+                simulationSettings.track = fvalue;
+            }
+            else if(sscanf(line.c_str(), "sim_idle %d", &ivalue) == 1)
+            {
+                simulationSettings.idle = ivalue;
+            }
+            else if(sscanf(line.c_str(), "log_level %63s", svalue) == 1)
+            {
+                int level = logParseLevel(svalue);
+                if(level < 0)
+                {
+                    printf("Unknown log_level: '%s'\n", svalue);
+                }
+                else
+                {
+                    logSetLevel(level);
+                }
+            }
+            else if(line.compare(0, 9, "log_file ") == 0)
+            {
+                log_file = line.substr(9);
+                while(!log_file.empty() && isspace(log_file[log_file.size() - 1]))
+                {
+                    log_file.erase(log_file.size() - 1);
+                }
+            }
+            else if(sscanf(line.c_str(), "trace_buffer %d", &ivalue) == 1)
+            {
+                traceSetBufferSize(ivalue);
+            }
+            else if(line.compare(0, 11, "trace_file ") == 0)
+            {
+                trace_file = line.substr(11);
+                while(!trace_file.empty() && isspace(trace_file[trace_file.size() - 1]))
+                {
+                    trace_file.erase(trace_file.size() - 1);
+                }
+            }
+            else if(sscanf(line.c_str(), "trace %d", &ivalue) == 1)
+            {
+                traceEnabled = ivalue;
+            }
+            else if(sscanf(line.c_str(), "max_controllers %d", &ivalue) == 1)
+            {
+                max_controllers = ivalue;
+            }
+            else if(sscanf(line.c_str(), "controller_timeout %f", &fvalue) == 1)
+            {
+                controller_timeout = fvalue;
+            }
+            else if(sscanf(line.c_str(), "led_refresh %f", &fvalue) == 1)
+            {
+                led_refresh = fvalue;
+            }
+            else if(line.compare(0, 13, "event_trigger") == 0)
+            {
+                // No levels turns the trigger events off.
+                event_trigger_count = sscanf(line.c_str(), "event_trigger %d %d %d %d",
+                                             &event_triggers[0], &event_triggers[1],
+                                             &event_triggers[2], &event_triggers[3]);
+                if(event_trigger_count < 0)
+                {
+                    event_trigger_count = 0;
+                }
+            }
+            else if(sscanf(line.c_str(), "event_retransmit %f", &fvalue) == 1)
+            {
+                event_retransmit = fvalue;
+            }
+            else if(sscanf(line.c_str(), "send_on_change %d", &ivalue) == 1)
+            {
+                send_on_change = ivalue;
+            }
+            else if(sscanf(line.c_str(), "subscriber_timeout %f", &fvalue) == 1)
+            {
+                subscriber_timeout = fvalue;
+            }
+            else if(sscanf(line.c_str(), "keyframe_interval %f", &fvalue) == 1)
+            {
+                keyframe_interval = fvalue;
+            }
+            else if(sscanf(line.c_str(), "deadband_imu %f", &fvalue) == 1)
+            {
+                deadband_imu = fvalue;
+            }
+            else if(sscanf(line.c_str(), "deadband_quaternion %f", &fvalue) == 1)
+            {
+                deadband_quaternion = fvalue;
+            }
+            else if(sscanf(line.c_str(), "deadband_position %f", &fvalue) == 1)
+            {
+                deadband_position = fvalue;
+            }
+            else if(sscanf(line.c_str(), "history_size %d", &ivalue) == 1)
+            {
+                history_size = ivalue;
+            }
+            else if(sscanf(line.c_str(), "history_rate %d", &ivalue) == 1)
+            {
+                history_rate = ivalue;
+            }
+            else if(sscanf(line.c_str(), "redundancy %d", &ivalue) == 1)
+            {
+                redundancy = ivalue < 0 ? 0
+                        : (ivalue > MAX_REDUNDANCY ? MAX_REDUNDANCY : ivalue);
+            }
+            else if(line.compare(0, 7, "haptic ") == 0)
+            {
+                HapticPattern pattern;
+                if(parseHapticPattern(line.c_str() + 7, ivalue, pattern))
+                {
+                    runtime.hapticPatterns[ivalue] = pattern;
+                    runtime.hapticSet[ivalue] = 1;
+                }
+                else
+                {
+                    LOG(LOG_WARNING, "Invalid haptic pattern: '%s'", line.c_str());
+                }
+            }
+            else if(sscanf(line.c_str(), "calibration_cache_age %d", &ivalue) == 1)
+            {
+                calibration_cache_age = ivalue;
+            }
+            else if(line.compare(0, 15, "control_socket ") == 0)
+            {
+                control_socket = line.substr(15);
+                while(!control_socket.empty()
+                        && isspace(control_socket[control_socket.size() - 1]))
+                {
+                    control_socket.erase(control_socket.size() - 1);
+                }
+            }
+            else if(line.compare(0, 18, "calibration_cache ") == 0)
+            {
+                calibration_cache_file = line.substr(18);
+                while(!calibration_cache_file.empty()
+                        && isspace(calibration_cache_file[calibration_cache_file.size() - 1]))
+                {
+                    calibration_cache_file.erase(calibration_cache_file.size() - 1);
+                }
+            }
+            else if(line.compare(0, 7, "record ") == 0)
+            {
+                record_file = line.substr(7);
+                while(!record_file.empty() && isspace(record_file[record_file.size() - 1]))
+                {
+                    record_file.erase(record_file.size() - 1);
+                }
+            }
+            else if(line.compare(0, 7, "replay ") == 0)
+            {
+                replay_file = line.substr(7);
+                while(!replay_file.empty() && isspace(replay_file[replay_file.size() - 1]))
+                {
+                    replay_file.erase(replay_file.size() - 1);
+                }
+                backend_name = "replay";
+            }
+            else if(sscanf(line.c_str(), "replay_speed %f", &fvalue) == 1)
+            {
+                replay_speed = fvalue;
+            }
+            else if(line.compare(0, 6, "video ") == 0)
+            {
+                video_file = line.substr(6);
+                while(!video_file.empty() && isspace(video_file[video_file.size() - 1]))
+                {
+                    video_file.erase(video_file.size() - 1);
+                }
+            }
+            else if(sscanf(line.c_str(), "fusion_accel_noise %f", &fvalue) == 1)
+            {
+                fusionSettings.accelNoise = fvalue;
+            }
+            else if(sscanf(line.c_str(), "fusion_accel %d", &ivalue) == 1)
+            {
+                fusionSettings.useAccel = ivalue;
+            }
+            else if(sscanf(line.c_str(), "fusion_coast %f", &fvalue) == 1)
+            {
+                fusionSettings.coastTime = fvalue;
+            }
+            else if(sscanf(line.c_str(), "fusion_gravity_time %f", &fvalue) == 1)
+            {
+                fusionSettings.gravityTime = fvalue;
+            }
+            else if(sscanf(line.c_str(), "fusion_align %f %f %f %f",
+                           &fvalues[0], &fvalues[1], &fvalues[2],
+                           &fvalues[3]) == 4)
+            {
+                for(int i = 0; i < 4; i++)
+                {
+                    fusionSettings.alignment[i] = fvalues[i];
+                }
+            }
+            else if(sscanf(line.c_str(), "fusion_position_noise %f %f %f",
+                           &fvalues[0], &fvalues[1], &fvalues[2]) == 3)
+            {
+                for(int i = 0; i < 3; i++)
+                {
+                    fusionSettings.positionNoise[i] = fvalues[i];
+                }
+            }
+            else if(sscanf(line.c_str(), "fusion %d", &ivalue) == 1)
+            {
+                fusionSettings.enabled = ivalue;
+            }
+            else if(parseFilterRule(line.c_str(), rule))
+            {
+                runtime.filterRules.push_back(rule);
             }
         }
     }
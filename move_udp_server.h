@@ -29,6 +29,11 @@
 #define MOVE_UDP_SERVER_H
 
 #include "Mutex.hpp"
+#include "Event.hpp"
+#include "position_fusion.h"
+#include "smoothing_filter.h"
+#include "camera_fusion.h"
+#include "haptics.h"
 
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -59,13 +64,45 @@ typedef struct sockaddr SOCKADDR;
 
 void set_up_udp_socket(SOCKET *newSocket, SOCKADDR_IN *socketAddress, int recv);
 
+class TrackerFrameMailbox;
+class FrameTripleBuffer;
+class MjpegStream;
+class SubscriberTable;
+class SampleHistory;
+
+/**
+ * Orientation calibration of a controller. Calibration is requested by the
+ * server and completed by the physical thread when MOVE is pressed.
+ **/
+enum OrientationCalibration
+{
+    ORIENTATION_UNAVAILABLE = 0, // USB, no orientation data.
+    ORIENTATION_UNCALIBRATED,
+    ORIENTATION_WAITING, // Waiting for the MOVE button.
+    ORIENTATION_CALIBRATED
+};
+
+/**
+ * Lifecycle of a controller slot. Slots are filled and retired by the
+ * ControllerMonitor; the polling and tracking threads only acknowledge.
+ **/
+enum ControllerSlotState
+{
+    SLOT_EMPTY = 0,
+    SLOT_CONNECTING, // Connected, waiting for the cameras to calibrate it.
+    SLOT_ACTIVE,
+    SLOT_RETIRING // Stopped polling, waiting for every thread to let go of it.
+};
+
 /**
  *Data struct for controller LEDs/Rumble control via UDP.
  **/
 typedef struct _ControllerData
 {
         unsigned char rumble; // Current rumble level of the controller
-        int rumbleTimeout; // Timeout after recieving rumble message. Stops battery wasting.
+        double rumbleUntil; // Rumble message runs out at this time. Stops battery wasting.
+        int hapticPattern; // Playing haptic pattern, -1 for none.
+        double hapticStart; // Time the pattern was triggered.
         unsigned char r; // Current color of the controller.
         unsigned char g;
         unsigned char b;
@@ -75,22 +112,38 @@ typedef struct _ControllerData
         int resetOrientation; // If 1, will calibrate the orientation of the controller
         int changeLight; // If 1, will set the color of the controller to r, g, b.
         int trackerLight; // If 1, will set the color of the controller to tr, tg, tb.
+        int orientationState; // OrientationCalibration
+        int slotState; // ControllerSlotState
+        int generation; // Incremented each time the slot gets a new controller.
+        int released; // Threads that have let go of a retiring controller.
+        unsigned int trackerDone; // Bit per camera that has finished calibrating a connecting controller.
+        double lastPoll; // Time of the last successful poll.
+        double commandTime; // Arrival of the oldest "d" message not yet applied, 0 if none.
 } ControllerData;
 
 /**
- * Structure to send to the tracking thread.
+ * Structure to send to the tracking threads (capture and send stage).
  **/
 typedef struct TrackerData
 {
-        PSMoveTracker* tracker;
+        PSMoveTracker **trackers; // One per camera
+        int totalCameras;
         PSMove **controllers;
-        int totalConnectedMoves;
+        ControllerData *controllerData; // Slot states, protected by controllerMutex.
+        int totalConnectedMoves; // Number of controller slots.
         int *showTracker;
+        int *shownCamera; // Camera whose frames are annotated for showTracker.
         int *okayToSend;
         SOCKET *udpSocket;
-        SOCKADDR_IN *sendAddress;
-        void * frame;
-        Mutex * frameMutex;
+        SubscriberTable *subscribers;
+        FrameTripleBuffer * frameBuffers; // One per camera, capture stage -> tracker window.
+        MjpegStream * debugStream; // NULL unless debug_stream_port is set.
+        TrackerFrameMailbox * mailbox; // Capture stages -> send stage.
+        CameraFusion * cameraFusion; // Only used by the send stage.
+        float framePace; // If > 0, frames are paced to this rate (recorded input).
+        unsigned int frameLimit; // If > 0, stop after this many frames and report.
+        int grabAhead; // Each camera has a grab thread, see TrackerGrabber.
+        int *closeServer;
 } TRACKERDATA, *PTRACKERDATA;
 
 /**
@@ -104,9 +157,24 @@ typedef struct RecvThreadData
         SOCKADDR_IN *recvAddress;
         int *okayToSend;
         SOCKET *udpSocketOut;
-        SOCKADDR_IN *sendAddress;
+        SubscriberTable *subscribers;
+        SampleHistory *history; // NULL without history_size.
+        int historyRate; // "G" packets a subscriber gets per HISTORY_WINDOW.
 } RECVTHREADDATA, *PRECVTHREADDATA;
 
+/**
+ * Structure to send to the controller monitor.
+ **/
+typedef struct MonitorData
+{
+        int totalSlots;
+        PSMove **controllers;
+        ControllerData *controllerData;
+        int totalCameras; // Cameras that have to calibrate a new controller, 0 without tracking.
+        int releaseCount; // Threads that must let go of a controller before it is disconnected.
+        float timeout; // Seconds without a successful poll before a controller is retired.
+} MONITORDATA, *PMONITORDATA;
+
 /**
  * Structure to send to the recv thread.
  **/
@@ -118,15 +186,32 @@ typedef struct SendThreadData
         int *okayToSend;
         int *trackingEnabled;
         SOCKET *udpSocket;
-        SOCKADDR_IN *sendAddress;
+        SubscriberTable *subscribers;
+        float ledRefresh; // Seconds between LED writes when nothing changed.
+        std::vector<int> eventThresholds; // Trigger levels reported as button events.
+        float eventRetransmit; // Seconds before an unacknowledged event is sent again.
+        SampleHistory *history; // NULL without history_size.
 } SENDTHREADDATA, *PSENDTHREADDATA;
 
+/**
+ * Latest state of a controller, shared with the VRPN server. x, y, z and
+ * the quaternion are the published values: filtered and/or fused when
+ * configured. The raw tracker location and orientation are kept beside them.
+ **/
 struct MoveState
 {
         unsigned int buttons;
         float qw, qx, qy, qz;
         float x, y, z;
+        float rqw, rqx, rqy, rqz;
+        float rx, ry, rz;
+        float vx, vy, vz; // Velocity, cm/s.
+        float lax, lay, laz; // Acceleration without gravity, cm/s^2.
+        float ax, ay, az, gx, gy, gz, mx, my, mz; // Raw IMU, as in the "a" packet.
         float trigger;
+        unsigned int sequence; // Incremented only when a published value actually changes.
+        double updateTime; // getTime() of the last sequence increment.
+        PositionFusion * fusion; // NULL unless fusion is enabled in the config.
         Mutex * lock;
 };
 
@@ -134,8 +219,10 @@ struct MoveState
  * \brief Sets up a simple UDP server which locally sends out PSMove data.
  * Sent in two formats: a Buttons Analogue ax ay az gx gy gz mx my mz
  *					 : b tx ty tz currentlyTracking
+ * With fusion enabled also: f fx fy fz currentlyTracking (at the physical rate)
+ * Streams with a smoothing filter have the filtered values appended.
  */
-int udp_move_server(PSMove **controllers,
+int udp_move_server(PSMove **controllers, int totalSlots,
                     std::vector<MoveState*> & moveStateList);
 
 // Showing/hiding tracker info mutex. Protects showTracker.
@@ -144,7 +231,22 @@ extern Mutex * trackerMutex;
 // Protects rumble/led.
 extern Mutex * controllerMutex;
 
-#define RUMBLE_TIMEOUT 150
+// Signalled after MoveStates have been updated, wakes the VRPN server.
+extern Event * moveStateEvent;
+
+// IMU/camera fusion settings from the config file.
+extern FusionSettings fusionSettings;
+
+// Smoothing filters from the config file, applied in order.
+extern std::vector<FilterRule> filterRules;
+// Incremented when filterRules are reloaded. Both are protected by controllerMutex.
+extern int filterVersion;
+
+// Haptic patterns uploaded by the client or set in the config file.
+// Protected by controllerMutex.
+extern HapticPattern hapticPatterns[HAPTIC_MAX_PATTERNS];
+
+#define RUMBLE_TIMEOUT_MS 1500
 #define SEND_PORT 23459
 #define RECV_PORT 23460
 
@@ -0,0 +1,338 @@
+#include "position_fusion.h"
+
+#include <cmath>
+
+// Standard gravity in cm/s^2, the tracker reports location in cm.
+#define GRAVITY_CM 980.665
+
+// Bound on a single prediction step, stops a stalled thread from throwing the state away.
+#define MAX_PREDICT_STEP 0.1
+
+void defaultFusionSettings(FusionSettings & settings)
+{
+    settings.enabled = 0;
+    settings.useAccel = 1;
+    settings.coastTime = 0.25f;
+    settings.accelNoise = 400.0f;
+    settings.positionNoise[0] = 0.3f;
+    settings.positionNoise[1] = 0.3f;
+    settings.positionNoise[2] = 1.5f;
+    settings.gravityTime = 2.0f;
+    settings.alignment[0] = 1.0f;
+    settings.alignment[1] = settings.alignment[2] = settings.alignment[3] = 0.0f;
+}
+
+PositionFusion::PositionFusion(const FusionSettings & settings)
+{
+    _settings = settings;
+    // A hand typed alignment is rarely of unit length.
+    float * align = _settings.alignment;
+    double norm = sqrt(align[0] * align[0] + align[1] * align[1]
+                       + align[2] * align[2] + align[3] * align[3]);
+    for(int i = 0; i < 4; i++)
+    {
+        align[i] = norm > 0.0 ? (float)(align[i] / norm) : (i == 0 ? 1.0f : 0.0f);
+    }
+    for(int i = 0; i < 3; i++)
+    {
+        _pos[i] = _vel[i] = 0.0;
+        _accel[i] = _gravity[i] = 0.0;
+        _cov[i][0] = _cov[i][2] = 1e6;
+        _cov[i][1] = 0.0;
+    }
+    _gravityInit = false;
+    _lastAccelTime = 0.0;
+    _lastTime = 0.0;
+    _lastMeasurement = -1.0;
+    _init = false;
+    _historyStart = 0;
+    _historyCount = 0;
+}
+
+// Rotate v by the quaternion q (w, x, y, z).
+static void rotate(const double q[4], const double v[3], double out[3])
+{
+    // t = 2 * cross(q.xyz, v)
+    double tx = 2.0 * (q[2] * v[2] - q[3] * v[1]);
+    double ty = 2.0 * (q[3] * v[0] - q[1] * v[2]);
+    double tz = 2.0 * (q[1] * v[1] - q[2] * v[0]);
+    // out = v + w * t + cross(q.xyz, t)
+    out[0] = v[0] + q[0] * tx + (q[2] * tz - q[3] * ty);
+    out[1] = v[1] + q[0] * ty + (q[3] * tx - q[1] * tz);
+    out[2] = v[2] + q[0] * tz + (q[1] * ty - q[2] * tx);
+}
+
+PositionFusion::State & PositionFusion::state(int i)
+{
+    return _history[(_historyStart + i) % FUSION_HISTORY];
+}
+
+void PositionFusion::save(State & state) const
+{
+    state.time = _lastTime;
+    for(int i = 0; i < 3; i++)
+    {
+        state.pos[i] = _pos[i];
+        state.vel[i] = _vel[i];
+        state.accel[i] = _accel[i];
+        for(int j = 0; j < 3; j++)
+        {
+            state.cov[i][j] = _cov[i][j];
+        }
+    }
+}
+
+void PositionFusion::restore(const State & state)
+{
+    _lastTime = state.time;
+    for(int i = 0; i < 3; i++)
+    {
+        _pos[i] = state.pos[i];
+        _vel[i] = state.vel[i];
+        _accel[i] = state.accel[i];
+        for(int j = 0; j < 3; j++)
+        {
+            _cov[i][j] = state.cov[i][j];
+        }
+    }
+}
+
+void PositionFusion::push()
+{
+    if(_historyCount > 0 && state(_historyCount - 1).time == _lastTime)
+    {
+        save(state(_historyCount - 1));
+        return;
+    }
+    if(_historyCount == FUSION_HISTORY)
+    {
+        _historyStart = (_historyStart + 1) % FUSION_HISTORY;
+        _historyCount--;
+    }
+    save(state(_historyCount++));
+}
+
+int PositionFusion::insert(int at)
+{
+    if(_historyCount == FUSION_HISTORY)
+    {
+        _historyStart = (_historyStart + 1) % FUSION_HISTORY;
+        _historyCount--;
+        at--;
+    }
+    _historyCount++;
+    for(int i = _historyCount - 1; i > at; i--)
+    {
+        state(i) = state(i - 1);
+    }
+    return at;
+}
+
+void PositionFusion::propagate(double time)
+{
+    // Time only moves forward, late measurements are handled by correct().
+    double dt = time - _lastTime;
+    if(!_init || dt <= 0.0)
+    {
+        return;
+    }
+    _lastTime = time;
+    if(dt > MAX_PREDICT_STEP)
+    {
+        dt = MAX_PREDICT_STEP;
+    }
+
+    // Once coasting has run out hold the last position rather than drift.
+    bool coasting = !tracking(time);
+    double q = _settings.accelNoise * _settings.accelNoise;
+    double dt2 = dt * dt;
+
+    for(int i = 0; i < 3; i++)
+    {
+        double a = coasting ? 0.0 : _accel[i];
+        if(coasting)
+        {
+            _vel[i] = 0.0;
+        }
+        _pos[i] += _vel[i] * dt + 0.5 * a * dt2;
+        _vel[i] += a * dt;
+
+        // P = F P F' + Q, F = [1 dt; 0 1]
+        double pp = _cov[i][0], pv = _cov[i][1], vv = _cov[i][2];
+        _cov[i][0] = pp + 2.0 * dt * pv + dt2 * vv + q * dt2 * dt2 * 0.25;
+        _cov[i][1] = pv + dt * vv + q * dt2 * dt * 0.5;
+        _cov[i][2] = vv + q * dt2;
+    }
+}
+
+void PositionFusion::predict(double time, float ax, float ay, float az,
+                             float qw, float qx, float qy, float qz)
+{
+    propagate(time);
+
+    if(!_settings.useAccel)
+    {
+        return;
+    }
+
+    double q[4] = { qw, qx, qy, qz };
+    double align[4] = { _settings.alignment[0], _settings.alignment[1],
+                        _settings.alignment[2], _settings.alignment[3] };
+    double body[3] = { ax, ay, az };
+    double oriented[3], world[3];
+    rotate(q, body, oriented);
+    rotate(align, oriented, world);
+
+    if(!_gravityInit)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            _gravity[i] = world[i];
+        }
+        _gravityInit = true;
+    }
+
+    // Slow running average of the rotated accelerometer, removes gravity and bias.
+    double alpha = 0.0;
+    double dt = time - _lastAccelTime;
+    _lastAccelTime = time;
+    if(_settings.gravityTime > 0.0f && dt > 0.0)
+    {
+        alpha = dt / _settings.gravityTime;
+        if(alpha > 1.0)
+        {
+            alpha = 1.0;
+        }
+    }
+    for(int i = 0; i < 3; i++)
+    {
+        _gravity[i] += alpha * (world[i] - _gravity[i]);
+        _accel[i] = (world[i] - _gravity[i]) * GRAVITY_CM;
+    }
+    if(_init)
+    {
+        push();
+    }
+}
+
+void PositionFusion::correct(double time, float x, float y, float z)
+{
+    double meas[3] = { x, y, z };
+
+    if(!_init || !tracking(time))
+    {
+        // (Re)acquire: snap to the measurement, velocity unknown.
+        for(int i = 0; i < 3; i++)
+        {
+            double r = _settings.positionNoise[i];
+            _pos[i] = meas[i];
+            _vel[i] = 0.0;
+            _cov[i][0] = r * r;
+            _cov[i][1] = 0.0;
+            _cov[i][2] = 100.0 * 100.0;
+        }
+        _init = true;
+        _lastTime = time;
+        _lastMeasurement = time;
+        _historyStart = 0;
+        _historyCount = 0;
+        push();
+        return;
+    }
+
+    if(time >= _lastTime)
+    {
+        propagate(time);
+        update(meas);
+        _lastMeasurement = time;
+        push();
+        return;
+    }
+
+    // Late: go back to the newest state at or before the measurement.
+    int k = _historyCount - 1;
+    while(k >= 0 && state(k).time > time)
+    {
+        k--;
+    }
+    if(time > _lastMeasurement)
+    {
+        _lastMeasurement = time;
+    }
+    if(k < 0)
+    {
+        // Older than the history, bring it up to the current time.
+        double late = _lastTime - time;
+        for(int i = 0; i < 3; i++)
+        {
+            meas[i] += _vel[i] * late;
+        }
+        update(meas);
+        push();
+        return;
+    }
+
+    restore(state(k));
+    propagate(time);
+    update(meas);
+    int at = state(k).time == time ? k : insert(k + 1);
+    save(state(at));
+    // Predict the later steps again, each with its own acceleration.
+    for(int i = at + 1; i < _historyCount; i++)
+    {
+        State & later = state(i);
+        propagate(later.time);
+        for(int j = 0; j < 3; j++)
+        {
+            _accel[j] = later.accel[j];
+        }
+        save(later);
+    }
+}
+
+void PositionFusion::update(const double meas[3])
+{
+    for(int i = 0; i < 3; i++)
+    {
+        double r = _settings.positionNoise[i];
+        double pp = _cov[i][0], pv = _cov[i][1], vv = _cov[i][2];
+        double s = pp + r * r;
+        double kp = pp / s;
+        double kv = pv / s;
+        double innovation = meas[i] - _pos[i];
+
+        _pos[i] += kp * innovation;
+        _vel[i] += kv * innovation;
+
+        _cov[i][0] = (1.0 - kp) * pp;
+        _cov[i][1] = (1.0 - kp) * pv;
+        _cov[i][2] = vv - kv * pv;
+    }
+}
+
+bool PositionFusion::tracking(double time) const
+{
+    return _init && _lastMeasurement >= 0.0
+            && (time - _lastMeasurement) <= _settings.coastTime;
+}
+
+void PositionFusion::getPosition(float & x, float & y, float & z) const
+{
+    x = (float)_pos[0];
+    y = (float)_pos[1];
+    z = (float)_pos[2];
+}
+
+void PositionFusion::getVelocity(float & x, float & y, float & z) const
+{
+    x = (float)_vel[0];
+    y = (float)_vel[1];
+    z = (float)_vel[2];
+}
+
+void PositionFusion::getAcceleration(float & x, float & y, float & z) const
+{
+    x = (float)_accel[0];
+    y = (float)_accel[1];
+    z = (float)_accel[2];
+}
@@ -0,0 +1,111 @@
+#ifndef POSITION_FUSION_H
+#define POSITION_FUSION_H
+
+// States kept for camera measurements that arrive after later predictions,
+// a few pipeline latencies at the poll rate.
+#define FUSION_HISTORY 64
+
+/**
+ * Settings for the IMU/camera position fusion, read from the config file.
+ **/
+struct FusionSettings
+{
+        int enabled; // If 1, position is fused and sent at the physical loop rate.
+        int useAccel; // If 1, the accelerometer drives the prediction step.
+        float coastTime; // Seconds to keep predicting after tracking is lost.
+        float accelNoise; // Process noise (cm/s^2) of the acceleration input.
+        float positionNoise[3]; // Measurement noise (cm) of the tracker per axis. z is depth.
+        float gravityTime; // Time constant (s) of the gravity/bias estimate.
+        // Rotation (w x y z) from the orientation frame to the camera frame,
+        // identity if the controller faced the camera when it was calibrated.
+        float alignment[4];
+};
+
+void defaultFusionSettings(FusionSettings & settings);
+
+/**
+ * Kalman filter combining the tracker location with the accelerometer.
+ *
+ * Each axis carries a position/velocity state. predict() is called on every
+ * physical poll with the accelerometer and orientation, correct() whenever
+ * the camera sees the controller. Gravity and accelerometer bias are removed
+ * with a slow running average.
+ *
+ * Camera positions are older than the last prediction by the time they
+ * arrive. The state after every prediction is kept for FUSION_HISTORY
+ * steps; a late measurement goes back to the state at its time, is
+ * applied there and the later steps are predicted again with the same
+ * acceleration. One older than the history is moved to the current time
+ * along the velocity and applied to the current state.
+ *
+ * The orientation is relative to the controller's pose at its last
+ * orientation reset, there is no automatic alignment with the camera. The
+ * accelerometer is rotated into that frame and then by the configured
+ * alignment (fusion_align), which is the identity when the controller was
+ * held facing the camera while calibrating. A wrong alignment turns real
+ * motion into acceleration along the wrong axes; fusion_check measures the
+ * resulting error on a recorded session.
+ *
+ * Not thread safe, guard with the MoveState lock.
+ **/
+class PositionFusion
+{
+    public:
+        PositionFusion(const FusionSettings & settings);
+
+        void predict(double time, float ax, float ay, float az, float qw,
+                     float qx, float qy, float qz);
+        void correct(double time, float x, float y, float z);
+
+        // False until the first measurement and once the coast time has run out.
+        bool tracking(double time) const;
+        void getPosition(float & x, float & y, float & z) const;
+        void getVelocity(float & x, float & y, float & z) const;
+        // Gravity compensated world acceleration from the last prediction, cm/s^2.
+        void getAcceleration(float & x, float & y, float & z) const;
+
+    protected:
+        // State after a prediction or correction, and the acceleration
+        // that drives the next step.
+        struct State
+        {
+                double time;
+                double pos[3];
+                double vel[3];
+                double cov[3][3];
+                double accel[3];
+        };
+
+        void propagate(double time);
+        void update(const double meas[3]);
+        // History entry 'i', 0 is the oldest.
+        State & state(int i);
+        void save(State & state) const;
+        void restore(const State & state);
+        // Appends the current state, or replaces the newest at the same time.
+        void push();
+        // Makes room for a state before the entry at 'at', returns its index.
+        int insert(int at);
+
+        FusionSettings _settings;
+
+        double _pos[3];
+        double _vel[3];
+        // Covariance per axis: [pp, pv, vv]
+        double _cov[3][3];
+
+        double _accel[3]; // Gravity compensated acceleration in cm/s^2
+        double _gravity[3]; // Running estimate in g
+        bool _gravityInit;
+        double _lastAccelTime;
+
+        double _lastTime;
+        double _lastMeasurement;
+        bool _init;
+
+        State _history[FUSION_HISTORY]; // Ring, oldest at _historyStart.
+        int _historyStart;
+        int _historyCount;
+};
+
+#endif
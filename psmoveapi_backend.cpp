@@ -0,0 +1,209 @@
+#include "psmoveapi_backend.h"
+
+bool PSMoveApiBackend::init()
+{
+    return psmove_init(PSMOVE_CURRENT_VERSION) != PSMove_False;
+}
+
+void PSMoveApiBackend::shutdown()
+{
+    psmove_shutdown();
+}
+
+const char * PSMoveApiBackend::name()
+{
+    return "psmoveapi";
+}
+
+int PSMoveApiBackend::countConnected()
+{
+    return psmove_count_connected();
+}
+
+PSMove * PSMoveApiBackend::connect(int id)
+{
+    return psmove_connect_by_id(id);
+}
+
+void PSMoveApiBackend::disconnect(PSMove * move)
+{
+    psmove_disconnect(move);
+}
+
+enum PSMove_Connection_Type PSMoveApiBackend::connectionType(PSMove * move)
+{
+    return psmove_connection_type(move);
+}
+
+char * PSMoveApiBackend::getSerial(PSMove * move)
+{
+    return psmove_get_serial(move);
+}
+
+void PSMoveApiBackend::enableOrientation(PSMove * move)
+{
+    psmove_set_orientation_fusion_type(move, (PSMoveOrientation_Fusion_Type)3);
+    psmove_enable_orientation(move, PSMove_True);
+}
+
+bool PSMoveApiBackend::hasOrientation(PSMove * move)
+{
+    return psmove_has_orientation(move) != PSMove_False;
+}
+
+void PSMoveApiBackend::resetOrientation(PSMove * move)
+{
+    psmove_reset_orientation(move);
+}
+
+int PSMoveApiBackend::poll(PSMove * move)
+{
+    return psmove_poll(move);
+}
+
+unsigned int PSMoveApiBackend::getButtons(PSMove * move)
+{
+    return psmove_get_buttons(move);
+}
+
+int PSMoveApiBackend::getTrigger(PSMove * move)
+{
+    return psmove_get_trigger(move);
+}
+
+void PSMoveApiBackend::getAccelerometer(PSMove * move, float * x, float * y,
+                                        float * z)
+{
+    psmove_get_accelerometer_frame(move, Frame_SecondHalf, x, y, z);
+}
+
+void PSMoveApiBackend::getGyroscope(PSMove * move, float * x, float * y,
+                                    float * z)
+{
+    psmove_get_gyroscope_frame(move, Frame_SecondHalf, x, y, z);
+}
+
+void PSMoveApiBackend::getMagnetometer(PSMove * move, float * x, float * y,
+                                       float * z)
+{
+    psmove_get_magnetometer_vector(move, x, y, z);
+}
+
+void PSMoveApiBackend::getOrientation(PSMove * move, float * w, float * x,
+                                      float * y, float * z)
+{
+    psmove_get_orientation(move, w, x, y, z);
+}
+
+void PSMoveApiBackend::setLeds(PSMove * move, unsigned char r,
+                               unsigned char g, unsigned char b)
+{
+    psmove_set_leds(move, r, g, b);
+}
+
+void PSMoveApiBackend::setRumble(PSMove * move, unsigned char rumble)
+{
+    psmove_set_rumble(move, rumble);
+}
+
+void PSMoveApiBackend::updateLeds(PSMove * move)
+{
+    psmove_update_leds(move);
+}
+
+PSMoveTracker * PSMoveApiBackend::newTracker(int camera)
+{
+    if(camera < 0)
+    {
+        return psmove_tracker_new();
+    }
+    return psmove_tracker_new_with_camera(camera);
+}
+
+void PSMoveApiBackend::freeTracker(PSMoveTracker * tracker)
+{
+    psmove_tracker_free(tracker);
+}
+
+void PSMoveApiBackend::getTrackerSettings(PSMoveTracker * tracker,
+                                          PSMoveTrackerSettings * settings)
+{
+    psmove_tracker_get_settings(tracker, settings);
+}
+
+void PSMoveApiBackend::setTrackerSettings(PSMoveTracker * tracker,
+                                          PSMoveTrackerSettings * settings)
+{
+    psmove_tracker_set_settings(tracker, settings);
+}
+
+void PSMoveApiBackend::getTrackerSize(PSMoveTracker * tracker, int * width,
+                                      int * height)
+{
+    psmove_tracker_get_size(tracker, width, height);
+}
+
+enum PSMoveTracker_Status PSMoveApiBackend::enable(PSMoveTracker * tracker,
+                                                   PSMove * move)
+{
+    return psmove_tracker_enable(tracker, move);
+}
+
+enum PSMoveTracker_Status PSMoveApiBackend::enableWithColor(
+        PSMoveTracker * tracker, PSMove * move, unsigned char r,
+        unsigned char g, unsigned char b)
+{
+    return psmove_tracker_enable_with_color(tracker, move, r, g, b);
+}
+
+void PSMoveApiBackend::disable(PSMoveTracker * tracker, PSMove * move)
+{
+    psmove_tracker_disable(tracker, move);
+}
+
+void PSMoveApiBackend::getColor(PSMoveTracker * tracker, PSMove * move,
+                                unsigned char * r, unsigned char * g,
+                                unsigned char * b)
+{
+    psmove_tracker_get_color(tracker, move, r, g, b);
+}
+
+void PSMoveApiBackend::setAutoUpdateLeds(PSMoveTracker * tracker,
+                                         PSMove * move, bool enabled)
+{
+    psmove_tracker_set_auto_update_leds(tracker, move,
+                                        enabled ? PSMove_True : PSMove_False);
+}
+
+void PSMoveApiBackend::updateImage(PSMoveTracker * tracker)
+{
+    psmove_tracker_update_image(tracker);
+}
+
+void PSMoveApiBackend::update(PSMoveTracker * tracker, PSMove * move)
+{
+    psmove_tracker_update(tracker, move);
+}
+
+enum PSMoveTracker_Status PSMoveApiBackend::getStatus(PSMoveTracker * tracker,
+                                                      PSMove * move)
+{
+    return psmove_tracker_get_status(tracker, move);
+}
+
+void PSMoveApiBackend::getPosition(PSMoveTracker * tracker, PSMove * move,
+                                   float * x, float * y, float * radius)
+{
+    psmove_tracker_get_position(tracker, move, x, y, radius);
+}
+
+void PSMoveApiBackend::getLocation(PSMoveTracker * tracker, PSMove * move,
+                                   float * x, float * y, float * z)
+{
+    psmove_tracker_get_location(tracker, move, x, y, z);
+}
+
+void * PSMoveApiBackend::getFrame(PSMoveTracker * tracker)
+{
+    return psmove_tracker_get_frame(tracker);
+}
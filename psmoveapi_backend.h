@@ -0,0 +1,74 @@
+#ifndef PSMOVEAPI_BACKEND_H
+#define PSMOVEAPI_BACKEND_H
+
+#include "move_backend.h"
+
+/**
+ * Real controllers and cameras through psmoveapi.
+ **/
+class PSMoveApiBackend : public MoveBackend
+{
+    public:
+        virtual bool init();
+        virtual void shutdown();
+        virtual const char * name();
+
+        virtual int countConnected();
+        virtual PSMove * connect(int id);
+        virtual void disconnect(PSMove * move);
+        virtual enum PSMove_Connection_Type connectionType(PSMove * move);
+        virtual char * getSerial(PSMove * move);
+        virtual void enableOrientation(PSMove * move);
+        virtual bool hasOrientation(PSMove * move);
+        virtual void resetOrientation(PSMove * move);
+
+        virtual int poll(PSMove * move);
+        virtual unsigned int getButtons(PSMove * move);
+        virtual int getTrigger(PSMove * move);
+        virtual void getAccelerometer(PSMove * move, float * x, float * y,
+                                      float * z);
+        virtual void getGyroscope(PSMove * move, float * x, float * y,
+                                  float * z);
+        virtual void getMagnetometer(PSMove * move, float * x, float * y,
+                                     float * z);
+        virtual void getOrientation(PSMove * move, float * w, float * x,
+                                    float * y, float * z);
+
+        virtual void setLeds(PSMove * move, unsigned char r, unsigned char g,
+                             unsigned char b);
+        virtual void setRumble(PSMove * move, unsigned char rumble);
+        virtual void updateLeds(PSMove * move);
+
+        virtual PSMoveTracker * newTracker(int camera);
+        virtual void freeTracker(PSMoveTracker * tracker);
+        virtual void getTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void setTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void getTrackerSize(PSMoveTracker * tracker, int * width,
+                                    int * height);
+
+        virtual enum PSMoveTracker_Status enable(PSMoveTracker * tracker,
+                                                 PSMove * move);
+        virtual enum PSMoveTracker_Status enableWithColor(
+                PSMoveTracker * tracker, PSMove * move, unsigned char r,
+                unsigned char g, unsigned char b);
+        virtual void disable(PSMoveTracker * tracker, PSMove * move);
+        virtual void getColor(PSMoveTracker * tracker, PSMove * move,
+                              unsigned char * r, unsigned char * g,
+                              unsigned char * b);
+        virtual void setAutoUpdateLeds(PSMoveTracker * tracker, PSMove * move,
+                                       bool enabled);
+
+        virtual void updateImage(PSMoveTracker * tracker);
+        virtual void update(PSMoveTracker * tracker, PSMove * move);
+        virtual enum PSMoveTracker_Status getStatus(PSMoveTracker * tracker,
+                                                    PSMove * move);
+        virtual void getPosition(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * radius);
+        virtual void getLocation(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * z);
+        virtual void * getFrame(PSMoveTracker * tracker);
+};
+
+#endif
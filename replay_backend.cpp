@@ -0,0 +1,794 @@
+#include "replay_backend.h"
+#include "Timer.hpp"
+
+#include <opencv2/core/core_c.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// How long a caller waits when its stream has run out.
+#define REPLAY_IDLE_MS 10
+
+// Handles given out as PSMove and PSMoveTracker are really these.
+struct ReplayMove
+{
+        int id;
+        size_t next; // Next poll record of this controller.
+        SessionPoll poll; // The last one handed out.
+        unsigned char r, g, b;
+        unsigned char rumble;
+};
+
+struct ReplayTrack
+{
+        int enabled;
+        int found; // There is a record for the current frame.
+        SessionTrack track;
+        unsigned char r, g, b; // Colour given to enable.
+};
+
+struct ReplayTracker
+{
+        int camera;
+        size_t next; // Next frame record of this camera.
+        IplImage * image;
+        std::vector<ReplayTrack> controllers; // Per controller id.
+};
+
+static inline ReplayMove * replayed(PSMove * move)
+{
+    return reinterpret_cast<ReplayMove *>(move);
+}
+
+static inline ReplayTracker * replayed(PSMoveTracker * tracker)
+{
+    return reinterpret_cast<ReplayTracker *>(tracker);
+}
+
+static void sleepSeconds(double seconds)
+{
+    if(seconds <= 0.0)
+    {
+        return;
+    }
+#ifdef WIN32
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    usleep((useconds_t)(seconds * 1000000.0));
+#endif
+}
+
+ReplayBackend::ReplayBackend(const std::string & file, float speed)
+{
+    _file = file;
+    _speed = speed < 0.0f ? 0.0f : speed;
+    _data = NULL;
+    _size = 0;
+#ifdef WIN32
+    _fileHandle = INVALID_HANDLE_VALUE;
+    _mapping = NULL;
+#endif
+    _duration = 0.0;
+    _start = 0.0;
+    _played = 0.0;
+    _nextCommand = 0;
+    _openedCameras = 0;
+}
+
+ReplayBackend::~ReplayBackend()
+{
+    unmap();
+}
+
+bool ReplayBackend::map()
+{
+#ifdef WIN32
+    _fileHandle = CreateFileA(_file.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              NULL);
+    if(_fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    _size = GetFileSize(_fileHandle, NULL);
+    _mapping = CreateFileMapping(_fileHandle, NULL, PAGE_READONLY, 0, 0,
+                                 NULL);
+    if(!_mapping)
+    {
+        return false;
+    }
+    _data = (const unsigned char *)MapViewOfFile(_mapping, FILE_MAP_READ, 0,
+                                                 0, 0);
+#else
+    int fd = open(_file.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    _size = st.st_size;
+    void * data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        return false;
+    }
+    // Indexing reads it front to back.
+    madvise(data, _size, MADV_SEQUENTIAL);
+    _data = (const unsigned char *)data;
+#endif
+    return _data != NULL;
+}
+
+void ReplayBackend::unmap()
+{
+#ifdef WIN32
+    if(_data)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if(_mapping)
+    {
+        CloseHandle(_mapping);
+    }
+    if(_fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_fileHandle);
+    }
+    _mapping = NULL;
+    _fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if(_data)
+    {
+        munmap((void *)_data, _size);
+    }
+#endif
+    _data = NULL;
+    _size = 0;
+}
+
+const SessionRecordHeader * ReplayBackend::header(size_t offset) const
+{
+    return (const SessionRecordHeader *)(_data + offset);
+}
+
+void ReplayBackend::payload(size_t offset, void * data, size_t size) const
+{
+    memcpy(data, _data + offset + sizeof(SessionRecordHeader), size);
+}
+
+bool ReplayBackend::index()
+{
+    SessionFileHeader file;
+    if(_size < sizeof(file))
+    {
+        printf("Session log %s is empty.\n", _file.c_str());
+        return false;
+    }
+    memcpy(&file, _data, sizeof(file));
+    if(file.magic != SESSION_MAGIC || file.version != SESSION_VERSION)
+    {
+        printf("%s isn't a session log this server can read.\n",
+               _file.c_str());
+        return false;
+    }
+
+    size_t offset = sizeof(file);
+    while(offset + sizeof(SessionRecordHeader) <= _size)
+    {
+        SessionRecordHeader record;
+        memcpy(&record, _data + offset, sizeof(record));
+        if(offset + sizeof(record) + record.size > _size)
+        {
+            // The server was stopped while writing.
+            printf("Session log ends in a partial record, ignoring it.\n");
+            break;
+        }
+        if(record.time > _duration)
+        {
+            _duration = record.time;
+        }
+
+        switch(record.type)
+        {
+            case RECORD_CONTROLLER:
+                if(record.id >= _controllers.size())
+                {
+                    SessionController none;
+                    memset(&none, 0, sizeof(none));
+                    _controllers.resize(record.id + 1, none);
+                    _controllerTimes.resize(record.id + 1, 0.0);
+                    _polls.resize(record.id + 1);
+                }
+                payload(offset, &_controllers[record.id],
+                        sizeof(SessionController));
+                _controllerTimes[record.id] = record.time;
+                break;
+
+            case RECORD_CAMERA:
+            {
+                if(record.id >= _cameras.size())
+                {
+                    _cameras.resize(record.id + 1);
+                }
+                SessionCamera camera;
+                payload(offset, &camera, sizeof(camera));
+                _cameras[record.id].width = camera.width;
+                _cameras[record.id].height = camera.height;
+                break;
+            }
+
+            case RECORD_POLL:
+                if(record.id < _polls.size())
+                {
+                    _polls[record.id].push_back(offset);
+                }
+                break;
+
+            case RECORD_FRAME:
+                if(record.id < _cameras.size())
+                {
+                    ReplayCamera & camera = _cameras[record.id];
+                    camera.frames.push_back(offset);
+                    camera.firstTrack.push_back(camera.tracks.size());
+                }
+                break;
+
+            case RECORD_TRACK:
+            {
+                // Belongs to the last frame of its camera, both come from
+                // the same queue so nothing comes in between.
+                SessionTrack track;
+                payload(offset, &track, sizeof(track));
+                if(track.camera < _cameras.size()
+                        && !_cameras[track.camera].frames.empty())
+                {
+                    _cameras[track.camera].tracks.push_back(offset);
+                }
+                break;
+            }
+
+            case RECORD_COMMAND:
+                _commands.push_back(offset);
+                break;
+
+            default:
+                // Newer record type, skipped.
+                break;
+        }
+        offset += sizeof(record) + record.size;
+    }
+
+    // Commands are the only records from different threads that are
+    // compared by time.
+    for(size_t i = 1; i < _commands.size(); i++)
+    {
+        size_t command = _commands[i];
+        size_t j = i;
+        while(j > 0 && header(_commands[j - 1])->time > header(command)->time)
+        {
+            _commands[j] = _commands[j - 1];
+            j--;
+        }
+        _commands[j] = command;
+    }
+
+    size_t polls = 0, frames = 0;
+    for(size_t i = 0; i < _polls.size(); i++)
+    {
+        polls += _polls[i].size();
+    }
+    for(size_t i = 0; i < _cameras.size(); i++)
+    {
+        frames += _cameras[i].frames.size();
+    }
+    printf("Replaying %s: %.1f s, %d controllers (%lu polls), %d cameras (%lu frames), %lu commands, at %s.\n",
+           _file.c_str(), _duration, (int)_controllers.size(),
+           (unsigned long)polls, (int)_cameras.size(), (unsigned long)frames,
+           (unsigned long)_commands.size(),
+           _speed > 0.0f ? "recorded speed" : "full speed");
+    if(_speed > 0.0f && _speed != 1.0f)
+    {
+        printf("Replay speed x%.2f\n", _speed);
+    }
+
+    _pollsPlayed.assign(_polls.size(), 0);
+    _framesPlayed.assign(_cameras.size(), 0);
+    return true;
+}
+
+bool ReplayBackend::init()
+{
+    if(!map())
+    {
+        printf("Couldn't open session log '%s'.\n", _file.c_str());
+        return false;
+    }
+    if(!index())
+    {
+        return false;
+    }
+    return true;
+}
+
+void ReplayBackend::shutdown()
+{
+    unmap();
+}
+
+const char * ReplayBackend::name()
+{
+    return "replay";
+}
+
+bool ReplayBackend::realtime()
+{
+    return _speed > 0.0f;
+}
+
+bool ReplayBackend::started()
+{
+    _mutex.lock();
+    bool started = _start > 0.0;
+    _mutex.unlock();
+    return started;
+}
+
+double ReplayBackend::now()
+{
+    _mutex.lock();
+    double time = _played;
+    if(_speed > 0.0f)
+    {
+        time = _start > 0.0 ? (getTime() - _start) * _speed : 0.0;
+    }
+    _mutex.unlock();
+    return time;
+}
+
+void ReplayBackend::advance(double time)
+{
+    if(_speed > 0.0f)
+    {
+        return;
+    }
+    _mutex.lock();
+    if(time > _played)
+    {
+        _played = time;
+    }
+    _mutex.unlock();
+}
+
+bool ReplayBackend::finished()
+{
+    if(_speed > 0.0f)
+    {
+        // A second to let the last records go out.
+        return now() > _duration + 1.0;
+    }
+
+    bool done = true;
+    _mutex.lock();
+    for(size_t i = 0; i < _polls.size(); i++)
+    {
+        done = done && _pollsPlayed[i] >= _polls[i].size();
+    }
+    // Cameras without a camera line in the config never play.
+    for(int i = 0; i < _openedCameras; i++)
+    {
+        done = done && _framesPlayed[i] >= _cameras[i].frames.size();
+    }
+    _mutex.unlock();
+    return done;
+}
+
+bool ReplayBackend::takeCommand(char * message, int size)
+{
+    _mutex.lock();
+    if(_start == 0.0)
+    {
+        _start = getTime();
+    }
+    _mutex.unlock();
+
+    if(_nextCommand >= _commands.size()
+            || header(_commands[_nextCommand])->time > now())
+    {
+        return false;
+    }
+    size_t offset = _commands[_nextCommand++];
+    int length = header(offset)->size;
+    if(length > size)
+    {
+        length = size;
+    }
+    payload(offset, message, length);
+    message[length - 1] = 0;
+    return true;
+}
+
+int ReplayBackend::countConnected()
+{
+    if(_speed <= 0.0f)
+    {
+        return _controllers.size();
+    }
+    double time = now();
+    int count = 0;
+    for(size_t i = 0; i < _controllerTimes.size(); i++)
+    {
+        if(_controllerTimes[i] <= time)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+PSMove * ReplayBackend::connect(int id)
+{
+    if(id < 0 || id >= countConnected())
+    {
+        return NULL;
+    }
+    ReplayMove * move = new ReplayMove();
+    move->id = id;
+    move->next = 0;
+    memset(&move->poll, 0, sizeof(move->poll));
+    move->poll.orientation[0] = 1.0f;
+    move->r = move->g = move->b = 0;
+    move->rumble = 0;
+    return reinterpret_cast<PSMove *>(move);
+}
+
+void ReplayBackend::disconnect(PSMove * move)
+{
+    delete replayed(move);
+}
+
+enum PSMove_Connection_Type ReplayBackend::connectionType(PSMove * move)
+{
+    return (enum PSMove_Connection_Type)
+            _controllers[replayed(move)->id].connectionType;
+}
+
+char * ReplayBackend::getSerial(PSMove * move)
+{
+    const char * serial = _controllers[replayed(move)->id].serial;
+    char * copy = (char *)malloc(strlen(serial) + 1);
+    strcpy(copy, serial);
+    return copy;
+}
+
+void ReplayBackend::enableOrientation(PSMove * move)
+{
+}
+
+bool ReplayBackend::hasOrientation(PSMove * move)
+{
+    return replayed(move)->poll.hasOrientation != 0;
+}
+
+void ReplayBackend::resetOrientation(PSMove * move)
+{
+    // The recorded orientation already includes any reset.
+}
+
+int ReplayBackend::poll(PSMove * move)
+{
+    ReplayMove * replay = replayed(move);
+    const std::vector<size_t> & polls = _polls[replay->id];
+    size_t next = replay->next;
+    if(next >= polls.size())
+    {
+        return 0;
+    }
+
+    if(_speed > 0.0f)
+    {
+        double time = now();
+        if(header(polls[next])->time > time)
+        {
+            return 0;
+        }
+        // Reports missed by a slow poller are lost, as with the real thing.
+        while(next + 1 < polls.size() && header(polls[next + 1])->time <= time)
+        {
+            next++;
+        }
+    }
+    else
+    {
+        if(!started())
+        {
+            return 0;
+        }
+        advance(header(polls[next])->time);
+    }
+    payload(polls[next], &replay->poll, sizeof(SessionPoll));
+    replay->next = next + 1;
+
+    _mutex.lock();
+    if(replay->next > _pollsPlayed[replay->id])
+    {
+        _pollsPlayed[replay->id] = replay->next;
+    }
+    _mutex.unlock();
+    return 1;
+}
+
+unsigned int ReplayBackend::getButtons(PSMove * move)
+{
+    return replayed(move)->poll.buttons;
+}
+
+int ReplayBackend::getTrigger(PSMove * move)
+{
+    return replayed(move)->poll.trigger;
+}
+
+void ReplayBackend::getAccelerometer(PSMove * move, float * x, float * y,
+                                     float * z)
+{
+    const float * accel = replayed(move)->poll.accel;
+    *x = accel[0];
+    *y = accel[1];
+    *z = accel[2];
+}
+
+void ReplayBackend::getGyroscope(PSMove * move, float * x, float * y,
+                                 float * z)
+{
+    const float * gyro = replayed(move)->poll.gyro;
+    *x = gyro[0];
+    *y = gyro[1];
+    *z = gyro[2];
+}
+
+void ReplayBackend::getMagnetometer(PSMove * move, float * x, float * y,
+                                    float * z)
+{
+    const float * mag = replayed(move)->poll.mag;
+    *x = mag[0];
+    *y = mag[1];
+    *z = mag[2];
+}
+
+void ReplayBackend::getOrientation(PSMove * move, float * w, float * x,
+                                   float * y, float * z)
+{
+    const float * q = replayed(move)->poll.orientation;
+    *w = q[0];
+    *x = q[1];
+    *y = q[2];
+    *z = q[3];
+}
+
+void ReplayBackend::setLeds(PSMove * move, unsigned char r, unsigned char g,
+                            unsigned char b)
+{
+    ReplayMove * replay = replayed(move);
+    replay->r = r;
+    replay->g = g;
+    replay->b = b;
+}
+
+void ReplayBackend::setRumble(PSMove * move, unsigned char rumble)
+{
+    replayed(move)->rumble = rumble;
+}
+
+void ReplayBackend::updateLeds(PSMove * move)
+{
+}
+
+PSMoveTracker * ReplayBackend::newTracker(int camera)
+{
+    if(_openedCameras >= (int)_cameras.size())
+    {
+        printf("The session log has only %d cameras.\n",
+               (int)_cameras.size());
+        return NULL;
+    }
+    ReplayCamera & recorded = _cameras[_openedCameras];
+    ReplayTracker * tracker = new ReplayTracker();
+    tracker->camera = _openedCameras++;
+    tracker->next = 0;
+    tracker->image = cvCreateImage(cvSize(recorded.width, recorded.height),
+                                   IPL_DEPTH_8U, 3);
+    cvSetZero(tracker->image);
+    ReplayTrack none;
+    memset(&none, 0, sizeof(none));
+    tracker->controllers.assign(_controllers.size(), none);
+    return reinterpret_cast<PSMoveTracker *>(tracker);
+}
+
+void ReplayBackend::freeTracker(PSMoveTracker * tracker)
+{
+    ReplayTracker * replay = replayed(tracker);
+    cvReleaseImage(&replay->image);
+    delete replay;
+}
+
+void ReplayBackend::getTrackerSettings(PSMoveTracker * tracker,
+                                       PSMoveTrackerSettings * settings)
+{
+    memset(settings, 0, sizeof(PSMoveTrackerSettings));
+}
+
+void ReplayBackend::setTrackerSettings(PSMoveTracker * tracker,
+                                       PSMoveTrackerSettings * settings)
+{
+}
+
+void ReplayBackend::getTrackerSize(PSMoveTracker * tracker, int * width,
+                                   int * height)
+{
+    const ReplayCamera & camera = _cameras[replayed(tracker)->camera];
+    *width = camera.width;
+    *height = camera.height;
+}
+
+enum PSMoveTracker_Status ReplayBackend::enable(PSMoveTracker * tracker,
+                                                PSMove * move)
+{
+    return enableWithColor(tracker, move, 0, 0, 0);
+}
+
+enum PSMoveTracker_Status ReplayBackend::enableWithColor(
+        PSMoveTracker * tracker, PSMove * move, unsigned char r,
+        unsigned char g, unsigned char b)
+{
+    ReplayTrack & track = replayed(tracker)->controllers[replayed(move)->id];
+    track.enabled = 1;
+    track.r = r;
+    track.g = g;
+    track.b = b;
+    return Tracker_CALIBRATED;
+}
+
+void ReplayBackend::disable(PSMoveTracker * tracker, PSMove * move)
+{
+    replayed(tracker)->controllers[replayed(move)->id].enabled = 0;
+}
+
+void ReplayBackend::getColor(PSMoveTracker * tracker, PSMove * move,
+                             unsigned char * r, unsigned char * g,
+                             unsigned char * b)
+{
+    const ReplayTrack & track =
+            replayed(tracker)->controllers[replayed(move)->id];
+    if(track.found)
+    {
+        *r = track.track.r;
+        *g = track.track.g;
+        *b = track.track.b;
+    }
+    else
+    {
+        *r = track.r;
+        *g = track.g;
+        *b = track.b;
+    }
+}
+
+void ReplayBackend::setAutoUpdateLeds(PSMoveTracker * tracker, PSMove * move,
+                                      bool enabled)
+{
+}
+
+void ReplayBackend::updateImage(PSMoveTracker * tracker)
+{
+    ReplayTracker * replay = replayed(tracker);
+    const ReplayCamera & camera = _cameras[replay->camera];
+    for(size_t i = 0; i < replay->controllers.size(); i++)
+    {
+        replay->controllers[i].found = 0;
+    }
+
+    size_t next = replay->next;
+    if(next >= camera.frames.size() || !started())
+    {
+        sleepSeconds(REPLAY_IDLE_MS / 1000.0);
+        return;
+    }
+
+    if(_speed > 0.0f)
+    {
+        // Blocks like a camera would until the frame is due.
+        sleepSeconds((header(camera.frames[next])->time - now()) / _speed);
+        double time = now();
+        while(next + 1 < camera.frames.size()
+                && header(camera.frames[next + 1])->time <= time)
+        {
+            next++;
+        }
+    }
+    else
+    {
+        advance(header(camera.frames[next])->time);
+    }
+    replay->next = next + 1;
+
+    size_t end = replay->next < camera.frames.size()
+            ? camera.firstTrack[replay->next] : camera.tracks.size();
+    for(size_t i = camera.firstTrack[next]; i < end; i++)
+    {
+        int id = header(camera.tracks[i])->id;
+        if(id < (int)replay->controllers.size())
+        {
+            ReplayTrack & track = replay->controllers[id];
+            payload(camera.tracks[i], &track.track, sizeof(SessionTrack));
+            track.found = 1;
+        }
+    }
+
+    _mutex.lock();
+    if(replay->next > _framesPlayed[replay->camera])
+    {
+        _framesPlayed[replay->camera] = replay->next;
+    }
+    _mutex.unlock();
+}
+
+void ReplayBackend::update(PSMoveTracker * tracker, PSMove * move)
+{
+    // Everything was read with the frame.
+}
+
+enum PSMoveTracker_Status ReplayBackend::getStatus(PSMoveTracker * tracker,
+                                                   PSMove * move)
+{
+    const ReplayTrack & track =
+            replayed(tracker)->controllers[replayed(move)->id];
+    if(!track.enabled)
+    {
+        return Tracker_NOT_CALIBRATED;
+    }
+    if(!track.found)
+    {
+        return Tracker_CALIBRATED;
+    }
+    return (enum PSMoveTracker_Status)track.track.status;
+}
+
+void ReplayBackend::getPosition(PSMoveTracker * tracker, PSMove * move,
+                                float * x, float * y, float * radius)
+{
+    const SessionTrack & track =
+            replayed(tracker)->controllers[replayed(move)->id].track;
+    *x = track.ux;
+    *y = track.uy;
+    *radius = track.radius;
+}
+
+void ReplayBackend::getLocation(PSMoveTracker * tracker, PSMove * move,
+                                float * x, float * y, float * z)
+{
+    const SessionTrack & track =
+            replayed(tracker)->controllers[replayed(move)->id].track;
+    *x = track.x;
+    *y = track.y;
+    *z = track.z;
+}
+
+void * ReplayBackend::getFrame(PSMoveTracker * tracker)
+{
+    // Images aren't recorded, the viewer draws the controllers onto a
+    // black one.
+    return replayed(tracker)->image;
+}
@@ -0,0 +1,154 @@
+#ifndef REPLAY_BACKEND_H
+#define REPLAY_BACKEND_H
+
+#include "move_backend.h"
+#include "session_log.h"
+#include "Mutex.hpp"
+
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/**
+ * Where one camera's frames and their tracking results are in the log.
+ **/
+struct ReplayCamera
+{
+        int width, height;
+        std::vector<size_t> frames; // Offset of each frame record.
+        std::vector<size_t> firstTrack; // Per frame, index into tracks.
+        std::vector<size_t> tracks; // Offsets of the track records.
+};
+
+/**
+ * Plays a session log (see session_log.h) back in place of the hardware.
+ *
+ * The log is memory mapped and indexed once in init(), after that records
+ * are read straight from the mapping. With speed > 0 records are handed out
+ * when they are due, speed 1 being the recorded timing. Speed 0 plays as
+ * fast as the server consumes it: every poll and every frame returns the
+ * next record, so poll and frame timing no longer match each other.
+ *
+ * Playback starts when a client connects, the first takeCommand() call.
+ * Controllers appear when they connected in the recording, cameras are
+ * handed out in the order they were opened. Client commands are replayed
+ * through takeCommand(). finished() turns true once everything is played.
+ **/
+class ReplayBackend : public MoveBackend
+{
+    public:
+        ReplayBackend(const std::string & file, float speed);
+        virtual ~ReplayBackend();
+
+        virtual bool init();
+        virtual void shutdown();
+        virtual const char * name();
+        virtual bool realtime();
+        virtual bool finished();
+        virtual bool takeCommand(char * message, int size);
+
+        virtual int countConnected();
+        virtual PSMove * connect(int id);
+        virtual void disconnect(PSMove * move);
+        virtual enum PSMove_Connection_Type connectionType(PSMove * move);
+        virtual char * getSerial(PSMove * move);
+        virtual void enableOrientation(PSMove * move);
+        virtual bool hasOrientation(PSMove * move);
+        virtual void resetOrientation(PSMove * move);
+
+        virtual int poll(PSMove * move);
+        virtual unsigned int getButtons(PSMove * move);
+        virtual int getTrigger(PSMove * move);
+        virtual void getAccelerometer(PSMove * move, float * x, float * y,
+                                      float * z);
+        virtual void getGyroscope(PSMove * move, float * x, float * y,
+                                  float * z);
+        virtual void getMagnetometer(PSMove * move, float * x, float * y,
+                                     float * z);
+        virtual void getOrientation(PSMove * move, float * w, float * x,
+                                    float * y, float * z);
+
+        virtual void setLeds(PSMove * move, unsigned char r, unsigned char g,
+                             unsigned char b);
+        virtual void setRumble(PSMove * move, unsigned char rumble);
+        virtual void updateLeds(PSMove * move);
+
+        virtual PSMoveTracker * newTracker(int camera);
+        virtual void freeTracker(PSMoveTracker * tracker);
+        virtual void getTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void setTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void getTrackerSize(PSMoveTracker * tracker, int * width,
+                                    int * height);
+
+        virtual enum PSMoveTracker_Status enable(PSMoveTracker * tracker,
+                                                 PSMove * move);
+        virtual enum PSMoveTracker_Status enableWithColor(
+                PSMoveTracker * tracker, PSMove * move, unsigned char r,
+                unsigned char g, unsigned char b);
+        virtual void disable(PSMoveTracker * tracker, PSMove * move);
+        virtual void getColor(PSMoveTracker * tracker, PSMove * move,
+                              unsigned char * r, unsigned char * g,
+                              unsigned char * b);
+        virtual void setAutoUpdateLeds(PSMoveTracker * tracker, PSMove * move,
+                                       bool enabled);
+
+        virtual void updateImage(PSMoveTracker * tracker);
+        virtual void update(PSMoveTracker * tracker, PSMove * move);
+        virtual enum PSMoveTracker_Status getStatus(PSMoveTracker * tracker,
+                                                    PSMove * move);
+        virtual void getPosition(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * radius);
+        virtual void getLocation(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * z);
+        virtual void * getFrame(PSMoveTracker * tracker);
+
+    protected:
+        bool map();
+        void unmap();
+        bool index();
+
+        bool started();
+        // Log time played up to. In as fast as possible mode this is the
+        // newest record handed out.
+        double now();
+        void advance(double time);
+
+        const SessionRecordHeader * header(size_t offset) const;
+        // Copies the payload of the record at offset.
+        void payload(size_t offset, void * data, size_t size) const;
+
+        std::string _file;
+        float _speed;
+
+        const unsigned char * _data;
+        size_t _size;
+#ifdef WIN32
+        HANDLE _fileHandle;
+        HANDLE _mapping;
+#endif
+
+        // Index of the log.
+        std::vector<SessionController> _controllers;
+        std::vector<double> _controllerTimes;
+        std::vector<std::vector<size_t> > _polls; // Per controller.
+        std::vector<ReplayCamera> _cameras;
+        std::vector<size_t> _commands;
+        double _duration;
+
+        Mutex _mutex;
+        double _start; // 0 until started, guarded by _mutex.
+        double _played; // As fast as possible mode, guarded by _mutex.
+        size_t _nextCommand; // Receive thread only.
+        int _openedCameras;
+        // Records played per controller and camera, guarded by _mutex.
+        std::vector<size_t> _pollsPlayed;
+        std::vector<size_t> _framesPlayed;
+};
+
+#endif
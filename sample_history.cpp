@@ -0,0 +1,75 @@
+#include "sample_history.h"
+#include "Atomic.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static bool earlier(const HistorySample & a, const HistorySample & b)
+{
+    return a.time < b.time;
+}
+
+SampleHistory::SampleHistory(int controllers, int size)
+{
+    _controllers = controllers;
+    _size = size > 0 ? size : 1;
+    _slots = new Slot[controllers * _size];
+    _written = new int[controllers];
+    memset(_slots, 0, sizeof(Slot) * controllers * _size);
+    for(int c = 0; c < controllers; c++)
+    {
+        _written[c] = 0;
+    }
+}
+
+SampleHistory::~SampleHistory()
+{
+    delete [] _slots;
+    delete [] _written;
+}
+
+void SampleHistory::push(int controller, const HistorySample & sample)
+{
+    int written = _written[controller];
+    Slot & slot = _slots[controller * _size + written % _size];
+    atomicAdd(&slot.version, 1);
+    slot.sample = sample;
+    atomicAdd(&slot.version, 1);
+    atomicStore(&_written[controller], written + 1);
+}
+
+void SampleHistory::find(int controller, bool byTime, double from, double to,
+                         std::vector<HistorySample> & out)
+{
+    out.clear();
+    if(controller < 0 || controller >= _controllers)
+    {
+        return;
+    }
+
+    int written = atomicLoad(&_written[controller]);
+    int oldest = written > _size ? written - _size : 0;
+    HistorySample sample;
+    for(int i = oldest; i < written; i++)
+    {
+        Slot & slot = _slots[controller * _size + i % _size];
+        int version = atomicLoad(&slot.version);
+        if(version & 1)
+        {
+            continue;
+        }
+        sample = slot.sample;
+        if(atomicLoad(&slot.version) != version)
+        {
+            continue;
+        }
+
+        double key = byTime ? sample.time : sample.sequence;
+        if(key >= from && key <= to)
+        {
+            out.push_back(sample);
+        }
+    }
+    // A slot overwritten during the scan holds a newer sample.
+    std::sort(out.begin(), out.end(), earlier);
+}
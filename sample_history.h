@@ -0,0 +1,82 @@
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+
+#include <vector>
+
+// Samples per "G" packet, keeps a reply packet under the Ethernet MTU.
+#define HISTORY_BATCH 16
+// Packets in one reply, longer ranges are cut short. Enough for the
+// default history_size.
+#define HISTORY_MAX_BATCHES 32
+// Seconds over which history_rate counts the "G" packets of a subscriber.
+#define HISTORY_WINDOW 1.0
+
+/**
+ * One physical tick of a controller as kept in the history, and as sent
+ * in "G" replies (native byte order, 80 bytes, no padding).
+ **/
+struct HistorySample
+{
+        int sequence; // Message number of the "a" packet, one per tick.
+        unsigned char buttons; // As in "a" packets.
+        unsigned char trigger;
+        unsigned char tracking; // Fused position is tracked.
+        unsigned char reserved;
+        double time; // Poll time, the clock of "e" packets.
+        float q[4]; // Orientation w x y z, raw.
+        float position[3]; // Published position, cm.
+        float accel[3];
+        float gyro[3];
+        float mag[3];
+};
+
+/**
+ * Header of a "G" packet, followed by 'count' HistorySamples.
+ **/
+struct HistoryBatchHeader
+{
+        char type; // 'G'
+        unsigned char controller;
+        unsigned char batch; // Index of this packet in the reply.
+        unsigned char batches; // Packets in the reply.
+        unsigned short count; // Samples in this packet.
+        unsigned short sampleSize; // sizeof(HistorySample)
+};
+
+/**
+ * The last few seconds of samples of every controller. Each controller
+ * has a ring written only by the physical thread. Readers don't lock: every
+ * slot is a seqlock, a slot overwritten while it is read is skipped.
+ **/
+class SampleHistory
+{
+    public:
+        SampleHistory(int controllers, int size);
+        ~SampleHistory();
+
+        void push(int controller, const HistorySample & sample);
+
+        // Samples with sequence (or time, if byTime) from 'from' to 'to',
+        // oldest first.
+        void find(int controller, bool byTime, double from, double to,
+                  std::vector<HistorySample> & out);
+
+        int controllers()
+        {
+            return _controllers;
+        }
+
+    protected:
+        struct Slot
+        {
+                volatile int version; // Odd while being written.
+                HistorySample sample;
+        };
+
+        int _controllers;
+        int _size;
+        Slot * _slots; // _size per controller
+        volatile int * _written; // Samples ever pushed, per controller.
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+/**
+ * Session log format, written by SessionRecorder and read by ReplayBackend.
+ *
+ * A SessionFileHeader, then records of a SessionRecordHeader followed by
+ * 'size' bytes of payload. Payloads are the structs below as laid out by
+ * the compiler, so a log is read back by a build for the same platform.
+ * Times are seconds since recording started.
+ **/
+
+#define SESSION_MAGIC 0x524d5350 // "PSMR"
+#define SESSION_VERSION 1
+
+#define SESSION_MAX_CONTROLLERS 32
+#define SESSION_MAX_CAMERAS 8
+#define SESSION_SERIAL_SIZE 24
+#define SESSION_COMMAND_SIZE 64
+
+enum SessionRecordType
+{
+    RECORD_CONTROLLER = 1, // A controller was connected.
+    RECORD_CAMERA, // A camera was opened.
+    RECORD_POLL, // A poll that returned data.
+    RECORD_FRAME, // A camera grabbed an image, its RECORD_TRACKs follow.
+    RECORD_TRACK, // Tracker result for one controller in one camera frame.
+    RECORD_COMMAND // A "d" message from the client.
+};
+
+struct SessionFileHeader
+{
+        unsigned int magic;
+        unsigned int version;
+};
+
+struct SessionRecordHeader
+{
+        unsigned char type; // SessionRecordType
+        unsigned char id; // Controller id, or camera for RECORD_CAMERA/FRAME
+        unsigned short size; // Payload bytes
+        double time;
+};
+
+struct SessionController
+{
+        char serial[SESSION_SERIAL_SIZE];
+        int connectionType;
+};
+
+struct SessionCamera
+{
+        int width;
+        int height;
+};
+
+struct SessionPoll
+{
+        unsigned int buttons;
+        unsigned char trigger;
+        unsigned char hasOrientation;
+        float accel[3];
+        float gyro[3];
+        float mag[3];
+        float orientation[4]; // w, x, y, z
+};
+
+struct SessionTrack
+{
+        unsigned char camera;
+        unsigned char status; // PSMoveTracker_Status
+        unsigned char r, g, b;
+        float ux, uy, radius; // Pixels
+        float x, y, z; // cm
+};
+
+#endif
@@ -0,0 +1,598 @@
+#include "session_recorder.h"
+#include "Timer.hpp"
+#include "log.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// Queue sizes in records. Polls arrive at up to ~200 Hz per controller,
+// camera queues hold a frame and its tracks per controller.
+#define POLL_QUEUE_SIZE 4096
+#define CAMERA_QUEUE_SIZE 2048
+#define OTHER_QUEUE_SIZE 256
+
+// How long the writer sleeps when every queue is empty.
+#define WRITER_IDLE_MS 5
+
+SessionRecorder * sessionRecorder = NULL;
+
+SessionRecorder::SessionRecorder(const std::string & file) :
+        Thread()
+{
+    _file = file;
+    _out = NULL;
+    _start = getTime();
+    _dropped = 0;
+    for(int i = 0; i < SESSION_MAX_CONTROLLERS; i++)
+    {
+        _announced[i] = false;
+    }
+
+    _queues.push_back(new RingBuffer<SessionEntry>(OTHER_QUEUE_SIZE));
+    _queues.push_back(new RingBuffer<SessionEntry>(POLL_QUEUE_SIZE));
+    _queues.push_back(new RingBuffer<SessionEntry>(OTHER_QUEUE_SIZE));
+    for(int i = 0; i < SESSION_MAX_CAMERAS; i++)
+    {
+        _queues.push_back(new RingBuffer<SessionEntry>(CAMERA_QUEUE_SIZE));
+    }
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    if(_out)
+    {
+        fclose(_out);
+    }
+    for(size_t i = 0; i < _queues.size(); i++)
+    {
+        delete _queues[i];
+    }
+}
+
+bool SessionRecorder::open()
+{
+    _out = fopen(_file.c_str(), "wb");
+    if(!_out)
+    {
+        printf("Couldn't create session log %s\n", _file.c_str());
+        return false;
+    }
+    SessionFileHeader header;
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    fwrite(&header, sizeof(header), 1, _out);
+    _start = getTime();
+    printf("Recording session to %s\n", _file.c_str());
+    return true;
+}
+
+void SessionRecorder::push(int queue, int type, int id, int size,
+                           SessionEntry & entry)
+{
+    entry.header.type = (unsigned char)type;
+    entry.header.id = (unsigned char)id;
+    entry.header.size = (unsigned short)size;
+    entry.header.time = getTime() - _start;
+    if(!_queues[queue]->push(entry))
+    {
+        atomicAdd(&_dropped, 1);
+    }
+}
+
+void SessionRecorder::recordController(int id, const char * serial,
+                                       int connectionType)
+{
+    SessionEntry entry;
+    memset(&entry.data.controller, 0, sizeof(SessionController));
+    strncpy(entry.data.controller.serial, serial, SESSION_SERIAL_SIZE - 1);
+    entry.data.controller.connectionType = connectionType;
+    _controlMutex.lock();
+    push(QUEUE_CONTROL, RECORD_CONTROLLER, id, sizeof(SessionController),
+         entry);
+    _controlMutex.unlock();
+}
+
+void SessionRecorder::recordCamera(int camera, int width, int height)
+{
+    SessionEntry entry;
+    entry.data.camera.width = width;
+    entry.data.camera.height = height;
+    _controlMutex.lock();
+    push(QUEUE_CONTROL, RECORD_CAMERA, camera, sizeof(SessionCamera), entry);
+    _controlMutex.unlock();
+}
+
+void SessionRecorder::recordPoll(int id, const SessionPoll & poll)
+{
+    SessionEntry entry;
+    entry.data.poll = poll;
+    push(QUEUE_POLL, RECORD_POLL, id, sizeof(SessionPoll), entry);
+}
+
+void SessionRecorder::recordFrame(int camera)
+{
+    SessionEntry entry;
+    push(QUEUE_CAMERA + camera, RECORD_FRAME, camera, 0, entry);
+}
+
+void SessionRecorder::recordTrack(int id, const SessionTrack & track)
+{
+    SessionEntry entry;
+    entry.data.track = track;
+    push(QUEUE_CAMERA + track.camera, RECORD_TRACK, id, sizeof(SessionTrack),
+         entry);
+}
+
+void SessionRecorder::recordCommand(const char * message, int length)
+{
+    SessionEntry entry;
+    if(length > SESSION_COMMAND_SIZE - 1)
+    {
+        length = SESSION_COMMAND_SIZE - 1;
+    }
+    memcpy(entry.data.command, message, length);
+    entry.data.command[length] = 0;
+    push(QUEUE_COMMAND, RECORD_COMMAND, 0, length + 1, entry);
+}
+
+unsigned int SessionRecorder::dropped()
+{
+    return (unsigned int)atomicLoad(&_dropped);
+}
+
+void SessionRecorder::write(const SessionEntry & entry)
+{
+    if(entry.header.type == RECORD_CONTROLLER
+            && entry.header.id < SESSION_MAX_CONTROLLERS)
+    {
+        _announced[entry.header.id] = true;
+    }
+    fwrite(&entry.header, sizeof(SessionRecordHeader), 1, _out);
+    if(entry.header.size)
+    {
+        fwrite(&entry.data, entry.header.size, 1, _out);
+    }
+}
+
+bool SessionRecorder::drainQueue(int queue)
+{
+    bool wrote = false;
+    SessionEntry entry;
+    while(_queues[queue]->pop(entry))
+    {
+        // A controller connected after QUEUE_CONTROL was drained can
+        // already have polls queued. Its record was pushed before them, so
+        // it is in the control queue by now.
+        bool controller = entry.header.type == RECORD_POLL
+                || entry.header.type == RECORD_TRACK;
+        if(controller && entry.header.id < SESSION_MAX_CONTROLLERS
+                && !_announced[entry.header.id])
+        {
+            drainQueue(QUEUE_CONTROL);
+        }
+        write(entry);
+        wrote = true;
+    }
+    return wrote;
+}
+
+bool SessionRecorder::drain()
+{
+    bool wrote = false;
+    for(size_t q = 0; q < _queues.size(); q++)
+    {
+        wrote = drainQueue((int)q) || wrote;
+    }
+    return wrote;
+}
+
+void SessionRecorder::run()
+{
+    nameCurrentThread("recorder");
+    while(1)
+    {
+        if(!drain())
+        {
+            fflush(_out);
+#ifdef WIN32
+            Sleep(WRITER_IDLE_MS);
+#else
+            usleep(WRITER_IDLE_MS * 1000);
+#endif
+        }
+
+        _quitMutex->lock();
+        if(_quit)
+        {
+            _quitMutex->unlock();
+            break;
+        }
+        _quitMutex->unlock();
+    }
+
+    // Whatever was queued before quit still goes in.
+    drain();
+    fflush(_out);
+    if(dropped())
+    {
+        LOG(LOG_WARNING, "Session log: %u records dropped, the disk couldn't keep up.",
+            dropped());
+    }
+}
+
+RecordingBackend::RecordingBackend(MoveBackend * backend,
+                                   SessionRecorder * recorder)
+{
+    _backend = backend;
+    _recorder = recorder;
+    for(int i = 0; i < SESSION_MAX_CONTROLLERS; i++)
+    {
+        _moves[i] = NULL;
+        _moveNumbers[i] = -1;
+    }
+    _totalTrackers = 0;
+}
+
+RecordingBackend::~RecordingBackend()
+{
+    delete _backend;
+}
+
+bool RecordingBackend::init()
+{
+    return _backend->init();
+}
+
+void RecordingBackend::shutdown()
+{
+    _backend->shutdown();
+}
+
+const char * RecordingBackend::name()
+{
+    return _backend->name();
+}
+
+bool RecordingBackend::realtime()
+{
+    return _backend->realtime();
+}
+
+bool RecordingBackend::finished()
+{
+    return _backend->finished();
+}
+
+bool RecordingBackend::takeCommand(char * message, int size)
+{
+    return _backend->takeCommand(message, size);
+}
+
+int RecordingBackend::controllerNumber(PSMove * move)
+{
+    for(int i = 0; i < SESSION_MAX_CONTROLLERS; i++)
+    {
+        if(_moves[i] == move)
+        {
+            return _moveNumbers[i];
+        }
+    }
+    return -1;
+}
+
+int RecordingBackend::cameraNumber(PSMoveTracker * tracker)
+{
+    for(int i = 0; i < _totalTrackers; i++)
+    {
+        if(_trackers[i] == tracker)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int RecordingBackend::countConnected()
+{
+    return _backend->countConnected();
+}
+
+PSMove * RecordingBackend::connect(int id)
+{
+    PSMove * move = _backend->connect(id);
+    if(!move)
+    {
+        return NULL;
+    }
+
+    // The same controller may be connected again (USB and Bluetooth, or
+    // enumerated twice), it keeps its session number.
+    std::string serial;
+    char * s = _backend->getSerial(move);
+    if(s)
+    {
+        serial = s;
+        free(s);
+    }
+    int number = -1;
+    for(size_t i = 0; i < _serials.size(); i++)
+    {
+        if(_serials[i] == serial)
+        {
+            number = i;
+        }
+    }
+    if(number < 0 && _serials.size() < SESSION_MAX_CONTROLLERS)
+    {
+        number = _serials.size();
+        _serials.push_back(serial);
+        _recorder->recordController(number, serial.c_str(),
+                                    _backend->connectionType(move));
+    }
+
+    for(int i = 0; i < SESSION_MAX_CONTROLLERS; i++)
+    {
+        if(_moves[i] == NULL)
+        {
+            // The number is in place before the handle can be found.
+            _moveNumbers[i] = number;
+            _moves[i] = move;
+            break;
+        }
+    }
+    return move;
+}
+
+void RecordingBackend::disconnect(PSMove * move)
+{
+    for(int i = 0; i < SESSION_MAX_CONTROLLERS; i++)
+    {
+        if(_moves[i] == move)
+        {
+            _moves[i] = NULL;
+        }
+    }
+    _backend->disconnect(move);
+}
+
+enum PSMove_Connection_Type RecordingBackend::connectionType(PSMove * move)
+{
+    return _backend->connectionType(move);
+}
+
+char * RecordingBackend::getSerial(PSMove * move)
+{
+    return _backend->getSerial(move);
+}
+
+void RecordingBackend::enableOrientation(PSMove * move)
+{
+    _backend->enableOrientation(move);
+}
+
+bool RecordingBackend::hasOrientation(PSMove * move)
+{
+    return _backend->hasOrientation(move);
+}
+
+void RecordingBackend::resetOrientation(PSMove * move)
+{
+    _backend->resetOrientation(move);
+}
+
+int RecordingBackend::poll(PSMove * move)
+{
+    int polled = _backend->poll(move);
+    int number;
+    if(polled && (number = controllerNumber(move)) >= 0)
+    {
+        SessionPoll poll;
+        float * q = poll.orientation;
+        poll.buttons = _backend->getButtons(move);
+        poll.trigger = (unsigned char)_backend->getTrigger(move);
+        poll.hasOrientation = _backend->hasOrientation(move) ? 1 : 0;
+        _backend->getAccelerometer(move, &poll.accel[0], &poll.accel[1],
+                                   &poll.accel[2]);
+        _backend->getGyroscope(move, &poll.gyro[0], &poll.gyro[1],
+                               &poll.gyro[2]);
+        _backend->getMagnetometer(move, &poll.mag[0], &poll.mag[1],
+                                  &poll.mag[2]);
+        q[0] = 1.0f;
+        q[1] = q[2] = q[3] = 0.0f;
+        if(poll.hasOrientation)
+        {
+            _backend->getOrientation(move, &q[0], &q[1], &q[2], &q[3]);
+        }
+        _recorder->recordPoll(number, poll);
+    }
+    return polled;
+}
+
+unsigned int RecordingBackend::getButtons(PSMove * move)
+{
+    return _backend->getButtons(move);
+}
+
+int RecordingBackend::getTrigger(PSMove * move)
+{
+    return _backend->getTrigger(move);
+}
+
+void RecordingBackend::getAccelerometer(PSMove * move, float * x, float * y,
+                                        float * z)
+{
+    _backend->getAccelerometer(move, x, y, z);
+}
+
+void RecordingBackend::getGyroscope(PSMove * move, float * x, float * y,
+                                    float * z)
+{
+    _backend->getGyroscope(move, x, y, z);
+}
+
+void RecordingBackend::getMagnetometer(PSMove * move, float * x, float * y,
+                                       float * z)
+{
+    _backend->getMagnetometer(move, x, y, z);
+}
+
+void RecordingBackend::getOrientation(PSMove * move, float * w, float * x,
+                                      float * y, float * z)
+{
+    _backend->getOrientation(move, w, x, y, z);
+}
+
+void RecordingBackend::setLeds(PSMove * move, unsigned char r,
+                               unsigned char g, unsigned char b)
+{
+    _backend->setLeds(move, r, g, b);
+}
+
+void RecordingBackend::setRumble(PSMove * move, unsigned char rumble)
+{
+    _backend->setRumble(move, rumble);
+}
+
+void RecordingBackend::updateLeds(PSMove * move)
+{
+    _backend->updateLeds(move);
+}
+
+PSMoveTracker * RecordingBackend::newTracker(int camera)
+{
+    PSMoveTracker * tracker = _backend->newTracker(camera);
+    if(tracker && _totalTrackers < SESSION_MAX_CAMERAS)
+    {
+        int width, height;
+        _backend->getTrackerSize(tracker, &width, &height);
+        _recorder->recordCamera(_totalTrackers, width, height);
+        _trackers[_totalTrackers++] = tracker;
+    }
+    return tracker;
+}
+
+void RecordingBackend::freeTracker(PSMoveTracker * tracker)
+{
+    _backend->freeTracker(tracker);
+}
+
+void RecordingBackend::getTrackerSettings(PSMoveTracker * tracker,
+                                          PSMoveTrackerSettings * settings)
+{
+    _backend->getTrackerSettings(tracker, settings);
+}
+
+void RecordingBackend::setTrackerSettings(PSMoveTracker * tracker,
+                                          PSMoveTrackerSettings * settings)
+{
+    _backend->setTrackerSettings(tracker, settings);
+}
+
+void RecordingBackend::getTrackerSize(PSMoveTracker * tracker, int * width,
+                                      int * height)
+{
+    _backend->getTrackerSize(tracker, width, height);
+}
+
+enum PSMoveTracker_Status RecordingBackend::enable(PSMoveTracker * tracker,
+                                                   PSMove * move)
+{
+    return _backend->enable(tracker, move);
+}
+
+enum PSMoveTracker_Status RecordingBackend::enableWithColor(
+        PSMoveTracker * tracker, PSMove * move, unsigned char r,
+        unsigned char g, unsigned char b)
+{
+    return _backend->enableWithColor(tracker, move, r, g, b);
+}
+
+void RecordingBackend::disable(PSMoveTracker * tracker, PSMove * move)
+{
+    _backend->disable(tracker, move);
+}
+
+void RecordingBackend::getColor(PSMoveTracker * tracker, PSMove * move,
+                                unsigned char * r, unsigned char * g,
+                                unsigned char * b)
+{
+    _backend->getColor(tracker, move, r, g, b);
+}
+
+void RecordingBackend::setAutoUpdateLeds(PSMoveTracker * tracker,
+                                         PSMove * move, bool enabled)
+{
+    _backend->setAutoUpdateLeds(tracker, move, enabled);
+}
+
+void RecordingBackend::updateImage(PSMoveTracker * tracker)
+{
+    _backend->updateImage(tracker);
+    int camera = cameraNumber(tracker);
+    if(camera >= 0)
+    {
+        _recorder->recordFrame(camera);
+    }
+}
+
+bool RecordingBackend::canGrabAhead()
+{
+    return _backend->canGrabAhead();
+}
+
+void RecordingBackend::grabImage(PSMoveTracker * tracker)
+{
+    // The frame is recorded once updateImage() makes it the tracked one.
+    _backend->grabImage(tracker);
+}
+
+void RecordingBackend::update(PSMoveTracker * tracker, PSMove * move)
+{
+    _backend->update(tracker, move);
+
+    int camera = cameraNumber(tracker);
+    int number = controllerNumber(move);
+    if(camera < 0 || number < 0)
+    {
+        return;
+    }
+    SessionTrack track;
+    memset(&track, 0, sizeof(track));
+    track.camera = (unsigned char)camera;
+    track.status = (unsigned char)_backend->getStatus(tracker, move);
+    if(track.status == Tracker_TRACKING)
+    {
+        _backend->getPosition(tracker, move, &track.ux, &track.uy,
+                              &track.radius);
+        _backend->getLocation(tracker, move, &track.x, &track.y, &track.z);
+    }
+    _backend->getColor(tracker, move, &track.r, &track.g, &track.b);
+    _recorder->recordTrack(number, track);
+}
+
+enum PSMoveTracker_Status RecordingBackend::getStatus(PSMoveTracker * tracker,
+                                                      PSMove * move)
+{
+    return _backend->getStatus(tracker, move);
+}
+
+void RecordingBackend::getPosition(PSMoveTracker * tracker, PSMove * move,
+                                   float * x, float * y, float * radius)
+{
+    _backend->getPosition(tracker, move, x, y, radius);
+}
+
+void RecordingBackend::getLocation(PSMoveTracker * tracker, PSMove * move,
+                                   float * x, float * y, float * z)
+{
+    _backend->getLocation(tracker, move, x, y, z);
+}
+
+void * RecordingBackend::getFrame(PSMoveTracker * tracker)
+{
+    return _backend->getFrame(tracker);
+}
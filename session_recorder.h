@@ -0,0 +1,181 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include "Thread.hpp"
+#include "Mutex.hpp"
+#include "RingBuffer.hpp"
+#include "move_backend.h"
+#include "session_log.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * One record on its way to the writer thread.
+ **/
+struct SessionEntry
+{
+        SessionRecordHeader header;
+        union
+        {
+                SessionController controller;
+                SessionCamera camera;
+                SessionPoll poll;
+                SessionTrack track;
+                char command[SESSION_COMMAND_SIZE];
+        } data;
+};
+
+/**
+ * Appends everything the server reads to a session log (see session_log.h)
+ * for replay with the replay backend.
+ *
+ * Every source thread has its own lock-free queue, drained by this thread,
+ * so recording never blocks polling or tracking. Controllers and cameras
+ * are announced by the main thread and later the monitor, their queue is
+ * the only one with a lock. If the writer falls behind records are dropped
+ * and counted. Records are in order per source, not across sources, except
+ * that a controller is always written before its polls and tracks.
+ **/
+class SessionRecorder : public Thread
+{
+    public:
+        SessionRecorder(const std::string & file);
+        virtual ~SessionRecorder();
+
+        bool open();
+        virtual void run();
+
+        // Main thread, and later the controller monitor.
+        void recordController(int id, const char * serial, int connectionType);
+        void recordCamera(int camera, int width, int height);
+        // Physical thread.
+        void recordPoll(int id, const SessionPoll & poll);
+        // The camera's capture thread.
+        void recordFrame(int camera);
+        void recordTrack(int id, const SessionTrack & track);
+        // Receive thread.
+        void recordCommand(const char * message, int length);
+
+        unsigned int dropped();
+
+    protected:
+        enum
+        {
+            QUEUE_CONTROL = 0,
+            QUEUE_POLL,
+            QUEUE_COMMAND,
+            QUEUE_CAMERA // One per camera from here.
+        };
+
+        void push(int queue, int type, int id, int size, SessionEntry & entry);
+        bool drain();
+        bool drainQueue(int queue);
+        void write(const SessionEntry & entry);
+
+        std::string _file;
+        FILE * _out;
+        double _start;
+        std::vector<RingBuffer<SessionEntry>*> _queues;
+        Mutex _controlMutex; // Serialises the producers of QUEUE_CONTROL.
+        bool _announced[SESSION_MAX_CONTROLLERS]; // Controller record written.
+        volatile int _dropped;
+};
+
+/**
+ * Passes everything on to another backend and records what it returns.
+ * Controllers are numbered by serial in the order they first connect.
+ **/
+class RecordingBackend : public MoveBackend
+{
+    public:
+        RecordingBackend(MoveBackend * backend, SessionRecorder * recorder);
+        virtual ~RecordingBackend();
+
+        virtual bool init();
+        virtual void shutdown();
+        virtual const char * name();
+        virtual bool realtime();
+        virtual bool finished();
+        virtual bool takeCommand(char * message, int size);
+
+        virtual int countConnected();
+        virtual PSMove * connect(int id);
+        virtual void disconnect(PSMove * move);
+        virtual enum PSMove_Connection_Type connectionType(PSMove * move);
+        virtual char * getSerial(PSMove * move);
+        virtual void enableOrientation(PSMove * move);
+        virtual bool hasOrientation(PSMove * move);
+        virtual void resetOrientation(PSMove * move);
+
+        virtual int poll(PSMove * move);
+        virtual unsigned int getButtons(PSMove * move);
+        virtual int getTrigger(PSMove * move);
+        virtual void getAccelerometer(PSMove * move, float * x, float * y,
+                                      float * z);
+        virtual void getGyroscope(PSMove * move, float * x, float * y,
+                                  float * z);
+        virtual void getMagnetometer(PSMove * move, float * x, float * y,
+                                     float * z);
+        virtual void getOrientation(PSMove * move, float * w, float * x,
+                                    float * y, float * z);
+
+        virtual void setLeds(PSMove * move, unsigned char r, unsigned char g,
+                             unsigned char b);
+        virtual void setRumble(PSMove * move, unsigned char rumble);
+        virtual void updateLeds(PSMove * move);
+
+        virtual PSMoveTracker * newTracker(int camera);
+        virtual void freeTracker(PSMoveTracker * tracker);
+        virtual void getTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void setTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void getTrackerSize(PSMoveTracker * tracker, int * width,
+                                    int * height);
+
+        virtual enum PSMoveTracker_Status enable(PSMoveTracker * tracker,
+                                                 PSMove * move);
+        virtual enum PSMoveTracker_Status enableWithColor(
+                PSMoveTracker * tracker, PSMove * move, unsigned char r,
+                unsigned char g, unsigned char b);
+        virtual void disable(PSMoveTracker * tracker, PSMove * move);
+        virtual void getColor(PSMoveTracker * tracker, PSMove * move,
+                              unsigned char * r, unsigned char * g,
+                              unsigned char * b);
+        virtual void setAutoUpdateLeds(PSMoveTracker * tracker, PSMove * move,
+                                       bool enabled);
+
+        virtual void updateImage(PSMoveTracker * tracker);
+        virtual bool canGrabAhead();
+        virtual void grabImage(PSMoveTracker * tracker);
+        virtual void update(PSMoveTracker * tracker, PSMove * move);
+        virtual enum PSMoveTracker_Status getStatus(PSMoveTracker * tracker,
+                                                    PSMove * move);
+        virtual void getPosition(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * radius);
+        virtual void getLocation(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * z);
+        virtual void * getFrame(PSMoveTracker * tracker);
+
+    protected:
+        // Session number of a connected controller, -1 if unknown.
+        int controllerNumber(PSMove * move);
+        int cameraNumber(PSMoveTracker * tracker);
+
+        MoveBackend * _backend;
+        SessionRecorder * _recorder;
+
+        // Written by the connecting thread only, read by the polling threads.
+        PSMove * volatile _moves[SESSION_MAX_CONTROLLERS];
+        int _moveNumbers[SESSION_MAX_CONTROLLERS];
+        std::vector<std::string> _serials; // Index is the session number.
+        PSMoveTracker * _trackers[SESSION_MAX_CAMERAS];
+        int _totalTrackers;
+};
+
+// Set while a session is being recorded.
+extern SessionRecorder * sessionRecorder;
+
+#endif
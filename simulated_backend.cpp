@@ -0,0 +1,506 @@
+#include "simulated_backend.h"
+#include "latency_stats.h"
+#include "Timer.hpp"
+
+#include <opencv2/core/core_c.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define GRAVITY_CM 980.665
+
+// Camera model, roughly a PS Eye at 640x480.
+#define SIM_WIDTH 640
+#define SIM_HEIGHT 480
+#define SIM_FOCAL 550.0
+#define SIM_BALL_RADIUS 2.25
+
+// Each controller circles around its own centre, SIM_SPACING cm apart.
+#define SIM_SPACING 20.0
+#define SIM_CIRCLE 10.0
+#define SIM_DISTANCE 150.0
+
+// Handles given out as PSMove and PSMoveTracker are really these, psmoveapi
+// never sees them.
+struct SimulatedMove
+{
+        int id;
+        unsigned long long report; // Index of the last report handed out.
+        double yawOffset; // Set by resetOrientation.
+        bool orientation;
+
+        // Values of the last report.
+        double time;
+        unsigned int buttons;
+        int trigger;
+        float accel[3], gyro[3], mag[3];
+        float yaw;
+
+        unsigned char r, g, b;
+        unsigned char rumble;
+};
+
+struct SimulatedTracker
+{
+        int camera;
+        unsigned int frame;
+        double frameTime; // Motion time of the last image.
+        unsigned int grabbed; // Newest frame grabbed, frame if none is kept.
+        IplImage * image;
+        std::vector<int> enabled; // Per controller id.
+        std::vector<unsigned char> colour; // r, g, b per controller id.
+};
+
+static const unsigned char palette[][3] = { { 255, 0, 255 },
+        { 0, 255, 255 }, { 255, 255, 0 }, { 255, 0, 0 }, { 0, 0, 255 },
+        { 0, 255, 0 } };
+static const int paletteSize = sizeof(palette) / sizeof(palette[0]);
+
+static const unsigned int pressedButtons[] = { Btn_CROSS, Btn_SQUARE,
+        Btn_TRIANGLE, Btn_CIRCLE, Btn_MOVE };
+
+static inline SimulatedMove * simulated(PSMove * move)
+{
+    return reinterpret_cast<SimulatedMove *>(move);
+}
+
+static inline SimulatedTracker * simulated(PSMoveTracker * tracker)
+{
+    return reinterpret_cast<SimulatedTracker *>(tracker);
+}
+
+static void sleepSeconds(double seconds)
+{
+    if(seconds <= 0.0)
+    {
+        return;
+    }
+#ifdef WIN32
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    usleep((useconds_t)(seconds * 1000000.0));
+#endif
+}
+
+// Keeps the CPU busy instead of sleeping.
+static void busySeconds(double seconds)
+{
+    double until = getTime() + seconds;
+    while(getTime() < until)
+    {
+    }
+}
+
+// Angular rate (rad/s) and phase of controller 'id' at motion time t.
+static void motion(int id, bool idle, double t, double & rate, double & phase)
+{
+    rate = idle ? 0.0 : 2.0 * M_PI * (0.25 + 0.05 * id);
+    phase = rate * t + id;
+}
+
+// Camera frame position in cm, the same for every camera.
+static void simulatedLocation(int id, bool idle, double t, float * x,
+                              float * y, float * z)
+{
+    double rate, phase;
+    motion(id, idle, t, rate, phase);
+    *x = (float)(SIM_SPACING * id + SIM_CIRCLE * cos(phase));
+    *y = (float)(SIM_CIRCLE * sin(phase));
+    *z = (float)SIM_DISTANCE;
+}
+
+// Rotate a world vector into the controller frame, which is turned by yaw around y.
+static void toBody(double yaw, const double world[3], float body[3])
+{
+    double c = cos(yaw), s = sin(yaw);
+    body[0] = (float)(c * world[0] - s * world[2]);
+    body[1] = (float)world[1];
+    body[2] = (float)(s * world[0] + c * world[2]);
+}
+
+void defaultSimulationSettings(SimulationSettings & settings)
+{
+    settings.controllers = 2;
+    settings.rate = 100.0f;
+    settings.latency = 0.0f;
+    settings.fps = 60.0f;
+    settings.grab = 0.0f;
+    settings.track = 0.0f;
+    settings.idle = 0;
+}
+
+SimulatedBackend::SimulatedBackend(const SimulationSettings & settings)
+{
+    _settings = settings;
+    if(_settings.rate <= 0.0f)
+    {
+        _settings.rate = 100.0f;
+    }
+    if(_settings.fps <= 0.0f)
+    {
+        _settings.fps = 60.0f;
+    }
+    _start = 0.0;
+}
+
+SimulatedBackend::~SimulatedBackend()
+{
+}
+
+bool SimulatedBackend::init()
+{
+    _start = getTime();
+    printf("Simulating %d controllers (%d idle) at %.0f Hz, %.1f ms poll latency, cameras at %.0f fps (%.1f ms grab, %.1f ms tracking).\n",
+           _settings.controllers, _settings.idle, _settings.rate,
+           _settings.latency, _settings.fps, _settings.grab,
+           _settings.track);
+    return true;
+}
+
+void SimulatedBackend::shutdown()
+{
+}
+
+const char * SimulatedBackend::name()
+{
+    return "simulated";
+}
+
+int SimulatedBackend::countConnected()
+{
+    return _settings.controllers;
+}
+
+PSMove * SimulatedBackend::connect(int id)
+{
+    if(id < 0 || id >= _settings.controllers)
+    {
+        return NULL;
+    }
+    SimulatedMove * move = new SimulatedMove();
+    move->id = id;
+    move->report = 0;
+    move->yawOffset = 0.0;
+    move->orientation = false;
+    move->time = 0.0;
+    move->buttons = 0;
+    move->trigger = 0;
+    for(int i = 0; i < 3; i++)
+    {
+        move->accel[i] = move->gyro[i] = move->mag[i] = 0.0f;
+    }
+    move->yaw = 0.0f;
+    move->r = move->g = move->b = 0;
+    move->rumble = 0;
+    return reinterpret_cast<PSMove *>(move);
+}
+
+void SimulatedBackend::disconnect(PSMove * move)
+{
+    delete simulated(move);
+}
+
+enum PSMove_Connection_Type SimulatedBackend::connectionType(PSMove * move)
+{
+    return Conn_Bluetooth;
+}
+
+char * SimulatedBackend::getSerial(PSMove * move)
+{
+    char * serial = (char *)malloc(18);
+    sprintf(serial, "00:06:f7:51:4d:%02x", simulated(move)->id & 0xff);
+    return serial;
+}
+
+void SimulatedBackend::enableOrientation(PSMove * move)
+{
+    simulated(move)->orientation = true;
+}
+
+bool SimulatedBackend::hasOrientation(PSMove * move)
+{
+    return simulated(move)->orientation;
+}
+
+void SimulatedBackend::resetOrientation(PSMove * move)
+{
+    SimulatedMove * sim = simulated(move);
+    sim->yawOffset = sim->yaw + sim->yawOffset;
+}
+
+int SimulatedBackend::poll(PSMove * move)
+{
+    SimulatedMove * sim = simulated(move);
+    double t = getTime() - _start;
+    unsigned long long due = (unsigned long long)(t * _settings.rate);
+    if(due <= sim->report)
+    {
+        return 0;
+    }
+    // Reports missed by a slow poller are lost, as with the real thing.
+    // The first poll after connecting starts the count.
+    if(sim->report > 0 && due > sim->report + 1)
+    {
+        statsCount(COUNT_LOST_REPORTS, (int)(due - sim->report - 1));
+    }
+    sim->report = due;
+    sim->time = due / _settings.rate;
+
+    double rate, phase;
+    bool idle = sim->id >= _settings.controllers - _settings.idle;
+    motion(sim->id, idle, sim->time, rate, phase);
+
+    double world[3];
+    world[0] = -rate * rate * SIM_CIRCLE * cos(phase) / GRAVITY_CM;
+    world[1] = -rate * rate * SIM_CIRCLE * sin(phase) / GRAVITY_CM + 1.0;
+    world[2] = 0.0;
+    toBody(phase, world, sim->accel);
+
+    sim->gyro[0] = 0.0f;
+    sim->gyro[1] = (float)rate;
+    sim->gyro[2] = 0.0f;
+
+    const double field[3] = { 0.3, -0.4, 0.85 };
+    toBody(phase, field, sim->mag);
+    sim->yaw = (float)(phase - sim->yawOffset);
+
+    // A button every two seconds, held for half a second.
+    const int buttonCount = sizeof(pressedButtons) / sizeof(pressedButtons[0]);
+    long segment = (long)(sim->time / 2.0);
+    sim->buttons = 0;
+    sim->trigger = 0;
+    if(!idle)
+    {
+        if(sim->time - segment * 2.0 < 0.5)
+        {
+            sim->buttons = pressedButtons[(segment + sim->id) % buttonCount];
+        }
+        double ramp = fmod(sim->time, 3.0) / 1.5;
+        sim->trigger = (int)(255.0 * (ramp > 1.0 ? 2.0 - ramp : ramp));
+    }
+
+    sleepSeconds(_settings.latency / 1000.0);
+    return 1;
+}
+
+unsigned int SimulatedBackend::getButtons(PSMove * move)
+{
+    return simulated(move)->buttons;
+}
+
+int SimulatedBackend::getTrigger(PSMove * move)
+{
+    return simulated(move)->trigger;
+}
+
+void SimulatedBackend::getAccelerometer(PSMove * move, float * x, float * y,
+                                        float * z)
+{
+    SimulatedMove * sim = simulated(move);
+    *x = sim->accel[0];
+    *y = sim->accel[1];
+    *z = sim->accel[2];
+}
+
+void SimulatedBackend::getGyroscope(PSMove * move, float * x, float * y,
+                                    float * z)
+{
+    SimulatedMove * sim = simulated(move);
+    *x = sim->gyro[0];
+    *y = sim->gyro[1];
+    *z = sim->gyro[2];
+}
+
+void SimulatedBackend::getMagnetometer(PSMove * move, float * x, float * y,
+                                       float * z)
+{
+    SimulatedMove * sim = simulated(move);
+    *x = sim->mag[0];
+    *y = sim->mag[1];
+    *z = sim->mag[2];
+}
+
+void SimulatedBackend::getOrientation(PSMove * move, float * w, float * x,
+                                      float * y, float * z)
+{
+    float half = 0.5f * simulated(move)->yaw;
+    *w = cosf(half);
+    *x = 0.0f;
+    *y = sinf(half);
+    *z = 0.0f;
+}
+
+void SimulatedBackend::setLeds(PSMove * move, unsigned char r,
+                               unsigned char g, unsigned char b)
+{
+    SimulatedMove * sim = simulated(move);
+    sim->r = r;
+    sim->g = g;
+    sim->b = b;
+}
+
+void SimulatedBackend::setRumble(PSMove * move, unsigned char rumble)
+{
+    simulated(move)->rumble = rumble;
+}
+
+void SimulatedBackend::updateLeds(PSMove * move)
+{
+}
+
+PSMoveTracker * SimulatedBackend::newTracker(int camera)
+{
+    SimulatedTracker * tracker = new SimulatedTracker();
+    tracker->camera = camera;
+    tracker->frame = 0;
+    tracker->frameTime = 0.0;
+    tracker->grabbed = 0;
+    tracker->image = cvCreateImage(cvSize(SIM_WIDTH, SIM_HEIGHT),
+                                   IPL_DEPTH_8U, 3);
+    cvSetZero(tracker->image);
+    tracker->enabled.assign(_settings.controllers, 0);
+    tracker->colour.assign(_settings.controllers * 3, 0);
+    return reinterpret_cast<PSMoveTracker *>(tracker);
+}
+
+void SimulatedBackend::freeTracker(PSMoveTracker * tracker)
+{
+    SimulatedTracker * sim = simulated(tracker);
+    cvReleaseImage(&sim->image);
+    delete sim;
+}
+
+void SimulatedBackend::getTrackerSettings(PSMoveTracker * tracker,
+                                          PSMoveTrackerSettings * settings)
+{
+    memset(settings, 0, sizeof(PSMoveTrackerSettings));
+}
+
+void SimulatedBackend::setTrackerSettings(PSMoveTracker * tracker,
+                                          PSMoveTrackerSettings * settings)
+{
+}
+
+void SimulatedBackend::getTrackerSize(PSMoveTracker * tracker, int * width,
+                                      int * height)
+{
+    *width = SIM_WIDTH;
+    *height = SIM_HEIGHT;
+}
+
+enum PSMoveTracker_Status SimulatedBackend::enable(PSMoveTracker * tracker,
+                                                   PSMove * move)
+{
+    int id = simulated(move)->id;
+    const unsigned char * rgb = palette[id % paletteSize];
+    return enableWithColor(tracker, move, rgb[0], rgb[1], rgb[2]);
+}
+
+enum PSMoveTracker_Status SimulatedBackend::enableWithColor(
+        PSMoveTracker * tracker, PSMove * move, unsigned char r,
+        unsigned char g, unsigned char b)
+{
+    SimulatedTracker * sim = simulated(tracker);
+    int id = simulated(move)->id;
+    sim->enabled[id] = 1;
+    sim->colour[id * 3] = r;
+    sim->colour[id * 3 + 1] = g;
+    sim->colour[id * 3 + 2] = b;
+    return Tracker_CALIBRATED;
+}
+
+void SimulatedBackend::disable(PSMoveTracker * tracker, PSMove * move)
+{
+    simulated(tracker)->enabled[simulated(move)->id] = 0;
+}
+
+void SimulatedBackend::getColor(PSMoveTracker * tracker, PSMove * move,
+                                unsigned char * r, unsigned char * g,
+                                unsigned char * b)
+{
+    const unsigned char * rgb = &simulated(tracker)->colour[simulated(move)->id * 3];
+    *r = rgb[0];
+    *g = rgb[1];
+    *b = rgb[2];
+}
+
+void SimulatedBackend::setAutoUpdateLeds(PSMoveTracker * tracker,
+                                         PSMove * move, bool enabled)
+{
+}
+
+void SimulatedBackend::updateImage(PSMoveTracker * tracker)
+{
+    SimulatedTracker * sim = simulated(tracker);
+    if(sim->grabbed == sim->frame)
+    {
+        // Nothing grabbed ahead.
+        grabImage(tracker);
+    }
+    sim->frame = sim->grabbed;
+    sim->frameTime = sim->frame / _settings.fps;
+}
+
+bool SimulatedBackend::canGrabAhead()
+{
+    return true;
+}
+
+void SimulatedBackend::grabImage(PSMoveTracker * tracker)
+{
+    // Only touches grabbed, the tracked frame stays as it is.
+    SimulatedTracker * sim = simulated(tracker);
+    sim->grabbed++;
+    sleepSeconds(_start + sim->grabbed / _settings.fps - getTime());
+    busySeconds(_settings.grab / 1000.0);
+}
+
+void SimulatedBackend::update(PSMoveTracker * tracker, PSMove * move)
+{
+    if(simulated(tracker)->enabled[simulated(move)->id])
+    {
+        busySeconds(_settings.track / 1000.0);
+    }
+}
+
+enum PSMoveTracker_Status SimulatedBackend::getStatus(PSMoveTracker * tracker,
+                                                      PSMove * move)
+{
+    return simulated(tracker)->enabled[simulated(move)->id] ?
+            Tracker_TRACKING : Tracker_NOT_CALIBRATED;
+}
+
+void SimulatedBackend::getPosition(PSMoveTracker * tracker, PSMove * move,
+                                   float * x, float * y, float * radius)
+{
+    float lx, ly, lz;
+    getLocation(tracker, move, &lx, &ly, &lz);
+    *x = (float)(SIM_WIDTH / 2 + SIM_FOCAL * lx / lz);
+    *y = (float)(SIM_HEIGHT / 2 - SIM_FOCAL * ly / lz);
+    *radius = (float)(SIM_FOCAL * SIM_BALL_RADIUS / lz);
+}
+
+void SimulatedBackend::getLocation(PSMoveTracker * tracker, PSMove * move,
+                                   float * x, float * y, float * z)
+{
+    int id = simulated(move)->id;
+    simulatedLocation(id, id >= _settings.controllers - _settings.idle,
+                      simulated(tracker)->frameTime, x, y, z);
+}
+
+void * SimulatedBackend::getFrame(PSMoveTracker * tracker)
+{
+    // A black image, the viewer draws the controllers onto its copy.
+    return simulated(tracker)->image;
+}
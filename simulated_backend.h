@@ -0,0 +1,109 @@
+#ifndef SIMULATED_BACKEND_H
+#define SIMULATED_BACKEND_H
+
+#include "move_backend.h"
+
+/**
+ * Config for the simulated backend, all 'sim_*' keys.
+ **/
+struct SimulationSettings
+{
+        int controllers; // Controllers that appear connected.
+        float rate; // Hz, IMU reports per controller.
+        float latency; // ms spent in every poll that returns a report.
+        float fps; // Camera frame rate.
+        float grab; // ms of CPU every grabbed image costs (decoding).
+        float track; // ms of CPU every update() of an enabled controller costs.
+        int idle; // The last this many controllers lie still, no buttons.
+};
+
+void defaultSimulationSettings(SimulationSettings & settings);
+
+/**
+ * Made up controllers and cameras for running the server without hardware.
+ *
+ * Every controller circles in front of the cameras while turning, presses
+ * a button every two seconds and ramps its trigger, unless it is idle. All values are a
+ * function of the report or frame time only, so runs are repeatable apart
+ * from scheduling. New reports become available at the configured rate,
+ * and each one can cost an injected latency in poll() to stand in for the
+ * Bluetooth transport. Cameras deliver frames at their frame rate and
+ * always find every enabled controller. Grabbing and tracking can cost
+ * injected CPU time to stand in for decoding and the blob search, and
+ * images can be grabbed ahead of tracking.
+ **/
+class SimulatedBackend : public MoveBackend
+{
+    public:
+        SimulatedBackend(const SimulationSettings & settings);
+        virtual ~SimulatedBackend();
+
+        virtual bool init();
+        virtual void shutdown();
+        virtual const char * name();
+
+        virtual int countConnected();
+        virtual PSMove * connect(int id);
+        virtual void disconnect(PSMove * move);
+        virtual enum PSMove_Connection_Type connectionType(PSMove * move);
+        virtual char * getSerial(PSMove * move);
+        virtual void enableOrientation(PSMove * move);
+        virtual bool hasOrientation(PSMove * move);
+        virtual void resetOrientation(PSMove * move);
+
+        virtual int poll(PSMove * move);
+        virtual unsigned int getButtons(PSMove * move);
+        virtual int getTrigger(PSMove * move);
+        virtual void getAccelerometer(PSMove * move, float * x, float * y,
+                                      float * z);
+        virtual void getGyroscope(PSMove * move, float * x, float * y,
+                                  float * z);
+        virtual void getMagnetometer(PSMove * move, float * x, float * y,
+                                     float * z);
+        virtual void getOrientation(PSMove * move, float * w, float * x,
+                                    float * y, float * z);
+
+        virtual void setLeds(PSMove * move, unsigned char r, unsigned char g,
+                             unsigned char b);
+        virtual void setRumble(PSMove * move, unsigned char rumble);
+        virtual void updateLeds(PSMove * move);
+
+        virtual PSMoveTracker * newTracker(int camera);
+        virtual void freeTracker(PSMoveTracker * tracker);
+        virtual void getTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void setTrackerSettings(PSMoveTracker * tracker,
+                                        PSMoveTrackerSettings * settings);
+        virtual void getTrackerSize(PSMoveTracker * tracker, int * width,
+                                    int * height);
+
+        virtual enum PSMoveTracker_Status enable(PSMoveTracker * tracker,
+                                                 PSMove * move);
+        virtual enum PSMoveTracker_Status enableWithColor(
+                PSMoveTracker * tracker, PSMove * move, unsigned char r,
+                unsigned char g, unsigned char b);
+        virtual void disable(PSMoveTracker * tracker, PSMove * move);
+        virtual void getColor(PSMoveTracker * tracker, PSMove * move,
+                              unsigned char * r, unsigned char * g,
+                              unsigned char * b);
+        virtual void setAutoUpdateLeds(PSMoveTracker * tracker, PSMove * move,
+                                       bool enabled);
+
+        virtual void updateImage(PSMoveTracker * tracker);
+        virtual bool canGrabAhead();
+        virtual void grabImage(PSMoveTracker * tracker);
+        virtual void update(PSMoveTracker * tracker, PSMove * move);
+        virtual enum PSMoveTracker_Status getStatus(PSMoveTracker * tracker,
+                                                    PSMove * move);
+        virtual void getPosition(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * radius);
+        virtual void getLocation(PSMoveTracker * tracker, PSMove * move,
+                                 float * x, float * y, float * z);
+        virtual void * getFrame(PSMoveTracker * tracker);
+
+    protected:
+        SimulationSettings _settings;
+        double _start; // Time zero of every controller's motion.
+};
+
+#endif
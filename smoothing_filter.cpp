@@ -0,0 +1,261 @@
+#include "smoothing_filter.h"
+#include "log.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+bool parseFilterRule(const char * line, FilterRule & rule)
+{
+    char controller[16], stream[16], type[16];
+    float minCutoff = 1.0f, beta = 0.0f, dCutoff = 1.0f;
+
+    int n = sscanf(line, "filter %15s %15s %15s %f %f %f", controller, stream,
+                   type, &minCutoff, &beta, &dCutoff);
+    if(n < 3)
+    {
+        return false;
+    }
+
+    if(strcmp(controller, "*") == 0)
+    {
+        rule.controller = -1;
+    }
+    else
+    {
+        rule.controller = atoi(controller);
+    }
+
+    if(strcmp(stream, "position") == 0)
+    {
+        rule.stream = STREAM_POSITION;
+    }
+    else if(strcmp(stream, "orientation") == 0)
+    {
+        rule.stream = STREAM_ORIENTATION;
+    }
+    else if(strcmp(stream, "fused") == 0)
+    {
+        rule.stream = STREAM_FUSED;
+    }
+    else
+    {
+        LOG(LOG_WARNING, "Unknown filter stream: '%s'", stream);
+        return false;
+    }
+
+    if(strcmp(type, "none") == 0)
+    {
+        rule.settings.type = FILTER_NONE;
+    }
+    else if(strcmp(type, "exponential") == 0)
+    {
+        rule.settings.type = FILTER_EXPONENTIAL;
+    }
+    else if(strcmp(type, "oneeuro") == 0)
+    {
+        rule.settings.type = FILTER_ONE_EURO;
+    }
+    else
+    {
+        LOG(LOG_WARNING, "Unknown filter type: '%s'", type);
+        return false;
+    }
+
+    rule.settings.minCutoff = minCutoff;
+    rule.settings.beta = beta;
+    rule.settings.dCutoff = dCutoff;
+    return true;
+}
+
+// Smoothing factor of a first order low pass with the given cutoff.
+static inline float lowPassAlpha(float cutoff, double dt)
+{
+    double tau = 1.0 / (2.0 * M_PI * cutoff);
+    return (float)(1.0 / (1.0 + tau / dt));
+}
+
+SmoothingBank::SmoothingBank(int controllers, int dimension, bool quaternion)
+{
+    _controllers = controllers;
+    _dimension = dimension;
+    _quaternion = quaternion;
+
+    FilterSettings none;
+    none.type = FILTER_NONE;
+    none.minCutoff = 1.0f;
+    none.beta = 0.0f;
+    none.dCutoff = 1.0f;
+
+    _settings.resize(controllers, none);
+    _value.resize(controllers * dimension, 0.0f);
+    _deriv.resize(controllers * dimension, 0.0f);
+    _lastTime.resize(controllers, 0.0);
+    _init.resize(controllers, 0);
+}
+
+void SmoothingBank::setFilter(int controller, const FilterSettings & settings)
+{
+    if(controller < 0 || controller >= _controllers)
+    {
+        return;
+    }
+    _settings[controller] = settings;
+    _init[controller] = 0;
+}
+
+void SmoothingBank::applyRules(int stream,
+                               const std::vector<FilterRule> & rules)
+{
+    FilterSettings none;
+    none.type = FILTER_NONE;
+    none.minCutoff = 1.0f;
+    none.beta = 0.0f;
+    none.dCutoff = 1.0f;
+    for(int c = 0; c < _controllers; c++)
+    {
+        if(_settings[c].type != FILTER_NONE)
+        {
+            setFilter(c, none);
+        }
+    }
+
+    // Later rules override earlier ones, so "*" can be followed by exceptions.
+    for(size_t i = 0; i < rules.size(); i++)
+    {
+        if(rules[i].stream != stream)
+        {
+            continue;
+        }
+        if(rules[i].controller < 0)
+        {
+            for(int c = 0; c < _controllers; c++)
+            {
+                setFilter(c, rules[i].settings);
+            }
+        }
+        else
+        {
+            setFilter(rules[i].controller, rules[i].settings);
+        }
+    }
+}
+
+void SmoothingBank::reset(int controller)
+{
+    if(controller >= 0 && controller < _controllers)
+    {
+        _init[controller] = 0;
+    }
+}
+
+bool SmoothingBank::enabled(int controller) const
+{
+    return _settings[controller].type != FILTER_NONE;
+}
+
+void SmoothingBank::update(double time, const float * raw, const int * valid,
+                           float * out)
+{
+    const int dim = _dimension;
+
+    for(int c = 0; c < _controllers; c++)
+    {
+        const float * x = raw + c * dim;
+        float * y = out + c * dim;
+        float * value = &_value[c * dim];
+        float * deriv = &_deriv[c * dim];
+        const FilterSettings & s = _settings[c];
+
+        if(s.type == FILTER_NONE || (!valid[c] && !_init[c]))
+        {
+            memcpy(y, x, sizeof(float) * dim);
+            continue;
+        }
+        if(!valid[c])
+        {
+            memcpy(y, value, sizeof(float) * dim);
+            continue;
+        }
+
+        float sample[4];
+        memcpy(sample, x, sizeof(float) * dim);
+
+        if(_quaternion && _init[c])
+        {
+            // q and -q are the same rotation, keep to the previous hemisphere.
+            float dot = 0.0f;
+            for(int i = 0; i < dim; i++)
+            {
+                dot += sample[i] * value[i];
+            }
+            if(dot < 0.0f)
+            {
+                for(int i = 0; i < dim; i++)
+                {
+                    sample[i] = -sample[i];
+                }
+            }
+        }
+
+        double dt = time - _lastTime[c];
+        if(!_init[c] || dt <= 0.0)
+        {
+            if(!_init[c])
+            {
+                memcpy(value, sample, sizeof(float) * dim);
+                memset(deriv, 0, sizeof(float) * dim);
+                _init[c] = 1;
+                _lastTime[c] = time;
+            }
+            memcpy(y, value, sizeof(float) * dim);
+            continue;
+        }
+        _lastTime[c] = time;
+
+        float cutoff = s.minCutoff;
+        if(s.type == FILTER_ONE_EURO)
+        {
+            // Filtered speed raises the cutoff while moving, lowering lag.
+            float da = lowPassAlpha(s.dCutoff, dt);
+            float speed = 0.0f;
+            for(int i = 0; i < dim; i++)
+            {
+                float d = (float)((sample[i] - value[i]) / dt);
+                deriv[i] += da * (d - deriv[i]);
+                speed += deriv[i] * deriv[i];
+            }
+            cutoff += s.beta * sqrtf(speed);
+        }
+
+        float a = lowPassAlpha(cutoff, dt);
+        for(int i = 0; i < dim; i++)
+        {
+            value[i] += a * (sample[i] - value[i]);
+        }
+
+        if(_quaternion)
+        {
+            float norm = 0.0f;
+            for(int i = 0; i < dim; i++)
+            {
+                norm += value[i] * value[i];
+            }
+            if(norm > 0.0f)
+            {
+                norm = 1.0f / sqrtf(norm);
+                for(int i = 0; i < dim; i++)
+                {
+                    value[i] *= norm;
+                }
+            }
+        }
+
+        memcpy(y, value, sizeof(float) * dim);
+    }
+}
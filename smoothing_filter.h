@@ -0,0 +1,80 @@
+#ifndef SMOOTHING_FILTER_H
+#define SMOOTHING_FILTER_H
+
+#include <vector>
+
+enum FilterType
+{
+    FILTER_NONE = 0,
+    FILTER_EXPONENTIAL,
+    FILTER_ONE_EURO
+};
+
+/**
+ * Streams that can be smoothed. Each stream is filtered by the thread that
+ * produces it: position by the tracker, orientation and fused position by
+ * the physical thread.
+ **/
+enum FilterStream
+{
+    STREAM_POSITION = 0, // "b" tx ty tz
+    STREAM_ORIENTATION, // "a" qw qx qy qz
+    STREAM_FUSED, // "f" fx fy fz
+    STREAM_COUNT
+};
+
+struct FilterSettings
+{
+        int type;
+        float minCutoff; // Hz. The cutoff of the exponential filter.
+        float beta; // One-Euro speed coefficient.
+        float dCutoff; // Hz. One-Euro cutoff for the speed estimate.
+};
+
+/**
+ * Config line: filter <controller|*> <position|orientation|fused> <none|exponential|oneeuro> [minCutoff beta dCutoff]
+ **/
+struct FilterRule
+{
+        int controller; // -1 for all controllers
+        int stream;
+        FilterSettings settings;
+};
+
+bool parseFilterRule(const char * line, FilterRule & rule);
+
+/**
+ * Smoothing filters for one stream of every controller, stored as flat
+ * arrays so all controllers are filtered in a single pass per tick.
+ * Quaternion streams are sign aligned and renormalised.
+ **/
+class SmoothingBank
+{
+    public:
+        SmoothingBank(int controllers, int dimension, bool quaternion);
+
+        void setFilter(int controller, const FilterSettings & settings);
+        // Replaces the current filters, controllers without a rule get none.
+        void applyRules(int stream, const std::vector<FilterRule> & rules);
+        bool enabled(int controller) const;
+        // Forget the filter state, e.g. when a slot gets a new controller.
+        void reset(int controller);
+
+        // raw and out hold 'dimension' floats per controller. Controllers with
+        // valid[c] == 0 are not advanced and return their last filtered value.
+        void update(double time, const float * raw, const int * valid,
+                    float * out);
+
+    protected:
+        int _controllers;
+        int _dimension;
+        bool _quaternion;
+
+        std::vector<FilterSettings> _settings;
+        std::vector<float> _value;
+        std::vector<float> _deriv;
+        std::vector<double> _lastTime;
+        std::vector<int> _init;
+};
+
+#endif
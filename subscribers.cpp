@@ -0,0 +1,385 @@
+#include "subscribers.h"
+#include "Atomic.hpp"
+#include "latency_stats.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+SubscriberTable::SubscriberTable(const Subscriber & defaults, double timeout)
+{
+    _defaults = defaults;
+    _timeout = timeout;
+    _version = 0;
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        _acked[i] = -1;
+    }
+}
+
+int SubscriberTable::find(const SOCKADDR_IN & address)
+{
+    for(size_t i = 0; i < _subscribers.size(); i++)
+    {
+        if(_subscribers[i].active
+                && _subscribers[i].address.sin_addr.s_addr == address.sin_addr.s_addr
+                && _subscribers[i].address.sin_port == address.sin_port)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SubscriberTable::find(const SOCKADDR_IN & from, int port)
+{
+    SOCKADDR_IN address = from;
+    address.sin_port = htons(port);
+    return find(address);
+}
+
+void SubscriberTable::release(int index)
+{
+    _subscribers[index].active = 0;
+    atomicStore(&_acked[index], -1);
+    atomicAdd(&_version, 1);
+}
+
+int SubscriberTable::subscribe(const SOCKADDR_IN & from, const char * options,
+                               double now)
+{
+    Subscriber subscriber = _defaults;
+    memset(&subscriber.address, 0, sizeof(subscriber.address));
+    subscriber.address.sin_family = AF_INET;
+    subscriber.address.sin_addr = from.sin_addr;
+    subscriber.generation = 0;
+    subscriber.active = 1;
+    subscriber.seen = now;
+
+    int port = SEND_PORT;
+    char key[32];
+    int value, used;
+    while(sscanf(options, " %31[^= ]=%d%n", key, &value, &used) == 2)
+    {
+        options += used;
+        if(strcmp(key, "port") == 0)
+        {
+            port = value;
+        }
+        else if(strcmp(key, "stream") == 0)
+        {
+            subscriber.stream = value;
+        }
+        else if(strcmp(key, "events") == 0)
+        {
+            subscriber.events = value;
+        }
+        else if(strcmp(key, "changes") == 0)
+        {
+            subscriber.changes = value;
+        }
+        else if(strcmp(key, "keyframe") == 0)
+        {
+            subscriber.keyframe = value / 1000.0;
+        }
+        else if(strcmp(key, "redundancy") == 0)
+        {
+            subscriber.redundancy = value < 0 ? 0
+                    : (value > MAX_REDUNDANCY ? MAX_REDUNDANCY : value);
+        }
+    }
+    subscriber.address.sin_port = htons(port);
+
+    _mutex.lock();
+    int index = find(subscriber.address);
+    for(size_t i = 0; index < 0 && i < _subscribers.size(); i++)
+    {
+        if(!_subscribers[i].active)
+        {
+            index = i;
+        }
+    }
+    if(index >= 0)
+    {
+        subscriber.generation = _subscribers[index].generation + 1;
+        _subscribers[index] = subscriber;
+    }
+    else if(_subscribers.size() < MAX_SUBSCRIBERS)
+    {
+        index = _subscribers.size();
+        _subscribers.push_back(subscriber);
+    }
+    if(index >= 0)
+    {
+        atomicStore(&_acked[index], -1);
+        atomicAdd(&_version, 1);
+    }
+    _mutex.unlock();
+    return index;
+}
+
+bool SubscriberTable::unsubscribe(const SOCKADDR_IN & from, int port)
+{
+    _mutex.lock();
+    int index = find(from, port);
+    if(index >= 0)
+    {
+        release(index);
+    }
+    _mutex.unlock();
+    return index >= 0;
+}
+
+void SubscriberTable::keepAlive(const SOCKADDR_IN & from, int port, double now)
+{
+    _mutex.lock();
+    int index = find(from, port);
+    if(index >= 0)
+    {
+        _subscribers[index].seen = now;
+    }
+    _mutex.unlock();
+}
+
+bool SubscriberTable::expire(double now, SOCKADDR_IN & address)
+{
+    if(_timeout <= 0.0)
+    {
+        return false;
+    }
+    _mutex.lock();
+    int index = -1;
+    for(size_t i = 0; index < 0 && i < _subscribers.size(); i++)
+    {
+        if(_subscribers[i].active && now - _subscribers[i].seen > _timeout)
+        {
+            index = i;
+        }
+    }
+    if(index >= 0)
+    {
+        address = _subscribers[index].address;
+        release(index);
+    }
+    _mutex.unlock();
+    return index >= 0;
+}
+
+int SubscriberTable::lookup(const SOCKADDR_IN & from, int port)
+{
+    _mutex.lock();
+    int index = find(from, port);
+    _mutex.unlock();
+    return index;
+}
+
+int SubscriberTable::version()
+{
+    return atomicLoad(&_version);
+}
+
+int SubscriberTable::copy(std::vector<Subscriber> & out)
+{
+    _mutex.lock();
+    int version = atomicLoad(&_version);
+    out = _subscribers;
+    _mutex.unlock();
+    return version;
+}
+
+void SubscriberTable::ack(const SOCKADDR_IN & from, int port, int sequence,
+                          double now)
+{
+    _mutex.lock();
+    int index = find(from, port);
+    if(index >= 0)
+    {
+        _subscribers[index].seen = now;
+    }
+    _mutex.unlock();
+    if(index < 0)
+    {
+        return;
+    }
+    // Acks can arrive out of order, only ever move forward.
+    int old = atomicLoad(&_acked[index]);
+    while(sequence - old > 0)
+    {
+        int previous = atomicCompareExchange(&_acked[index], old, sequence);
+        if(previous == old)
+        {
+            break;
+        }
+        old = previous;
+    }
+}
+
+int SubscriberTable::acked(int index)
+{
+    return atomicLoad(&_acked[index]);
+}
+
+StreamSender::StreamSender(int streams)
+{
+    _streams = streams;
+    Sent none = { -1, 0.0 };
+    _sent.resize(MAX_SUBSCRIBERS * streams, none);
+    _payloads.resize(MAX_SUBSCRIBERS * streams * MAX_PAYLOAD, 0);
+    _records.resize(MAX_SUBSCRIBERS * streams * MAX_REDUNDANCY * MAX_RECORD, 0);
+    _recordCount.resize(MAX_SUBSCRIBERS * streams, 0);
+    _newest.resize(MAX_SUBSCRIBERS * streams, 0);
+}
+
+bool StreamSender::due(int index, const Subscriber & subscriber, int stream,
+                       const char * payload, const char * fields, double now)
+{
+    Sent & sent = _sent[index * _streams + stream];
+    char * last = &_payloads[(index * _streams + stream) * MAX_PAYLOAD];
+    if(subscriber.changes && sent.generation == subscriber.generation
+            && now - sent.time < subscriber.keyframe
+            && !payloadChanged(last, payload, fields, subscriber.deadband))
+    {
+        return false;
+    }
+    sent.generation = subscriber.generation;
+    sent.time = now;
+    if(subscriber.changes)
+    {
+        // One that doesn't fit is never matched, so it's always sent.
+        size_t length = strlen(payload);
+        if(length < MAX_PAYLOAD)
+        {
+            memcpy(last, payload, length + 1);
+        }
+        else
+        {
+            last[0] = 0;
+        }
+    }
+    return true;
+}
+
+void StreamSender::addRecord(int sent, const char * record)
+{
+    _newest[sent] = (_newest[sent] + 1) % MAX_REDUNDANCY;
+    char * slot = &_records[(sent * MAX_REDUNDANCY + _newest[sent]) * MAX_RECORD];
+    strncpy(slot, record, MAX_RECORD - 1);
+    slot[MAX_RECORD - 1] = 0;
+    if(_recordCount[sent] < MAX_REDUNDANCY)
+    {
+        _recordCount[sent]++;
+    }
+}
+
+void StreamSender::send(SOCKET socket,
+                        const std::vector<Subscriber> & subscribers, int stream,
+                        const char * message, int length, const char * fields,
+                        const char * record, double now)
+{
+    char packet[512 + 16 + MAX_REDUNDANCY * MAX_RECORD];
+    const char * payload = streamPayload(message);
+    for(size_t i = 0; i < subscribers.size(); i++)
+    {
+        const Subscriber & subscriber = subscribers[i];
+        if(!subscriber.active || !subscriber.stream)
+        {
+            continue;
+        }
+        // Records sent to an earlier client in the slot don't count.
+        int sent = i * _streams + stream;
+        if(_sent[sent].generation != subscriber.generation)
+        {
+            _recordCount[sent] = 0;
+        }
+        if(!due(i, subscriber, stream, payload, fields, now))
+        {
+            statsCount(COUNT_SUPPRESSED);
+            continue;
+        }
+
+        const char * out = message;
+        int outLength = length;
+        int depth = subscriber.redundancy;
+        if(depth > _recordCount[sent])
+        {
+            depth = _recordCount[sent];
+        }
+        if(depth > 0 && length < 512)
+        {
+            memcpy(packet, message, length);
+            outLength = length + sprintf(packet + length, " R %d", depth);
+            for(int r = 0; r < depth; r++)
+            {
+                int slot = (_newest[sent] - r + MAX_REDUNDANCY) % MAX_REDUNDANCY;
+                outLength += sprintf(packet + outLength, " %s",
+                        &_records[(sent * MAX_REDUNDANCY + slot) * MAX_RECORD]);
+            }
+            out = packet;
+        }
+
+        if(sendto(socket, out, outLength, 0,
+                  (const SOCKADDR*)&subscriber.address,
+                  sizeof(subscriber.address)) < 0)
+        {
+            statsCount(COUNT_SEND_ERRORS);
+        }
+        if(subscriber.redundancy > 0)
+        {
+            addRecord(sent, record);
+        }
+    }
+}
+
+const char * streamPayload(const char * message)
+{
+    int fields = 0;
+    while(*message && fields < 2)
+    {
+        if(*message++ == ' ')
+        {
+            fields++;
+        }
+    }
+    return message;
+}
+
+bool payloadChanged(const char * last, const char * payload,
+                    const char * fields, const float * deadband)
+{
+    while(1)
+    {
+        while(*last == ' ')
+        {
+            last++;
+        }
+        while(*payload == ' ')
+        {
+            payload++;
+        }
+        if(!*last || !*payload)
+        {
+            return *last != *payload;
+        }
+        size_t lastLength = strcspn(last, " ");
+        size_t length = strcspn(payload, " ");
+
+        char kind = *fields ? *fields++ : 0;
+        if(kind == 'i' || kind == 'q' || kind == 'p')
+        {
+            int which = kind == 'i' ? DEADBAND_IMU
+                    : (kind == 'q' ? DEADBAND_QUATERNION : DEADBAND_POSITION);
+            if(fabs(strtod(payload, NULL) - strtod(last, NULL)) > deadband[which])
+            {
+                return true;
+            }
+        }
+        else if(kind != '-' && (length != lastLength
+                                || memcmp(last, payload, length) != 0))
+        {
+            return true;
+        }
+        last += lastLength;
+        payload += length;
+    }
+}
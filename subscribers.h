@@ -0,0 +1,169 @@
+#ifndef SUBSCRIBERS_H
+#define SUBSCRIBERS_H
+
+#include "Mutex.hpp"
+#include "move_udp_server.h"
+
+#include <vector>
+
+#define MAX_SUBSCRIBERS 8
+// Deepest redundancy a subscriber can ask for, and the longest sample record.
+#define MAX_REDUNDANCY 8
+#define MAX_RECORD 64
+// Longest stream packet payload kept for send-on-change, longer ones are
+// always sent.
+#define MAX_PAYLOAD 384
+
+/**
+ * Field kinds of a stream packet, for the send-on-change deadbands. The
+ * senders describe their packets with one letter per field after the
+ * message number: 'i' IMU (accelerometer, gyroscope, magnetometer), 'q'
+ * quaternion, 'p' position in cm, '-' not compared, anything else has to
+ * match exactly.
+ **/
+enum DeadbandKind
+{
+    DEADBAND_IMU = 0,
+    DEADBAND_QUATERNION,
+    DEADBAND_POSITION,
+    DEADBAND_KINDS
+};
+
+/**
+ * A client that sent "c". Options can follow the c as key=value pairs:
+ *   port=<n>     UDP port the client listens on, SEND_PORT by default.
+ *   stream=0|1   "a", "b" and "f" packets, on by default.
+ *   events=0|1   "e" button events, off by default.
+ *   changes=0|1  Only stream packets that differ from the last one sent for
+ *                the controller, send_on_change by default.
+ *   keyframe=<n> ms after which an unchanged packet is sent anyway.
+ *                A field counts as unchanged while it is within its
+ *                deadband of the value last sent.
+ *   redundancy=<k>  Stream packets also carry the previous k samples of the
+ *                controller, redundancy by default.
+ * Sending "c" again from the same address and port changes the options.
+ * "p [port]" keeps a subscriber alive without touching its options and
+ * "u [port]" unsubscribes it.
+ **/
+struct Subscriber
+{
+        SOCKADDR_IN address;
+        int stream;
+        int events;
+        int changes;
+        double keyframe; // Seconds
+        float deadband[DEADBAND_KINDS]; // From the config, 0 sends any change.
+        int redundancy;
+        int generation; // Incremented each time the client subscribes.
+        int active; // 0 once the slot is free.
+        double seen; // Last c, k or p from the client.
+};
+
+/**
+ * Clients the server streams to. Subscriptions come from the receive
+ * thread; the sending threads keep a copy and refresh it when version()
+ * changes. A subscriber keeps its index until it unsubscribes or expires,
+ * the sending threads skip inactive slots. A client taking over a freed
+ * slot gets the next generation, so per subscriber state is started over.
+ **/
+class SubscriberTable
+{
+    public:
+        // Options of a client that doesn't set them, and seconds without a
+        // message after which a subscriber expires (0 never).
+        SubscriberTable(const Subscriber & defaults, double timeout);
+
+        // Adds the client or updates its options. Returns its index, -1 if the table is full.
+        int subscribe(const SOCKADDR_IN & from, const char * options,
+                      double now);
+        // "u": frees the subscriber's slot. False if it isn't subscribed.
+        bool unsubscribe(const SOCKADDR_IN & from, int port);
+        // "p": the subscriber is still there.
+        void keepAlive(const SOCKADDR_IN & from, int port, double now);
+        // Frees the slot of one subscriber silent for longer than the
+        // timeout and returns its address. False if there is none.
+        bool expire(double now, SOCKADDR_IN & address);
+        // Index of the subscriber at the client's address and 'port', -1
+        // if there is none.
+        int lookup(const SOCKADDR_IN & from, int port);
+        int version();
+        // Copies the table, returns the version copied.
+        int copy(std::vector<Subscriber> & out);
+
+        // Event sequence number acknowledged by a "k" message from the client.
+        void ack(const SOCKADDR_IN & from, int port, int sequence, double now);
+        // -1 until the subscriber acknowledges an event.
+        int acked(int index);
+
+    protected:
+        // Index of the active subscriber at 'address', -1 if there is none.
+        int find(const SOCKADDR_IN & address);
+        // Same, for an address the client sent from and the port it gave.
+        int find(const SOCKADDR_IN & from, int port);
+        void release(int index);
+
+        Subscriber _defaults;
+        double _timeout;
+
+        Mutex _mutex;
+        std::vector<Subscriber> _subscribers;
+        volatile int _version;
+        volatile int _acked[MAX_SUBSCRIBERS];
+};
+
+/**
+ * Sends the stream packets of one thread to the subscribers. A stream is
+ * e.g. the "a" packets of one controller.
+ *
+ * Send-on-change: the payload of the last packet each subscriber got on
+ * each stream is kept, without the message number, and compared field by
+ * field with the next one.
+ *
+ * Redundancy: each packet comes with a compact record of its sample. The
+ * records of the last MAX_REDUNDANCY packets each subscriber was sent on
+ * each stream are kept, packets send-on-change held back don't count. A
+ * subscriber with redundancy=k gets its previous k appended, newest first:
+ *   <packet> R <n> <record> ...
+ * so it can rebuild lost samples from the next packet that arrives.
+ **/
+class StreamSender
+{
+    public:
+        StreamSender(int streams);
+
+        // 'fields' are the kinds of the packet's fields, see DeadbandKind.
+        void send(SOCKET socket, const std::vector<Subscriber> & subscribers,
+                  int stream, const char * message, int length,
+                  const char * fields, const char * record, double now);
+
+    protected:
+        // False if the payload is within the subscriber's deadbands of the
+        // last one it got and no keyframe is due.
+        bool due(int index, const Subscriber & subscriber, int stream,
+                 const char * payload, const char * fields, double now);
+        // 'sent' indexes _sent, one ring per subscriber and stream.
+        void addRecord(int sent, const char * record);
+
+        struct Sent
+        {
+                int generation;
+                double time;
+        };
+
+        int _streams;
+        std::vector<Sent> _sent; // MAX_SUBSCRIBERS * streams
+        std::vector<char> _payloads; // MAX_PAYLOAD per subscriber and stream
+
+        std::vector<char> _records; // MAX_REDUNDANCY * MAX_RECORD per subscriber and stream
+        std::vector<int> _recordCount;
+        std::vector<int> _newest;
+};
+
+// A stream packet after its first two fields (type and message number).
+const char * streamPayload(const char * message);
+// True if a field of 'payload' is off the same field of 'last' by more than
+// the deadband of its kind, or the fields don't line up.
+bool payloadChanged(const char * last, const char * payload,
+                    const char * fields, const float * deadband);
+
+#endif
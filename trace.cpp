@@ -0,0 +1,122 @@
+#include "trace.h"
+#include "Atomic.hpp"
+#include "Thread.hpp"
+#include "Timer.hpp"
+
+#include <cstdio>
+#include <vector>
+
+#define TRACE_DEFAULT_EVENTS 65536
+
+struct TraceRecord
+{
+        const char * name;
+        unsigned long long micros;
+        char phase;
+};
+
+/**
+ * One thread's events. Only the owning thread writes, traceWrite() reads
+ * whatever has been published through 'next'.
+ **/
+struct TraceRing
+{
+        const char * thread;
+        TraceRecord * records;
+        int mask;
+        volatile int next;
+        volatile int wrapped;
+};
+
+volatile int traceEnabled = 0;
+
+static int bufferEvents = TRACE_DEFAULT_EVENTS;
+static Mutex ringsMutex;
+static std::vector<TraceRing *> rings;
+static unsigned long long traceStart = getTimeMicros();
+
+static THREAD_LOCAL TraceRing * threadRing = NULL;
+
+void traceSetBufferSize(int events)
+{
+    // Rounded up to a power of two.
+    int size = 1024;
+    while(size < events && size < (1 << 24))
+    {
+        size <<= 1;
+    }
+    bufferEvents = size;
+}
+
+static TraceRing * addRing()
+{
+    TraceRing * ring = new TraceRing();
+    const char * name = Thread::currentName();
+    ring->thread = name ? name : "unnamed";
+    ring->records = new TraceRecord[bufferEvents];
+    ring->mask = bufferEvents - 1;
+    ring->next = 0;
+    ring->wrapped = 0;
+
+    ringsMutex.lock();
+    rings.push_back(ring);
+    ringsMutex.unlock();
+    return ring;
+}
+
+void traceEvent(const char * name, char phase)
+{
+    TraceRing * ring = threadRing;
+    if(!ring)
+    {
+        ring = threadRing = addRing();
+    }
+    int next = ring->next;
+    TraceRecord & record = ring->records[next];
+    record.name = name;
+    record.micros = getTimeMicros();
+    record.phase = phase;
+    next = (next + 1) & ring->mask;
+    if(next == 0)
+    {
+        ring->wrapped = 1;
+    }
+    atomicStore(&ring->next, next);
+}
+
+int traceWrite(const std::string & file)
+{
+    FILE * out = fopen(file.c_str(), "w");
+    if(!out)
+    {
+        return -1;
+    }
+
+    int events = 0;
+    fprintf(out, "{\"traceEvents\":[\n");
+    ringsMutex.lock();
+    for(size_t i = 0; i < rings.size(); i++)
+    {
+        TraceRing * ring = rings[i];
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                i ? ",\n" : "", (int)i + 1, ring->thread);
+
+        // Oldest first. Events written while this runs may show up torn,
+        // the trace is meant to be saved after it has been turned off.
+        int next = atomicLoad(&ring->next);
+        int count = ring->wrapped ? ring->mask + 1 : next;
+        int first = ring->wrapped ? next : 0;
+        for(int e = 0; e < count; e++)
+        {
+            const TraceRecord & record = ring->records[(first + e) & ring->mask];
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%llu}",
+                    record.name, record.phase, (int)i + 1,
+                    record.micros - traceStart);
+        }
+        events += count;
+    }
+    ringsMutex.unlock();
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    return events;
+}
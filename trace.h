@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Mutex.hpp"
+
+#include <string>
+
+/**
+ * Timeline tracing of the server threads, saved as Chrome trace JSON
+ * (chrome://tracing, ui.perfetto.dev).
+ *
+ * Every thread writes begin and end events into its own ring buffer, so
+ * recording takes no lock; once a ring is full the oldest events are
+ * overwritten. Threads appear under the name given to
+ * Thread::nameCurrentThread(). While tracing is off each call site costs
+ * one branch on traceEnabled. Event names must be string literals, only the
+ * pointer is kept.
+ **/
+
+// Set by "trace on" or the trace config line.
+extern volatile int traceEnabled;
+
+// Events per thread ring, for rings created after the call.
+void traceSetBufferSize(int events);
+void traceEvent(const char * name, char phase);
+// Writes what the rings hold. Returns the number of events, -1 on error.
+int traceWrite(const std::string & file);
+
+// Returns whether the begin was traced. traceEnd takes it back, so "trace
+// on" or "trace off" in between can't leave half a pair.
+inline bool traceBegin(const char * name)
+{
+    if(traceEnabled)
+    {
+        traceEvent(name, 'B');
+        return true;
+    }
+    return false;
+}
+
+inline void traceEnd(const char * name, bool traced)
+{
+    if(traced)
+    {
+        traceEvent(name, 'E');
+    }
+}
+
+/**
+ * Traces the enclosing scope.
+ **/
+class TraceScope
+{
+    public:
+        TraceScope(const char * name)
+        {
+            _name = traceEnabled ? name : NULL;
+            if(_name)
+            {
+                traceEvent(_name, 'B');
+            }
+        }
+
+        ~TraceScope()
+        {
+            if(_name)
+            {
+                traceEvent(_name, 'E');
+            }
+        }
+
+    protected:
+        const char * _name;
+};
+
+// Locks the mutex, tracing the time spent waiting for it.
+inline void traceLock(Mutex * mutex, const char * name)
+{
+    if(!traceEnabled)
+    {
+        mutex->lock();
+        return;
+    }
+    traceEvent(name, 'B');
+    mutex->lock();
+    traceEvent(name, 'E');
+}
+
+#endif
@@ -0,0 +1,78 @@
+#include "tracker_timing.h"
+#include "Timer.hpp"
+
+#include <cstdio>
+
+static const char * stageNames[STAGE_COUNT] = { "capture", "track",
+        "viewer copy", "send" };
+
+TrackerTiming::TrackerTiming()
+{
+    reset();
+}
+
+void TrackerTiming::addStage(int stage, double seconds)
+{
+    _mutex.lock();
+    _count[stage]++;
+    _total[stage] += seconds;
+    if(seconds > _max[stage])
+    {
+        _max[stage] = seconds;
+    }
+    _mutex.unlock();
+}
+
+void TrackerTiming::addFrame()
+{
+    _mutex.lock();
+    _frames++;
+    _mutex.unlock();
+}
+
+unsigned int TrackerTiming::frames()
+{
+    _mutex.lock();
+    unsigned int frames = _frames;
+    _mutex.unlock();
+    return frames;
+}
+
+void TrackerTiming::reset()
+{
+    _mutex.lock();
+    _start = getTime();
+    _frames = 0;
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        _count[i] = 0;
+        _total[i] = 0.0;
+        _max[i] = 0.0;
+    }
+    _mutex.unlock();
+}
+
+std::string TrackerTiming::report(const char * name)
+{
+    char line[256];
+    std::string out;
+
+    _mutex.lock();
+    double elapsed = getTime() - _start;
+    snprintf(line, sizeof(line), "%s: %u frames in %.2f s (%.1f fps)\n", name,
+             _frames, elapsed, elapsed > 0.0 ? _frames / elapsed : 0.0);
+    out += line;
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        if(_count[i] == 0)
+        {
+            continue;
+        }
+        snprintf(line, sizeof(line), "  %-9s avg %7.3f ms  max %7.3f ms\n",
+                 stageNames[i], 1000.0 * _total[i] / _count[i],
+                 1000.0 * _max[i]);
+        out += line;
+    }
+    _mutex.unlock();
+    return out;
+}
@@ -0,0 +1,43 @@
+#ifndef TRACKER_TIMING_H
+#define TRACKER_TIMING_H
+
+#include "Mutex.hpp"
+
+#include <string>
+
+enum TrackerStage
+{
+    STAGE_CAPTURE = 0, // psmove_tracker_update_image
+    STAGE_TRACK, // psmove_tracker_update for every controller
+    STAGE_ANNOTATE, // Copying the frame for the viewer and debug stream
+    STAGE_SEND, // Filtering, MoveState and sendto in the send stage
+    STAGE_COUNT
+};
+
+/**
+ * Frame rate and per stage timing of one tracker thread. Written by the
+ * thread itself, read by the console.
+ **/
+class TrackerTiming
+{
+    public:
+        TrackerTiming();
+
+        void addStage(int stage, double seconds);
+        void addFrame();
+        unsigned int frames();
+        void reset();
+
+        // Human readable summary: fps and avg/max per stage in ms.
+        std::string report(const char * name);
+
+    protected:
+        Mutex _mutex;
+        double _start;
+        unsigned int _frames;
+        unsigned int _count[STAGE_COUNT];
+        double _total[STAGE_COUNT];
+        double _max[STAGE_COUNT];
+};
+
+#endif
@@ -28,6 +28,15 @@
 
 #include "move_udp_server.h"
 #include "udp_physical.h"
+#include "Timer.hpp"
+#include "smoothing_filter.h"
+#include "trace.h"
+#include "log.h"
+#include "latency_stats.h"
+#include "move_backend.h"
+#include "subscribers.h"
+#include "button_events.h"
+#include "sample_history.h"
 
 #include <cstring>
 
@@ -35,6 +44,42 @@
 #include <unistd.h>
 #endif
 
+// Reports read from a controller in one tick, queued reports are drained so
+// button events see every one of them.
+#define MAX_DRAINED_REPORTS 8
+
+// Field kinds of the "a" and "f" packets for the send-on-change deadbands:
+// controller, buttons, trigger, IMU, orientation flag, quaternion, LED
+// colour, filtered quaternion; controller, position, tracking, filtered
+// position.
+#define FIELDS_A "eee" "iiiiiiiii" "e" "qqqq" "eee" "qqqq"
+#define FIELDS_F "e" "ppp" "e" "ppp"
+
+// Everything read from one controller in a single poll.
+struct PhysicalSample
+{
+        int polled;
+        double pollTime; // Just before the poll of the report used.
+        unsigned int rawButtons;
+        int buttons;
+        int trigger;
+        float ax, ay, az, gx, gy, gz, mx, my, mz;
+        int orientationEnabled;
+        int fusionTracking;
+        int r, g, b;
+        int rumble;
+};
+
+// LED and rumble values last written to a controller. Output reports share
+// the Bluetooth link with the input reports, so they only go out on a change
+// or when the keep-alive is due.
+struct OutputState
+{
+        int r, g, b;
+        int rumble;
+        double time; // Time of the write, < 0 forces the next one.
+};
+
 // Formats move button presses into a simple 8 bit integer.
 int format_buttons(unsigned int currButtons)
 {
@@ -50,6 +95,36 @@ int format_buttons(unsigned int currButtons)
     return btnsToReturn;
 }
 
+// True if the poll left every value the physical thread publishes as it was.
+static bool samePublished(const MoveState & a, const MoveState & b)
+{
+    return a.buttons == b.buttons && a.trigger == b.trigger
+            && a.qw == b.qw && a.qx == b.qx && a.qy == b.qy && a.qz == b.qz
+            && a.rqw == b.rqw && a.rqx == b.rqx && a.rqy == b.rqy
+            && a.rqz == b.rqz
+            && a.x == b.x && a.y == b.y && a.z == b.z
+            && a.vx == b.vx && a.vy == b.vy && a.vz == b.vz
+            && a.lax == b.lax && a.lay == b.lay && a.laz == b.laz
+            && a.ax == b.ax && a.ay == b.ay && a.az == b.az
+            && a.gx == b.gx && a.gy == b.gy && a.gz == b.gz
+            && a.mx == b.mx && a.my == b.my && a.mz == b.mz;
+}
+
+// Moves the controller's fusion on to the report just polled.
+static void predictFusion(MoveState * state, PSMove * move, double time)
+{
+    float ax, ay, az;
+    float q[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+    moveBackend->getAccelerometer(move, &ax, &ay, &az);
+    if(moveBackend->hasOrientation(move))
+    {
+        moveBackend->getOrientation(move, &q[0], &q[1], &q[2], &q[3]);
+    }
+    traceLock(state->lock, "wait MoveState");
+    state->fusion->predict(time, ax, ay, az, q[0], q[1], q[2], q[3]);
+    state->lock->unlock();
+}
+
 UDP_Physical::UDP_Physical(PSENDTHREADDATA data,
                            std::vector<MoveState*> & stateList) :
         Thread()
@@ -67,39 +142,164 @@ void UDP_Physical::run()
     // ----- physicalData variables -----
     int totalConnectedMoves = _physicalData->totalConnectedMoves;
     PSMove** controllers = _physicalData->controllers;
-    // Sending address/socket is defined by udp_recv.cpp once a client connects.
-    SOCKADDR_IN* sendAddress = _physicalData->sendAddress;
+    // Subscribers and the socket are set up by udp_recv.cpp once a client connects.
+    SubscriberTable* subscriberTable = _physicalData->subscribers;
     SOCKET* udpSocket = _physicalData->udpSocket;
     int* okayToSend = _physicalData->okayToSend;
+    float ledRefresh = _physicalData->ledRefresh;
+    SampleHistory* history = _physicalData->history;
 
     int* trackingEnabled = _physicalData->trackingEnabled;
     // ControllerData can be changed by 'udp_recv.cpp' messages and also altered here.
     // Protected by the controllerMutex.
     ControllerData* controllerData = _physicalData->controllerData;
 
-    int currButtons = 0;
-    int analogVal = 0;
-    int orientationEnabled = 0;
     int currPoll = 0;
     int msgNo = 0;
     int c;
-    float ax, ay, az, gx, gy, gz, mx, my, mz, qx, qy, qz, qw;
-    int server_length = sizeof(struct sockaddr_in);
     char sendMes[512];
 
     PSMove* move;
 
+    // Values read this tick, one entry per controller. Quaternions and fused
+    // positions are kept in flat arrays so each filter bank runs in one pass.
+    std::vector<PhysicalSample> samples(totalConnectedMoves);
+    std::vector<float> rawQuat(totalConnectedMoves * 4, 0.0f);
+    std::vector<float> filteredQuat(totalConnectedMoves * 4, 0.0f);
+    std::vector<int> quatValid(totalConnectedMoves, 0);
+    std::vector<float> rawFused(totalConnectedMoves * 3, 0.0f);
+    std::vector<float> filteredFused(totalConnectedMoves * 3, 0.0f);
+    std::vector<int> fusedValid(totalConnectedMoves, 0);
+
+    // Slot state this tick, and the controller generation last seen per slot.
+    std::vector<int> slotState(totalConnectedMoves, SLOT_EMPTY);
+    std::vector<int> generation(totalConnectedMoves, -1);
+    std::vector<int> releasedGeneration(totalConnectedMoves, -1);
+
+    OutputState noOutput = { 0, 0, 0, 0, -1.0 };
+    std::vector<OutputState> outputs(totalConnectedMoves, noOutput);
+
+    // Rules are applied on the first tick and again after a config reload.
+    SmoothingBank orientationFilter(totalConnectedMoves, 4, true);
+    SmoothingBank fusedFilter(totalConnectedMoves, 3, false);
+    int appliedFilterVersion = -1;
+
+    std::vector<Subscriber> subscribers;
+    int subscriberVersion = -1;
+    // "a" and "f" packets of each controller.
+    StreamSender streamSender(totalConnectedMoves * 2);
+    char record[MAX_RECORD];
+    ButtonEvents events(totalConnectedMoves, _physicalData->eventThresholds,
+                        _physicalData->eventRetransmit);
+
+    for(c = 0; c < totalConnectedMoves; c++)
+    {
+        rawQuat[c * 4] = 1.0f;
+    }
+    nameCurrentThread("physical");
+
     while(1)
     {
+        double now = getTime();
+        bool tracedTick = traceBegin("tick");
+
+        // Let go of retiring controllers, the monitor disconnects them once
+        // every thread has. A new generation means a new controller in the slot.
+        traceLock(controllerMutex, "wait controllerMutex");
+        if(appliedFilterVersion != filterVersion)
+        {
+            appliedFilterVersion = filterVersion;
+            orientationFilter.applyRules(STREAM_ORIENTATION, filterRules);
+            fusedFilter.applyRules(STREAM_FUSED, filterRules);
+        }
+        for(c = 0; c < totalConnectedMoves; c++)
+        {
+            slotState[c] = controllerData[c].slotState;
+            if(slotState[c] == SLOT_RETIRING
+                    && releasedGeneration[c] != controllerData[c].generation)
+            {
+                releasedGeneration[c] = controllerData[c].generation;
+                controllerData[c].released++;
+            }
+            else if(slotState[c] == SLOT_ACTIVE
+                    && generation[c] != controllerData[c].generation)
+            {
+                generation[c] = controllerData[c].generation;
+                orientationFilter.reset(c);
+                fusedFilter.reset(c);
+                outputs[c] = noOutput;
+                events.reset(c);
+            }
+        }
+        controllerMutex->unlock();
+
+        if(subscriberTable->version() != subscriberVersion)
+        {
+            subscriberVersion = subscriberTable->copy(subscribers);
+        }
+
         for(c = 0; c < totalConnectedMoves; c++)
         {
+            PhysicalSample & sample = samples[c];
+            sample.polled = 0;
+            quatValid[c] = 0;
+            fusedValid[c] = 0;
+            if(slotState[c] != SLOT_ACTIVE)
+            {
+                continue;
+            }
+
             move = controllers[c];
             // Need to poll for new Move data. Returns 0 if unsucessful poll.
-            currPoll = psmove_poll(move);
+            sample.pollTime = getTime();
+            bool tracedPoll = traceBegin("poll");
+            currPoll = moveBackend->poll(move);
+            traceEnd("poll", tracedPoll);
+            sample.polled = currPoll;
+            statsCount(COUNT_POLLS);
+            if(!currPoll)
+            {
+                statsCount(COUNT_FAILED_POLLS);
+            }
             if(currPoll)
             {
+                sample.trigger = moveBackend->getTrigger(move);
+                sample.rawButtons = moveBackend->getButtons(move);
+                sample.buttons = format_buttons(sample.rawButtons);
+                events.report(c, sample.pollTime, sample.buttons, sample.trigger);
+                if(_stateList[c]->fusion)
+                {
+                    predictFusion(_stateList[c], move, sample.pollTime);
+                }
+
+                // Every queued report goes to the button events and the
+                // fusion, the sample keeps the newest. A replay as fast as
+                // possible would be drained in one go.
+                for(int d = 1; d < MAX_DRAINED_REPORTS && moveBackend->realtime(); d++)
+                {
+                    double pollTime = getTime();
+                    bool tracedDrain = traceBegin("poll");
+                    int drained = moveBackend->poll(move);
+                    traceEnd("poll", tracedDrain);
+                    if(!drained)
+                    {
+                        break;
+                    }
+                    statsCount(COUNT_POLLS);
+                    sample.trigger = moveBackend->getTrigger(move);
+                    sample.rawButtons = moveBackend->getButtons(move);
+                    sample.buttons = format_buttons(sample.rawButtons);
+                    events.report(c, pollTime, sample.buttons, sample.trigger);
+                    sample.pollTime = pollTime;
+                    if(_stateList[c]->fusion)
+                    {
+                        predictFusion(_stateList[c], move, pollTime);
+                    }
+                }
+
                 // Controller mutex
-                controllerMutex->lock();
+                traceLock(controllerMutex, "wait controllerMutex");
+                controllerData[c].lastPoll = now;
 
                 // Set the move light to the tracker set value.
                 if(controllerData[c].trackerLight)
@@ -112,95 +312,278 @@ void UDP_Physical::run()
                         controllerData[c].g = controllerData[c].tg;
                         controllerData[c].b = controllerData[c].tb;
                     }
-                    psmove_set_leds(move, controllerData[c].r,
-                                    controllerData[c].g, controllerData[c].b);
                 }
-                // Set the move light to a user defined light (not recommended if tracking)
+                // A user defined light (not recommended if tracking) is already in r, g, b.
                 else if(controllerData[c].changeLight)
                 {
                     controllerData[c].changeLight = 0;
-                    psmove_set_leds(move, controllerData[c].r,
-                                    controllerData[c].g, controllerData[c].b);
                 }
-                // Rumble the controller. Only runs for a certain amount of ticks, client needs to send multiple packets to keep it going.
-                if(controllerData[c].rumbleTimeout > 0)
+                // Rumble the controller. Only runs for RUMBLE_TIMEOUT_MS, client needs to send multiple packets to keep it going.
+                sample.rumble = 0;
+                if(now < controllerData[c].rumbleUntil)
                 {
-                    if(controllerData[c].rumbleTimeout == RUMBLE_TIMEOUT)
-                    {
-                        psmove_set_rumble(move, controllerData[c].rumble);
-                    }
-                    controllerData[c].rumbleTimeout -= 1;
+                    sample.rumble = controllerData[c].rumble;
                 }
-                // Set the rumble on the controller to 0. (timeout goes to -1 to stop needlessly setting rumble to 0)
-                else
+                // A playing haptic pattern, the stronger of the two wins.
+                if(controllerData[c].hapticPattern >= 0)
                 {
-                    if(controllerData[c].rumbleTimeout == 0)
+                    int level = hapticLevel(hapticPatterns[controllerData[c].hapticPattern],
+                                            now - controllerData[c].hapticStart);
+                    if(level < 0)
+                    {
+                        controllerData[c].hapticPattern = -1;
+                    }
+                    else if(level > sample.rumble)
                     {
-                        psmove_set_rumble(move, 0);
-                        controllerData[c].rumbleTimeout = -1;
+                        sample.rumble = level;
                     }
                 }
                 // Reset the orientation (allows user to do so in application)
                 if(controllerData[c].resetOrientation)
                 {
                     controllerData[c].resetOrientation = 0;
-                    psmove_reset_orientation(move);
-                    printf("\nController %d has been calibrated.\n >", c);
+                    moveBackend->resetOrientation(move);
+                    if(controllerData[c].orientationState != ORIENTATION_UNAVAILABLE)
+                    {
+                        controllerData[c].orientationState = ORIENTATION_CALIBRATED;
+                    }
+                    LOG(LOG_INFO, "Controller %d has been calibrated.", c);
                 }
+                // Calibration requested by the server, completes when MOVE is pressed.
+                else if(controllerData[c].orientationState == ORIENTATION_WAITING
+                        && (sample.rawButtons & Btn_MOVE))
+                {
+                    moveBackend->resetOrientation(move);
+                    controllerData[c].orientationState = ORIENTATION_CALIBRATED;
+                    LOG(LOG_INFO, "Controller %d has been calibrated.", c);
+                }
+                if(controllerData[c].commandTime != 0.0)
+                {
+                    statsRecordSince(HIST_COMMAND, controllerData[c].commandTime);
+                    controllerData[c].commandTime = 0.0;
+                }
+                sample.r = controllerData[c].r;
+                sample.g = controllerData[c].g;
+                sample.b = controllerData[c].b;
                 controllerMutex->unlock();
                 // Controller mutex end
 
                 // Read values from the controller.
-                analogVal = psmove_get_trigger(move);
-                unsigned int rawButtons = psmove_get_buttons(move);
-                currButtons = format_buttons(rawButtons);
-                psmove_get_accelerometer_frame(move, Frame_SecondHalf, &ax, &ay,
-                                               &az);
-                psmove_get_gyroscope_frame(move, Frame_SecondHalf, &gx, &gy,
-                                           &gz);
-                psmove_get_magnetometer_vector(move, &mx, &my, &mz);
-                psmove_update_leds(move);
+                moveBackend->getAccelerometer(move, &sample.ax, &sample.ay,
+                                              &sample.az);
+                moveBackend->getGyroscope(move, &sample.gx, &sample.gy,
+                                          &sample.gz);
+                moveBackend->getMagnetometer(move, &sample.mx, &sample.my,
+                                             &sample.mz);
+
+                // Level changes within an envelope are coalesced, starting
+                // and stopping go out straight away.
+                OutputState & out = outputs[c];
+                bool rumbleChanged = sample.rumble != out.rumble
+                        && (sample.rumble == 0 || out.rumble == 0
+                            || now - out.time >= HAPTIC_WRITE_INTERVAL);
+                if(sample.r != out.r || sample.g != out.g || sample.b != out.b
+                        || rumbleChanged || out.time < 0.0
+                        || now - out.time >= ledRefresh)
+                {
+                    moveBackend->setLeds(move, sample.r, sample.g, sample.b);
+                    moveBackend->setRumble(move, sample.rumble);
+                    bool tracedLeds = traceBegin("update leds");
+                    moveBackend->updateLeds(move);
+                    traceEnd("update leds", tracedLeds);
+                    out.r = sample.r;
+                    out.g = sample.g;
+                    out.b = sample.b;
+                    out.rumble = sample.rumble;
+                    out.time = now;
+                    statsCount(COUNT_OUTPUT_REPORTS);
+                }
 
                 // Check for orientation and get new values
-                if(psmove_has_orientation(move))
+                float * q = &rawQuat[c * 4];
+                if(moveBackend->hasOrientation(move))
+                {
+                    sample.orientationEnabled = 1;
+                    moveBackend->getOrientation(move, &q[0], &q[1], &q[2], &q[3]);
+                    quatValid[c] = 1;
+                }
+                else
+                {
+                    sample.orientationEnabled = 0;
+                }
+
+                // Fused position is published at the poll rate, the tracker
+                // only corrects it. Every report was predicted above.
+                if(_stateList[c]->fusion)
+                {
+                    PositionFusion * fusion = _stateList[c]->fusion;
+                    float * f = &rawFused[c * 3];
+
+                    traceLock(_stateList[c]->lock, "wait MoveState");
+                    fusion->getPosition(f[0], f[1], f[2]);
+                    sample.fusionTracking = fusion->tracking(sample.pollTime) ? 1 : 0;
+                    _stateList[c]->lock->unlock();
+
+                    fusedValid[c] = 1;
+                }
+            }
+        }
+
+        // Smooth every controller in one pass.
+        orientationFilter.update(now, &rawQuat[0], &quatValid[0],
+                                 &filteredQuat[0]);
+        fusedFilter.update(now, &rawFused[0], &fusedValid[0],
+                           &filteredFused[0]);
+
+        bool updated = false;
+        for(c = 0; c < totalConnectedMoves; c++)
+        {
+            PhysicalSample & sample = samples[c];
+            if(!sample.polled)
+            {
+                continue;
+            }
+            updated = true;
+            const float * q = &rawQuat[c * 4];
+            const float * fq = &filteredQuat[c * 4];
+            const float * f = &filteredFused[c * 3];
+
+            traceLock(_stateList[c]->lock, "wait MoveState");
+
+            MoveState before = *_stateList[c];
+            _stateList[c]->buttons = sample.rawButtons;
+            _stateList[c]->rqw = q[0];
+            _stateList[c]->rqx = q[1];
+            _stateList[c]->rqy = q[2];
+            _stateList[c]->rqz = q[3];
+            _stateList[c]->qw = fq[0];
+            _stateList[c]->qx = fq[1];
+            _stateList[c]->qy = fq[2];
+            _stateList[c]->qz = fq[3];
+            _stateList[c]->trigger = ((float)sample.trigger) / 255.0f;
+            _stateList[c]->ax = sample.ax;
+            _stateList[c]->ay = sample.ay;
+            _stateList[c]->az = sample.az;
+            _stateList[c]->gx = sample.gx;
+            _stateList[c]->gy = sample.gy;
+            _stateList[c]->gz = sample.gz;
+            _stateList[c]->mx = sample.mx;
+            _stateList[c]->my = sample.my;
+            _stateList[c]->mz = sample.mz;
+            if(_stateList[c]->fusion)
+            {
+                // With fusion the derivatives come from the filter state.
+                PositionFusion * fusion = _stateList[c]->fusion;
+                _stateList[c]->x = f[0];
+                _stateList[c]->y = f[1];
+                _stateList[c]->z = f[2];
+                fusion->getVelocity(_stateList[c]->vx, _stateList[c]->vy,
+                                    _stateList[c]->vz);
+                if(sample.fusionTracking)
                 {
-                    orientationEnabled = 1;
-                    psmove_get_orientation(move, &qw, &qx, &qy, &qz);
+                    fusion->getAcceleration(_stateList[c]->lax,
+                                            _stateList[c]->lay,
+                                            _stateList[c]->laz);
                 }
                 else
                 {
-                    orientationEnabled = 0;
+                    _stateList[c]->lax = _stateList[c]->lay = _stateList[c]->laz = 0.0f;
                 }
+            }
+            // A report that repeats the last one isn't an update, so VRPN
+            // can skip the controller.
+            if(!samePublished(before, *_stateList[c]))
+            {
+                _stateList[c]->sequence++;
+                _stateList[c]->updateTime = now;
+            }
 
-                _stateList[c]->lock->lock();
+            if(history)
+            {
+                HistorySample h;
+                h.sequence = msgNo;
+                h.buttons = sample.buttons;
+                h.trigger = sample.trigger;
+                h.tracking = _stateList[c]->fusion ? sample.fusionTracking : 0;
+                h.reserved = 0;
+                h.time = sample.pollTime;
+                memcpy(h.q, q, sizeof(h.q));
+                h.position[0] = _stateList[c]->x;
+                h.position[1] = _stateList[c]->y;
+                h.position[2] = _stateList[c]->z;
+                h.accel[0] = sample.ax;
+                h.accel[1] = sample.ay;
+                h.accel[2] = sample.az;
+                h.gyro[0] = sample.gx;
+                h.gyro[1] = sample.gy;
+                h.gyro[2] = sample.gz;
+                h.mag[0] = sample.mx;
+                h.mag[1] = sample.my;
+                h.mag[2] = sample.mz;
+                history->push(c, h);
+            }
 
-                _stateList[c]->buttons = rawButtons;
-                _stateList[c]->qx = qx;
-                _stateList[c]->qy = qy;
-                _stateList[c]->qz = qz;
-                _stateList[c]->qw = qw;
-                _stateList[c]->trigger = ((float)analogVal) / 255.0f;
+            _stateList[c]->lock->unlock();
 
-                _stateList[c]->lock->unlock();
+            if(*okayToSend == 1)
+            {
+                // Stream data for controller to the client.
+                int len = sprintf(sendMes,
+                        "a %d %d %d %d %.3f %.3f %.3f %.3f %.3f %.3f %.3f %.3f %.3f %d %.3f %.3f %.3f %.3f %d %d %d",
+                        msgNo, c, sample.buttons, sample.trigger, sample.ax,
+                        sample.ay, sample.az, sample.gx, sample.gy, sample.gz,
+                        sample.mx, sample.my, sample.mz,
+                        sample.orientationEnabled, q[0], q[1], q[2], q[3],
+                        sample.r, sample.g, sample.b);
+                // Filtered values follow the raw ones when a filter is configured.
+                if(orientationFilter.enabled(c))
+                {
+                    sprintf(sendMes + len, " %.3f %.3f %.3f %.3f", fq[0],
+                            fq[1], fq[2], fq[3]);
+                }
+                //printf("%s\n", sendMes);
+                // Redundancy record: buttons, trigger and orientation.
+                snprintf(record, sizeof(record), "%d %d %d %.3f %.3f %.3f %.3f",
+                         msgNo, sample.buttons, sample.trigger, q[0], q[1],
+                         q[2], q[3]);
+                bool tracedSend = traceBegin("send a");
+                streamSender.send(*udpSocket, subscribers, c * 2, sendMes,
+                                  strlen(sendMes), FIELDS_A, record, now);
+                traceEnd("send a", tracedSend);
+                statsCount(COUNT_PHYSICAL_PACKETS);
+                statsRecordSince(HIST_PHYSICAL, sample.pollTime);
 
-                if(*okayToSend == 1)
+                if(_stateList[c]->fusion)
                 {
-                    // Stream data for controller to the client.
-                    sprintf(sendMes,
-                            "a %d %d %d %d %.3f %.3f %.3f %.3f %.3f %.3f %.3f %.3f %.3f %d %.3f %.3f %.3f %.3f %d %d %d",
-                            msgNo, c, currButtons, analogVal, ax, ay, az, gx,
-                            gy, gz, mx, my, mz, orientationEnabled, qw, qx, qy,
-                            qz, controllerData[c].r, controllerData[c].g,
-                            controllerData[c].b);
-                    //printf("%s\n", sendMes);
-                    sendto(*udpSocket, sendMes, strlen(sendMes), 0,
-                           (SOCKADDR*)sendAddress, server_length);
-                    //sprintf(sendMes, "%.3f %.3f %.3f", mx, my, mz);
-                    //printf("%s\n", sendMes);
+                    const float * rf = &rawFused[c * 3];
+                    len = sprintf(sendMes, "f %d %d %.3f %.3f %.3f %d", msgNo, c,
+                                  rf[0], rf[1], rf[2], sample.fusionTracking);
+                    if(fusedFilter.enabled(c))
+                    {
+                        sprintf(sendMes + len, " %.3f %.3f %.3f", f[0], f[1],
+                                f[2]);
+                    }
+                    snprintf(record, sizeof(record), "%d %.2f %.2f %.2f %d",
+                             msgNo, rf[0], rf[1], rf[2], sample.fusionTracking);
+                    streamSender.send(*udpSocket, subscribers, c * 2 + 1,
+                                      sendMes, strlen(sendMes), FIELDS_F,
+                                      record, now);
+                    statsCount(COUNT_PHYSICAL_PACKETS);
                 }
             }
         }
 
+        if(*okayToSend == 1)
+        {
+            events.send(*udpSocket, subscribers, *subscriberTable, now);
+        }
+
+        if(updated)
+        {
+            moveStateEvent->signal();
+        }
+        traceEnd("tick", tracedTick);
+
         _quitMutex->lock();
         if(_quit)
         {
@@ -209,15 +592,18 @@ void UDP_Physical::run()
         }
         _quitMutex->unlock();
 
+        // A replay as fast as possible has its reports ready straight away.
+        if(moveBackend->realtime())
+        {
 #ifdef WIN32
-        Sleep(10);
+            Sleep(10);
 #else
-        usleep(10000);
+            usleep(10000);
 #endif
-        if(*okayToSend)
-        {
-            msgNo++;
         }
+        // Counts while nobody is subscribed too, so every sample in the
+        // history has a message number of its own.
+        msgNo++;
     }
 }
 
@@ -28,11 +28,65 @@
 
 #include "move_udp_server.h"
 #include "udp_recv.h"
+#include "latency_stats.h"
+#include "session_recorder.h"
+#include "trace.h"
+#include "log.h"
+#include "subscribers.h"
+#include "sample_history.h"
+#include "Timer.hpp"
+
+#include <cstring>
 
 #ifndef WIN32
 #include <unistd.h>
+#include <arpa/inet.h>
 #endif
 
+// Replies to a history request, HISTORY_BATCH samples per packet. Nothing
+// found is a single packet without samples.
+// Sends at most 'maxBatches' packets, returns how many were sent.
+static int sendHistory(SOCKET socket, const SOCKADDR_IN & address,
+                       int controller,
+                       const std::vector<HistorySample> & samples,
+                       int maxBatches)
+{
+    char packet[sizeof(HistoryBatchHeader) + HISTORY_BATCH * sizeof(HistorySample)];
+    size_t total = samples.size();
+    if(total > (size_t)(HISTORY_BATCH * maxBatches))
+    {
+        // The client asks again from the last sample it got.
+        total = HISTORY_BATCH * maxBatches;
+    }
+    int batches = total ? (total + HISTORY_BATCH - 1) / HISTORY_BATCH : 1;
+
+    for(int b = 0; b < batches; b++)
+    {
+        size_t first = b * HISTORY_BATCH;
+        size_t count = total - first < HISTORY_BATCH ? total - first : HISTORY_BATCH;
+
+        HistoryBatchHeader header;
+        header.type = 'G';
+        header.controller = controller;
+        header.batch = b;
+        header.batches = batches;
+        header.count = count;
+        header.sampleSize = sizeof(HistorySample);
+        memcpy(packet, &header, sizeof(header));
+        if(count)
+        {
+            memcpy(packet + sizeof(header), &samples[first],
+                   count * sizeof(HistorySample));
+        }
+        if(sendto(socket, packet, sizeof(header) + count * sizeof(HistorySample),
+                  0, (const SOCKADDR*)&address, sizeof(address)) < 0)
+        {
+            statsCount(COUNT_SEND_ERRORS);
+        }
+    }
+    return batches;
+}
+
 UDP_Recv::UDP_Recv(PRECVTHREADDATA data) :
         Thread()
 {
@@ -50,17 +104,28 @@ void UDP_Recv::run()
     SOCKET* recvSocket = _recvThreadData->udpSocket;
     // The send address/socket are defined by the first connect message recieved
     int* okayToSend = _recvThreadData->okayToSend;
-    SOCKADDR_IN* sendAddress = _recvThreadData->sendAddress;
+    SubscriberTable* subscribers = _recvThreadData->subscribers;
+    SampleHistory* history = _recvThreadData->history;
+    std::vector<HistorySample> historySamples;
+    // "G" packets sent to each subscriber since the start of its window.
+    double historyWindow[MAX_SUBSCRIBERS];
+    int historySent[MAX_SUBSCRIBERS];
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        historyWindow[i] = 0.0;
+        historySent[i] = 0;
+    }
     SOCKET* sendSocket = _recvThreadData->udpSocketOut;
 
     ControllerData* controllerData = _recvThreadData->controllerData;
-    char recvMsg[512];
+    char recvMsg[513];
 
     SOCKADDR_IN* SenderAddr = (SOCKADDR_IN*)malloc(sizeof *SenderAddr);
     int SenderAddrSize;
 
     int c, rumble, resetOrientation, trackerLight, changeLight, r, g, b,
             changeRumble;
+    nameCurrentThread("receive");
 
     while(1)
     {
@@ -74,46 +139,75 @@ void UDP_Recv::run()
         int n = recvfrom(*recvSocket, recvMsg, 512, MSG_DONTWAIT,
                          (SOCKADDR *)SenderAddr, (socklen_t*)&SenderAddrSize);
 #endif
-        if(n > 0)
+        // A replayed session's commands are handled like the client's.
+        if(n <= 0 && *okayToSend && moveBackend->takeCommand(recvMsg, 512))
         {
+            n = strlen(recvMsg);
+        }
 #ifdef WIN32
+        else if(n > 0)
+        {
 			recvfrom(*recvSocket, recvMsg, 512, 0,
 				(SOCKADDR *)SenderAddr, (socklen_t*)&SenderAddrSize);
+        }
 #endif
-            // Waiting on 'c'onnect message from client.
-            if(!*okayToSend)
+        if(n > 0)
+        {
+            recvMsg[n] = 0;
+            // 'c'onnect messages subscribe a client, or change its options.
+            if(recvMsg[0] == 'c')
             {
-                if(recvMsg[0] == 'c')
+                if(!*okayToSend)
                 {
-                    sendAddress->sin_addr = SenderAddr->sin_addr;
-                    sendAddress->sin_family = AF_INET;
-                    sendAddress->sin_port = htons(SEND_PORT);
-                    set_up_udp_socket(sendSocket, sendAddress, 0);
-                    printf("Client connected. Streaming data on port %d\n",
-                           SEND_PORT);
+                    // One unconnected socket streams to every subscriber.
+                    *sendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+                }
+                int index = subscribers->subscribe(*SenderAddr, recvMsg + 1,
+                                                   getTime());
+                if(index < 0)
+                {
+                    LOG(LOG_WARNING, "Ignoring client %s, %d subscribers already.",
+                        inet_ntoa(SenderAddr->sin_addr), MAX_SUBSCRIBERS);
+                }
+                else
+                {
+                    LOG(LOG_INFO, "Client %s connected as subscriber %d.",
+                        inet_ntoa(SenderAddr->sin_addr), index);
                     // The other threads now know to stream their data.
                     *okayToSend = 1;
                 }
             }
-            else
+            else if(*okayToSend)
             {
                 // When we know where to stream data to, we now listen for messages to update controller properties.
                 if(recvMsg[0] == 'd')
                 {
+                    TraceScope scope("command");
                     sscanf(recvMsg, "d %d %d %d %d %d %d %d %d %d", &c,
                            &changeRumble, &rumble, &resetOrientation,
                            &trackerLight, &changeLight, &r, &g, &b);
+                    statsCount(COUNT_COMMANDS);
+                    double received = getTime();
+                    if(sessionRecorder)
+                    {
+                        sessionRecorder->recordCommand(recvMsg, n);
+                    }
 
                     // Protect controller data.
-                    controllerMutex->lock();
+                    traceLock(controllerMutex, "wait controllerMutex");
 
                     // Very slight error detection here. Up to the user to send the right packets.
                     if(c >= 0 && c < _recvThreadData->totalConnectedMoves)
                     {
+                        // Timed until the physical thread applies it.
+                        if(controllerData[c].commandTime == 0.0)
+                        {
+                            controllerData[c].commandTime = received;
+                        }
                         if(changeRumble)
                         {
                             controllerData[c].rumble = rumble;
-                            controllerData[c].rumbleTimeout = RUMBLE_TIMEOUT;
+                            controllerData[c].rumbleUntil = received + RUMBLE_TIMEOUT_MS / 1000.0;
                         }
                         // Can only change from 0 -> 1 for these options via messages. Avoids overriding messages before their intended
                         // operation can be completed. (Eg. reseting orientation, but recieving many different rumble messages quickly.
@@ -133,6 +227,116 @@ void UDP_Recv::run()
                     }
                     controllerMutex->unlock();
                 }
+                // Haptic patterns: "h p <id> <repeat> <ms> <level> ..." uploads one,
+                // "h t <controller> <id>" plays it from the start (-1 stops).
+                else if(recvMsg[0] == 'h')
+                {
+                    TraceScope scope("command");
+                    statsCount(COUNT_COMMANDS);
+                    double received = getTime();
+                    if(sessionRecorder)
+                    {
+                        sessionRecorder->recordCommand(recvMsg, n);
+                    }
+
+                    int id;
+                    HapticPattern pattern;
+                    if(recvMsg[1] == ' ' && recvMsg[2] == 'p')
+                    {
+                        if(parseHapticPattern(recvMsg + 3, id, pattern))
+                        {
+                            traceLock(controllerMutex, "wait controllerMutex");
+                            hapticPatterns[id] = pattern;
+                            controllerMutex->unlock();
+                        }
+                        else
+                        {
+                            LOG(LOG_WARNING, "Invalid haptic pattern: '%s'", recvMsg);
+                        }
+                    }
+                    else if(sscanf(recvMsg, "h t %d %d", &c, &id) == 2
+                            && c >= 0 && c < _recvThreadData->totalConnectedMoves
+                            && id >= -1 && id < HAPTIC_MAX_PATTERNS)
+                    {
+                        traceLock(controllerMutex, "wait controllerMutex");
+                        if(controllerData[c].commandTime == 0.0)
+                        {
+                            controllerData[c].commandTime = received;
+                        }
+                        controllerData[c].hapticPattern = id;
+                        controllerData[c].hapticStart = received;
+                        controllerMutex->unlock();
+                    }
+                }
+                // Button event acknowledgement: "k <sequence> [port]".
+                else if(recvMsg[0] == 'k')
+                {
+                    int sequence, port = SEND_PORT;
+                    if(sscanf(recvMsg, "k %d %d", &sequence, &port) >= 1)
+                    {
+                        subscribers->ack(*SenderAddr, port, sequence, getTime());
+                    }
+                }
+                // Keep-alive: "p [port]".
+                else if(recvMsg[0] == 'p')
+                {
+                    int port = SEND_PORT;
+                    sscanf(recvMsg, "p %d", &port);
+                    subscribers->keepAlive(*SenderAddr, port, getTime());
+                }
+                // Unsubscribe: "u [port]".
+                else if(recvMsg[0] == 'u')
+                {
+                    int port = SEND_PORT;
+                    sscanf(recvMsg, "u %d", &port);
+                    if(subscribers->unsubscribe(*SenderAddr, port))
+                    {
+                        LOG(LOG_INFO, "Client %s:%d unsubscribed.",
+                            inet_ntoa(SenderAddr->sin_addr), port);
+                    }
+                }
+                // History request: "g <controller> <s|t> <from> <to> [port]" by
+                // message number or time, answered with "G" packets. Only
+                // subscribers are answered, and only up to history_rate
+                // packets a window, so a small request can't be turned
+                // into a flood at someone else's address.
+                else if(recvMsg[0] == 'g' && history)
+                {
+                    TraceScope scope("history");
+                    char by;
+                    double from, to;
+                    int port = SEND_PORT;
+                    if(sscanf(recvMsg, "g %d %c %lf %lf %d", &c, &by, &from, &to,
+                              &port) >= 4
+                            && c >= 0 && c < history->controllers())
+                    {
+                        int index = subscribers->lookup(*SenderAddr, port);
+                        double now = getTime();
+                        if(index >= 0 && now - historyWindow[index] >= HISTORY_WINDOW)
+                        {
+                            historyWindow[index] = now;
+                            historySent[index] = 0;
+                        }
+                        int budget = index >= 0
+                                ? _recvThreadData->historyRate - historySent[index] : 0;
+                        if(budget > HISTORY_MAX_BATCHES)
+                        {
+                            budget = HISTORY_MAX_BATCHES;
+                        }
+                        if(budget > 0)
+                        {
+                            history->find(c, by == 't', from, to, historySamples);
+                            SOCKADDR_IN address = *SenderAddr;
+                            address.sin_port = htons(port);
+                            historySent[index] += sendHistory(*sendSocket, address, c,
+                                                              historySamples, budget);
+                        }
+                        else
+                        {
+                            statsCount(COUNT_HISTORY_REFUSED);
+                        }
+                    }
+                }
             }
         }
         else
@@ -145,6 +349,13 @@ void UDP_Recv::run()
         }
         //printf("%d %d %d %d %d %d\n", c, controllerData[c].rumble, controllerData[c].changeLight, controllerData[c].r, controllerData[c].g, controllerData[c].b);
 
+        SOCKADDR_IN expired;
+        while(*okayToSend && subscribers->expire(getTime(), expired))
+        {
+            LOG(LOG_INFO, "Client %s:%d timed out.",
+                inet_ntoa(expired.sin_addr), ntohs(expired.sin_port));
+        }
+
         _quitMutex->lock();
         if(_quit)
         {
@@ -27,114 +27,479 @@
  **/
 
 #include "udp_tracker.h"
+#include "Timer.hpp"
+#include "control_channel.h"
+#include "frame_triple_buffer.h"
+#include "mjpeg_stream.h"
+#include "move_backend.h"
+#include "trace.h"
+#include "log.h"
+#include <cstdio>
 #include <cstring>
 
-UDP_Tracker::UDP_Tracker(PTRACKERDATA data, std::vector<MoveState*> & stateList) :
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// How long the capture stage waits for the grab stage before it looks for
+// slot changes and quit again.
+#define GRAB_WAIT_MS 100
+
+// Plays a recording back at its recorded frame rate.
+static void paceFrame(double paceStart, unsigned int number, float framePace)
+{
+    double due = paceStart + number / framePace;
+    double wait = due - getTime();
+    if(wait > 0.0)
+    {
+#ifdef WIN32
+        Sleep((DWORD)(wait * 1000.0));
+#else
+        usleep((useconds_t)(wait * 1000000.0));
+#endif
+    }
+}
+
+TrackerFrameMailbox::TrackerFrameMailbox(int cameras)
+{
+    _frames.resize(cameras);
+    _full.resize(cameras, 0);
+    _next = 0;
+    _dropped = 0;
+}
+
+void TrackerFrameMailbox::post(const TrackerFrame & frame)
+{
+    _mutex.lock();
+    TrackerFrame & slot = _frames[frame.camera];
+    if(_full[frame.camera])
+    {
+        _dropped++;
+    }
+    slot.camera = frame.camera;
+    slot.number = frame.number;
+    slot.time = frame.time;
+    slot.controllers = frame.controllers;
+    _full[frame.camera] = 1;
+    _mutex.unlock();
+    _event.signal();
+}
+
+bool TrackerFrameMailbox::takeLocked(TrackerFrame & frame)
+{
+    // Round robin so one fast camera can't starve the others.
+    int cameras = _frames.size();
+    for(int i = 0; i < cameras; i++)
+    {
+        int cam = (_next + i) % cameras;
+        if(_full[cam])
+        {
+            TrackerFrame & slot = _frames[cam];
+            frame.camera = slot.camera;
+            frame.number = slot.number;
+            frame.time = slot.time;
+            frame.controllers.swap(slot.controllers);
+            _full[cam] = 0;
+            _next = (cam + 1) % cameras;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TrackerFrameMailbox::take(TrackerFrame & frame, int timeoutMs)
+{
+    _mutex.lock();
+    bool taken = takeLocked(frame);
+    _mutex.unlock();
+
+    if(taken)
+    {
+        return true;
+    }
+    if(!_event.wait(timeoutMs))
+    {
+        return false;
+    }
+
+    _mutex.lock();
+    taken = takeLocked(frame);
+    _mutex.unlock();
+    return taken;
+}
+
+unsigned int TrackerFrameMailbox::dropped()
+{
+    _mutex.lock();
+    unsigned int dropped = _dropped;
+    _mutex.unlock();
+    return dropped;
+}
+
+TrackerGrabber::TrackerGrabber(PSMoveTracker * tracker, int camera,
+                               float framePace) :
+        Thread()
+{
+    _tracker = tracker;
+    _camera = camera;
+    _framePace = framePace;
+    _full = false;
+    _time = 0.0;
+}
+
+void TrackerGrabber::run()
+{
+    char threadName[16];
+    sprintf(threadName, "grab %d", _camera);
+    nameCurrentThread(threadName);
+    unsigned int number = 0;
+    double paceStart = getTime();
+
+    while(1)
+    {
+        _mutex.lock();
+        bool full = _full;
+        _mutex.unlock();
+
+        if(full)
+        {
+            // The capture stage is still tracking the last image.
+            _taken.wait(GRAB_WAIT_MS);
+        }
+        else
+        {
+            if(_framePace > 0.0f)
+            {
+                paceFrame(paceStart, number, _framePace);
+            }
+            bool traced = traceBegin("grab image");
+            moveBackend->grabImage(_tracker);
+            traceEnd("grab image", traced);
+            double time = getTime();
+
+            _mutex.lock();
+            _full = true;
+            _time = time;
+            _mutex.unlock();
+            _grabbed.signal();
+            number++;
+        }
+
+        _quitMutex->lock();
+        if(_quit)
+        {
+            _quitMutex->unlock();
+            break;
+        }
+        _quitMutex->unlock();
+    }
+}
+
+bool TrackerGrabber::take(double & time, int timeoutMs)
+{
+    _mutex.lock();
+    if(!_full)
+    {
+        _mutex.unlock();
+        _grabbed.wait(timeoutMs);
+        _mutex.lock();
+    }
+    bool full = _full;
+    if(full)
+    {
+        // The grab thread leaves the tracker alone until _full is cleared.
+        moveBackend->updateImage(_tracker);
+        time = _time;
+        _full = false;
+    }
+    _mutex.unlock();
+
+    if(full)
+    {
+        _taken.signal();
+    }
+    return full;
+}
+
+UDP_Tracker::UDP_Tracker(PTRACKERDATA data, int camera,
+                         std::vector<MoveState*> & stateList) :
         Thread()
 {
     _trackerData = data;
+    _camera = camera;
     _stateList = stateList;
+    _grabber = NULL;
+
+    // Scratch space of updateSlots(), which runs every frame.
+    int totalSlots = data->totalConnectedMoves;
+    _slotGeneration.resize(totalSlots);
+    _calibrate.resize(totalSlots);
+    _colour.resize(totalSlots * 3);
 }
 
 UDP_Tracker::~UDP_Tracker()
 {
 }
 
+void UDP_Tracker::updateSlots()
+{
+    PSMoveTracker* tracker = _trackerData->trackers[_camera];
+    PSMove** controllers = _trackerData->controllers;
+    ControllerData* controllerData = _trackerData->controllerData;
+    int totalSlots = _trackerData->totalConnectedMoves;
+    unsigned int cameraBit = 1u << _camera;
+
+    traceLock(controllerMutex, "wait controllerMutex");
+    for(int c = 0; c < totalSlots; c++)
+    {
+        ControllerData & slot = controllerData[c];
+        _slotState[c] = slot.slotState;
+        _slotGeneration[c] = slot.generation;
+        _calibrate[c] = 0;
+        if(slot.slotState == SLOT_CONNECTING && !(slot.trackerDone & cameraBit))
+        {
+            // The first camera picks the colour, the others wait for it.
+            _calibrate[c] = _camera == 0 || (slot.trackerDone & 1);
+            _colour[c * 3] = slot.tr;
+            _colour[c * 3 + 1] = slot.tg;
+            _colour[c * 3 + 2] = slot.tb;
+        }
+    }
+    controllerMutex->unlock();
+
+    for(int c = 0; c < totalSlots; c++)
+    {
+        if(_slotState[c] == SLOT_RETIRING
+                && _releasedGeneration[c] != _slotGeneration[c])
+        {
+            if(_enabled[c])
+            {
+                moveBackend->disable(tracker, controllers[c]);
+                _enabled[c] = 0;
+            }
+            _releasedGeneration[c] = _slotGeneration[c];
+            traceLock(controllerMutex, "wait controllerMutex");
+            controllerData[c].released++;
+            controllerMutex->unlock();
+        }
+        else if(_calibrate[c])
+        {
+            PSMove * move = controllers[c];
+            unsigned char * rgb = &_colour[c * 3];
+            bool found = false;
+            // Calibration blocks this camera for a few seconds, the other
+            // cameras and the physical data keep running.
+            for(int attempt = 0; attempt < 5 && !found; attempt++)
+            {
+                if(_camera == 0)
+                {
+                    found = moveBackend->enable(tracker, move)
+                            == Tracker_CALIBRATED;
+                }
+                else if(rgb[0] || rgb[1] || rgb[2])
+                {
+                    found = moveBackend->enableWithColor(tracker, move,
+                            rgb[0], rgb[1], rgb[2]) == Tracker_CALIBRATED;
+                }
+                else
+                {
+                    // The first camera couldn't find it either.
+                    break;
+                }
+            }
+            _enabled[c] = found ? 1 : 0;
+            if(found)
+            {
+                moveBackend->getColor(tracker, move, &rgb[0], &rgb[1],
+                                      &rgb[2]);
+                moveBackend->setAutoUpdateLeds(tracker, move, false);
+            }
+
+            traceLock(controllerMutex, "wait controllerMutex");
+            if(found && _camera == 0)
+            {
+                controllerData[c].tr = rgb[0];
+                controllerData[c].tg = rgb[1];
+                controllerData[c].tb = rgb[2];
+                controllerData[c].trackerLight = 1;
+            }
+            controllerData[c].trackerDone |= cameraBit;
+            controllerMutex->unlock();
+
+            LOG(found ? LOG_INFO : LOG_WARNING, "Camera %d %s controller %d.",
+                _camera, found ? "calibrated" : "couldn't find", c);
+        }
+    }
+}
+
 void UDP_Tracker::run()
 {
 
     // ----- trackerData variables. -----
-    PSMoveTracker* tracker = _trackerData->tracker;
+    PSMoveTracker* tracker = _trackerData->trackers[_camera];
     PSMove** controllers = _trackerData->controllers;
-
-    // Sending address/socket is defined by udp_recv.cpp once a client connects.
-    SOCKADDR_IN* sendAddress = _trackerData->sendAddress;
-    SOCKET* udpSocket = _trackerData->udpSocket;
-    int* okayToSend = _trackerData->okayToSend;
+    TrackerFrameMailbox* mailbox = _trackerData->mailbox;
 
     int totalConnectedMoves = _trackerData->totalConnectedMoves;
     // showTracker changed by the main menu in 'move_udp_server.cpp'
     int* showTracker = _trackerData->showTracker;
 
-    // ----- Sending variables -----
+    // Controllers connected at startup have already been calibrated.
+    _slotState.assign(totalConnectedMoves, SLOT_EMPTY);
+    _enabled.assign(totalConnectedMoves, 0);
+    _releasedGeneration.assign(totalConnectedMoves, -1);
+    for(int i = 0; i < totalConnectedMoves; i++)
+    {
+        _enabled[i] = controllers[i] != NULL;
+    }
+
+    // Recorded input: optional pacing and a frame limit for benchmark runs.
+    float framePace = _trackerData->framePace;
+    unsigned int frameLimit = _trackerData->frameLimit;
+
+    // ----- Tracking variables -----
     enum PSMoveTracker_Status status;
-    char trackerMsg[256];
-    int posUpdateNumber = 0;
-    int trackingMove = 0;
     int c;
     PSMove* move;
-    float tx, ty, tz, ux, uy, rad;
     int width, height;
-    psmove_tracker_get_size(tracker, &width, &height);
-    int server_length = sizeof(struct sockaddr_in);
+    moveBackend->getTrackerSize(tracker, &width, &height);
+
+    TrackerFrame frame;
+    frame.camera = _camera;
+    frame.number = 0;
+    frame.controllers.resize(totalConnectedMoves);
+    for(c = 0; c < totalConnectedMoves; c++)
+    {
+        memset(&frame.controllers[c], 0, sizeof(TrackedController));
+    }
+
+    _timing.reset();
+    char threadName[16];
+    sprintf(threadName, "capture %d", _camera);
+    nameCurrentThread(threadName);
+    double paceStart = getTime();
+    double stageStart, stageEnd;
+
+    if(_trackerData->grabAhead)
+    {
+        // The grab stage paces a recording then.
+        _grabber = new TrackerGrabber(tracker, _camera, framePace);
+        _grabber->startThread();
+    }
 
     while(1)
     {
+        if(framePace > 0.0f && !_grabber)
+        {
+            paceFrame(paceStart, frame.number, framePace);
+        }
+
+        updateSlots();
+
         // Update tracker image
-        psmove_tracker_update_image(tracker);
+        stageStart = getTime();
+        bool tracedImage = traceBegin("update image");
+        bool grabbed = true;
+        if(_grabber)
+        {
+            // The grab stage has been waiting for the camera meanwhile.
+            grabbed = _grabber->take(frame.time, GRAB_WAIT_MS);
+        }
+        else
+        {
+            moveBackend->updateImage(tracker);
+            frame.time = getTime();
+        }
+        traceEnd("update image", tracedImage);
+        if(!grabbed)
+        {
+            _quitMutex->lock();
+            bool quit = _quit;
+            _quitMutex->unlock();
+            if(quit)
+            {
+                break;
+            }
+            continue;
+        }
+        bool tracedFrame = traceBegin("frame");
+        stageEnd = getTime();
+        _timing.addStage(STAGE_CAPTURE, stageEnd - stageStart);
+        stageStart = stageEnd;
 
         // Track each controller individually.
         for(c = 0; c < totalConnectedMoves; c++)
         {
             move = controllers[c];
-
-            psmove_tracker_update(tracker, move);
-            status = psmove_tracker_get_status(tracker, move);
-            if(status == Tracker_TRACKING)
+            TrackedController & t = frame.controllers[c];
+            if(_slotState[c] != SLOT_ACTIVE || !_enabled[c])
             {
-                // Create normailised position values to the size of the camera image plane.
-                psmove_tracker_get_position(tracker, move, &ux, &uy, &rad);
-                ux /= (float)width;
-                uy /= (float)height;
-                psmove_tracker_get_location(tracker, move, &tx, &ty, &tz);
-                trackingMove = 1;
+                t.tracking = 0;
+                continue;
             }
-            else
-            {
-                trackingMove = 0;
-            }
-
-            _stateList[c]->lock->lock();
 
-            _stateList[c]->x = tx;
-            _stateList[c]->y = ty;
-            _stateList[c]->z = tz;
-
-            _stateList[c]->lock->unlock();
-
-            if(*okayToSend)
+            TraceScope scope("track");
+            moveBackend->update(tracker, move);
+            status = moveBackend->getStatus(tracker, move);
+            if(status == Tracker_TRACKING)
             {
-                sprintf(trackerMsg, "b %d %d %f %f %f %f %f %d",
-                        posUpdateNumber, c, tx, ty, tz, ux, uy, trackingMove);
-                sendto(*udpSocket, trackerMsg, strlen(trackerMsg), 0,
-                       (SOCKADDR*)sendAddress, server_length);
+                // Create normailised position values to the size of the camera image plane.
+                moveBackend->getPosition(tracker, move, &t.ux, &t.uy,
+                                         &t.radius);
+                t.ux /= (float)width;
+                t.uy /= (float)height;
+                moveBackend->getLocation(tracker, move, &t.x, &t.y, &t.z);
+                t.tracking = 1;
             }
             else
             {
-                // While we aren't sending, the physical thread doesn't update. We temporarily do it here.
-                unsigned char r, g, b;
-                psmove_tracker_get_color(tracker, move, &r, &g, &b);
-                psmove_set_leds(move, r, g, b);
-                psmove_update_leds(move);
+                t.tracking = 0;
             }
+            moveBackend->getColor(tracker, move, &t.r, &t.g, &t.b);
         }
-        if(*okayToSend) posUpdateNumber++;
+        stageEnd = getTime();
+        _timing.addStage(STAGE_TRACK, stageEnd - stageStart);
+
+        // Filtering and sending happen on the send thread while we grab the next image.
+        mailbox->post(frame);
 
         // Wait for the main menu to decide showTracker's value.
         trackerMutex->lock();
+        bool show = *showTracker == 1 && *_trackerData->shownCamera == _camera;
+        trackerMutex->unlock();
 
-        if(*showTracker == 1)
+        if(show)
         {
-            _trackerData->frameMutex->lock();
-            if(!_trackerData->frame)
-            {
-                // Show an annotated stream of the tracking footage.
-                psmove_tracker_annotate(tracker);
-                _trackerData->frame = psmove_tracker_get_frame(tracker);
-            }
-            _trackerData->frameMutex->unlock();
+            // The viewer gets its own copy and draws the annotation itself,
+            // so showing the footage never holds up tracking.
+            stageStart = getTime();
+            _trackerData->frameBuffers[_camera].publish(
+                    (IplImage *)moveBackend->getFrame(tracker), _camera,
+                    frame.number, frame.controllers);
+            _timing.addStage(STAGE_ANNOTATE, getTime() - stageStart);
+        }
+        MjpegStream * debugStream = _trackerData->debugStream;
+        if(debugStream && debugStream->wantsFrame(_camera, frame.time))
+        {
+            stageStart = getTime();
+            debugStream->publish((IplImage *)moveBackend->getFrame(tracker),
+                                 _camera, frame.number, frame.controllers);
+            _timing.addStage(STAGE_ANNOTATE, getTime() - stageStart);
+        }
+        traceEnd("frame", tracedFrame);
+        frame.number++;
+
+        _timing.addFrame();
+        if(frameLimit && frame.number >= frameLimit)
+        {
+            char name[32];
+            sprintf(name, "Camera %d", _camera);
+            printf("%s", _timing.report(name).c_str());
+            // Benchmark run finished, shut the server down.
+            *_trackerData->closeServer = 1;
+            ControlChannel::wake();
+            break;
         }
-        trackerMutex->unlock();
 
         _quitMutex->lock();
         if(_quit)
@@ -144,4 +509,11 @@ void UDP_Tracker::run()
         }
         _quitMutex->unlock();
     }
+
+    if(_grabber)
+    {
+        _grabber->join();
+        delete _grabber;
+        _grabber = NULL;
+    }
 }
@@ -2,21 +2,137 @@
 #define UDP_TRACKER_H
 
 #include "Thread.hpp"
+#include "Event.hpp"
 #include "move_udp_server.h"
+#include "tracker_timing.h"
 
 #include <vector>
 
+/**
+ * Tracking result of one controller in one camera frame.
+ **/
+struct TrackedController
+{
+        int tracking;
+        float x, y, z; // psmove_tracker_get_location
+        float ux, uy; // Blob position normalised to the image size.
+        float radius; // Blob radius in pixels.
+        unsigned char r, g, b; // Colour the tracker wants the LED set to.
+};
+
+/**
+ * Everything the capture stage found in one camera frame.
+ **/
+struct TrackerFrame
+{
+        int camera;
+        unsigned int number;
+        double time; // Time the image was grabbed.
+        std::vector<TrackedController> controllers;
+};
+
+/**
+ * Hands frames from the capture stages (one per camera) to the send stage.
+ * Only the newest frame of each camera is kept, so a slow consumer never
+ * holds up a camera.
+ **/
+class TrackerFrameMailbox
+{
+    public:
+        TrackerFrameMailbox(int cameras);
+
+        void post(const TrackerFrame & frame);
+        // Waits up to timeoutMs for a frame from any camera. Returns false on timeout.
+        bool take(TrackerFrame & frame, int timeoutMs);
+        unsigned int dropped();
+
+    protected:
+        bool takeLocked(TrackerFrame & frame);
+
+        Mutex _mutex;
+        Event _event;
+        std::vector<TrackerFrame> _frames;
+        std::vector<int> _full;
+        int _next;
+        unsigned int _dropped;
+};
+
+/**
+ * Grab stage of one camera, if the backend can grab ahead: waits for the
+ * camera's next image and keeps it while the capture stage tracks the
+ * previous one. Holds at most one image, a slow capture stage makes it
+ * wait rather than skip frames.
+ **/
+class TrackerGrabber : public Thread
+{
+    public:
+        TrackerGrabber(PSMoveTracker * tracker, int camera, float framePace);
+
+        virtual void run();
+
+        // Waits up to timeoutMs for a grabbed image and makes it the
+        // tracker's current one. time is when it was grabbed. Returns false
+        // on timeout.
+        bool take(double & time, int timeoutMs);
+
+    protected:
+        PSMoveTracker * _tracker;
+        int _camera;
+        float _framePace;
+
+        Mutex _mutex;
+        Event _grabbed;
+        Event _taken;
+        bool _full; // An image is kept for take().
+        double _time;
+};
+
+/**
+ * Capture stage: runs the blob tracking on the images of one camera.
+ * Results are posted to the mailbox and published by UDP_TrackerSend, so
+ * the next frame is tracked while the previous one is filtered and sent.
+ * With grabAhead a TrackerGrabber waits for the camera meanwhile, without
+ * it this thread grabs the images itself. There is one of these per
+ * camera.
+ *
+ * psmoveapi trackers can't grab ahead: update() reads the image the last
+ * updateImage() grabbed into the tracker, which holds a single one. Their
+ * cameras grab and track in turn, the driver queues frames meanwhile.
+ * Controllers of one camera are always tracked one after the other, the
+ * tracker's scratch images are shared by all of them.
+ **/
 class UDP_Tracker : public Thread
 {
     public:
-        UDP_Tracker(PTRACKERDATA data, std::vector<MoveState*> & stateList);
+        UDP_Tracker(PTRACKERDATA data, int camera,
+                    std::vector<MoveState*> & stateList);
         virtual ~UDP_Tracker();
 
         virtual void run();
 
+        TrackerTiming & timing()
+        {
+            return _timing;
+        }
+
     protected:
+        // Handles connecting and retiring controllers, on this thread since
+        // a psmoveapi tracker can't be shared between threads.
+        void updateSlots();
+
         PTRACKERDATA _trackerData;
+        int _camera;
+        TrackerTiming _timing;
         std::vector<MoveState*> _stateList;
+
+        std::vector<int> _slotState;
+        std::vector<int> _enabled; // Controller is enabled in this camera's tracker.
+        std::vector<int> _releasedGeneration;
+        // updateSlots() copies of the slots, taken under controllerMutex.
+        std::vector<int> _slotGeneration;
+        std::vector<int> _calibrate;
+        std::vector<unsigned char> _colour;
+        TrackerGrabber * _grabber; // NULL unless grabAhead.
 };
 
 #endif
@@ -0,0 +1,376 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include "udp_tracker_send.h"
+#include "udp_tracker.h"
+#include "smoothing_filter.h"
+#include "latency_stats.h"
+#include "move_backend.h"
+#include "trace.h"
+#include "subscribers.h"
+#include "Timer.hpp"
+#include <cstring>
+
+// Time constant of the velocity/acceleration estimate without fusion.
+#define DERIVATIVE_TIME 0.05
+
+// Field kinds of the "b" packets for the send-on-change deadbands:
+// controller, position, image position (follows the position, not
+// compared), tracking, filtered position.
+#define FIELDS_B "e" "ppp" "--" "e" "ppp"
+
+// True if the frame left every value the camera path publishes as it was.
+static bool samePosition(const MoveState & a, const MoveState & b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z
+            && a.vx == b.vx && a.vy == b.vy && a.vz == b.vz
+            && a.lax == b.lax && a.lay == b.lay && a.laz == b.laz;
+}
+
+/**
+ * Velocity and acceleration of a camera position, smoothed finite
+ * differences. The acceleration is the difference of the smoothed
+ * velocity, so it only starts once there is a velocity. Only used without
+ * fusion, which has its own estimate.
+ **/
+struct PositionDerivative
+{
+        int samples; // Positions seen since the last reset, capped at 2.
+        double time;
+        float position[3];
+        float velocity[3];
+        float acceleration[3];
+
+        void reset()
+        {
+            samples = 0;
+            for(int i = 0; i < 3; i++)
+            {
+                velocity[i] = acceleration[i] = 0.0f;
+            }
+        }
+
+        void update(double now, const float * p)
+        {
+            double dt = now - time;
+            if(samples > 0 && dt > 0.0)
+            {
+                float a = (float)(dt / (DERIVATIVE_TIME + dt));
+                for(int i = 0; i < 3; i++)
+                {
+                    float v = (float)((p[i] - position[i]) / dt);
+                    if(samples == 1)
+                    {
+                        // Seeded, so the acceleration doesn't see the
+                        // smoothing ramp up from zero.
+                        velocity[i] = v;
+                        continue;
+                    }
+                    float last = velocity[i];
+                    velocity[i] += a * (v - velocity[i]);
+                    float acc = (float)((velocity[i] - last) / dt);
+                    acceleration[i] += a * (acc - acceleration[i]);
+                }
+                samples = 2;
+            }
+            else if(samples == 0)
+            {
+                samples = 1;
+            }
+            time = now;
+            for(int i = 0; i < 3; i++)
+            {
+                position[i] = p[i];
+            }
+        }
+};
+
+UDP_TrackerSend::UDP_TrackerSend(PTRACKERDATA data,
+                                 std::vector<MoveState*> & stateList) :
+        Thread()
+{
+    _trackerData = data;
+    _stateList = stateList;
+}
+
+UDP_TrackerSend::~UDP_TrackerSend()
+{
+}
+
+void UDP_TrackerSend::run()
+{
+    // ----- trackerData variables. -----
+    TrackerFrameMailbox* mailbox = _trackerData->mailbox;
+    CameraFusion* cameraFusion = _trackerData->cameraFusion;
+
+    // Sending address/socket is defined by udp_recv.cpp once a client connects.
+    SubscriberTable* subscriberTable = _trackerData->subscribers;
+    SOCKET* udpSocket = _trackerData->udpSocket;
+    int* okayToSend = _trackerData->okayToSend;
+
+    int totalConnectedMoves = _trackerData->totalConnectedMoves;
+    ControllerData* controllerData = _trackerData->controllerData;
+
+    // ----- Sending variables -----
+    char trackerMsg[256];
+    int posUpdateNumber = 0;
+    int c;
+
+    TrackerFrame frame;
+
+    // Locations are kept flat so the position filters run over every
+    // controller in one pass.
+    std::vector<float> location(totalConnectedMoves * 3, 0.0f);
+    std::vector<float> filtered(totalConnectedMoves * 3, 0.0f);
+    std::vector<int> trackingMove(totalConnectedMoves, 0);
+    std::vector<int> wasTracking(totalConnectedMoves, 0);
+    // Colour last passed on to the physical thread, packed as 0xRRGGBB.
+    std::vector<int> trackerColour(totalConnectedMoves, -1);
+    // Image plane position in the first camera, the others see another plane.
+    std::vector<float> ux(totalConnectedMoves, 0.0f);
+    std::vector<float> uy(totalConnectedMoves, 0.0f);
+
+    // Rules are applied on the first pass and again after a config reload.
+    SmoothingBank positionFilter(totalConnectedMoves, 3, false);
+    int appliedFilterVersion = -1;
+
+    std::vector<PositionDerivative> derivatives(totalConnectedMoves);
+    for(c = 0; c < totalConnectedMoves; c++)
+    {
+        derivatives[c].reset();
+    }
+
+    // Slot state per frame, see ControllerMonitor.
+    std::vector<int> slotState(totalConnectedMoves, SLOT_EMPTY);
+    std::vector<int> generation(totalConnectedMoves, -1);
+    std::vector<int> releasedGeneration(totalConnectedMoves, -1);
+
+    std::vector<Subscriber> subscribers;
+    int subscriberVersion = -1;
+    StreamSender streamSender(totalConnectedMoves);
+    char record[MAX_RECORD];
+
+    _timing.reset();
+    nameCurrentThread("tracker send");
+
+    while(1)
+    {
+        // Retiring controllers are let go of even while no frames arrive.
+        traceLock(controllerMutex, "wait controllerMutex");
+        if(appliedFilterVersion != filterVersion)
+        {
+            appliedFilterVersion = filterVersion;
+            positionFilter.applyRules(STREAM_POSITION, filterRules);
+        }
+        for(c = 0; c < totalConnectedMoves; c++)
+        {
+            slotState[c] = controllerData[c].slotState;
+            if(slotState[c] == SLOT_RETIRING
+                    && releasedGeneration[c] != controllerData[c].generation)
+            {
+                releasedGeneration[c] = controllerData[c].generation;
+                controllerData[c].released++;
+            }
+            else if(slotState[c] == SLOT_ACTIVE
+                    && generation[c] != controllerData[c].generation)
+            {
+                generation[c] = controllerData[c].generation;
+                positionFilter.reset(c);
+                derivatives[c].reset();
+            }
+        }
+        controllerMutex->unlock();
+
+        if(subscriberTable->version() != subscriberVersion)
+        {
+            subscriberVersion = subscriberTable->copy(subscribers);
+        }
+
+        // Timeout so quit is still noticed if the camera stalls.
+        if(mailbox->take(frame, 100))
+        {
+            TraceScope scope("frame");
+            double sendStart = getTime();
+
+            // Every camera's frame updates its observations and publishes
+            // the fused position, so the update rate grows with the cameras.
+            for(c = 0; c < totalConnectedMoves; c++)
+            {
+                const TrackedController & t = frame.controllers[c];
+                cameraFusion->setObservation(frame.camera, c, frame.time,
+                                             t.tracking, t.x, t.y, t.z);
+                if(t.tracking && frame.camera == 0)
+                {
+                    ux[c] = t.ux;
+                    uy[c] = t.uy;
+                }
+
+                // Keep the last location while the controller is lost.
+                float * l = &location[c * 3];
+                float fx, fy, fz;
+                trackingMove[c] = cameraFusion->fuse(c, frame.time, fx, fy,
+                                                     fz) > 0 ? 1 : 0;
+                if(slotState[c] != SLOT_ACTIVE)
+                {
+                    trackingMove[c] = 0;
+                }
+                else if(wasTracking[c] && !trackingMove[c])
+                {
+                    statsCount(COUNT_TRACKING_LOST);
+                }
+                wasTracking[c] = trackingMove[c];
+                if(trackingMove[c])
+                {
+                    l[0] = fx;
+                    l[1] = fy;
+                    l[2] = fz;
+                }
+            }
+
+            // Smooth every controller in one pass.
+            positionFilter.update(frame.time, &location[0], &trackingMove[0],
+                                  &filtered[0]);
+
+            bool updated = false;
+            for(c = 0; c < totalConnectedMoves; c++)
+            {
+                if(slotState[c] != SLOT_ACTIVE)
+                {
+                    continue;
+                }
+                const TrackedController & tc = frame.controllers[c];
+                const float * t = &location[c * 3];
+                const float * ft = &filtered[c * 3];
+
+                traceLock(_stateList[c]->lock, "wait MoveState");
+
+                _stateList[c]->rx = t[0];
+                _stateList[c]->ry = t[1];
+                _stateList[c]->rz = t[2];
+
+                // With fusion the physical thread publishes the position, the camera only corrects it.
+                if(_stateList[c]->fusion)
+                {
+                    if(trackingMove[c])
+                    {
+                        _stateList[c]->fusion->correct(frame.time, t[0], t[1],
+                                                       t[2]);
+                    }
+                }
+                // The frame that loses tracking also publishes the reset,
+                // the derivatives mustn't stay at their last values while
+                // the position is held.
+                else if(trackingMove[c] || derivatives[c].samples > 0
+                        || _stateList[c]->x != ft[0]
+                        || _stateList[c]->y != ft[1]
+                        || _stateList[c]->z != ft[2])
+                {
+                    PositionDerivative & d = derivatives[c];
+                    MoveState before = *_stateList[c];
+                    if(trackingMove[c])
+                    {
+                        d.update(frame.time, ft);
+                    }
+                    else
+                    {
+                        d.reset();
+                    }
+                    _stateList[c]->x = ft[0];
+                    _stateList[c]->y = ft[1];
+                    _stateList[c]->z = ft[2];
+                    _stateList[c]->vx = d.velocity[0];
+                    _stateList[c]->vy = d.velocity[1];
+                    _stateList[c]->vz = d.velocity[2];
+                    _stateList[c]->lax = d.acceleration[0];
+                    _stateList[c]->lay = d.acceleration[1];
+                    _stateList[c]->laz = d.acceleration[2];
+                    // A still controller isn't an update, so VRPN can
+                    // skip it.
+                    if(!samePosition(before, *_stateList[c]))
+                    {
+                        _stateList[c]->sequence++;
+                        _stateList[c]->updateTime = getTime();
+                        updated = true;
+                    }
+                }
+
+                _stateList[c]->lock->unlock();
+
+                if(*okayToSend)
+                {
+                    int len = sprintf(trackerMsg, "b %d %d %f %f %f %f %f %d",
+                                      posUpdateNumber, c, t[0], t[1], t[2],
+                                      ux[c], uy[c], trackingMove[c]);
+                    // Filtered values follow the raw ones when a filter is configured.
+                    if(positionFilter.enabled(c))
+                    {
+                        sprintf(trackerMsg + len, " %f %f %f", ft[0], ft[1],
+                                ft[2]);
+                    }
+                    snprintf(record, sizeof(record), "%d %.2f %.2f %.2f %d",
+                             posUpdateNumber, t[0], t[1], t[2], trackingMove[c]);
+                    bool tracedSend = traceBegin("send b");
+                    streamSender.send(*udpSocket, subscribers, c, trackerMsg,
+                                      strlen(trackerMsg), FIELDS_B, record,
+                                      sendStart);
+                    traceEnd("send b", tracedSend);
+                    statsCount(COUNT_TRACKER_PACKETS);
+                    statsRecordSince(HIST_TRACKER, frame.time);
+                }
+                else if(((tc.r << 16) | (tc.g << 8) | tc.b) != trackerColour[c])
+                {
+                    trackerColour[c] = (tc.r << 16) | (tc.g << 8) | tc.b;
+                    // Before a client connects the LED follows the tracker. The
+                    // physical thread does the write, this only passes the colour on.
+                    traceLock(controllerMutex, "wait controllerMutex");
+                    controllerData[c].tr = tc.r;
+                    controllerData[c].tg = tc.g;
+                    controllerData[c].tb = tc.b;
+                    controllerData[c].trackerLight = 1;
+                    controllerMutex->unlock();
+                }
+            }
+            if(*okayToSend) posUpdateNumber++;
+            if(updated)
+            {
+                moveStateEvent->signal();
+            }
+
+            _timing.addStage(STAGE_SEND, getTime() - sendStart);
+            _timing.addFrame();
+        }
+
+        _quitMutex->lock();
+        if(_quit)
+        {
+            _quitMutex->unlock();
+            break;
+        }
+        _quitMutex->unlock();
+    }
+}
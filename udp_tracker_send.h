@@ -0,0 +1,33 @@
+#ifndef UDP_TRACKER_SEND_H
+#define UDP_TRACKER_SEND_H
+
+#include "Thread.hpp"
+#include "move_udp_server.h"
+#include "tracker_timing.h"
+
+#include <vector>
+
+/**
+ * Send stage of the tracker pipeline. Takes frames from the capture stage
+ * (UDP_Tracker), filters them, updates MoveState and streams the "b" packets.
+ **/
+class UDP_TrackerSend : public Thread
+{
+    public:
+        UDP_TrackerSend(PTRACKERDATA data, std::vector<MoveState*> & stateList);
+        virtual ~UDP_TrackerSend();
+
+        virtual void run();
+
+        TrackerTiming & timing()
+        {
+            return _timing;
+        }
+
+    protected:
+        PTRACKERDATA _trackerData;
+        TrackerTiming _timing;
+        std::vector<MoveState*> _stateList;
+};
+
+#endif